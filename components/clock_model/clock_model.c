@@ -0,0 +1,196 @@
+/**
+ * Least squares fit of offset = a + b * (local - ref) over the time sync
+ * samples whose round trip time is in the lowest quarter of the window.
+ * Their offsets are least affected by queueing delay in one direction only.
+ */
+
+#include "clock_model.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ *
+ */
+void clock_model_reset(clock_model_t *model) {
+  memset(model, 0, sizeof(clock_model_t));
+}
+
+/**
+ *
+ */
+static int clock_model_cmp_rtt(const void *a, const void *b) {
+  int32_t x = *(const int32_t *)a;
+  int32_t y = *(const int32_t *)b;
+
+  return (x > y) - (x < y);
+}
+
+/**
+ *
+ */
+static void clock_model_fit(clock_model_t *model) {
+  int32_t rtt[CLOCK_MODEL_WINDOW];
+  int32_t rttLimit;
+  uint32_t rttIdx;
+  double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0, syy = 0;
+  double xMin = 0, xMax = 0, slope, intercept, sxxCentered, ssr;
+  int64_t base = model->sample[(model->head + CLOCK_MODEL_WINDOW - 1) %
+                               CLOCK_MODEL_WINDOW]
+                     .offset_us;
+
+  for (uint32_t i = 0; i < model->count; i++) {
+    rtt[i] = model->sample[i].rtt_us;
+  }
+  qsort(rtt, model->count, sizeof(int32_t), clock_model_cmp_rtt);
+
+  model->minRtt_us = rtt[0];
+  // lowest quarter, but enough samples for a line
+  rttIdx = (model->count - 1) / 4;
+  if (rttIdx < 2) {
+    rttIdx = (model->count > 2) ? 2 : model->count - 1;
+  }
+  rttLimit = rtt[rttIdx];
+
+  for (uint32_t i = 0; i < model->count; i++) {
+    const clock_sample_t *s = &model->sample[i];
+    double x, y;
+
+    if (s->rtt_us > rttLimit) {
+      continue;
+    }
+
+    // relative values keep the sums exact enough in double
+    x = (double)(s->local_us - model->ref_us);
+    y = (double)(s->offset_us - base);
+
+    if ((n == 0) || (x < xMin)) {
+      xMin = x;
+    }
+    if ((n == 0) || (x > xMax)) {
+      xMax = x;
+    }
+
+    n++;
+    sx += x;
+    sy += y;
+    sxx += x * x;
+    sxy += x * y;
+    syy += y * y;
+  }
+
+  sxxCentered = sxx - sx * sx / n;
+
+  if ((n >= 3) && (xMax - xMin >= CLOCK_MODEL_MIN_SKEW_SPAN_US) &&
+      (sxxCentered > 0)) {
+    slope = (sxy - sx * sy / n) / sxxCentered;
+
+    if (slope > CLOCK_MODEL_MAX_SKEW_PPB / 1e9) {
+      slope = CLOCK_MODEL_MAX_SKEW_PPB / 1e9;
+    } else if (slope < -CLOCK_MODEL_MAX_SKEW_PPB / 1e9) {
+      slope = -CLOCK_MODEL_MAX_SKEW_PPB / 1e9;
+    }
+
+    model->skewValid = true;
+  } else {
+    // keep the skew estimated before, if any
+    slope = (double)model->skew_ppb / 1e9;
+  }
+
+  intercept = (sy - slope * sx) / n;
+
+  // sum of squared residuals, expanded so one pass is enough
+  ssr = syy - 2 * intercept * sy - 2 * slope * sxy + n * intercept * intercept +
+        2 * intercept * slope * sx + slope * slope * sxx;
+  if (ssr < 0) {
+    ssr = 0;
+  }
+
+  model->offset_us = base + llround(intercept);
+  model->skew_ppb = (int32_t)llround(slope * 1e9);
+  model->residual_us = (int32_t)llround(sqrt(ssr / n));
+
+  if (model->skewValid && (sxxCentered > 0) && (n > 2)) {
+    double err = sqrt(ssr / (n - 2) / sxxCentered) * 1e9;
+
+    model->skewErr_ppb = (err < CLOCK_MODEL_UNKNOWN_SKEW_PPB)
+                             ? (int32_t)llround(err)
+                             : CLOCK_MODEL_UNKNOWN_SKEW_PPB;
+  } else {
+    model->skewErr_ppb = CLOCK_MODEL_UNKNOWN_SKEW_PPB;
+  }
+}
+
+/**
+ *
+ */
+int32_t clock_model_insert(clock_model_t *model, int64_t local_us,
+                           int64_t offset_us, int64_t rtt_us) {
+  int32_t ret = 0;
+
+  if (rtt_us < 0) {
+    rtt_us = 0;
+  } else if (rtt_us > INT32_MAX) {
+    rtt_us = INT32_MAX;
+  }
+
+  if (clock_model_ready(model)) {
+    int64_t dev = offset_us - clock_model_offset(model, local_us);
+
+    // asymmetric delay can shift a sample by up to half its round trip time
+    if (llabs(dev) > CLOCK_MODEL_STEP_US + rtt_us / 2) {
+      model->stepCnt++;
+      if (model->stepCnt < CLOCK_MODEL_STEP_CNT) {
+        return 1;
+      }
+
+      clock_model_reset(model);
+
+      ret = 2;
+    } else {
+      model->stepCnt = 0;
+    }
+  }
+
+  model->sample[model->head].local_us = local_us;
+  model->sample[model->head].offset_us = offset_us;
+  model->sample[model->head].rtt_us = (int32_t)rtt_us;
+  model->head = (model->head + 1) % CLOCK_MODEL_WINDOW;
+  if (model->count < CLOCK_MODEL_WINDOW) {
+    model->count++;
+  }
+  model->total++;
+  model->ref_us = local_us;
+
+  clock_model_fit(model);
+
+  return ret;
+}
+
+/**
+ *
+ */
+bool clock_model_ready(const clock_model_t *model) {
+  return model->count >= CLOCK_MODEL_READY_SAMPLES;
+}
+
+/**
+ *
+ */
+int64_t clock_model_offset(const clock_model_t *model, int64_t local_us) {
+  return model->offset_us +
+         (local_us - model->ref_us) * (int64_t)model->skew_ppb / 1000000000LL;
+}
+
+/**
+ *
+ */
+int64_t clock_model_uncertainty(const clock_model_t *model, int64_t local_us) {
+  if (clock_model_ready(model) == false) {
+    return INT64_MAX;
+  }
+
+  return model->residual_us + llabs(local_us - model->ref_us) *
+                                  (int64_t)model->skewErr_ppb / 1000000000LL;
+}
@@ -0,0 +1,103 @@
+#ifndef __CLOCK_MODEL_H__
+#define __CLOCK_MODEL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// time sync samples the estimate is fitted to
+#define CLOCK_MODEL_WINDOW 64
+// samples needed before the estimate is used
+#define CLOCK_MODEL_READY_SAMPLES 8
+// skew is only estimated once the fitted samples span this time
+#define CLOCK_MODEL_MIN_SKEW_SPAN_US 5000000LL
+// crystal tolerance plus some margin
+#define CLOCK_MODEL_MAX_SKEW_PPB 500000
+// assumed skew error as long as skew isn't estimated
+#define CLOCK_MODEL_UNKNOWN_SKEW_PPB 50000
+// offset jumps bigger than this are checked for a server clock step
+#define CLOCK_MODEL_STEP_US 20000
+// consecutive jumped samples which confirm a step
+#define CLOCK_MODEL_STEP_CNT 3
+
+typedef struct clock_sample_s {
+  int64_t local_us;   // local time the sample was taken
+  int64_t offset_us;  // server time - local time
+  int32_t rtt_us;     // round trip time of the time message
+} clock_sample_t;
+
+/**
+ * Estimates offset and skew of the server clock against the local one by a
+ * linear fit over the samples with the lowest round trip times, their
+ * offsets suffer least from asymmetric network delay.
+ */
+typedef struct clock_model_s {
+  clock_sample_t sample[CLOCK_MODEL_WINDOW];
+  uint32_t head;
+  uint32_t count;
+  uint32_t total;  // samples since clock_model_reset()
+
+  int64_t ref_us;       // local time of the newest sample
+  int64_t offset_us;    // estimated offset at ref_us
+  int32_t skew_ppb;     // server clock runs faster by this
+  int32_t skewErr_ppb;  // standard error of skew_ppb
+  int32_t residual_us;  // rms deviation of fitted samples from the estimate
+  int32_t minRtt_us;
+  bool skewValid;
+
+  uint32_t stepCnt;
+} clock_model_t;
+
+/**
+ * Forget all samples.
+ *
+ * @param[in] model The model.
+ */
+void clock_model_reset(clock_model_t *model);
+
+/**
+ * Add a time sync sample and update the estimate.
+ *
+ * @param[in] model The model.
+ * @param[in] local_us Local time the sample was taken.
+ * @param[in] offset_us Measured server time - local time.
+ * @param[in] rtt_us Round trip time of the measurement.
+ * @return 0 if the sample was fitted, 1 if it looks like a server clock step
+ * and is held back, 2 if a step was confirmed and the model restarted.
+ */
+int32_t clock_model_insert(clock_model_t *model, int64_t local_us,
+                           int64_t offset_us, int64_t rtt_us);
+
+/**
+ * @param[in] model The model.
+ * @return true once enough samples are fitted.
+ */
+bool clock_model_ready(const clock_model_t *model);
+
+/**
+ * Extrapolate the offset with the estimated skew.
+ *
+ * @param[in] model The model.
+ * @param[in] local_us Local time.
+ * @return Server time - local time at local_us.
+ */
+int64_t clock_model_offset(const clock_model_t *model, int64_t local_us);
+
+/**
+ * Rough error bound of clock_model_offset(): fit residual plus skew
+ * uncertainty accumulated since the last sample.
+ *
+ * @param[in] model The model.
+ * @param[in] local_us Local time.
+ * @return Uncertainty in µs, INT64_MAX if the model isn't ready.
+ */
+int64_t clock_model_uncertainty(const clock_model_t *model, int64_t local_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __CLOCK_MODEL_H__
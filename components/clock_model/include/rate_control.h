@@ -0,0 +1,54 @@
+#ifndef __RATE_CONTROL_H__
+#define __RATE_CONTROL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/**
+ * PI controller steering the playback rate from the measured sync error.
+ * Playback integrates the rate error into the sync error, so with the
+ * proportional and integral gain derived from one time constant tau the
+ * loop is critically damped: an error decays within a few tau and a constant
+ * clock skew is taken up by the integral without a remaining offset.
+ */
+typedef struct rate_control_s {
+  int32_t tau_ms;
+  int32_t max_ppb;
+
+  int64_t integral;  // sum of error * dt in µs², limited to max_ppb
+  int32_t ppb;       // last output
+} rate_control_t;
+
+/**
+ * @param[in] ctl The controller.
+ * @param[in] tau_ms Time constant of the loop.
+ * @param[in] max_ppb Output limit.
+ */
+void rate_control_init(rate_control_t *ctl, int32_t tau_ms, int32_t max_ppb);
+
+/**
+ * Start over, e.g. after a hard resync.
+ *
+ * @param[in] ctl The controller.
+ * @param[in] ppb Initial rate correction, e.g. the estimated clock skew,
+ * the integral starts with it.
+ */
+void rate_control_reset(rate_control_t *ctl, int32_t ppb);
+
+/**
+ * @param[in] ctl The controller.
+ * @param[in] err_us Sync error, positive if playback is late.
+ * @param[in] dt_us Time since the last update.
+ * @return Rate correction in ppb, positive to play faster.
+ */
+int32_t rate_control_update(rate_control_t *ctl, int64_t err_us,
+                            int64_t dt_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __RATE_CONTROL_H__
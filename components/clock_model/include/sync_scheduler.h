@@ -0,0 +1,94 @@
+#ifndef __SYNC_SCHEDULER_H__
+#define __SYNC_SCHEDULER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// interval while the clock model isn't ready and during bursts
+#define SYNC_SCHEDULER_MIN_INTERVAL_US 10000
+// quiet links are pinged at least this often
+#define SYNC_SCHEDULER_MAX_INTERVAL_US 5000000
+// interval of noisy links and shortest one outside of bursts
+#define SYNC_SCHEDULER_NOISY_INTERVAL_US 1000000
+// offset error allowed to build up from skew uncertainty between two pings
+#define SYNC_SCHEDULER_TARGET_US 100
+// pings sent at the minimum interval after a reconnect or degradation
+#define SYNC_SCHEDULER_BURST_PINGS 8
+// round trip time deviation considered quiet, typical for ethernet
+#define SYNC_SCHEDULER_QUIET_RTTVAR_US 1000
+// deviation this many times the long term one means the link degraded
+#define SYNC_SCHEDULER_DEGRADED_FACTOR 3
+
+typedef struct sync_scheduler_stats_s {
+  uint32_t samples;       // time sync responses seen
+  uint32_t bursts;        // bursts started, including resets
+  uint32_t degradations;  // bursts started because round trip times degraded
+  uint32_t backoffs;      // interval got longer
+  uint32_t speedups;      // interval got shorter
+  uint32_t interval_us;   // current interval
+  int32_t srtt_us;        // smoothed round trip time
+  int32_t rttVar_us;      // smoothed round trip time deviation
+} sync_scheduler_stats_t;
+
+/**
+ * Chooses the interval to the next time sync ping from the uncertainty of
+ * the clock estimate and the round trip time variation.
+ */
+typedef struct sync_scheduler_s {
+  int64_t interval_us;
+  uint32_t burstLeft;
+  bool degraded;
+
+  // rtt smoothing as in TCP, long term deviation adapts 16 times slower
+  bool rttValid;
+  int32_t srtt_us;
+  int32_t rttVar_us;
+  int32_t rttVarLong_us;
+
+  sync_scheduler_stats_t stats;
+} sync_scheduler_t;
+
+/**
+ * Start over after a reconnect, pings are sent in a burst.
+ *
+ * @param[in] sched The scheduler.
+ */
+void sync_scheduler_reset(sync_scheduler_t *sched);
+
+/**
+ * Account a time sync response and choose the next interval.
+ *
+ * @param[in] sched The scheduler.
+ * @param[in] rtt_us Round trip time of the response.
+ * @param[in] event Return value of clock_model_insert() for the response, 2
+ * restarts with a burst.
+ * @param[in] ready The clock model is ready.
+ * @param[in] skewErr_ppb Skew uncertainty of the clock model,
+ * CLOCK_MODEL_UNKNOWN_SKEW_PPB as long as skew isn't estimated.
+ * @return Interval to the next ping in µs.
+ */
+int64_t sync_scheduler_update(sync_scheduler_t *sched, int64_t rtt_us,
+                              int32_t event, bool ready, int32_t skewErr_ppb);
+
+/**
+ * @param[in] sched The scheduler.
+ * @return Interval to the next ping in µs.
+ */
+int64_t sync_scheduler_interval(const sync_scheduler_t *sched);
+
+/**
+ * @param[in] sched The scheduler.
+ * @param[out] stats Copy of the counters.
+ */
+void sync_scheduler_get_stats(const sync_scheduler_t *sched,
+                              sync_scheduler_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __SYNC_SCHEDULER_H__
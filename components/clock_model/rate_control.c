@@ -0,0 +1,69 @@
+/**
+ * Playback rate control: a rate error of 1 ppb moves the sync error by
+ * 1 ns per second, so with rate r = kp * e + ki * sum(e * dt) the error
+ * follows e'' + kp / 1000 * e' + ki / 1000 * e = 0 (e in µs, t in s).
+ * kp = 2000 / tau and ki = 1000 / tau² put both poles at -1 / tau.
+ */
+
+#include "rate_control.h"
+
+#include <string.h>
+
+/**
+ *
+ */
+static int64_t rate_control_clamp(int64_t v, int64_t limit) {
+  if (v > limit) {
+    return limit;
+  } else if (v < -limit) {
+    return -limit;
+  }
+
+  return v;
+}
+
+/**
+ *
+ */
+void rate_control_init(rate_control_t *ctl, int32_t tau_ms, int32_t max_ppb) {
+  memset(ctl, 0, sizeof(rate_control_t));
+
+  ctl->tau_ms = (tau_ms > 0) ? tau_ms : 1;
+  ctl->max_ppb = (max_ppb > 0) ? max_ppb : 0;
+}
+
+/**
+ *
+ */
+void rate_control_reset(rate_control_t *ctl, int32_t ppb) {
+  int64_t tau2 = (int64_t)ctl->tau_ms * ctl->tau_ms;
+
+  ctl->ppb = (int32_t)rate_control_clamp(ppb, ctl->max_ppb);
+  ctl->integral = (int64_t)ctl->ppb * tau2 / 1000;
+}
+
+/**
+ *
+ */
+int32_t rate_control_update(rate_control_t *ctl, int64_t err_us,
+                            int64_t dt_us) {
+  int64_t tau2 = (int64_t)ctl->tau_ms * ctl->tau_ms;
+  int64_t integralLimit = (int64_t)ctl->max_ppb * tau2 / 1000;
+  int64_t p, i;
+
+  // a second without update is plenty, errors beyond a second are resynced
+  // hard anyway, both keep the products below in range
+  err_us = rate_control_clamp(err_us, 1000000);
+  dt_us = (dt_us < 0) ? 0 : rate_control_clamp(dt_us, 1000000);
+
+  // the integral alone never pushes the output beyond the limit
+  ctl->integral =
+      rate_control_clamp(ctl->integral + err_us * dt_us, integralLimit);
+
+  p = 2000000LL * err_us / ctl->tau_ms;
+  i = 1000LL * ctl->integral / tau2;
+
+  ctl->ppb = (int32_t)rate_control_clamp(p + i, ctl->max_ppb);
+
+  return ctl->ppb;
+}
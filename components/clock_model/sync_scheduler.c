@@ -0,0 +1,152 @@
+/**
+ * Time sync ping interval: as long as the skew estimate is good, offset
+ * error grows only slowly between two pings and they can be spread out.
+ * Noisy links are pinged faster, and a sudden increase of round trip time
+ * variation triggers a burst so the clock model gets fresh samples quickly.
+ */
+
+#include "sync_scheduler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "clock_model.h"
+
+/**
+ *
+ */
+static void sync_scheduler_burst(sync_scheduler_t *sched) {
+  sched->burstLeft = SYNC_SCHEDULER_BURST_PINGS;
+  sched->stats.bursts++;
+}
+
+/**
+ *
+ */
+void sync_scheduler_reset(sync_scheduler_t *sched) {
+  sync_scheduler_stats_t stats = sched->stats;
+
+  memset(sched, 0, sizeof(sync_scheduler_t));
+
+  // counters survive reconnects
+  sched->stats = stats;
+  sched->stats.srtt_us = 0;
+  sched->stats.rttVar_us = 0;
+
+  sched->interval_us = SYNC_SCHEDULER_MIN_INTERVAL_US;
+  sync_scheduler_burst(sched);
+  sched->stats.interval_us = sched->interval_us;
+}
+
+/**
+ *
+ */
+static void sync_scheduler_rtt(sync_scheduler_t *sched, int32_t rtt) {
+  if (sched->rttValid == false) {
+    sched->srtt_us = rtt;
+    sched->rttVar_us = rtt / 2;
+    sched->rttVarLong_us = rtt / 2;
+    sched->rttValid = true;
+
+    return;
+  }
+
+  sched->rttVar_us += (abs(rtt - sched->srtt_us) - sched->rttVar_us) / 4;
+  sched->srtt_us += (rtt - sched->srtt_us) / 8;
+  sched->rttVarLong_us += (sched->rttVar_us - sched->rttVarLong_us) / 16;
+}
+
+/**
+ *
+ */
+int64_t sync_scheduler_update(sync_scheduler_t *sched, int64_t rtt_us,
+                              int32_t event, bool ready, int32_t skewErr_ppb) {
+  int64_t interval;
+  int32_t degradedLimit;
+
+  sched->stats.samples++;
+
+  if (rtt_us < 0) {
+    rtt_us = 0;
+  } else if (rtt_us > INT32_MAX / 2) {
+    rtt_us = INT32_MAX / 2;
+  }
+
+  sync_scheduler_rtt(sched, (int32_t)rtt_us);
+
+  degradedLimit = SYNC_SCHEDULER_DEGRADED_FACTOR * sched->rttVarLong_us +
+                  SYNC_SCHEDULER_QUIET_RTTVAR_US;
+  if (sched->rttVar_us > degradedLimit) {
+    // only the rising edge starts a burst
+    if ((sched->degraded == false) && (sched->burstLeft == 0)) {
+      sync_scheduler_burst(sched);
+      sched->stats.degradations++;
+    }
+    sched->degraded = true;
+  } else {
+    sched->degraded = false;
+  }
+
+  if (event == 2) {
+    sync_scheduler_burst(sched);
+  }
+
+  if (sched->burstLeft > 0) {
+    sched->burstLeft--;
+    interval = SYNC_SCHEDULER_MIN_INTERVAL_US;
+  } else if (ready == false) {
+    interval = SYNC_SCHEDULER_MIN_INTERVAL_US;
+  } else {
+    // time until skew uncertainty adds up to the target error
+    if (skewErr_ppb >= CLOCK_MODEL_UNKNOWN_SKEW_PPB) {
+      interval = SYNC_SCHEDULER_NOISY_INTERVAL_US;
+    } else if (skewErr_ppb > 0) {
+      interval = SYNC_SCHEDULER_TARGET_US * 1000000000LL / skewErr_ppb;
+    } else {
+      interval = SYNC_SCHEDULER_MAX_INTERVAL_US;
+    }
+
+    // back off gradually, a single lucky sample shouldn't stretch it
+    if (interval > 2 * sched->interval_us) {
+      interval = 2 * sched->interval_us;
+    }
+
+    if (sched->rttVar_us > SYNC_SCHEDULER_QUIET_RTTVAR_US) {
+      interval = SYNC_SCHEDULER_NOISY_INTERVAL_US;
+    } else if (interval < SYNC_SCHEDULER_NOISY_INTERVAL_US) {
+      // faster pings would shrink the time span covered by the clock model
+      // window and make the skew estimate worse
+      interval = SYNC_SCHEDULER_NOISY_INTERVAL_US;
+    } else if (interval > SYNC_SCHEDULER_MAX_INTERVAL_US) {
+      interval = SYNC_SCHEDULER_MAX_INTERVAL_US;
+    }
+  }
+
+  if (interval > sched->interval_us) {
+    sched->stats.backoffs++;
+  } else if (interval < sched->interval_us) {
+    sched->stats.speedups++;
+  }
+
+  sched->interval_us = interval;
+  sched->stats.interval_us = interval;
+  sched->stats.srtt_us = sched->srtt_us;
+  sched->stats.rttVar_us = sched->rttVar_us;
+
+  return interval;
+}
+
+/**
+ *
+ */
+int64_t sync_scheduler_interval(const sync_scheduler_t *sched) {
+  return sched->interval_us;
+}
+
+/**
+ *
+ */
+void sync_scheduler_get_stats(const sync_scheduler_t *sched,
+                              sync_scheduler_stats_t *stats) {
+  memcpy(stats, &sched->stats, sizeof(sync_scheduler_stats_t));
+}
@@ -0,0 +1,202 @@
+/**
+ * Clock model against the 199 entry latency median it replaced: simulated
+ * time sync with drifting clocks and asymmetric network jitter.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "MedianFilter.h"
+#include "clock_model.h"
+#include "esp_log.h"
+#include "unity.h"
+
+static const char *TAG = "TEST_CLOCK";
+
+#define TEST_MEDIAN_LEN 199
+#define TEST_MEDIAN_FULL 19
+#define TEST_FAST_SYNC_US 10000LL
+#define TEST_NORMAL_SYNC_US 1000000LL
+#define TEST_DURATION_US (600LL * 1000000LL)
+
+typedef struct {
+  int64_t offset0_us;
+  int32_t skew_ppm;
+  int32_t baseDelay_us;
+  int32_t upJitter_us;    // mean of exponential jitter client -> server
+  int32_t downJitter_us;  // mean of exponential jitter server -> client
+} sync_sim_t;
+
+typedef struct {
+  int64_t readyAt_us;
+  int64_t sumErr;
+  int64_t maxErr;
+  uint32_t n;
+} sync_result_t;
+
+static uint32_t rngState;
+
+static double rng_uniform(void) {
+  rngState = rngState * 1664525u + 1013904223u;
+
+  return ((rngState >> 8) + 0.5) / 16777216.0;
+}
+
+static int64_t rng_delay(const sync_sim_t *sim, int32_t jitter_us) {
+  return sim->baseDelay_us + (int64_t)(-jitter_us * log(rng_uniform()));
+}
+
+static int64_t true_offset(const sync_sim_t *sim, int64_t local_us) {
+  return sim->offset0_us + local_us * sim->skew_ppm / 1000000;
+}
+
+static void result_add(sync_result_t *r, int64_t err) {
+  err = llabs(err);
+  r->sumErr += err;
+  if (err > r->maxErr) {
+    r->maxErr = err;
+  }
+  r->n++;
+}
+
+/**
+ * Run the time sync message exchange of main.c and evaluate both estimators
+ * halfway between two syncs, where the player uses them.
+ */
+static void run_sync_sim(const sync_sim_t *sim, sync_result_t *model,
+                         sync_result_t *median) {
+  static sMedianNode_t medianBuffer[TEST_MEDIAN_LEN];
+  sMedianFilter_t medianFilter;
+  clock_model_t clock;
+  int64_t t = 1000000, medianValue = 0;
+
+  memset(model, 0, sizeof(sync_result_t));
+  memset(median, 0, sizeof(sync_result_t));
+  model->readyAt_us = median->readyAt_us = -1;
+
+  medianFilter.numNodes = TEST_MEDIAN_LEN;
+  medianFilter.medianBuffer = medianBuffer;
+  TEST_ASSERT_EQUAL(0, MEDIANFILTER_Init(&medianFilter));
+  clock_model_reset(&clock);
+
+  rngState = 1704;
+
+  while (t < TEST_DURATION_US) {
+    int64_t up = rng_delay(sim, sim->upJitter_us);
+    int64_t down = rng_delay(sim, sim->downJitter_us);
+    int64_t arrival = t + up;
+    int64_t serverSent = arrival + true_offset(sim, arrival);
+    int64_t received = arrival + down;
+    int64_t latency = serverSent - t;  // server fills in receive - client sent
+    int64_t tdif = received - serverSent;
+    int64_t diff = (latency - tdif) / 2;
+    bool modelReady, medianReady;
+    int64_t period, eval;
+
+    clock_model_insert(&clock, received, diff, latency + tdif);
+    medianValue = MEDIANFILTER_Insert(&medianFilter, diff);
+
+    modelReady = clock_model_ready(&clock);
+    medianReady = MEDIANFILTER_isFull(&medianFilter, TEST_MEDIAN_FULL);
+
+    if (modelReady && (model->readyAt_us < 0)) {
+      model->readyAt_us = received;
+    }
+    if (medianReady && (median->readyAt_us < 0)) {
+      median->readyAt_us = received;
+    }
+
+    // main.c syncs fast until the estimate is ready, here until both are
+    period = (modelReady && medianReady) ? TEST_NORMAL_SYNC_US
+                                         : TEST_FAST_SYNC_US;
+    eval = received + period / 2;
+
+    if (modelReady && medianReady) {
+      result_add(model,
+                 clock_model_offset(&clock, eval) - true_offset(sim, eval));
+      result_add(median, medianValue - true_offset(sim, eval));
+    }
+
+    t += period;
+  }
+}
+
+static void log_result(const char *name, const sync_result_t *r) {
+  ESP_LOGI(TAG, "%s: ready after %lldus, mean error %lldus, max error %lldus",
+           name, r->readyAt_us - 1000000, r->sumErr / r->n, r->maxErr);
+}
+
+TEST_CASE("clock model tracks drifting clocks better than the median",
+          "[clock_model]") {
+  const sync_sim_t sims[] = {
+      // crystals close together, symmetric jitter
+      {.offset0_us = 123456789,
+       .skew_ppm = 5,
+       .baseDelay_us = 1000,
+       .upJitter_us = 500,
+       .downJitter_us = 500},
+      // worst case crystals and a busy uplink
+      {.offset0_us = -987654321,
+       .skew_ppm = 80,
+       .baseDelay_us = 2000,
+       .upJitter_us = 4000,
+       .downJitter_us = 500},
+  };
+
+  for (int i = 0; i < sizeof(sims) / sizeof(sims[0]); i++) {
+    sync_result_t model, median;
+
+    run_sync_sim(&sims[i], &model, &median);
+
+    ESP_LOGI(TAG, "skew %ldppm, jitter up %ldus down %ldus",
+             (long)sims[i].skew_ppm, (long)sims[i].upJitter_us,
+             (long)sims[i].downJitter_us);
+    log_result("clock model", &model);
+    log_result("median", &median);
+
+    TEST_ASSERT_LESS_THAN_INT64(median.readyAt_us, model.readyAt_us);
+    TEST_ASSERT_LESS_THAN_INT64(median.sumErr / median.n,
+                                model.sumErr / model.n);
+    TEST_ASSERT_LESS_THAN_INT64(median.maxErr, model.maxErr);
+    TEST_ASSERT_LESS_THAN_INT64(1000, model.maxErr);
+  }
+}
+
+TEST_CASE("clock model ignores outliers and restarts on clock steps",
+          "[clock_model]") {
+  clock_model_t clock;
+  int64_t t = 0;
+
+  clock_model_reset(&clock);
+  TEST_ASSERT_FALSE(clock_model_ready(&clock));
+  TEST_ASSERT_EQUAL_INT64(INT64_MAX, clock_model_uncertainty(&clock, 0));
+
+  for (int i = 0; i < 20; i++, t += 1000000) {
+    TEST_ASSERT_EQUAL_INT32(0, clock_model_insert(&clock, t, 5000, 2000));
+  }
+  TEST_ASSERT_TRUE(clock_model_ready(&clock));
+  TEST_ASSERT_EQUAL_INT64(5000, clock_model_offset(&clock, t));
+
+  // a single outlier is held back
+  TEST_ASSERT_EQUAL_INT32(1, clock_model_insert(&clock, t, 800000, 2000));
+  t += 1000000;
+  TEST_ASSERT_EQUAL_INT32(0, clock_model_insert(&clock, t, 5000, 2000));
+  t += 1000000;
+  TEST_ASSERT_EQUAL_INT64(5000, clock_model_offset(&clock, t));
+
+  // server time jumps by a second
+  TEST_ASSERT_EQUAL_INT32(1, clock_model_insert(&clock, t, 1005000, 2000));
+  t += 1000000;
+  TEST_ASSERT_EQUAL_INT32(1, clock_model_insert(&clock, t, 1005000, 2000));
+  t += 1000000;
+  TEST_ASSERT_EQUAL_INT32(2, clock_model_insert(&clock, t, 1005000, 2000));
+  t += 1000000;
+  TEST_ASSERT_FALSE(clock_model_ready(&clock));
+
+  for (int i = 1; i < CLOCK_MODEL_READY_SAMPLES; i++, t += 1000000) {
+    TEST_ASSERT_EQUAL_INT32(0, clock_model_insert(&clock, t, 1005000, 2000));
+  }
+  TEST_ASSERT_TRUE(clock_model_ready(&clock));
+  TEST_ASSERT_EQUAL_INT64(1005000, clock_model_offset(&clock, t));
+}
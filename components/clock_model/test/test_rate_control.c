@@ -0,0 +1,123 @@
+/**
+ * Playback rate control: close the loop over a simulated player whose sync
+ * error drifts with the clock skew and moves with the rate correction, one
+ * update per played chunk with measurement noise like the median filtered
+ * age.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "rate_control.h"
+#include "unity.h"
+
+static const char *TAG = "TEST_RATE";
+
+#define TEST_TAU_MS 10000
+#define TEST_MAX_PPB 500000
+// 1152 frames at 48 kHz
+#define TEST_CHUNK_US 24000
+
+typedef struct {
+  int64_t err_ns;     // true sync error
+  int64_t maxAbs_ns;  // after settling
+  int32_t ppb;
+} sim_t;
+
+/**
+ * Play for duration_us with the given skew, the error is measured with
+ * +-noise_us and maxAbs_ns tracked once settle_us are over.
+ */
+static void simulate(rate_control_t *ctl, sim_t *sim, int32_t skew_ppb,
+                     int64_t duration_us, int64_t settle_us,
+                     int32_t noise_us) {
+  for (int64_t t = 0; t < duration_us; t += TEST_CHUNK_US) {
+    int64_t measured = sim->err_ns / 1000;
+
+    if (noise_us > 0) {
+      measured += rand() % (2 * noise_us + 1) - noise_us;
+    }
+
+    sim->ppb = rate_control_update(ctl, measured, TEST_CHUNK_US);
+
+    // 1 ppb over 1 µs is 1 fs
+    sim->err_ns +=
+        (int64_t)(skew_ppb - sim->ppb) * TEST_CHUNK_US / 1000000;
+
+    if ((t >= settle_us) && (llabs(sim->err_ns) > sim->maxAbs_ns)) {
+      sim->maxAbs_ns = llabs(sim->err_ns);
+    }
+  }
+}
+
+TEST_CASE("rate control takes up skew and offset", "[clock_model]") {
+  rate_control_t ctl;
+  sim_t sim;
+
+  srand(1);
+
+  rate_control_init(&ctl, TEST_TAU_MS, TEST_MAX_PPB);
+  rate_control_reset(&ctl, 0);
+  memset(&sim, 0, sizeof(sim));
+
+  // 500µs late with a crystal 80 ppm off, 10 time constants to settle
+  sim.err_ns = 500000;
+  simulate(&ctl, &sim, 80000, 200LL * 1000000, 100LL * 1000000, 0);
+
+  ESP_LOGI(TAG, "clean: %ldppb, max error %lldns", (long)sim.ppb,
+           sim.maxAbs_ns);
+  TEST_ASSERT_INT32_WITHIN(1000, 80000, sim.ppb);
+  TEST_ASSERT_LESS_THAN_INT64(1000, sim.maxAbs_ns);
+
+  // noisy measurements only move the rate a little
+  sim.maxAbs_ns = 0;
+  simulate(&ctl, &sim, 80000, 200LL * 1000000, 0, 50);
+
+  ESP_LOGI(TAG, "noisy: %ldppb, max error %lldns", (long)sim.ppb,
+           sim.maxAbs_ns);
+  TEST_ASSERT_INT32_WITHIN(20000, 80000, sim.ppb);
+  TEST_ASSERT_LESS_THAN_INT64(50000, sim.maxAbs_ns);
+}
+
+TEST_CASE("rate control starts from the skew estimate", "[clock_model]") {
+  rate_control_t ctl;
+  sim_t sim;
+
+  rate_control_init(&ctl, TEST_TAU_MS, TEST_MAX_PPB);
+  memset(&sim, 0, sizeof(sim));
+
+  // in sync right away, the error never builds up
+  rate_control_reset(&ctl, -40000);
+  TEST_ASSERT_EQUAL_INT32(-40000, ctl.ppb);
+  simulate(&ctl, &sim, -40000, 60LL * 1000000, 0, 0);
+
+  TEST_ASSERT_EQUAL_INT64(0, sim.maxAbs_ns);
+  TEST_ASSERT_EQUAL_INT32(-40000, sim.ppb);
+}
+
+TEST_CASE("rate control doesn't wind up at its limit", "[clock_model]") {
+  rate_control_t ctl;
+  sim_t sim;
+
+  rate_control_init(&ctl, TEST_TAU_MS, TEST_MAX_PPB);
+  rate_control_reset(&ctl, 2 * TEST_MAX_PPB);
+  TEST_ASSERT_EQUAL_INT32(TEST_MAX_PPB, ctl.ppb);
+
+  memset(&sim, 0, sizeof(sim));
+
+  // more skew than the limit, error grows and output saturates
+  simulate(&ctl, &sim, 2 * TEST_MAX_PPB, 10LL * 1000000, 0, 0);
+  TEST_ASSERT_EQUAL_INT32(TEST_MAX_PPB, sim.ppb);
+  TEST_ASSERT_GREATER_THAN_INT64(0, sim.err_ns);
+
+  // skew back to normal, the integral is not beyond the limit so the error
+  // is taken up within a few time constants
+  sim.maxAbs_ns = 0;
+  simulate(&ctl, &sim, 0, 150LL * 1000000, 100LL * 1000000, 0);
+
+  ESP_LOGI(TAG, "recovered: %ldppb, max error %lldns", (long)sim.ppb,
+           sim.maxAbs_ns);
+  TEST_ASSERT_INT32_WITHIN(1000, 0, sim.ppb);
+  TEST_ASSERT_LESS_THAN_INT64(10000, sim.maxAbs_ns);
+}
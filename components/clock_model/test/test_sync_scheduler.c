@@ -0,0 +1,201 @@
+/**
+ * Time sync scheduler: replay round trip time traces through the clock model
+ * and check how often the server gets pinged.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "clock_model.h"
+#include "esp_log.h"
+#include "sync_scheduler.h"
+#include "unity.h"
+
+static const char *TAG = "TEST_SCHED";
+
+#define TEST_SKEW_PPM 30
+
+// ethernet, switch in between
+static const int32_t rttEthernet[] = {
+    329, 324, 346, 321, 339, 331, 321, 337, 320, 334, 321, 322, 333, 363, 323,
+    326, 344, 393, 341, 332, 413, 321, 368, 328, 323, 323, 329, 362, 324, 341,
+    345, 331, 339, 321, 321, 325, 348, 333, 329, 342, 335, 328, 359, 350, 326,
+    341, 338, 372, 352, 328, 418, 323, 333, 355, 324, 336, 320, 347, 356, 341,
+    372, 329, 349, 342,
+};
+
+// wifi, good signal
+static const int32_t rttWifi[] = {
+    3380, 3148, 4249, 5205, 3178, 3581, 2656, 3688, 3537, 7078, 4152, 2901,
+    3038, 3594, 2620, 3157, 2765, 2712, 2654, 3915, 2724, 2856, 3046, 4446,
+    2675, 3136, 3317, 4533, 4139, 4395, 2893, 3082, 2999, 4540, 5447, 2747,
+    2774, 2837, 2839, 3197, 3400, 2874, 2603, 3088, 3014, 3351, 5353, 3655,
+    3252, 3465, 3614, 2649, 4668, 3962, 4467, 4038, 3048, 3058, 2698, 3505,
+    2657, 2662, 2810, 2759,
+};
+
+// wifi, busy channel
+static const int32_t rttWifiCongested[] = {
+    7240,  3986,  3502,  4976,  4462,  7567,  3732,  22167, 12068, 4947,
+    6116,  7340,  7575,  4679,  20510, 48289, 9146,  9451,  4308,  4470,
+    7275,  6267,  19387, 5084,  3710,  30640, 10261, 4926,  10551, 3746,
+    10259, 38057, 21411, 14222, 6223,  7611,  5144,  16803, 10344, 17088,
+    7099,  5771,  18518, 41253, 20733, 18262, 18850, 15619, 5814,  10061,
+    7454,  3764,  3755,  6449,  6199,  14114, 31718, 8835,  28384, 43334,
+    31409, 7582,  5741,  5815,
+};
+
+typedef struct {
+  const int32_t *rtt;
+  uint32_t len;
+  int64_t duration_us;
+} trace_segment_t;
+
+typedef struct {
+  uint32_t pings;
+  int64_t maxErr;
+} replay_result_t;
+
+static int64_t true_offset(int64_t local_us) {
+  return 5000000LL + local_us * TEST_SKEW_PPM / 1000000;
+}
+
+/**
+ * Ping whenever the scheduler says so. Queueing delay beyond the fastest
+ * round trip is put mostly on the uplink, so busy links also bias the
+ * measured offset.
+ */
+static void replay(clock_model_t *model, sync_scheduler_t *sched, int64_t *t,
+                   const trace_segment_t *seg, replay_result_t *result) {
+  int32_t rttMin = INT32_MAX;
+  int64_t end = *t + seg->duration_us;
+  uint32_t i = 0;
+
+  for (uint32_t k = 0; k < seg->len; k++) {
+    if (seg->rtt[k] < rttMin) {
+      rttMin = seg->rtt[k];
+    }
+  }
+
+  memset(result, 0, sizeof(replay_result_t));
+
+  while (*t < end) {
+    int32_t rtt = seg->rtt[i++ % seg->len];
+    int64_t up = rttMin / 2 + (rtt - rttMin) * 7 / 10;
+    int64_t down = rtt - up;
+    int64_t arrival = *t + up;
+    int64_t serverSent = arrival + true_offset(arrival);
+    int64_t received = arrival + down;
+    int64_t latency = serverSent - *t;
+    int64_t tdif = received - serverSent;
+    int64_t interval, err;
+    int32_t ret;
+
+    ret = clock_model_insert(model, received, (latency - tdif) / 2,
+                             latency + tdif);
+    interval = sync_scheduler_update(sched, latency + tdif, ret,
+                                     clock_model_ready(model),
+                                     model->skewErr_ppb);
+
+    // error of the offset right before the next ping, once skew is known
+    if (model->skewValid) {
+      err = llabs(clock_model_offset(model, received + interval) -
+                  true_offset(received + interval));
+      if (err > result->maxErr) {
+        result->maxErr = err;
+      }
+    }
+
+    result->pings++;
+    *t += interval;
+  }
+}
+
+static void log_stats(const char *name, const sync_scheduler_t *sched,
+                      const replay_result_t *result) {
+  sync_scheduler_stats_t stats;
+
+  sync_scheduler_get_stats(sched, &stats);
+  ESP_LOGI(TAG,
+           "%s: %lu pings, max error %lldus, interval %luus, bursts %lu, "
+           "degradations %lu, backoffs %lu, speedups %lu, rtt %ld+-%ldus",
+           name, (unsigned long)result->pings, result->maxErr,
+           (unsigned long)stats.interval_us, (unsigned long)stats.bursts,
+           (unsigned long)stats.degradations, (unsigned long)stats.backoffs,
+           (unsigned long)stats.speedups, (long)stats.srtt_us,
+           (long)stats.rttVar_us);
+}
+
+TEST_CASE("sync scheduler backs off on quiet links", "[clock_model]") {
+  static clock_model_t model;
+  sync_scheduler_t sched;
+  sync_scheduler_stats_t stats;
+  replay_result_t result;
+  const trace_segment_t ethernet = {rttEthernet,
+                                    sizeof(rttEthernet) / sizeof(int32_t),
+                                    600LL * 1000000LL};
+  int64_t t = 0;
+
+  memset(&sched, 0, sizeof(sched));
+  clock_model_reset(&model);
+  sync_scheduler_reset(&sched);
+  TEST_ASSERT_EQUAL_INT64(SYNC_SCHEDULER_MIN_INTERVAL_US,
+                          sync_scheduler_interval(&sched));
+
+  replay(&model, &sched, &t, &ethernet, &result);
+  log_stats("ethernet", &sched, &result);
+
+  sync_scheduler_get_stats(&sched, &stats);
+  TEST_ASSERT_EQUAL_UINT32(SYNC_SCHEDULER_MAX_INTERVAL_US, stats.interval_us);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.bursts);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.degradations);
+  // fixed 1s interval would have taken more than 600 pings
+  TEST_ASSERT_LESS_THAN_UINT32(200, result.pings);
+  TEST_ASSERT_LESS_THAN_INT64(SYNC_SCHEDULER_TARGET_US * 2, result.maxErr);
+}
+
+TEST_CASE("sync scheduler bursts when the link degrades", "[clock_model]") {
+  static clock_model_t model;
+  sync_scheduler_t sched;
+  sync_scheduler_stats_t stats;
+  replay_result_t result;
+  const trace_segment_t wifi = {rttWifi, sizeof(rttWifi) / sizeof(int32_t),
+                                300LL * 1000000LL};
+  const trace_segment_t congested = {
+      rttWifiCongested, sizeof(rttWifiCongested) / sizeof(int32_t),
+      60LL * 1000000LL};
+  uint32_t degradations;
+  int64_t t = 0;
+
+  memset(&sched, 0, sizeof(sched));
+  clock_model_reset(&model);
+  sync_scheduler_reset(&sched);
+
+  replay(&model, &sched, &t, &wifi, &result);
+  log_stats("wifi", &sched, &result);
+  sync_scheduler_get_stats(&sched, &stats);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.degradations);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(310, result.pings);
+
+  replay(&model, &sched, &t, &congested, &result);
+  log_stats("congested", &sched, &result);
+  sync_scheduler_get_stats(&sched, &stats);
+  TEST_ASSERT_GREATER_OR_EQUAL_UINT32(1, stats.degradations);
+  TEST_ASSERT_EQUAL_UINT32(1 + stats.degradations, stats.bursts);
+  TEST_ASSERT_EQUAL_UINT32(SYNC_SCHEDULER_NOISY_INTERVAL_US,
+                           stats.interval_us);
+  degradations = stats.degradations;
+
+  replay(&model, &sched, &t, &wifi, &result);
+  log_stats("wifi again", &sched, &result);
+  sync_scheduler_get_stats(&sched, &stats);
+  TEST_ASSERT_EQUAL_UINT32(degradations, stats.degradations);
+  TEST_ASSERT_EQUAL_UINT32(SYNC_SCHEDULER_MAX_INTERVAL_US, stats.interval_us);
+
+  // reconnect
+  sync_scheduler_reset(&sched);
+  TEST_ASSERT_EQUAL_INT64(SYNC_SCHEDULER_MIN_INTERVAL_US,
+                          sync_scheduler_interval(&sched));
+  sync_scheduler_get_stats(&sched, &stats);
+  TEST_ASSERT_EQUAL_UINT32(2 + degradations, stats.bursts);
+}
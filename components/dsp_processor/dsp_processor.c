@@ -200,13 +200,74 @@ static int32_t dsp_processor_gen_filter(ptype_t *filter, uint32_t cnt) {
   return ESP_OK;
 }
 
+/**
+ * Read a block of one channel. 16 bit frames are a single word with channel 0
+ * in the lower half, 32 bit frames a word per sample.
+ */
+static void dsp_processor_load(volatile uint32_t *audio, uint32_t frame,
+                               uint32_t frames, uint32_t ch, uint8_t bits,
+                               double gain, float *out) {
+  if (bits == 32) {
+    volatile uint32_t *tmp = &audio[2 * frame + ch];
+
+    for (uint32_t i = 0; i < frames; i++) {
+      out[i] = gain * ((float)((int32_t)tmp[2 * i])) / INT32_MAX;
+    }
+  } else {
+    volatile uint32_t *tmp = &audio[frame];
+
+    for (uint32_t i = 0; i < frames; i++) {
+      out[i] = gain * ((float)((int16_t)(tmp[i] >> (16 * ch)))) / INT16_MAX;
+    }
+  }
+}
+
+/**
+ * Write back a block read by dsp_processor_load(), 32 bit samples are
+ * clamped as float can't hold INT32_MAX.
+ */
+static void dsp_processor_store(volatile uint32_t *audio, uint32_t frame,
+                                uint32_t frames, uint32_t ch, uint8_t bits,
+                                const float *in) {
+  if (bits == 32) {
+    volatile uint32_t *tmp = &audio[2 * frame + ch];
+
+    for (uint32_t i = 0; i < frames; i++) {
+      float val = in[i] * (float)INT32_MAX;
+      int32_t valint;
+
+      if (val >= (float)INT32_MAX) {
+        valint = INT32_MAX;
+      } else if (val <= (float)INT32_MIN) {
+        valint = INT32_MIN;
+      } else {
+        valint = (int32_t)val;
+      }
+
+      tmp[2 * i] = (uint32_t)valint;
+    }
+  } else {
+    volatile uint32_t *tmp = &audio[frame];
+
+    for (uint32_t i = 0; i < frames; i++) {
+      uint16_t valint = (uint16_t)(int16_t)(in[i] * INT16_MAX);
+
+      if (ch == 0) {
+        tmp[i] = (tmp[i] & 0xFFFF0000) | valint;
+      } else {
+        tmp[i] = (tmp[i] & 0xFFFF) | ((uint32_t)valint << 16);
+      }
+    }
+  }
+}
+
 /**
  *
  */
-int dsp_processor_worker(char *audio, size_t chunk_size, uint32_t samplerate) {
-  int16_t len = chunk_size / 4;
-  int16_t valint;
-  uint16_t i;
+int dsp_processor_worker(char *audio, size_t chunk_size, uint32_t samplerate,
+                         uint8_t bits) {
+  // frames, see dsp_processor_load()
+  int16_t len = chunk_size / ((bits == 32) ? 8 : 4);
   // volatile needed to ensure 32 bit access
   volatile uint32_t *audio_tmp = (volatile uint32_t *)audio;
   dspFlows_t dspFlow;
@@ -363,7 +424,6 @@ int dsp_processor_worker(char *audio, size_t chunk_size, uint32_t samplerate) {
     switch (dspFlow) {
       case dspfEQBassTreble: {
         for (int k = 0; k < len; k += DSP_PROCESSOR_LEN) {
-          volatile uint32_t *tmp = (uint32_t *)(&audio_tmp[k]);
           uint32_t max = DSP_PROCESSOR_LEN;
           uint32_t test = len - k;
 
@@ -372,63 +432,44 @@ int dsp_processor_worker(char *audio, size_t chunk_size, uint32_t samplerate) {
           }
 
           // channel 0
-          for (i = 0; i < max; i++) {
-            sbuffer0[i] = dynamic_vol * /*0.5 **/
-                          ((float)((int16_t)(tmp[i] & 0xFFFF))) / INT16_MAX;
-          }
-
+          dsp_processor_load(audio_tmp, k, max, 0, bits, dynamic_vol,
+                             sbuffer0);
           // BASS
           BIQUAD(sbuffer0, sbufout0, max, filter[0].coeffs, filter[0].w);
           // TREBLE
           BIQUAD(sbufout0, sbuffer0, max, filter[1].coeffs, filter[1].w);
-
-          for (i = 0; i < max; i++) {
-            valint = (int16_t)(sbuffer0[i] * INT16_MAX);
-            tmp[i] =
-                (volatile uint32_t)((tmp[i] & 0xFFFF0000) + (uint32_t)valint);
-          }
+          dsp_processor_store(audio_tmp, k, max, 0, bits, sbuffer0);
 
           // channel 1
-          for (i = 0; i < max; i++) {
-            sbuffer0[i] = dynamic_vol * /*0.5 **/
-                          ((float)((int16_t)((tmp[i] & 0xFFFF0000) >> 16))) /
-                          INT16_MAX;
-          }
-
+          dsp_processor_load(audio_tmp, k, max, 1, bits, dynamic_vol,
+                             sbuffer0);
           // BASS
           BIQUAD(sbuffer0, sbufout0, max, filter[2].coeffs, filter[2].w);
           // TREBLE
           BIQUAD(sbufout0, sbuffer0, max, filter[3].coeffs, filter[3].w);
-
-          for (i = 0; i < max; i++) {
-            valint = (int16_t)(sbuffer0[i] * INT16_MAX);
-            tmp[i] = (volatile uint32_t)((tmp[i] & 0xFFFF) +
-                                         ((uint32_t)valint << 16));
-          }
+          dsp_processor_store(audio_tmp, k, max, 1, bits, sbuffer0);
         }
 
         break;
       }
 
       case dspfStereo: {
-        for (int k = 0; k < len; k += DSP_PROCESSOR_LEN) {
-          volatile uint32_t *tmp = (uint32_t *)(&audio_tmp[k]);
-          uint32_t max = DSP_PROCESSOR_LEN;
-          uint32_t test = len - k;
-
-          if (test < DSP_PROCESSOR_LEN) {
-            max = test;
-          }
-
-          // set volume
-          if (dynamic_vol != 1.0) {
-            for (i = 0; i < max; i++) {
-              tmp[i] =
+        // set volume
+        if (dynamic_vol != 1.0) {
+          if (bits == 32) {
+            for (int k = 0; k < 2 * len; k++) {
+              audio_tmp[k] =
+                  (uint32_t)(int32_t)(dynamic_vol * (int32_t)audio_tmp[k]);
+            }
+          } else {
+            for (int k = 0; k < len; k++) {
+              audio_tmp[k] =
                   ((uint32_t)(dynamic_vol *
-                              ((float)((int16_t)((tmp[i] & 0xFFFF0000) >> 16))))
+                              ((float)((int16_t)((audio_tmp[k] & 0xFFFF0000) >>
+                                                 16))))
                    << 16) +
                   (uint32_t)(dynamic_vol *
-                             ((float)((int16_t)(tmp[i] & 0xFFFF))));
+                             ((float)((int16_t)(audio_tmp[k] & 0xFFFF))));
             }
           }
         }
@@ -438,7 +479,6 @@ int dsp_processor_worker(char *audio, size_t chunk_size, uint32_t samplerate) {
 
       case dspfBassBoost: {  // CH0 low shelf 6dB @ 400Hz
         for (int k = 0; k < len; k += DSP_PROCESSOR_LEN) {
-          volatile uint32_t *tmp = (uint32_t *)(&audio_tmp[k]);
           uint32_t max = DSP_PROCESSOR_LEN;
           uint32_t test = len - k;
 
@@ -447,29 +487,16 @@ int dsp_processor_worker(char *audio, size_t chunk_size, uint32_t samplerate) {
           }
 
           // channel 0
-          for (i = 0; i < max; i++) {
-            sbuffer0[i] = dynamic_vol * 0.5 *
-                          ((float)((int16_t)(tmp[i] & 0xFFFF))) / INT16_MAX;
-          }
+          dsp_processor_load(audio_tmp, k, max, 0, bits, dynamic_vol * 0.5,
+                             sbuffer0);
           BIQUAD(sbuffer0, sbufout0, max, filter[0].coeffs, filter[0].w);
-
-          for (i = 0; i < max; i++) {
-            valint = (int16_t)(sbufout0[i] * INT16_MAX);
-            tmp[i] = (tmp[i] & 0xFFFF0000) + (uint32_t)valint;
-          }
+          dsp_processor_store(audio_tmp, k, max, 0, bits, sbufout0);
 
           // channel 1
-          for (i = 0; i < max; i++) {
-            sbuffer0[i] = dynamic_vol * 0.5 *
-                          ((float)((int16_t)((tmp[i] & 0xFFFF0000) >> 16))) /
-                          INT16_MAX;
-          }
+          dsp_processor_load(audio_tmp, k, max, 1, bits, dynamic_vol * 0.5,
+                             sbuffer0);
           BIQUAD(sbuffer0, sbufout0, max, filter[1].coeffs, filter[1].w);
-
-          for (i = 0; i < max; i++) {
-            valint = (int16_t)(sbufout0[i] * INT16_MAX);
-            tmp[i] = (tmp[i] & 0xFFFF) + ((uint32_t)valint << 16);
-          }
+          dsp_processor_store(audio_tmp, k, max, 1, bits, sbufout0);
         }
 
         break;
@@ -477,7 +504,6 @@ int dsp_processor_worker(char *audio, size_t chunk_size, uint32_t samplerate) {
 
       case dspfBiamp: {
         for (int k = 0; k < len; k += DSP_PROCESSOR_LEN) {
-          volatile uint32_t *tmp = (uint32_t *)(&audio_tmp[k]);
           uint32_t max = DSP_PROCESSOR_LEN;
           uint32_t test = len - k;
 
@@ -486,31 +512,18 @@ int dsp_processor_worker(char *audio, size_t chunk_size, uint32_t samplerate) {
           }
 
           // Process audio ch0 LOW PASS FILTER
-          for (i = 0; i < max; i++) {
-            sbuffer0[i] = dynamic_vol * 0.5 *
-                          ((float)((int16_t)(tmp[i] & 0xFFFF))) / INT16_MAX;
-          }
+          dsp_processor_load(audio_tmp, k, max, 0, bits, dynamic_vol * 0.5,
+                             sbuffer0);
           BIQUAD(sbuffer0, sbufout0, max, filter[0].coeffs, filter[0].w);
           BIQUAD(sbufout0, sbuffer0, max, filter[1].coeffs, filter[1].w);
-
-          for (i = 0; i < max; i++) {
-            valint = (int16_t)(sbuffer0[i] * INT16_MAX);
-            tmp[i] = (tmp[i] & 0xFFFF0000) + (uint32_t)valint;
-          }
+          dsp_processor_store(audio_tmp, k, max, 0, bits, sbuffer0);
 
           // Process audio ch1 HIGH PASS FILTER
-          for (i = 0; i < max; i++) {
-            sbuffer0[i] = dynamic_vol * 0.5 *
-                          ((float)((int16_t)((tmp[i] & 0xFFFF0000) >> 16))) /
-                          INT16_MAX;
-          }
+          dsp_processor_load(audio_tmp, k, max, 1, bits, dynamic_vol * 0.5,
+                             sbuffer0);
           BIQUAD(sbuffer0, sbufout0, max, filter[2].coeffs, filter[2].w);
           BIQUAD(sbufout0, sbuffer0, max, filter[3].coeffs, filter[3].w);
-
-          for (i = 0; i < max; i++) {
-            valint = (int16_t)(sbuffer0[i] * INT16_MAX);
-            tmp[i] = (tmp[i] & 0xFFFF) + ((uint32_t)valint << 16);
-          }
+          dsp_processor_store(audio_tmp, k, max, 1, bits, sbuffer0);
         }
 
         break;
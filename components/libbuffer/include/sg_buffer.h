@@ -0,0 +1,138 @@
+#ifndef __SG_BUFFER_H__
+#define __SG_BUFFER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// a wire chunk received in MSS sized segments fits easily
+#define SG_CHAIN_MAX_SEGMENTS 48
+
+typedef void (*sg_release_t)(void *owner);
+
+/**
+ * A span of bytes owned by someone else, e.g. a received pbuf. The owner is
+ * passed to release once the span isn't needed anymore.
+ */
+typedef struct sg_segment_t {
+  const char *data;
+  uint32_t len;
+  void *owner;
+  sg_release_t release;
+} sg_segment_t;
+
+typedef struct sg_chain_t {
+  sg_segment_t segment[SG_CHAIN_MAX_SEGMENTS];
+  uint32_t count;
+  uint32_t len;
+} sg_chain_t;
+
+typedef struct sg_cursor_t {
+  const sg_chain_t *chain;
+  uint32_t segment, offset;
+  uint32_t remaining;
+} sg_cursor_t;
+
+/**
+ * Init an empty chain.
+ *
+ * @param[in] chain The chain to initialize.
+ */
+void sg_chain_init(sg_chain_t *chain);
+
+/**
+ * Append a span to the chain. Nothing is copied.
+ *
+ * @param[in] chain The chain to append to.
+ * @param[in] data The first byte of the span.
+ * @param[in] len The length of the span.
+ * @param[in] owner Passed to release, may be NULL.
+ * @param[in] release Called with owner from sg_chain_release(), may be NULL.
+ * @return 1 if the chain is full, 0 otherwise.
+ */
+int sg_chain_append(sg_chain_t *chain, const char *data, uint32_t len,
+                    void *owner, sg_release_t release);
+
+/**
+ * Release all segments and empty the chain.
+ *
+ * @param[in] chain The chain to release.
+ */
+void sg_chain_release(sg_chain_t *chain);
+
+/**
+ * Replace all segments by a single heap allocated segment of size bytes
+ * holding a copy of the current content. The bytes behind the copied content
+ * are left for the caller to fill in.
+ *
+ * @param[in] chain The chain to flatten.
+ * @param[in] size The size of the new segment, at least the chain length.
+ * @return The new segment's memory or NULL if it couldn't be allocated, the
+ * chain is left untouched then.
+ */
+char *sg_chain_flatten(sg_chain_t *chain, uint32_t size);
+
+/**
+ * Get the content of the chain in one piece. If the chain has a single
+ * segment it is returned directly, otherwise the content is copied to
+ * scratch.
+ *
+ * @param[in] chain The chain.
+ * @param[out] scratch Memory used if the chain has more than one segment.
+ * @param[in] size The size of scratch.
+ * @return Pointer to the content or NULL if scratch is too small.
+ */
+const char *sg_chain_linearize(const sg_chain_t *chain, char *scratch,
+                               uint32_t size);
+
+/**
+ * Init a cursor at the start of the chain. The chain must not be modified
+ * while the cursor is in use.
+ *
+ * @param[in] cursor The cursor to initialize.
+ * @param[in] chain The chain to read from.
+ */
+void sg_cursor_init(sg_cursor_t *cursor, const sg_chain_t *chain);
+
+/**
+ * @param[in] cursor The cursor.
+ * @return The count of bytes not read yet.
+ */
+uint32_t sg_cursor_remaining(const sg_cursor_t *cursor);
+
+/**
+ * Read up to len bytes.
+ *
+ * @param[in] cursor The cursor to read from.
+ * @param[out] data The read data.
+ * @param[in] len The maximum count of bytes to read.
+ * @return The count of bytes read, smaller than len at the end of the chain.
+ */
+uint32_t sg_cursor_read(sg_cursor_t *cursor, char *data, uint32_t len);
+
+/**
+ * Skip up to len bytes.
+ *
+ * @param[in] cursor The cursor.
+ * @param[in] len The maximum count of bytes to skip.
+ * @return The count of bytes skipped.
+ */
+uint32_t sg_cursor_skip(sg_cursor_t *cursor, uint32_t len);
+
+/**
+ * Get the contiguous span at the cursor position without consuming it.
+ *
+ * @param[in] cursor The cursor.
+ * @param[out] data The first byte of the span.
+ * @return The length of the span, 0 at the end of the chain.
+ */
+uint32_t sg_cursor_peek(const sg_cursor_t *cursor, const char **data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __SG_BUFFER_H__
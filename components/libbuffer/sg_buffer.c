@@ -0,0 +1,152 @@
+#include "sg_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+void sg_chain_init(sg_chain_t *chain) {
+  chain->count = 0;
+  chain->len = 0;
+}
+
+int sg_chain_append(sg_chain_t *chain, const char *data, uint32_t len,
+                    void *owner, sg_release_t release) {
+  sg_segment_t *segment;
+
+  if (chain->count >= SG_CHAIN_MAX_SEGMENTS) {
+    return 1;
+  }
+
+  segment = &chain->segment[chain->count++];
+  segment->data = data;
+  segment->len = len;
+  segment->owner = owner;
+  segment->release = release;
+
+  chain->len += len;
+
+  return 0;
+}
+
+void sg_chain_release(sg_chain_t *chain) {
+  uint32_t i;
+
+  for (i = 0; i < chain->count; i++) {
+    if (chain->segment[i].release) {
+      chain->segment[i].release(chain->segment[i].owner);
+    }
+  }
+
+  sg_chain_init(chain);
+}
+
+char *sg_chain_flatten(sg_chain_t *chain, uint32_t size) {
+  sg_cursor_t cursor;
+  uint32_t len = chain->len;
+  char *data;
+
+  if (size < len) {
+    return NULL;
+  }
+
+  data = (char *)malloc(size);
+  if (data == NULL) {
+    return NULL;
+  }
+
+  sg_cursor_init(&cursor, chain);
+  sg_cursor_read(&cursor, data, len);
+
+  sg_chain_release(chain);
+  sg_chain_append(chain, data, size, data, free);
+
+  return data;
+}
+
+const char *sg_chain_linearize(const sg_chain_t *chain, char *scratch,
+                               uint32_t size) {
+  sg_cursor_t cursor;
+
+  if (chain->count == 1) {
+    return chain->segment[0].data;
+  }
+
+  if (size < chain->len) {
+    return NULL;
+  }
+
+  sg_cursor_init(&cursor, chain);
+  sg_cursor_read(&cursor, scratch, chain->len);
+
+  return scratch;
+}
+
+void sg_cursor_init(sg_cursor_t *cursor, const sg_chain_t *chain) {
+  cursor->chain = chain;
+  cursor->segment = 0;
+  cursor->offset = 0;
+  cursor->remaining = chain->len;
+}
+
+uint32_t sg_cursor_remaining(const sg_cursor_t *cursor) {
+  return cursor->remaining;
+}
+
+static uint32_t sg_cursor_advance(sg_cursor_t *cursor, char *data,
+                                  uint32_t len) {
+  const sg_chain_t *chain = cursor->chain;
+  uint32_t done = 0;
+
+  while ((done < len) && (cursor->segment < chain->count)) {
+    const sg_segment_t *segment = &chain->segment[cursor->segment];
+    uint32_t n = segment->len - cursor->offset;
+
+    if (n > len - done) {
+      n = len - done;
+    }
+
+    if (data) {
+      memcpy(&data[done], &segment->data[cursor->offset], n);
+    }
+
+    done += n;
+    cursor->offset += n;
+    if (cursor->offset >= segment->len) {
+      cursor->segment++;
+      cursor->offset = 0;
+    }
+  }
+
+  cursor->remaining -= done;
+
+  return done;
+}
+
+uint32_t sg_cursor_read(sg_cursor_t *cursor, char *data, uint32_t len) {
+  return sg_cursor_advance(cursor, data, len);
+}
+
+uint32_t sg_cursor_skip(sg_cursor_t *cursor, uint32_t len) {
+  return sg_cursor_advance(cursor, NULL, len);
+}
+
+uint32_t sg_cursor_peek(const sg_cursor_t *cursor, const char **data) {
+  const sg_chain_t *chain = cursor->chain;
+  uint32_t i = cursor->segment;
+  uint32_t offset = cursor->offset;
+
+  // skip empty segments
+  while ((i < chain->count) && (offset >= chain->segment[i].len)) {
+    i++;
+    offset = 0;
+  }
+
+  if (i >= chain->count) {
+    *data = NULL;
+
+    return 0;
+  }
+
+  *data = &chain->segment[i].data[offset];
+
+  return chain->segment[i].len - offset;
+}
@@ -0,0 +1,177 @@
+/**
+ * Scatter-gather cursor over synthetic pbuf-like chains: reference counted
+ * segments which are only freed once the last reference is released.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "sg_buffer.h"
+#include "unity.h"
+
+#define TEST_PAYLOAD_SIZE 5000
+
+typedef struct fake_pbuf_s {
+  char payload[1460];
+  uint16_t len;
+  uint8_t ref;
+} fake_pbuf_t;
+
+static int freedPbufs;
+
+static void fake_pbuf_free(void *owner) {
+  fake_pbuf_t *p = (fake_pbuf_t *)owner;
+
+  TEST_ASSERT_GREATER_THAN_UINT8(0, p->ref);
+
+  p->ref--;
+  if (p->ref == 0) {
+    freedPbufs++;
+  }
+}
+
+/**
+ * split payload into pbufs of random size, every pbuf is referenced once by
+ * its "netbuf" and once by the chain
+ */
+static int build_chain(sg_chain_t *chain, fake_pbuf_t *pbufs, int maxPbufs,
+                       const char *payload, uint32_t len) {
+  uint32_t pos = 0;
+  int cnt = 0;
+
+  sg_chain_init(chain);
+
+  while ((pos < len) && (cnt < maxPbufs)) {
+    fake_pbuf_t *p = &pbufs[cnt++];
+    uint32_t n = (rand() % 3) ? (1 + rand() % sizeof(p->payload)) : 0;
+
+    if (n > len - pos) {
+      n = len - pos;
+    }
+
+    memcpy(p->payload, &payload[pos], n);
+    p->len = n;
+    p->ref = 2;
+
+    TEST_ASSERT_EQUAL(0, sg_chain_append(chain, p->payload, p->len, p,
+                                         fake_pbuf_free));
+    pos += n;
+  }
+
+  TEST_ASSERT_EQUAL_UINT32(len, pos);
+  TEST_ASSERT_EQUAL_UINT32(len, chain->len);
+
+  return cnt;
+}
+
+TEST_CASE("sg cursor reads synthetic pbuf chains", "[libbuffer]") {
+  static fake_pbuf_t pbufs[SG_CHAIN_MAX_SEGMENTS];
+  static char payload[TEST_PAYLOAD_SIZE];
+  static char out[TEST_PAYLOAD_SIZE];
+  sg_chain_t chain;
+  sg_cursor_t cursor;
+
+  srand(1704);
+
+  for (int i = 0; i < TEST_PAYLOAD_SIZE; i++) {
+    payload[i] = (char)(i * 7);
+  }
+
+  for (int round = 0; round < 200; round++) {
+    int cnt = build_chain(&chain, pbufs, SG_CHAIN_MAX_SEGMENTS, payload,
+                          TEST_PAYLOAD_SIZE);
+    uint32_t pos = 0;
+
+    // netbuf_delete() drops the receive reference
+    for (int i = 0; i < cnt; i++) {
+      fake_pbuf_free(&pbufs[i]);
+    }
+
+    sg_cursor_init(&cursor, &chain);
+
+    // read in random pieces like the FLAC read callback is asked for them,
+    // skip some bytes in between
+    while (sg_cursor_remaining(&cursor) > 0) {
+      uint32_t n = 1 + rand() % 2000;
+      const char *span;
+      uint32_t spanLen = sg_cursor_peek(&cursor, &span);
+
+      TEST_ASSERT_GREATER_THAN_UINT32(0, spanLen);
+      TEST_ASSERT_EQUAL_MEMORY(&payload[pos], span, 1);
+
+      if ((rand() % 8) == 0) {
+        n = sg_cursor_skip(&cursor, n);
+      } else {
+        uint32_t got = sg_cursor_read(&cursor, &out[pos], n);
+
+        TEST_ASSERT_EQUAL_MEMORY(&payload[pos], &out[pos], got);
+        n = got;
+      }
+
+      TEST_ASSERT_GREATER_THAN_UINT32(0, n);
+      pos += n;
+      TEST_ASSERT_EQUAL_UINT32(TEST_PAYLOAD_SIZE - pos,
+                               sg_cursor_remaining(&cursor));
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(0, sg_cursor_read(&cursor, out, 1));
+
+    // payload stays valid until the chain is released
+    freedPbufs = 0;
+    sg_chain_release(&chain);
+    TEST_ASSERT_EQUAL(cnt, freedPbufs);
+    TEST_ASSERT_EQUAL_UINT32(0, chain.count);
+  }
+}
+
+TEST_CASE("sg chain linearize and flatten", "[libbuffer]") {
+  static fake_pbuf_t pbufs[4];
+  sg_chain_t chain;
+  sg_cursor_t cursor;
+  char scratch[16];
+  char *flat;
+  const char *data;
+
+  sg_chain_init(&chain);
+
+  // single segment is returned in place
+  memcpy(pbufs[0].payload, "abcd", 4);
+  pbufs[0].ref = 1;
+  TEST_ASSERT_EQUAL(0, sg_chain_append(&chain, pbufs[0].payload, 4, &pbufs[0],
+                                       fake_pbuf_free));
+  data = sg_chain_linearize(&chain, scratch, sizeof(scratch));
+  TEST_ASSERT_EQUAL_PTR(pbufs[0].payload, data);
+
+  // more segments are gathered in scratch
+  memcpy(pbufs[1].payload, "efgh", 4);
+  pbufs[1].ref = 1;
+  TEST_ASSERT_EQUAL(0, sg_chain_append(&chain, pbufs[1].payload, 4, &pbufs[1],
+                                       fake_pbuf_free));
+  data = sg_chain_linearize(&chain, scratch, sizeof(scratch));
+  TEST_ASSERT_EQUAL_PTR(scratch, data);
+  TEST_ASSERT_EQUAL_MEMORY("abcdefgh", data, 8);
+  TEST_ASSERT_NULL(sg_chain_linearize(&chain, scratch, 7));
+
+  // flatten releases the segments and keeps room for the rest of the chunk
+  freedPbufs = 0;
+  flat = sg_chain_flatten(&chain, 12);
+  TEST_ASSERT_NOT_NULL(flat);
+  TEST_ASSERT_EQUAL(2, freedPbufs);
+  TEST_ASSERT_EQUAL_UINT32(1, chain.count);
+  TEST_ASSERT_EQUAL_UINT32(12, chain.len);
+  memcpy(&flat[8], "ijkl", 4);
+
+  sg_cursor_init(&cursor, &chain);
+  TEST_ASSERT_EQUAL_UINT32(12, sg_cursor_read(&cursor, scratch, 16));
+  TEST_ASSERT_EQUAL_MEMORY("abcdefghijkl", scratch, 12);
+
+  sg_chain_release(&chain);
+  TEST_ASSERT_EQUAL_UINT32(0, chain.len);
+
+  // a full chain refuses more segments
+  for (int i = 0; i < SG_CHAIN_MAX_SEGMENTS; i++) {
+    TEST_ASSERT_EQUAL(0, sg_chain_append(&chain, scratch, 1, NULL, NULL));
+  }
+  TEST_ASSERT_EQUAL(1, sg_chain_append(&chain, scratch, 1, NULL, NULL));
+  sg_chain_release(&chain);
+}
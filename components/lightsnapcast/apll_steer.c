@@ -0,0 +1,57 @@
+/**
+ * APLL frequency steering, see apll_steer.h
+ */
+
+#include "apll_steer.h"
+
+#include <string.h>
+
+/**
+ *
+ */
+void apll_steer_init(apll_steer_t *st, uint32_t sdm0, uint32_t sdm1,
+                     uint32_t sdm2) {
+  memset(st, 0, sizeof(apll_steer_t));
+
+  st->sdm = ((sdm2 & 0x3F) << 16) | ((sdm1 & 0xFF) << 8) | (sdm0 & 0xFF);
+  st->base = (4 << 16) + st->sdm;
+}
+
+/**
+ *
+ */
+bool apll_steer_update(apll_steer_t *st, int32_t ppb) {
+  // 2^16 / 10^9 is 2^7 / 5^9, base * ppb * 2^7 fits for any ppb
+  int64_t target = ((int64_t)st->base << 16) +
+                   (int64_t)st->base * ppb * 128 / 1953125;
+  int64_t v = target + st->residue;
+  int64_t multiplier = (v + 0x8000) >> 16;
+  uint32_t sdm;
+  bool changed;
+
+  if (multiplier < (4 << 16)) {
+    multiplier = 4 << 16;
+    v = multiplier << 16;
+  } else if (multiplier > (4 << 16) + APLL_STEER_SDM_MAX) {
+    multiplier = (4 << 16) + APLL_STEER_SDM_MAX;
+    v = multiplier << 16;
+  }
+
+  st->residue = (int32_t)(v - (multiplier << 16));
+
+  sdm = (uint32_t)multiplier - (4 << 16);
+  changed = (st->valid == false) || (sdm != st->sdm);
+  st->sdm = sdm;
+  st->valid = true;
+
+  return changed;
+}
+
+/**
+ *
+ */
+int32_t apll_steer_ppb(const apll_steer_t *st) {
+  int64_t multiplier = (4 << 16) + (int64_t)st->sdm;
+
+  return (int32_t)((multiplier - st->base) * 1000000000LL / st->base);
+}
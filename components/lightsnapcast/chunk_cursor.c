@@ -0,0 +1,146 @@
+#include "chunk_cursor.h"
+
+#include <string.h>
+
+/**
+ *
+ */
+void chunk_cursor_reset(chunk_cursor_t *cursor) {
+  memset(cursor, 0, sizeof(chunk_cursor_t));
+}
+
+/**
+ *
+ */
+static chunk_cursor_pending_t *chunk_cursor_at(chunk_cursor_t *cursor,
+                                               uint32_t i) {
+  return &cursor->pending[(cursor->head + i) % CHUNK_CURSOR_PENDING];
+}
+
+/**
+ *
+ */
+static void chunk_cursor_pop(chunk_cursor_t *cursor) {
+  cursor->head = (cursor->head + 1) % CHUNK_CURSOR_PENDING;
+  cursor->count--;
+}
+
+/**
+ *
+ */
+int32_t chunk_cursor_push(chunk_cursor_t *cursor, const sg_chain_t *chain,
+                          int64_t time_us) {
+  chunk_cursor_pending_t *pending;
+  int32_t ret = 0;
+
+  // the decoder never sees them, it will resync on the next frame
+  if (cursor->valid) {
+    cursor->readPos += sg_cursor_remaining(&cursor->data);
+  }
+
+  if (cursor->count >= CHUNK_CURSOR_PENDING) {
+    chunk_cursor_pop(cursor);
+
+    ret = -1;
+  }
+
+  pending = chunk_cursor_at(cursor, cursor->count);
+  pending->start = cursor->readPos;
+  pending->time_us = time_us;
+  pending->frames = 0;
+  cursor->count++;
+
+  sg_cursor_init(&cursor->data, chain);
+  cursor->valid = true;
+
+  return ret;
+}
+
+/**
+ *
+ */
+uint32_t chunk_cursor_remaining(const chunk_cursor_t *cursor) {
+  if (!cursor->valid) {
+    return 0;
+  }
+
+  return sg_cursor_remaining(&cursor->data);
+}
+
+/**
+ *
+ */
+uint32_t chunk_cursor_read(chunk_cursor_t *cursor, char *data, uint32_t len) {
+  uint32_t n;
+
+  if (!cursor->valid) {
+    return 0;
+  }
+
+  n = sg_cursor_read(&cursor->data, data, len);
+  cursor->readPos += n;
+
+  return n;
+}
+
+/**
+ *
+ */
+uint64_t chunk_cursor_tell(const chunk_cursor_t *cursor) {
+  return cursor->readPos;
+}
+
+/**
+ *
+ */
+void chunk_cursor_sync(chunk_cursor_t *cursor, uint64_t pos) {
+  cursor->frameStart = pos;
+}
+
+/**
+ *
+ */
+void chunk_cursor_skip(chunk_cursor_t *cursor) {
+  if (cursor->valid) {
+    cursor->readPos += sg_cursor_remaining(&cursor->data);
+    cursor->valid = false;
+  }
+
+  chunk_cursor_sync(cursor, cursor->readPos);
+}
+
+/**
+ *
+ */
+int32_t chunk_cursor_frame(chunk_cursor_t *cursor, uint64_t frameEnd,
+                           uint32_t frames, uint32_t sampleRate,
+                           int64_t *time_us) {
+  uint64_t frameStart = cursor->frameStart;
+  chunk_cursor_pending_t *pending;
+
+  cursor->frameStart = frameEnd;
+
+  // frames come in stream order, so older chunks are done
+  while ((cursor->count > 1) &&
+         (chunk_cursor_at(cursor, 1)->start <= frameStart)) {
+    chunk_cursor_pop(cursor);
+  }
+
+  if (cursor->count == 0) {
+    return -1;
+  }
+
+  pending = chunk_cursor_at(cursor, 0);
+  if (pending->start > frameStart) {
+    return -1;
+  }
+
+  *time_us = pending->time_us;
+  if (sampleRate > 0) {
+    *time_us += 1000000LL * pending->frames / sampleRate;
+  }
+
+  pending->frames += frames;
+
+  return 0;
+}
@@ -0,0 +1,239 @@
+/**
+ * Ring of variable sized records [header][payload], payload padded to
+ * CHUNK_STORE_ALIGN. If a record doesn't fit at the end of the ring the rest
+ * is marked as padding and the record is placed at the start.
+ */
+
+#include "chunk_store.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNK_STORE_ALIGN 4
+#define CHUNK_STORE_PADDING UINT32_MAX
+
+typedef struct chunk_store_hdr_s {
+  tv_t timestamp;
+  uint32_t size;
+} chunk_store_hdr_t;
+
+/**
+ *
+ */
+static uint32_t chunk_store_record_size(uint32_t size) {
+  return sizeof(chunk_store_hdr_t) +
+         ((size + CHUNK_STORE_ALIGN - 1) & ~(CHUNK_STORE_ALIGN - 1));
+}
+
+/**
+ *
+ */
+int32_t chunk_store_init(chunk_store_t *store, uint32_t size) {
+  memset(store, 0, sizeof(chunk_store_t));
+
+  size &= ~(CHUNK_STORE_ALIGN - 1);
+
+  store->buffer = (char *)malloc(size);
+  if (store->buffer == NULL) {
+    return -1;
+  }
+
+  store->size = size;
+
+  return 0;
+}
+
+/**
+ *
+ */
+void chunk_store_deinit(chunk_store_t *store) {
+  if (store->buffer) {
+    free(store->buffer);
+  }
+
+  memset(store, 0, sizeof(chunk_store_t));
+}
+
+/**
+ *
+ */
+void chunk_store_reset(chunk_store_t *store) {
+  store->head = 0;
+  store->tail = 0;
+  store->used = 0;
+  store->count = 0;
+  store->reservedSize = 0;
+  store->highWater = 0;
+}
+
+/**
+ *
+ */
+char *chunk_store_reserve(chunk_store_t *store, const tv_t *timestamp,
+                          uint32_t size) {
+  uint32_t need = chunk_store_record_size(size);
+  uint32_t pos;
+
+  store->reservedSize = 0;
+
+  if ((store->buffer == NULL) || (need > store->size)) {
+    return NULL;
+  }
+
+  if (store->count == 0) {
+    store->head = 0;
+    store->tail = 0;
+    store->used = 0;
+  }
+
+  if ((store->count > 0) && (store->head <= store->tail)) {
+    // free space is between head and tail
+    if (store->tail - store->head < need) {
+      return NULL;
+    }
+
+    pos = store->head;
+  } else if (store->size - store->head >= need) {
+    pos = store->head;
+  } else if ((store->count == 0) || (store->tail >= need)) {
+    // wrap, rest of the ring is padding
+    pos = 0;
+  } else {
+    return NULL;
+  }
+
+  store->reservedPos = pos;
+  store->reservedSize = size;
+  store->reservedTimestamp = *timestamp;
+
+  return &store->buffer[pos + sizeof(chunk_store_hdr_t)];
+}
+
+/**
+ *
+ */
+void chunk_store_commit(chunk_store_t *store) {
+  chunk_store_hdr_t hdr;
+  uint32_t need;
+
+  if (store->reservedSize == 0) {
+    return;
+  }
+
+  need = chunk_store_record_size(store->reservedSize);
+
+  if (store->reservedPos != store->head) {
+    // wrapped, mark the rest of the ring as padding if a header fits
+    if (store->size - store->head >= sizeof(chunk_store_hdr_t)) {
+      hdr.size = CHUNK_STORE_PADDING;
+      memcpy(&store->buffer[store->head], &hdr, sizeof(hdr));
+    }
+
+    store->used += store->size - store->head;
+  }
+
+  hdr.timestamp = store->reservedTimestamp;
+  hdr.size = store->reservedSize;
+  memcpy(&store->buffer[store->reservedPos], &hdr, sizeof(hdr));
+
+  store->head = store->reservedPos + need;
+  store->used += need;
+  store->count++;
+  store->newest = store->reservedTimestamp;
+  store->reservedSize = 0;
+
+  if (store->used > store->highWater) {
+    store->highWater = store->used;
+  }
+}
+
+/**
+ * find the oldest record, skipping padding at the end of the ring
+ */
+static uint32_t chunk_store_oldest(chunk_store_t *store,
+                                   chunk_store_hdr_t *hdr) {
+  uint32_t pos = store->tail;
+
+  if (store->size - pos >= sizeof(chunk_store_hdr_t)) {
+    memcpy(hdr, &store->buffer[pos], sizeof(chunk_store_hdr_t));
+    if (hdr->size != CHUNK_STORE_PADDING) {
+      return pos;
+    }
+  }
+
+  memcpy(hdr, &store->buffer[0], sizeof(chunk_store_hdr_t));
+
+  return 0;
+}
+
+/**
+ *
+ */
+const char *chunk_store_peek(chunk_store_t *store, tv_t *timestamp,
+                             uint32_t *size) {
+  chunk_store_hdr_t hdr;
+  uint32_t pos;
+
+  if (store->count == 0) {
+    return NULL;
+  }
+
+  pos = chunk_store_oldest(store, &hdr);
+
+  if (timestamp) {
+    *timestamp = hdr.timestamp;
+  }
+  *size = hdr.size;
+
+  return &store->buffer[pos + sizeof(chunk_store_hdr_t)];
+}
+
+/**
+ *
+ */
+void chunk_store_pop(chunk_store_t *store) {
+  chunk_store_hdr_t hdr;
+  uint32_t pos;
+  uint32_t need;
+
+  if (store->count == 0) {
+    return;
+  }
+
+  pos = chunk_store_oldest(store, &hdr);
+  if (pos != store->tail) {
+    store->used -= store->size - store->tail;
+  }
+
+  need = chunk_store_record_size(hdr.size);
+
+  store->tail = pos + need;
+  store->used -= need;
+  store->count--;
+
+  if (store->count == 0) {
+    store->head = 0;
+    store->tail = 0;
+    store->used = 0;
+  }
+}
+
+/**
+ *
+ */
+uint32_t chunk_store_count(const chunk_store_t *store) { return store->count; }
+
+/**
+ *
+ */
+int64_t chunk_store_span_us(chunk_store_t *store) {
+  tv_t oldest;
+  uint32_t size;
+
+  if (chunk_store_peek(store, &oldest, &size) == NULL) {
+    return 0;
+  }
+
+  return ((int64_t)store->newest.sec - (int64_t)oldest.sec) * 1000000LL +
+         ((int64_t)store->newest.usec - (int64_t)oldest.usec);
+}
@@ -0,0 +1,73 @@
+#ifndef __APLL_STEER_H__
+#define __APLL_STEER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// sdm2 has 6 bits, sdm1 and sdm0 8 bits each
+#define APLL_STEER_SDM_MAX ((63 << 16) | 0xFFFF)
+
+/**
+ * Fine tuning of the APLL frequency by an offset in ppb. With o_div fixed
+ *
+ *   apll_freq = xtal_freq * (4 + sdm2 + sdm1/256 + sdm0/65536) /
+ *               ((o_div + 2) * 2)
+ *
+ * is proportional to the 16.16 fixed point multiplier 4 + sdm, so the
+ * coefficients for any offset follow from the nominal ones with a multiply,
+ * rtc_clk_apll_coeff_calc() is only needed once per sample rate. A step of
+ * sdm0 is 1.2 to 1.8 ppm with a 40 MHz crystal. The rounding error is
+ * carried over to the next update, so on average the frequency is exact to
+ * much less than that.
+ */
+typedef struct apll_steer_s {
+  uint32_t base;    // nominal multiplier 4 + sdm, 16.16 fixed point
+  uint32_t sdm;     // sdm2 << 16 | sdm1 << 8 | sdm0 last set
+  int32_t residue;  // rounding error of sdm, 16.32 fixed point
+  bool valid;       // sdm has been set since init
+} apll_steer_t;
+
+/**
+ * @param[in] st The steering state.
+ * @param[in] sdm0 Nominal coefficients from rtc_clk_apll_coeff_calc().
+ * @param[in] sdm1
+ * @param[in] sdm2
+ */
+void apll_steer_init(apll_steer_t *st, uint32_t sdm0, uint32_t sdm1,
+                     uint32_t sdm2);
+
+/**
+ * @param[in] st The steering state.
+ * @param[in] ppb Frequency offset, positive plays faster.
+ * @return true if the coefficients changed and have to be set, always on
+ * the first call after apll_steer_init().
+ */
+bool apll_steer_update(apll_steer_t *st, int32_t ppb);
+
+/**
+ * @param[in] st The steering state.
+ * @return Offset of the coefficients set from the nominal ones, in ppb.
+ */
+int32_t apll_steer_ppb(const apll_steer_t *st);
+
+static inline uint32_t apll_steer_sdm0(const apll_steer_t *st) {
+  return st->sdm & 0xFF;
+}
+
+static inline uint32_t apll_steer_sdm1(const apll_steer_t *st) {
+  return (st->sdm >> 8) & 0xFF;
+}
+
+static inline uint32_t apll_steer_sdm2(const apll_steer_t *st) {
+  return st->sdm >> 16;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __APLL_STEER_H__
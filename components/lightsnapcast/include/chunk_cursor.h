@@ -0,0 +1,123 @@
+#ifndef __CHUNK_CURSOR_H__
+#define __CHUNK_CURSOR_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sg_buffer.h"
+
+// wire chunks whose frames may still be buffered in the decoder
+#define CHUNK_CURSOR_PENDING 8
+
+typedef struct chunk_cursor_pending_s {
+  uint64_t start;  // stream position of the chunk's first byte
+  int64_t time_us;
+  uint32_t frames;  // decoded so far
+} chunk_cursor_pending_t;
+
+/**
+ * Input of a pulling decoder like libFLAC. Wire chunks are pushed as they
+ * arrive and read from in place, their bytes only ever get copied into the
+ * decoder's own buffer. The decoder may read ahead across chunk boundaries;
+ * every chunk keeps its time stamp until the last frame starting in it has
+ * been decoded, so a frame is stamped by the position of its first byte
+ * instead of by the chunk being read when it comes out.
+ */
+typedef struct chunk_cursor_s {
+  sg_cursor_t data;  // unread part of the current chunk
+  bool valid;        // data refers to a chunk
+  uint64_t readPos;  // bytes handed to the decoder
+  uint64_t frameStart;
+
+  chunk_cursor_pending_t pending[CHUNK_CURSOR_PENDING];
+  uint32_t head;  // oldest pending chunk
+  uint32_t count;
+} chunk_cursor_t;
+
+/**
+ * Forget all chunks and start the stream at position 0.
+ *
+ * @param[in] cursor The cursor.
+ */
+void chunk_cursor_reset(chunk_cursor_t *cursor);
+
+/**
+ * Make chain the current chunk. Unread bytes of the previous chunk are
+ * skipped. If CHUNK_CURSOR_PENDING chunks are pending already the oldest one
+ * is dropped.
+ *
+ * @param[in] cursor The cursor.
+ * @param[in] chain The chunk, must stay valid until it was read or the next
+ * chunk is pushed.
+ * @param[in] time_us Time stamp of the first frame starting in the chunk.
+ * @return 0 on success, -1 if a pending chunk was dropped.
+ */
+int32_t chunk_cursor_push(chunk_cursor_t *cursor, const sg_chain_t *chain,
+                          int64_t time_us);
+
+/**
+ * @param[in] cursor The cursor.
+ * @return Unread bytes of the current chunk.
+ */
+uint32_t chunk_cursor_remaining(const chunk_cursor_t *cursor);
+
+/**
+ * Copy from the current chunk.
+ *
+ * @param[in] cursor The cursor.
+ * @param[out] data Destination.
+ * @param[in] len Count of bytes wanted.
+ * @return Count of bytes copied, less than len at the end of the chunk.
+ */
+uint32_t chunk_cursor_read(chunk_cursor_t *cursor, char *data, uint32_t len);
+
+/**
+ * @param[in] cursor The cursor.
+ * @return Stream position of the next byte read, for the decoder's tell
+ * callback.
+ */
+uint64_t chunk_cursor_tell(const chunk_cursor_t *cursor);
+
+/**
+ * Set the stream position of the next frame's first byte, e.g. to the end of
+ * the codec header.
+ *
+ * @param[in] cursor The cursor.
+ * @param[in] pos Stream position.
+ */
+void chunk_cursor_sync(chunk_cursor_t *cursor, uint64_t pos);
+
+/**
+ * Drop the unread bytes of the current chunk, e.g. after a decoder error.
+ * The next frame starts in the next chunk pushed.
+ *
+ * @param[in] cursor The cursor.
+ */
+void chunk_cursor_skip(chunk_cursor_t *cursor);
+
+/**
+ * Stamp a decoded frame. It starts where the previous one ended and is
+ * placed after the frames decoded before from the same chunk. Chunks nothing
+ * can start in any more are released.
+ *
+ * @param[in] cursor The cursor.
+ * @param[in] frameEnd Stream position after the frame, as reported by the
+ * decoder.
+ * @param[in] frames Count of audio frames in the frame.
+ * @param[in] sampleRate Sample rate.
+ * @param[out] time_us Time stamp of the frame.
+ * @return 0 on success, -1 if the frame didn't start in a pending chunk.
+ */
+int32_t chunk_cursor_frame(chunk_cursor_t *cursor, uint64_t frameEnd,
+                           uint32_t frames, uint32_t sampleRate,
+                           int64_t *time_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __CHUNK_CURSOR_H__
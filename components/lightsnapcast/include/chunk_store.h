@@ -0,0 +1,114 @@
+#ifndef __CHUNK_STORE_H__
+#define __CHUNK_STORE_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "snapcast.h"
+
+/**
+ * FIFO of timestamped, still compressed wire chunks in one preallocated
+ * ring. Every chunk is stored contiguously, so it can be passed to a decoder
+ * in place. Not thread safe, meant to be filled and drained by the same task.
+ */
+typedef struct chunk_store_s {
+  char *buffer;
+  uint32_t size;
+
+  uint32_t head;  // write position
+  uint32_t tail;  // read position
+  uint32_t used;  // bytes in use including headers and wrap padding
+  uint32_t count;
+
+  // pending reservation
+  uint32_t reservedPos;
+  uint32_t reservedSize;
+  tv_t reservedTimestamp;
+
+  tv_t newest;
+
+  uint32_t highWater;  // max. used bytes since chunk_store_reset()
+} chunk_store_t;
+
+/**
+ * Allocate the ring.
+ *
+ * @param[in] store The store to initialize.
+ * @param[in] size Size of the ring in bytes.
+ * @return 0 on success, -1 if memory couldn't be allocated.
+ */
+int32_t chunk_store_init(chunk_store_t *store, uint32_t size);
+
+/**
+ * Free the ring.
+ *
+ * @param[in] store The store to deinitialize.
+ */
+void chunk_store_deinit(chunk_store_t *store);
+
+/**
+ * Drop all stored chunks.
+ *
+ * @param[in] store The store to reset.
+ */
+void chunk_store_reset(chunk_store_t *store);
+
+/**
+ * Reserve contiguous memory for a chunk of size bytes. The chunk becomes
+ * visible to chunk_store_peek() once chunk_store_commit() is called, a new
+ * reservation replaces a pending one.
+ *
+ * @param[in] store The store.
+ * @param[in] timestamp Server time stamp of the chunk.
+ * @param[in] size The size of the compressed chunk.
+ * @return Pointer to fill in the chunk or NULL if the store is full.
+ */
+char *chunk_store_reserve(chunk_store_t *store, const tv_t *timestamp,
+                          uint32_t size);
+
+/**
+ * Append the reserved chunk to the FIFO.
+ *
+ * @param[in] store The store.
+ */
+void chunk_store_commit(chunk_store_t *store);
+
+/**
+ * Get the oldest chunk without removing it.
+ *
+ * @param[in] store The store.
+ * @param[out] timestamp Server time stamp of the chunk, may be NULL.
+ * @param[out] size Size of the chunk.
+ * @return Pointer to the chunk or NULL if the store is empty.
+ */
+const char *chunk_store_peek(chunk_store_t *store, tv_t *timestamp,
+                             uint32_t *size);
+
+/**
+ * Remove the oldest chunk.
+ *
+ * @param[in] store The store.
+ */
+void chunk_store_pop(chunk_store_t *store);
+
+/**
+ * @param[in] store The store.
+ * @return The count of stored chunks.
+ */
+uint32_t chunk_store_count(const chunk_store_t *store);
+
+/**
+ * @param[in] store The store.
+ * @return Time between the oldest and the newest stored chunk in µs.
+ */
+int64_t chunk_store_span_us(chunk_store_t *store);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __CHUNK_STORE_H__
@@ -0,0 +1,64 @@
+#ifndef __LATENCY_HIST_H__
+#define __LATENCY_HIST_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// bucket 0 counts everything below 1 << LATENCY_HIST_MIN_SHIFT µs, every
+// further bucket doubles the range, the last one is open ended
+#define LATENCY_HIST_BUCKETS 16
+#define LATENCY_HIST_MIN_SHIFT 7
+
+/**
+ * Log2 histogram of latencies in µs. Cheap enough to be fed for every chunk
+ * and small enough to keep one per processing stage.
+ */
+typedef struct latency_hist_s {
+  uint32_t bucket[LATENCY_HIST_BUCKETS];
+  uint32_t count;
+  int64_t sum_us;
+  int64_t max_us;
+} latency_hist_t;
+
+/**
+ * Clear all buckets.
+ *
+ * @param[in] hist The histogram.
+ */
+void latency_hist_reset(latency_hist_t *hist);
+
+/**
+ * Count a latency, negative values are counted as 0.
+ *
+ * @param[in] hist The histogram.
+ * @param[in] us The latency.
+ */
+void latency_hist_add(latency_hist_t *hist, int64_t us);
+
+/**
+ * @param[in] hist The histogram.
+ * @param[in] percent Percentile, 0 to 100.
+ * @return Upper bound of the bucket holding the percentile, max_us for the
+ * last bucket and 0 if the histogram is empty.
+ */
+int64_t latency_hist_percentile(const latency_hist_t *hist, uint32_t percent);
+
+/**
+ * Print the non empty buckets as "<upper bound>:<count>" pairs.
+ *
+ * @param[in] hist The histogram.
+ * @param[out] str The string, always terminated.
+ * @param[in] size Size of str.
+ * @return Length of the string.
+ */
+uint32_t latency_hist_format(const latency_hist_t *hist, char *str,
+                             uint32_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __LATENCY_HIST_H__
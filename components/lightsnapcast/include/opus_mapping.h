@@ -0,0 +1,54 @@
+#ifndef __OPUS_MAPPING_H__
+#define __OPUS_MAPPING_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// channel mapping family 1 goes up to 7.1
+#define OPUS_MAPPING_MAX_CHANNELS 8
+
+/**
+ * How the channels of an Opus stream are coded, the arguments of
+ * opus_multistream_decoder_init(). See RFC 7845, section 5.1.1.
+ */
+typedef struct opus_mapping_s {
+  uint8_t channels;  // decoded channels
+  uint8_t streams;   // Opus streams in a packet
+  uint8_t coupled;   // streams with two channels, they come first
+  // decoded channel to channel of the streams, 255 is silence
+  uint8_t mapping[OPUS_MAPPING_MAX_CHANNELS];
+} opus_mapping_t;
+
+/**
+ * Mapping of a stream without mapping table, like snapserver's Opus codec
+ * header. Mono and stereo are a single stream, more channels are taken to be
+ * in Vorbis order, coded like libopus' surround encoder does for mapping
+ * family 1.
+ *
+ * @param[out] mapping The mapping.
+ * @param[in] channels Channels of the stream.
+ * @return 0 on success, -1 if channels isn't 1 to
+ * OPUS_MAPPING_MAX_CHANNELS.
+ */
+int32_t opus_mapping_default(opus_mapping_t *mapping, uint32_t channels);
+
+/**
+ * Mapping of an Ogg/Opus stream from its identification header.
+ *
+ * @param[out] mapping The mapping.
+ * @param[in] head OpusHead packet.
+ * @param[in] len Length of head.
+ * @return 0 on success, -1 if head is no valid OpusHead or has more than
+ * OPUS_MAPPING_MAX_CHANNELS channels.
+ */
+int32_t opus_mapping_parse_head(opus_mapping_t *mapping, const uint8_t *head,
+                                uint32_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __OPUS_MAPPING_H__
@@ -0,0 +1,216 @@
+#ifndef __PCM_PACK_H__
+#define __PCM_PACK_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "player.h"
+
+/**
+ * Player sample width for a decoded one. 16 bit samples share a 32 bit word,
+ * 24 and 32 bit ones get a word of their own, MSB aligned, so I2S runs with
+ * 32 bit slots and nothing is truncated.
+ *
+ * @param[in] bits Bits per sample of the stream.
+ * @return 16 or 32, 0 if bits isn't supported.
+ */
+uint8_t pcm_pack_container_bits(uint32_t bits);
+
+/**
+ * Planar to interleaved stereo kernel, see pcm_pack_s16_stereo().
+ */
+typedef void (*pcm_pack_fn_t)(uint32_t *dst, const int32_t *left,
+                              const int32_t *right, uint32_t frames);
+
+/**
+ * Interleave 16 bit stereo from planar decoder output, e.g. FLAC__int32
+ * channel buffers. Every frame is a single 32 bit store of left in the lower
+ * and right in the upper half word, so dst may be IRAM.
+ *
+ * @param[out] dst Destination, 32 bit aligned.
+ * @param[in] left Left channel samples.
+ * @param[in] right Right channel samples.
+ * @param[in] frames Count of frames.
+ */
+void pcm_pack_s16_stereo(uint32_t *dst, const int32_t *left,
+                         const int32_t *right, uint32_t frames);
+
+/**
+ * Interleave 24 bit stereo, a 32 bit word per sample with the sample in the
+ * upper 24 bits, left first.
+ */
+void pcm_pack_s24_stereo(uint32_t *dst, const int32_t *left,
+                         const int32_t *right, uint32_t frames);
+
+/**
+ * Interleave 32 bit stereo, a 32 bit word per sample, left first.
+ */
+void pcm_pack_s32_stereo(uint32_t *dst, const int32_t *left,
+                         const int32_t *right, uint32_t frames);
+
+/**
+ * Kernel for a sample width, picked once per stream or chunk so the per frame
+ * loop has no branches.
+ *
+ * @param[in] bits Bits per sample of the stream.
+ * @return The kernel, NULL if bits isn't supported.
+ */
+pcm_pack_fn_t pcm_pack_stereo_kernel(uint32_t bits);
+
+/**
+ * Pack planar stereo of any supported width into the payload of a player
+ * chunk, which may be split into fragments. The chunk holds
+ * pcm_pack_container_bits() wide samples.
+ *
+ * @param[in] chunk The chunk.
+ * @param[in] offset Frame of the chunk to start at.
+ * @param[in] left Left channel samples.
+ * @param[in] right Right channel samples.
+ * @param[in] frames Count of frames.
+ * @param[in] bits Bits per sample of left and right.
+ * @return Count of frames written, less than frames if the chunk is full or
+ * bits isn't supported.
+ */
+uint32_t pcm_pack_chunk_stereo(pcm_chunk_message_t *chunk, uint32_t offset,
+                               const int32_t *left, const int32_t *right,
+                               uint32_t frames, uint32_t bits);
+
+/**
+ * Like pcm_pack_s16_stereo() but into the payload of a player chunk, which
+ * may be split into fragments.
+ *
+ * @param[in] chunk The chunk.
+ * @param[in] offset Frame of the chunk to start at.
+ * @param[in] left Left channel samples.
+ * @param[in] right Right channel samples.
+ * @param[in] frames Count of frames.
+ * @return Count of frames written, less than frames if the chunk is full.
+ */
+uint32_t pcm_pack_chunk_s16_stereo(pcm_chunk_message_t *chunk,
+                                   uint32_t offset, const int32_t *left,
+                                   const int32_t *right, uint32_t frames);
+
+/**
+ * Pack planar fixed point stereo into a player chunk as 16 bit, in the
+ * layout of pcm_pack_s16_stereo(). For decoders working with more precision
+ * than played, e.g. Tremor's Vorbis output with 24 fraction bits. Samples
+ * are truncated and saturated.
+ *
+ * @param[in] chunk The chunk.
+ * @param[in] offset Frame of the chunk to start at.
+ * @param[in] left Left channel samples.
+ * @param[in] right Right channel samples.
+ * @param[in] frames Count of frames.
+ * @param[in] fracBits Fraction bits of the samples, 1.0 is 1 << fracBits,
+ * 15 to 31.
+ * @return Count of frames written, less than frames if the chunk is full or
+ * fracBits isn't supported.
+ */
+uint32_t pcm_pack_chunk_fixed_s16_stereo(pcm_chunk_message_t *chunk,
+                                         uint32_t offset, const int32_t *left,
+                                         const int32_t *right, uint32_t frames,
+                                         uint32_t fracBits);
+
+/**
+ * Pack interleaved 16 bit stereo like Opus decodes it into a player chunk,
+ * first sample of a frame in the upper half word like the PCM codec does it.
+ * Stores are 32 bit wide.
+ *
+ * @param[in] chunk The chunk.
+ * @param[in] offset Frame of the chunk to start at.
+ * @param[in] samples Interleaved samples, two per frame.
+ * @param[in] frames Count of frames.
+ * @return Count of frames written, less than frames if the chunk is full.
+ */
+uint32_t pcm_pack_chunk_s16_interleaved(pcm_chunk_message_t *chunk,
+                                        uint32_t offset,
+                                        const int16_t *samples,
+                                        uint32_t frames);
+
+/**
+ * Like pcm_pack_chunk_s16_interleaved() for decoder output with any count of
+ * channels, two of which are played. Multichannel streams are routed to the
+ * stereo output this way, mono is played on both sides with left and right
+ * 0.
+ *
+ * @param[in] chunk The chunk.
+ * @param[in] offset Frame of the chunk to start at.
+ * @param[in] samples Interleaved samples, channels per frame.
+ * @param[in] channels Channels of samples.
+ * @param[in] left Channel played left.
+ * @param[in] right Channel played right.
+ * @param[in] frames Count of frames.
+ * @return Count of frames written, less than frames if the chunk is full or
+ * left or right isn't a channel of samples.
+ */
+uint32_t pcm_pack_chunk_s16_routed(pcm_chunk_message_t *chunk, uint32_t offset,
+                                   const int16_t *samples, uint32_t channels,
+                                   uint32_t left, uint32_t right,
+                                   uint32_t frames);
+
+/**
+ * State of pcm_unpack_s16_wire() between spans of a wire chunk, which may
+ * split a frame.
+ */
+typedef struct pcm_unpack_s {
+  uint32_t word;    // wire word gathered so far, little endian
+  int32_t shift;    // 3 minus the bytes of word gathered
+  uint32_t offset;  // bytes written to the chunk
+} pcm_unpack_t;
+
+/**
+ * Start unpacking a new wire chunk.
+ *
+ * @param[in] unpack The state.
+ */
+void pcm_unpack_reset(pcm_unpack_t *unpack);
+
+/**
+ * Unpack a span of a 16 bit stereo PCM wire chunk into the first fragment of
+ * a player chunk, with 32 bit stores in the PCM word layout, see
+ * pcm_pack_chunk_s16_interleaved(). Spans may split frames anywhere, whole
+ * frames are converted a word at a time.
+ *
+ * @param[in] unpack The state.
+ * @param[in] chunk The chunk, may be NULL to drop the data.
+ * @param[in] data Wire chunk payload.
+ * @param[in] len Length of data.
+ */
+void pcm_unpack_s16_wire(pcm_unpack_t *unpack, pcm_chunk_message_t *chunk,
+                         const char *data, uint32_t len);
+
+/**
+ * Like pcm_unpack_s16_wire() for 24 bit stereo, which snapserver sends in
+ * 4 byte little endian samples. Samples are stored like
+ * pcm_pack_s24_stereo() does.
+ */
+void pcm_unpack_s24_wire(pcm_unpack_t *unpack, pcm_chunk_message_t *chunk,
+                         const char *data, uint32_t len);
+
+/**
+ * Like pcm_unpack_s16_wire() for 32 bit stereo.
+ */
+void pcm_unpack_s32_wire(pcm_unpack_t *unpack, pcm_chunk_message_t *chunk,
+                         const char *data, uint32_t len);
+
+/**
+ * Unpack with the kernel for bits.
+ *
+ * @param[in] unpack The state.
+ * @param[in] chunk The chunk, may be NULL to drop the data.
+ * @param[in] data Wire chunk payload.
+ * @param[in] len Length of data.
+ * @param[in] bits Bits per sample of the stream, 16, 24 or 32.
+ * @return 0 on success, -1 if bits isn't supported.
+ */
+int32_t pcm_unpack_wire(pcm_unpack_t *unpack, pcm_chunk_message_t *chunk,
+                        const char *data, uint32_t len, uint32_t bits);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __PCM_PACK_H__
@@ -0,0 +1,71 @@
+#ifndef __PCM_POOL_H__
+#define __PCM_POOL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "player.h"
+
+// max. count of memory blocks a pool is split into if the heap is fragmented
+#define PCM_POOL_MAX_BLOCKS 8
+
+typedef struct pcm_pool_stats_s {
+  uint32_t hits;       // chunks served from the pool
+  uint32_t misses;     // chunks the caller had to allocate from heap
+  uint32_t inUse;      // pool slots currently handed out
+  uint32_t highWater;  // max. inUse since the pool was set up
+  uint32_t slots;      // slots of the current pool
+  size_t payloadSize;  // payload bytes per slot
+} pcm_pool_stats_t;
+
+/**
+ * (Re)create the pool if it can't serve slots chunks of payloadSize bytes
+ * each. Memory is allocated here only, pcm_pool_alloc() and pcm_pool_free()
+ * never touch the heap. Chunks still handed out from a previous pool are
+ * returned to it, it is freed once all of them came back.
+ *
+ * @param[in] slots Count of chunks the pool should hold.
+ * @param[in] payloadSize Max. payload size of a chunk.
+ * @return 0 on success, < 0 if no pool could be created.
+ */
+int32_t pcm_pool_setup(uint32_t slots, size_t payloadSize);
+
+/**
+ * Free all pools. Call once no chunk is in use anymore, e.g. after the pcm
+ * chunk queue was destroyed.
+ */
+void pcm_pool_deinit(void);
+
+/**
+ * Get a chunk with a single fragment of bytes payload.
+ *
+ * @param[in] bytes Payload size.
+ * @return The chunk or NULL if the pool is empty or bytes is too big, which
+ * is counted as miss.
+ */
+pcm_chunk_message_t *pcm_pool_alloc(size_t bytes);
+
+/**
+ * Return a chunk to its pool.
+ *
+ * @param[in] pcmChunk The chunk.
+ * @return true if the chunk belongs to a pool, false if it has to be freed
+ * by the caller.
+ */
+bool pcm_pool_free(pcm_chunk_message_t *pcmChunk);
+
+/**
+ * @param[out] stats Current counters.
+ */
+void pcm_pool_get_stats(pcm_pool_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __PCM_POOL_H__
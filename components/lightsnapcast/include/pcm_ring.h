@@ -0,0 +1,137 @@
+#ifndef __PCM_RING_H__
+#define __PCM_RING_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// max. count of timestamp discontinuities buffered at once
+#define PCM_RING_MAX_ANCHORS 8
+
+typedef struct pcm_ring_anchor_s {
+  uint32_t frame;   // frame counter the time stamp belongs to
+  int64_t time_us;  // server time of that frame
+} pcm_ring_anchor_t;
+
+/**
+ * Contiguous ring of PCM frames indexed by server time. Filled by one task
+ * and drained by another one without locking: the producer only moves
+ * writeFrame and anchorHead, the consumer only readFrame and anchorTail.
+ * Both cursors are free running frame counters.
+ *
+ * Time of a frame is derived from the newest anchor at or before it, so a
+ * new anchor is only stored if a chunk doesn't continue the previous one.
+ */
+typedef struct pcm_ring_s {
+  char *buffer;
+  uint32_t frames;     // capacity
+  uint32_t frameSize;  // bytes per frame
+  uint32_t sr;
+  uint32_t caps;
+
+  uint32_t writeFrame;
+  uint32_t readFrame;
+
+  pcm_ring_anchor_t anchor[PCM_RING_MAX_ANCHORS];
+  uint32_t anchorHead;
+  uint32_t anchorTail;
+} pcm_ring_t;
+
+/**
+ * Allocate the ring.
+ *
+ * @param[in] ring The ring to initialize.
+ * @param[in] frames Capacity in frames.
+ * @param[in] frameSize Bytes per frame, must be a multiple of 4.
+ * @param[in] sr Sample rate.
+ * @return 0 on success, -1 on parameter error, -2 if memory couldn't be
+ * allocated.
+ */
+int32_t pcm_ring_init(pcm_ring_t *ring, uint32_t frames, uint32_t frameSize,
+                      uint32_t sr);
+
+/**
+ * Free the ring. Neither producer nor consumer may use it anymore.
+ *
+ * @param[in] ring The ring to deinitialize.
+ */
+void pcm_ring_deinit(pcm_ring_t *ring);
+
+/**
+ * Producer: append a chunk of PCM. A chunk which doesn't fit completely is
+ * rejected.
+ *
+ * @param[in] ring The ring.
+ * @param[in] time_us Server time of the first frame.
+ * @param[in] data PCM data, NULL to append silence.
+ * @param[in] bytes Size of data, a multiple of the frame size.
+ * @return 0 on success, -1 if there is not enough space.
+ */
+int32_t pcm_ring_write(pcm_ring_t *ring, int64_t time_us, const char *data,
+                       uint32_t bytes);
+
+/**
+ * @param[in] ring The ring.
+ * @return Frames which can be written.
+ */
+uint32_t pcm_ring_free_frames(pcm_ring_t *ring);
+
+/**
+ * Consumer: frames ready to be read.
+ *
+ * @param[in] ring The ring.
+ * @return Count of frames.
+ */
+uint32_t pcm_ring_available(pcm_ring_t *ring);
+
+/**
+ * Consumer: get the longest contiguous span of readable frames.
+ *
+ * @param[in] ring The ring.
+ * @param[out] data Start of the span.
+ * @return Frames in the span, 0 if the ring is empty.
+ */
+uint32_t pcm_ring_read_span(pcm_ring_t *ring, const char **data);
+
+/**
+ * Consumer: release frames returned by pcm_ring_read_span().
+ *
+ * @param[in] ring The ring.
+ * @param[in] frames Count of frames, limited to the available ones.
+ */
+void pcm_ring_consume(pcm_ring_t *ring, uint32_t frames);
+
+/**
+ * Consumer: server time of the next frame to read.
+ *
+ * @param[in] ring The ring.
+ * @param[out] time_us The time.
+ * @return true if a frame is available.
+ */
+bool pcm_ring_read_time(pcm_ring_t *ring, int64_t *time_us);
+
+/**
+ * Consumer: drop all frames played before time_us, so the next frame read
+ * is the first one at or after time_us.
+ *
+ * @param[in] ring The ring.
+ * @param[in] time_us Server time to seek to.
+ * @return Count of dropped frames.
+ */
+uint32_t pcm_ring_seek(pcm_ring_t *ring, int64_t time_us);
+
+/**
+ * Consumer: drop all available frames.
+ *
+ * @param[in] ring The ring.
+ */
+void pcm_ring_flush(pcm_ring_t *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __PCM_RING_H__
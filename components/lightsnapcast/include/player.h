@@ -17,19 +17,6 @@ extern "C" {
 // size?!
 #define CHNK_CTRL_CNT 2
 
-#define LATENCY_MEDIAN_FILTER_LEN 199
-#define LATENCY_MEDIAN_FILTER_FULL 19
-
-// set to 0 if you do not wish to be the median an average around actual
-// median average will be (LATENCY_MEDIAN_FILTER_LEN /
-// LATENCY_MEDIAN_AVG_DIVISOR) + 1 samples around median. e.g. if n=4 then
-// 2 samples above and below will be added plus the actual median. So in
-// reality n+1 samples will be averaged
-#define LATENCY_MEDIAN_AVG_DIVISOR 0
-
-#define SHORT_BUFFER_LEN 99
-#define MINI_BUFFER_LEN 19
-
 typedef struct pcm_chunk_fragment pcm_chunk_fragment_t;
 struct pcm_chunk_fragment {
   size_t size;
@@ -63,6 +50,15 @@ typedef struct snapcastSetting_s {
   uint32_t pcmBufSize;
 } snapcastSetting_t;
 
+// what sync control did since start, see sync_control.h
+typedef struct player_sync_stats_s {
+  uint32_t softResyncs;  // jumps without a gap
+  uint32_t hardResyncs;  // mutes and initial syncs
+  uint32_t starved;      // hard resyncs because no audio was left
+  uint32_t skippedFrames;
+  uint32_t insertedFrames;
+} player_sync_stats_t;
+
 int init_player(i2s_std_gpio_config_t pin_config0_, i2s_port_t i2sNum_);
 int deinit_player(void);
 
@@ -72,7 +68,9 @@ int32_t insert_pcm_chunk(pcm_chunk_message_t *pcmChunk);
 // int8_t insert_pcm_chunk (wire_chunk_message_t *decodedWireChunk);
 int8_t free_pcm_chunk(pcm_chunk_message_t *pcmChunk);
 
-int32_t player_latency_insert(int64_t newValue);
+int32_t player_latency_insert(int64_t localTime_us, int64_t diff_us,
+                              int64_t rtt_us);
+int32_t player_clock_skew_error(int32_t *skewErr_ppb);
 int32_t player_send_snapcast_setting(snapcastSetting_t *setting);
 int8_t player_get_snapcast_settings(snapcastSetting_t *setting);
 
@@ -82,6 +80,11 @@ int32_t get_diff_to_server(int64_t *tDiff);
 int32_t server_now(int64_t *sNow, int64_t *diff2Server);
 
 int32_t pcm_chunk_queue_msg_waiting(void);
+uint32_t player_get_dma_buffer_frames(void);
+
+bool player_skip_late_chunk(tv_t timestamp, uint32_t frames);
+uint32_t player_get_skipped_chunks(void);
+void player_get_sync_stats(player_sync_stats_t *stats);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,102 @@
+#ifndef __RESAMPLER_H__
+#define __RESAMPLER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// filter length in frames, a power of 2
+#define RESAMPLER_TAPS 16
+// table phases per frame are 2^RESAMPLER_PHASE_BITS
+#define RESAMPLER_PHASE_BITS 7
+// output lags the newest consumed input frame by this, plus the phase
+#define RESAMPLER_DELAY_FRAMES (RESAMPLER_TAPS / 2)
+// ratio limit, far beyond any crystal tolerance
+#define RESAMPLER_MAX_PPB 10000000
+
+/**
+ * Asynchronous resampler for player chunk words, stereo with 16 bit samples
+ * sharing a 32 bit word or 32 bit words per sample, see
+ * pcm_pack_container_bits(). Every output frame is filtered from the
+ * RESAMPLER_TAPS input frames around its position by a Kaiser windowed sinc.
+ * The filters for 2^RESAMPLER_PHASE_BITS positions between two frames are
+ * tabulated and interpolated linearly in between, so the ratio can change on
+ * every call. Input is read as 32 bit words only, so it may be IRAM.
+ *
+ * At a ratio of exactly 1 and phase 0 input is passed through unchanged,
+ * delayed by RESAMPLER_DELAY_FRAMES.
+ */
+typedef struct resampler_s {
+  uint32_t bits;   // container bits, 16 or 32
+  uint32_t phase;  // position after the center tap, 0.32 fixed point
+  int32_t step;    // input advances by 1 + step / 2^32 frames per output
+  uint32_t need;   // input frames to shift in before the next output
+  uint32_t pos;    // newest frame in hist
+  // last RESAMPLER_TAPS input frames, stored twice so the filter reads them
+  // in one piece
+  int32_t hist[2 * RESAMPLER_TAPS][2];
+} resampler_t;
+
+/**
+ * @param[in] rs The resampler.
+ * @param[in] bits Container bits of a sample, 16 or 32.
+ * @return 0 on success, -1 if bits isn't supported.
+ */
+int32_t resampler_init(resampler_t *rs, uint32_t bits);
+
+/**
+ * Forget the history, output starts with RESAMPLER_DELAY_FRAMES frames of
+ * silence before the next input frame. The ratio is kept.
+ *
+ * @param[in] rs The resampler.
+ */
+void resampler_reset(resampler_t *rs);
+
+/**
+ * Continue after frames which were played without the resampler, e.g.
+ * preloaded to DMA directly. They are shifted into the history and the next
+ * output frame is the input frame following them, the phase starts at 0.
+ *
+ * @param[in] rs The resampler.
+ * @param[in] in Frames played, 32 bit aligned.
+ * @param[in] frames Count of frames.
+ */
+void resampler_prime(resampler_t *rs, const uint32_t *in, uint32_t frames);
+
+/**
+ * @param[in] rs The resampler.
+ * @return Input frames consumed but not output yet, without the phase.
+ */
+uint32_t resampler_lag_frames(const resampler_t *rs);
+
+/**
+ * @param[in] rs The resampler.
+ * @param[in] ppb Input frames consumed per output frame minus 1, in ppb.
+ * Positive plays the input faster, limited to RESAMPLER_MAX_PPB.
+ */
+void resampler_set_ppb(resampler_t *rs, int32_t ppb);
+
+/**
+ * Resample until the input is used up or the output is full, whatever comes
+ * first. State carries over to the next call, so input may be fed in pieces
+ * of any size.
+ *
+ * @param[in] rs The resampler.
+ * @param[in] in Input frames, 32 bit aligned.
+ * @param[in] inFrames Count of input frames.
+ * @param[out] used Count of input frames consumed.
+ * @param[out] out Output frames, 32 bit aligned.
+ * @param[in] outFrames Space for output frames.
+ * @return Count of frames written to out.
+ */
+uint32_t resampler_process(resampler_t *rs, const uint32_t *in,
+                           uint32_t inFrames, uint32_t *used, uint32_t *out,
+                           uint32_t outFrames);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __RESAMPLER_H__
@@ -0,0 +1,77 @@
+#ifndef __SLEW_H__
+#define __SLEW_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+// crossfade length, 1.3ms at 48kHz
+#define SLEW_FADE_FRAMES 64
+// skipped or inserted at one chunk boundary, larger slews take more chunks
+#define SLEW_MAX_FRAMES 256
+// frames written in place of a chunk's first ones
+#define SLEW_HEAD_MAX_FRAMES (SLEW_MAX_FRAMES + SLEW_FADE_FRAMES)
+
+/**
+ * Soft resync for player chunk words, stereo with 16 bit samples sharing a
+ * 32 bit word or 32 bit words per sample, see pcm_pack_container_bits().
+ * Playback jumps by an exact count of frames while I2S keeps running: the
+ * head of a chunk is replaced by a head which crossfades from the frames due
+ * to the frames skipped to, or back to frames played already.
+ *
+ * Skipping n frames plays x[0 .. F) faded into x[n .. n + F), then x[n + F]
+ * on. Inserting n frames plays x[0 .. n), then x[n .. n + F) faded into
+ * x[0 .. F), then x[F] on. F is SLEW_FADE_FRAMES, the fade is linear.
+ * Input is read as 32 bit words only, so it may be IRAM.
+ */
+typedef struct slew_s {
+  uint32_t bits;     // container bits, 16 or 32
+  int32_t pending;   // frames left to skip if positive, to insert if negative
+  uint32_t skipped;  // frames skipped since init
+  uint32_t inserted;
+  uint32_t head[2 * SLEW_HEAD_MAX_FRAMES];  // of the last slew_process()
+} slew_t;
+
+/**
+ * @param[in] sl The slew state.
+ * @param[in] bits Container bits of a sample, 16 or 32.
+ * @return 0 on success, -1 if bits isn't supported.
+ */
+int32_t slew_init(slew_t *sl, uint32_t bits);
+
+/**
+ * Drop what is pending, e.g. on a hard resync. Counters are kept.
+ *
+ * @param[in] sl The slew state.
+ */
+void slew_reset(slew_t *sl);
+
+/**
+ * @param[in] sl The slew state.
+ * @param[in] frames Frames to skip if positive, to insert if negative, added
+ * to what is pending.
+ */
+void slew_start(slew_t *sl, int32_t frames);
+
+/**
+ * Slew by up to SLEW_MAX_FRAMES of what is pending at the start of a chunk.
+ * The returned frames in sl->head are played instead of the first used ones
+ * of the input.
+ *
+ * @param[in] sl The slew state.
+ * @param[in] in First frames of the chunk, 32 bit aligned.
+ * @param[in] inFrames Count of frames in, the slew is put off if they are
+ * too few.
+ * @param[out] used Count of input frames replaced.
+ * @return Count of frames in sl->head, 0 if nothing is slewed.
+ */
+uint32_t slew_process(slew_t *sl, const uint32_t *in, uint32_t inFrames,
+                      uint32_t *used);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __SLEW_H__
@@ -95,7 +95,7 @@ void codec_header_message_free(codec_header_message_t *msg);
 
 typedef struct wire_chunk_message {
   tv_t timestamp;
-  size_t size;
+  uint32_t size;
   char *payload;
 } wire_chunk_message_t;
 
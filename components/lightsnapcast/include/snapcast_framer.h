@@ -0,0 +1,165 @@
+#ifndef __SNAPCAST_FRAMER_H__
+#define __SNAPCAST_FRAMER_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "snapcast.h"
+
+#define WIRE_CHUNK_HEADER_SIZE 12
+
+// biggest fixed size header we have to gather across buffer boundaries
+#define SNAPCAST_FRAMER_STAGING_SIZE BASE_MESSAGE_SIZE
+
+// upper limit for messages which are gathered completely before they are
+// handed out (codec header, server settings). Everything bigger is treated
+// as a protocol error.
+#define SNAPCAST_FRAMER_MAX_MESSAGE_SIZE 16384
+
+#define SNAPCAST_FRAMER_OK 0
+#define SNAPCAST_FRAMER_ERR_PROTOCOL -1
+#define SNAPCAST_FRAMER_ERR_NO_MEM -2
+#define SNAPCAST_FRAMER_ERR_CALLBACK -3
+
+/**
+ * Callbacks for complete messages. Every callback may be NULL, the message is
+ * skipped then. Returning a value != 0 from a callback aborts
+ * snapcast_framer_feed() which returns SNAPCAST_FRAMER_ERR_CALLBACK.
+ *
+ * Pointers handed to the callbacks are only valid during the call.
+ */
+typedef struct snapcast_framer_callbacks_s {
+  /**
+   * Called once the base message is complete, before the typed message is
+   * parsed. Used to stamp base->received. arrival_us is the arrival time of
+   * the buffer which carried the first byte of the message, see
+   * snapcast_framer_set_arrival(), 0 if unknown.
+   */
+  void (*base_message)(void *ctx, base_message_t *base, int64_t arrival_us);
+
+  /**
+   * Called with the decoded wire chunk header before any payload is passed.
+   */
+  int (*wire_chunk_start)(void *ctx, const base_message_t *base,
+                          const wire_chunk_message_t *chunk);
+
+  /**
+   * Called for every span of wire chunk payload. data points directly into
+   * the buffer passed to snapcast_framer_feed(), nothing is copied. owner is
+   * the one passed to snapcast_framer_feed() so the span can be kept alive
+   * beyond the call, e.g. by referencing the pbuf.
+   */
+  int (*wire_chunk_data)(void *ctx, const char *data, uint32_t len,
+                         void *owner);
+
+  /**
+   * Called after the last payload byte of a wire chunk was passed.
+   */
+  int (*wire_chunk_end)(void *ctx, const base_message_t *base,
+                        const wire_chunk_message_t *chunk);
+
+  int (*codec_header)(void *ctx, const base_message_t *base,
+                      const codec_header_message_t *header);
+
+  /**
+   * json is NULL terminated
+   */
+  int (*server_settings)(void *ctx, const base_message_t *base,
+                         const char *json);
+
+  int (*time)(void *ctx, const base_message_t *base,
+              const time_message_t *time);
+} snapcast_framer_callbacks_t;
+
+typedef enum snapcast_framer_state_e {
+  FRAMER_STATE_BASE = 0,
+  FRAMER_STATE_TYPED_HEADER,
+  FRAMER_STATE_WIRE_CHUNK_PAYLOAD,
+  FRAMER_STATE_MESSAGE,
+  FRAMER_STATE_SKIP,
+} snapcast_framer_state_t;
+
+typedef struct snapcast_framer_s {
+  snapcast_framer_state_t state;
+
+  const snapcast_framer_callbacks_t *cb;
+  void *ctx;
+
+  // gathers fixed size headers which are split across buffers
+  char staging[SNAPCAST_FRAMER_STAGING_SIZE];
+  uint32_t stagingLen;
+  uint32_t stagingNeeded;
+
+  base_message_t base;
+  wire_chunk_message_t wireChunk;
+
+  int64_t arrival_us;      // arrival of the buffer being fed
+  int64_t baseArrival_us;  // arrival of the first byte of the current message
+
+  // bytes of the current typed message consumed so far
+  uint32_t typedPos;
+
+  // gathers complete small messages, grows on demand and is reused
+  char *msgBuf;
+  uint32_t msgBufSize;
+
+  uint32_t messages;
+} snapcast_framer_t;
+
+/**
+ * Init the framer.
+ *
+ * @param[in] framer The framer to initialize.
+ * @param[in] cb The callbacks, must stay valid for the lifetime of the framer.
+ * @param[in] ctx Passed to every callback.
+ */
+void snapcast_framer_init(snapcast_framer_t *framer,
+                          const snapcast_framer_callbacks_t *cb, void *ctx);
+
+/**
+ * Drop any partially parsed message, e.g. after a reconnect. The message
+ * buffer is kept for reuse.
+ *
+ * @param[in] framer The framer to reset.
+ */
+void snapcast_framer_reset(snapcast_framer_t *framer);
+
+/**
+ * Free memory held by the framer.
+ *
+ * @param[in] framer The framer to deinitialize.
+ */
+void snapcast_framer_deinit(snapcast_framer_t *framer);
+
+/**
+ * Set the arrival time of the data fed next.
+ *
+ * @param[in] framer The framer.
+ * @param[in] arrival_us Arrival time, 0 if unknown.
+ */
+void snapcast_framer_set_arrival(snapcast_framer_t *framer,
+                                 int64_t arrival_us);
+
+/**
+ * Feed received stream data. Data may be split at arbitrary positions.
+ *
+ * @param[in] framer The framer.
+ * @param[in] data Received bytes.
+ * @param[in] len Count of received bytes.
+ * @param[in] owner Owner of data, passed on to wire_chunk_data, may be NULL.
+ * @return SNAPCAST_FRAMER_OK on success, a negative SNAPCAST_FRAMER_ERR_*
+ * otherwise. The framer has to be reset after an error.
+ */
+int snapcast_framer_feed(snapcast_framer_t *framer, const char *data,
+                         uint32_t len, void *owner);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __SNAPCAST_FRAMER_H__
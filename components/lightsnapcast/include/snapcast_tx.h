@@ -0,0 +1,174 @@
+#ifndef __SNAPCAST_TX_H__
+#define __SNAPCAST_TX_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "snapcast.h"
+
+// slots for small messages like time sync, enough for a burst of pings
+#define SNAPCAST_TX_SMALL_SLOTS 8
+#define SNAPCAST_TX_SMALL_SIZE 64
+// slots for JSON messages like hello
+#define SNAPCAST_TX_LARGE_SLOTS 2
+#define SNAPCAST_TX_LARGE_SIZE 512
+#define SNAPCAST_TX_SLOTS (SNAPCAST_TX_SMALL_SLOTS + SNAPCAST_TX_LARGE_SLOTS)
+// message types with a template
+#define SNAPCAST_TX_TEMPLATES 4
+// storage shared by all templates
+#define SNAPCAST_TX_TEMPLATE_POOL_SIZE \
+  (SNAPCAST_TX_LARGE_SIZE + 2 * SNAPCAST_TX_SMALL_SIZE)
+// slots still referenced by a closed connection are reused after this
+#define SNAPCAST_TX_ORPHAN_US 30000000LL
+
+/**
+ * Hands a message to the transport.
+ *
+ * @param[in] ctx Context given to snapcast_tx_send().
+ * @param[in] data Serialized message, stays valid until the transport
+ * reported its bytes as acknowledged through snapcast_tx_acked().
+ * @param[in] size Size of data.
+ * @return 0 if all bytes were queued, < 0 otherwise.
+ */
+typedef int32_t (*snapcast_tx_write_t)(void *ctx, const char *data,
+                                       uint32_t size);
+
+typedef struct snapcast_tx_stats_s {
+  uint32_t sent;      // messages handed to the transport
+  uint32_t noSlot;    // messages not sent, all fitting slots in flight
+  uint32_t failed;    // transport didn't take the message
+  uint32_t orphaned;  // slots left behind by closed connections
+  uint32_t inFlight;  // slots waiting for acknowledgement
+} snapcast_tx_stats_t;
+
+typedef struct snapcast_tx_template_s {
+  uint16_t type;
+  uint16_t size;      // 0 if unused
+  uint16_t capacity;  // bytes reserved in the template pool
+  char *data;         // base message followed by payload
+} snapcast_tx_template_t;
+
+typedef struct snapcast_tx_slot_s {
+  char *data;
+  uint16_t capacity;
+  uint8_t state;
+  uint32_t end;        // stream position after this message
+  int64_t orphan_us;   // time the connection was closed
+} snapcast_tx_slot_t;
+
+/**
+ * Transmit arena for client to server messages. Messages are kept as
+ * serialized templates and copied to a slot where id and sent time are
+ * patched in place. A slot is given to the transport with NOCOPY semantics
+ * and only reused once the transport acknowledged all of its bytes, so the
+ * send path never touches the heap.
+ */
+typedef struct snapcast_tx_s {
+  snapcast_tx_slot_t slot[SNAPCAST_TX_SLOTS];
+  char smallData[SNAPCAST_TX_SMALL_SLOTS][SNAPCAST_TX_SMALL_SIZE];
+  char largeData[SNAPCAST_TX_LARGE_SLOTS][SNAPCAST_TX_LARGE_SIZE];
+
+  snapcast_tx_template_t templates[SNAPCAST_TX_TEMPLATES];
+  char templatePool[SNAPCAST_TX_TEMPLATE_POOL_SIZE];
+  uint32_t templatePoolUsed;
+
+  uint32_t written;  // bytes queued on the current connection
+  uint32_t acked;    // bytes acknowledged on the current connection
+
+  SemaphoreHandle_t mux;
+  StaticSemaphore_t muxBuffer;
+
+  snapcast_tx_stats_t stats;
+} snapcast_tx_t;
+
+/**
+ * Set up the arena, no memory is allocated. Contains a template for time
+ * messages afterwards.
+ *
+ * @param[in] tx The arena.
+ * @return 0 on success, -1 otherwise.
+ */
+int32_t snapcast_tx_init(snapcast_tx_t *tx);
+
+/**
+ * Serialize a message template. A template of the same type is replaced.
+ *
+ * @param[in] tx The arena.
+ * @param[in] type Message type.
+ * @param[in] payload Serialized payload following the base message.
+ * @param[in] size Size of payload.
+ * @return 0 on success, -1 if there isn't enough space.
+ */
+int32_t snapcast_tx_set_template(snapcast_tx_t *tx, uint16_t type,
+                                 const char *payload, uint32_t size);
+
+/**
+ * Serialize the hello message template, only needed once as it doesn't
+ * change between connections.
+ *
+ * @param[in] tx The arena.
+ * @param[in] msg The hello message.
+ * @return 0 on success, -1 otherwise.
+ */
+int32_t snapcast_tx_set_hello(snapcast_tx_t *tx, hello_message_t *msg);
+
+/**
+ * Send a message from its template.
+ *
+ * @param[in] tx The arena.
+ * @param[in] type Message type, needs a template.
+ * @param[in] id Message id.
+ * @param[in] now_us Sent time.
+ * @param[in] write Transport.
+ * @param[in] ctx Context passed to write.
+ * @return 0 on success, -1 if no template, -2 if all slots are in flight,
+ * -3 if the transport failed.
+ */
+int32_t snapcast_tx_send(snapcast_tx_t *tx, uint16_t type, uint16_t id,
+                         int64_t now_us, snapcast_tx_write_t write, void *ctx);
+
+/**
+ * Account bytes the transport doesn't reference anymore. May be called from
+ * the transport's own task.
+ *
+ * @param[in] tx The arena.
+ * @param[in] bytes Count of acknowledged bytes.
+ */
+void snapcast_tx_acked(snapcast_tx_t *tx, uint32_t bytes);
+
+/**
+ * Account all bytes written so far as acknowledged, for when the transport
+ * has nothing queued anymore. Covers acknowledgements the transport didn't
+ * report through snapcast_tx_acked(). May be called from the transport's
+ * own task.
+ *
+ * @param[in] tx The arena.
+ */
+void snapcast_tx_drained(snapcast_tx_t *tx);
+
+/**
+ * Start over on a new connection. Slots still in flight on the old one
+ * are reused after SNAPCAST_TX_ORPHAN_US.
+ *
+ * @param[in] tx The arena.
+ * @param[in] now_us Current time.
+ */
+void snapcast_tx_reset(snapcast_tx_t *tx, int64_t now_us);
+
+/**
+ * @param[in] tx The arena.
+ * @param[out] stats Copy of the counters.
+ */
+void snapcast_tx_get_stats(snapcast_tx_t *tx, snapcast_tx_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __SNAPCAST_TX_H__
@@ -0,0 +1,127 @@
+#ifndef __SYNC_CONTROL_H__
+#define __SYNC_CONTROL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "MedianFilter.h"
+#include "rate_control.h"
+
+// ages in the median filters, the short one decides on resyncs, the mini
+// one feeds the rate control
+#define SYNC_CONTROL_SHORT_LEN 99
+#define SYNC_CONTROL_MINI_LEN 19
+// beyond this the short median is slewed to by skipping or inserting frames
+#define SYNC_CONTROL_SOFT_RESYNC_US 2000
+// beyond this the player resyncs hard
+#define SYNC_CONTROL_HARD_RESYNC_US 50000
+
+typedef enum sync_control_action_e {
+  SYNC_CONTROL_PLAY = 0,     // keep playing at the rate in ppb
+  SYNC_CONTROL_RESYNC_SOFT,  // skip slew_us of audio, insert if negative
+  SYNC_CONTROL_RESYNC_HARD,  // mute, stop and start over with initial sync
+} sync_control_action_t;
+
+typedef struct sync_control_stats_s {
+  uint32_t updates;      // ages measured
+  uint32_t softResyncs;  // SYNC_CONTROL_RESYNC_SOFT returned
+  uint32_t hardResyncs;  // SYNC_CONTROL_RESYNC_HARD returned
+  uint32_t starved;      // of them because no audio was left
+} sync_control_stats_t;
+
+/**
+ * Sync control of the player without the platform: filters the measured
+ * ages and picks one of three tiers. Within the soft limit the playback rate
+ * is steered, beyond it playback jumps to the right position without a gap
+ * and beyond the hard limit it starts over with an initial sync. The player
+ * measures the age once per chunk and applies the rate, by resampling or by
+ * tuning the APLL, and the jumps, see slew.h. tools/sync_sim simulates the
+ * loop on the host.
+ */
+typedef struct sync_control_s {
+  sMedianFilter_t shortFilter;
+  sMedianNode_t shortNodes[SYNC_CONTROL_SHORT_LEN];
+  sMedianFilter_t miniFilter;
+  sMedianNode_t miniNodes[SYNC_CONTROL_MINI_LEN];
+  rate_control_t rate;
+  int64_t softResync_us;
+  int64_t hardResync_us;
+
+  int64_t shortMedian_us;  // of the last update
+  int64_t miniMedian_us;
+  int32_t ppb;  // playback rate correction, positive plays faster
+  int64_t slew_us;  // of the last SYNC_CONTROL_RESYNC_SOFT
+
+  sync_control_stats_t stats;
+} sync_control_t;
+
+/**
+ * Age of the audio played, positive if it is late. The next frame written
+ * is stamped chunkStart_us and hits the DAC after outputBufferDacTime_us.
+ *
+ * @param[in] serverNow_us Server time now.
+ * @param[in] chunkStart_us Server time stamp of the next frame written.
+ * @param[in] buf_us Playback delay the server asks for.
+ * @param[in] dacLatency_us Client latency, added to the server's delay.
+ * @param[in] outputBufferDacTime_us Audio queued up in front of the DAC.
+ * @return Age in µs.
+ */
+static inline int64_t sync_control_age(int64_t serverNow_us,
+                                       int64_t chunkStart_us, int64_t buf_us,
+                                       int64_t dacLatency_us,
+                                       int64_t outputBufferDacTime_us) {
+  return serverNow_us - chunkStart_us - buf_us + dacLatency_us +
+         outputBufferDacTime_us;
+}
+
+/**
+ * @param[in] sc The sync control.
+ * @param[in] tau_ms Time constant of the rate control loop.
+ * @param[in] max_ppb Rate correction limit.
+ * @param[in] softResync_us Short median limit of rate control, e.g.
+ * SYNC_CONTROL_SOFT_RESYNC_US.
+ * @param[in] hardResync_us Short median limit of soft resyncs, e.g.
+ * SYNC_CONTROL_HARD_RESYNC_US.
+ */
+void sync_control_init(sync_control_t *sc, int32_t tau_ms, int32_t max_ppb,
+                       int64_t softResync_us, int64_t hardResync_us);
+
+/**
+ * Start over after an initial sync, the median filters are emptied and the
+ * rate starts at the clock skew.
+ *
+ * @param[in] sc The sync control.
+ * @param[in] skew_ppb Skew of the server clock, 0 if unknown.
+ */
+void sync_control_reset(sync_control_t *sc, int32_t skew_ppb);
+
+/**
+ * Account an age measured after a chunk was written. The rate in sc->ppb is
+ * updated once the mini median filter is full. On a soft resync the median
+ * filters start over, the rate is kept.
+ *
+ * @param[in] sc The sync control.
+ * @param[in] age_us Age, see sync_control_age().
+ * @param[in] dt_us Audio written since the last update.
+ * @param[in] starved No audio is left to write.
+ * @return What the player has to do.
+ */
+sync_control_action_t sync_control_update(sync_control_t *sc, int64_t age_us,
+                                          int64_t dt_us, bool starved);
+
+/**
+ * @param[in] sc The sync control.
+ * @param[out] stats Copy of the counters.
+ */
+void sync_control_get_stats(const sync_control_t *sc,
+                            sync_control_stats_t *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // __SYNC_CONTROL_H__
@@ -0,0 +1,119 @@
+#include "latency_hist.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/**
+ *
+ */
+void latency_hist_reset(latency_hist_t *hist) {
+  memset(hist, 0, sizeof(latency_hist_t));
+}
+
+/**
+ *
+ */
+static uint32_t latency_hist_bucket(int64_t us) {
+  uint32_t i = 0;
+
+  us >>= LATENCY_HIST_MIN_SHIFT;
+  while ((us > 0) && (i < LATENCY_HIST_BUCKETS - 1)) {
+    us >>= 1;
+    i++;
+  }
+
+  return i;
+}
+
+/**
+ *
+ */
+void latency_hist_add(latency_hist_t *hist, int64_t us) {
+  if (us < 0) {
+    us = 0;
+  }
+
+  hist->bucket[latency_hist_bucket(us)]++;
+  hist->count++;
+  hist->sum_us += us;
+  if (us > hist->max_us) {
+    hist->max_us = us;
+  }
+}
+
+/**
+ *
+ */
+static int64_t latency_hist_upper(const latency_hist_t *hist, uint32_t i) {
+  if (i == LATENCY_HIST_BUCKETS - 1) {
+    return hist->max_us;
+  }
+
+  return 1LL << (LATENCY_HIST_MIN_SHIFT + i);
+}
+
+/**
+ *
+ */
+int64_t latency_hist_percentile(const latency_hist_t *hist, uint32_t percent) {
+  uint64_t target, sum = 0;
+
+  if (hist->count == 0) {
+    return 0;
+  }
+
+  if (percent > 100) {
+    percent = 100;
+  }
+
+  // count of samples at or below the percentile, at least one
+  target = ((uint64_t)hist->count * percent + 99) / 100;
+  if (target == 0) {
+    target = 1;
+  }
+
+  for (uint32_t i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+    sum += hist->bucket[i];
+    if (sum >= target) {
+      return latency_hist_upper(hist, i);
+    }
+  }
+
+  return hist->max_us;
+}
+
+/**
+ *
+ */
+uint32_t latency_hist_format(const latency_hist_t *hist, char *str,
+                             uint32_t size) {
+  uint32_t len = 0;
+
+  if (size == 0) {
+    return 0;
+  }
+
+  str[0] = 0;
+
+  for (uint32_t i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+    int n;
+
+    if (hist->bucket[i] == 0) {
+      continue;
+    }
+
+    n = snprintf(&str[len], size - len, "%s%lld:%lu", (len > 0) ? " " : "",
+                 (long long)latency_hist_upper(hist, i),
+                 (unsigned long)hist->bucket[i]);
+    if ((n < 0) || (len + n >= size)) {
+      // drop the truncated pair
+      str[len] = 0;
+
+      break;
+    }
+
+    len += n;
+  }
+
+  return len;
+}
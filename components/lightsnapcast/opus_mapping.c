@@ -0,0 +1,88 @@
+#include "opus_mapping.h"
+
+#include <string.h>
+
+#define OPUS_HEAD_SIZE 19
+
+/**
+ * Streams, coupled streams and mapping libopus' surround encoder uses for
+ * 1 to 8 channels in Vorbis order.
+ */
+static const opus_mapping_t vorbisMappings[OPUS_MAPPING_MAX_CHANNELS] = {
+    {1, 1, 0, {0}},
+    {2, 1, 1, {0, 1}},
+    {3, 2, 1, {0, 2, 1}},
+    {4, 2, 2, {0, 1, 2, 3}},
+    {5, 3, 2, {0, 4, 1, 2, 3}},
+    {6, 4, 2, {0, 4, 1, 2, 3, 5}},
+    {7, 4, 3, {0, 4, 1, 2, 3, 5, 6}},
+    {8, 5, 3, {0, 6, 1, 2, 3, 4, 5, 7}},
+};
+
+/**
+ *
+ */
+int32_t opus_mapping_default(opus_mapping_t *mapping, uint32_t channels) {
+  if ((channels == 0) || (channels > OPUS_MAPPING_MAX_CHANNELS)) {
+    return -1;
+  }
+
+  *mapping = vorbisMappings[channels - 1];
+
+  return 0;
+}
+
+/**
+ *
+ */
+int32_t opus_mapping_parse_head(opus_mapping_t *mapping, const uint8_t *head,
+                                uint32_t len) {
+  uint32_t channels, family;
+
+  if ((len < OPUS_HEAD_SIZE) || (memcmp(head, "OpusHead", 8) != 0)) {
+    return -1;
+  }
+
+  // major version 0 is all there is, minor versions stay compatible
+  if ((head[8] >> 4) != 0) {
+    return -1;
+  }
+
+  channels = head[9];
+  family = head[18];
+
+  if (family == 0) {
+    if ((channels == 0) || (channels > 2)) {
+      return -1;
+    }
+
+    return opus_mapping_default(mapping, channels);
+  }
+
+  // streams, coupled streams and a mapping table follow
+  if ((channels == 0) || (channels > OPUS_MAPPING_MAX_CHANNELS) ||
+      (len < OPUS_HEAD_SIZE + 2 + channels)) {
+    return -1;
+  }
+
+  mapping->channels = channels;
+  mapping->streams = head[19];
+  mapping->coupled = head[20];
+
+  if ((mapping->streams == 0) || (mapping->coupled > mapping->streams) ||
+      (mapping->streams + mapping->coupled > 255)) {
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < channels; i++) {
+    uint8_t index = head[21 + i];
+
+    if ((index != 255) && (index >= mapping->streams + mapping->coupled)) {
+      return -1;
+    }
+
+    mapping->mapping[i] = index;
+  }
+
+  return 0;
+}
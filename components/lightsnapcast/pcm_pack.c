@@ -0,0 +1,453 @@
+#include "pcm_pack.h"
+
+#include <stddef.h>
+#include <string.h>
+
+/**
+ *
+ */
+uint8_t pcm_pack_container_bits(uint32_t bits) {
+  switch (bits) {
+    case 16:
+      return 16;
+
+    case 24:
+    case 32:
+      return 32;
+
+    default:
+      return 0;
+  }
+}
+
+/**
+ *
+ */
+void pcm_pack_s16_stereo(uint32_t *dst, const int32_t *left,
+                         const int32_t *right, uint32_t frames) {
+  for (uint32_t i = 0; i < frames; i++) {
+    dst[i] = ((uint32_t)left[i] & 0xFFFF) | ((uint32_t)right[i] << 16);
+  }
+}
+
+/**
+ * Kernel for samples in a word of their own. Always inlined with a constant
+ * shift, so every width gets its own loop.
+ */
+static inline __attribute__((always_inline)) void pcm_pack_words_stereo(
+    uint32_t *dst, const int32_t *left, const int32_t *right,
+    uint32_t frames, const uint32_t shift) {
+  for (uint32_t i = 0; i < frames; i++) {
+    dst[2 * i] = (uint32_t)left[i] << shift;
+    dst[2 * i + 1] = (uint32_t)right[i] << shift;
+  }
+}
+
+/**
+ *
+ */
+void pcm_pack_s24_stereo(uint32_t *dst, const int32_t *left,
+                         const int32_t *right, uint32_t frames) {
+  pcm_pack_words_stereo(dst, left, right, frames, 8);
+}
+
+/**
+ *
+ */
+void pcm_pack_s32_stereo(uint32_t *dst, const int32_t *left,
+                         const int32_t *right, uint32_t frames) {
+  pcm_pack_words_stereo(dst, left, right, frames, 0);
+}
+
+/**
+ *
+ */
+pcm_pack_fn_t pcm_pack_stereo_kernel(uint32_t bits) {
+  switch (bits) {
+    case 16:
+      return pcm_pack_s16_stereo;
+
+    case 24:
+      return pcm_pack_s24_stereo;
+
+    case 32:
+      return pcm_pack_s32_stereo;
+
+    default:
+      return NULL;
+  }
+}
+
+/**
+ *
+ */
+uint32_t pcm_pack_chunk_stereo(pcm_chunk_message_t *chunk, uint32_t offset,
+                               const int32_t *left, const int32_t *right,
+                               uint32_t frames, uint32_t bits) {
+  pcm_pack_fn_t pack = pcm_pack_stereo_kernel(bits);
+  pcm_chunk_fragment_t *fragment = chunk->fragment;
+  // 32 bit words per frame
+  uint32_t frameWords = pcm_pack_container_bits(bits) / 16;
+  uint32_t written = 0;
+
+  if (pack == NULL) {
+    return 0;
+  }
+
+  while ((fragment != NULL) && (written < frames)) {
+    uint32_t capacity = fragment->size / (4 * frameWords);
+    uint32_t n;
+
+    if (offset >= capacity) {
+      offset -= capacity;
+      fragment = fragment->nextFragment;
+
+      continue;
+    }
+
+    if (fragment->payload == NULL) {
+      break;
+    }
+
+    n = capacity - offset;
+    if (n > frames - written) {
+      n = frames - written;
+    }
+
+    pack(&((uint32_t *)fragment->payload)[offset * frameWords],
+         &left[written], &right[written], n);
+
+    written += n;
+    offset = 0;
+    fragment = fragment->nextFragment;
+  }
+
+  return written;
+}
+
+/**
+ *
+ */
+uint32_t pcm_pack_chunk_s16_stereo(pcm_chunk_message_t *chunk,
+                                   uint32_t offset, const int32_t *left,
+                                   const int32_t *right, uint32_t frames) {
+  return pcm_pack_chunk_stereo(chunk, offset, left, right, frames, 16);
+}
+
+/**
+ * Saturate to 16 bit.
+ */
+static inline int32_t pcm_pack_clip_s16(int32_t sample) {
+  if (sample > INT16_MAX) {
+    return INT16_MAX;
+  }
+
+  if (sample < INT16_MIN) {
+    return INT16_MIN;
+  }
+
+  return sample;
+}
+
+/**
+ *
+ */
+uint32_t pcm_pack_chunk_fixed_s16_stereo(pcm_chunk_message_t *chunk,
+                                         uint32_t offset, const int32_t *left,
+                                         const int32_t *right, uint32_t frames,
+                                         uint32_t fracBits) {
+  pcm_chunk_fragment_t *fragment = chunk->fragment;
+  uint32_t shift = fracBits - 15;
+  uint32_t written = 0;
+
+  if ((fracBits < 15) || (fracBits > 31)) {
+    return 0;
+  }
+
+  while ((fragment != NULL) && (written < frames)) {
+    uint32_t capacity = fragment->size / 4;
+    uint32_t *dst;
+    uint32_t n;
+
+    if (offset >= capacity) {
+      offset -= capacity;
+      fragment = fragment->nextFragment;
+
+      continue;
+    }
+
+    if (fragment->payload == NULL) {
+      break;
+    }
+
+    n = capacity - offset;
+    if (n > frames - written) {
+      n = frames - written;
+    }
+
+    dst = &((uint32_t *)fragment->payload)[offset];
+    for (uint32_t i = 0; i < n; i++) {
+      int32_t l = pcm_pack_clip_s16(left[written + i] >> shift);
+      int32_t r = pcm_pack_clip_s16(right[written + i] >> shift);
+
+      dst[i] = ((uint32_t)l & 0xFFFF) | ((uint32_t)r << 16);
+    }
+
+    written += n;
+    offset = 0;
+    fragment = fragment->nextFragment;
+  }
+
+  return written;
+}
+
+/**
+ *
+ */
+uint32_t pcm_pack_chunk_s16_interleaved(pcm_chunk_message_t *chunk,
+                                        uint32_t offset,
+                                        const int16_t *samples,
+                                        uint32_t frames) {
+  pcm_chunk_fragment_t *fragment = chunk->fragment;
+  uint32_t written = 0;
+
+  while ((fragment != NULL) && (written < frames)) {
+    uint32_t capacity = fragment->size / 4;
+    uint32_t *dst;
+    uint32_t n;
+
+    if (offset >= capacity) {
+      offset -= capacity;
+      fragment = fragment->nextFragment;
+
+      continue;
+    }
+
+    if (fragment->payload == NULL) {
+      break;
+    }
+
+    n = capacity - offset;
+    if (n > frames - written) {
+      n = frames - written;
+    }
+
+    dst = &((uint32_t *)fragment->payload)[offset];
+    for (uint32_t i = 0; i < n; i++) {
+      const int16_t *frame = &samples[2 * (written + i)];
+
+      dst[i] = ((uint32_t)(uint16_t)frame[0] << 16) | (uint16_t)frame[1];
+    }
+
+    written += n;
+    offset = 0;
+    fragment = fragment->nextFragment;
+  }
+
+  return written;
+}
+
+/**
+ *
+ */
+uint32_t pcm_pack_chunk_s16_routed(pcm_chunk_message_t *chunk, uint32_t offset,
+                                   const int16_t *samples, uint32_t channels,
+                                   uint32_t left, uint32_t right,
+                                   uint32_t frames) {
+  pcm_chunk_fragment_t *fragment = chunk->fragment;
+  uint32_t written = 0;
+
+  if ((left >= channels) || (right >= channels)) {
+    return 0;
+  }
+
+  // plain stereo keeps its own loop
+  if ((channels == 2) && (left == 0) && (right == 1)) {
+    return pcm_pack_chunk_s16_interleaved(chunk, offset, samples, frames);
+  }
+
+  while ((fragment != NULL) && (written < frames)) {
+    uint32_t capacity = fragment->size / 4;
+    uint32_t *dst;
+    uint32_t n;
+
+    if (offset >= capacity) {
+      offset -= capacity;
+      fragment = fragment->nextFragment;
+
+      continue;
+    }
+
+    if (fragment->payload == NULL) {
+      break;
+    }
+
+    n = capacity - offset;
+    if (n > frames - written) {
+      n = frames - written;
+    }
+
+    dst = &((uint32_t *)fragment->payload)[offset];
+    for (uint32_t i = 0; i < n; i++) {
+      const int16_t *frame = &samples[channels * (written + i)];
+
+      dst[i] = ((uint32_t)(uint16_t)frame[left] << 16) |
+               (uint16_t)frame[right];
+    }
+
+    written += n;
+    offset = 0;
+    fragment = fragment->nextFragment;
+  }
+
+  return written;
+}
+
+/**
+ *
+ */
+void pcm_unpack_reset(pcm_unpack_t *unpack) {
+  unpack->word = 0;
+  unpack->shift = 3;
+  unpack->offset = 0;
+}
+
+/**
+ * Player word for a wire sample, or frame for 16 bit, read as a little endian
+ * word. Always inlined with a constant bits, so it folds into the loops.
+ */
+static inline __attribute__((always_inline)) uint32_t pcm_unpack_word(
+    uint32_t word, const uint32_t bits) {
+  switch (bits) {
+    case 16:
+      // left in the upper half word, see pcm_pack_chunk_s16_interleaved()
+      return (word << 16) | (word >> 16);
+
+    case 24:
+      return word << 8;
+
+    default:
+      return word;
+  }
+}
+
+/**
+ * Unpack a span of wire chunk, which may start and end inside a word. The
+ * split words at both ends are gathered byte by byte, the whole ones in
+ * between are converted a word at a time straight into the chunk. Wire data
+ * is little endian like the ESP32.
+ */
+static inline __attribute__((always_inline)) void pcm_unpack_words(
+    pcm_unpack_t *unpack, pcm_chunk_message_t *chunk, const char *data,
+    uint32_t len, const uint32_t bits) {
+  volatile uint32_t *dst = NULL;
+  uint32_t size = 0;
+  uint32_t words, fit;
+
+  if ((chunk) && (chunk->fragment->payload)) {
+    dst = (volatile uint32_t *)chunk->fragment->payload;
+    size = chunk->fragment->size;
+  }
+
+  while (len > 0) {
+    // word split by the previous span, or the end of this one
+    if ((unpack->shift != 3) || (len < 4)) {
+      unpack->word |= (uint32_t)(uint8_t)*data++ << (8 * (3 - unpack->shift));
+      len--;
+
+      unpack->shift--;
+      if (unpack->shift < 0) {
+        unpack->shift = 3;
+
+        if ((dst) && (unpack->offset + 4 <= size)) {
+          dst[unpack->offset / 4] = pcm_unpack_word(unpack->word, bits);
+
+          unpack->offset += 4;
+        }
+
+        unpack->word = 0;
+      }
+
+      continue;
+    }
+
+    words = len / 4;
+    fit = 0;
+    if ((dst) && (unpack->offset < size)) {
+      fit = (size - unpack->offset) / 4;
+    }
+    if (fit > words) {
+      fit = words;
+    }
+
+    if (((uintptr_t)data & 3) == 0) {
+      const uint32_t *src = (const uint32_t *)data;
+
+      for (uint32_t i = 0; i < fit; i++) {
+        dst[unpack->offset / 4 + i] = pcm_unpack_word(src[i], bits);
+      }
+    } else {
+      for (uint32_t i = 0; i < fit; i++) {
+        uint32_t word;
+
+        memcpy(&word, &data[4 * i], sizeof(word));
+        dst[unpack->offset / 4 + i] = pcm_unpack_word(word, bits);
+      }
+    }
+
+    // words beyond the chunk are dropped
+    unpack->offset += 4 * fit;
+    data += 4 * words;
+    len -= 4 * words;
+  }
+}
+
+/**
+ *
+ */
+void pcm_unpack_s16_wire(pcm_unpack_t *unpack, pcm_chunk_message_t *chunk,
+                         const char *data, uint32_t len) {
+  pcm_unpack_words(unpack, chunk, data, len, 16);
+}
+
+/**
+ *
+ */
+void pcm_unpack_s24_wire(pcm_unpack_t *unpack, pcm_chunk_message_t *chunk,
+                         const char *data, uint32_t len) {
+  pcm_unpack_words(unpack, chunk, data, len, 24);
+}
+
+/**
+ *
+ */
+void pcm_unpack_s32_wire(pcm_unpack_t *unpack, pcm_chunk_message_t *chunk,
+                         const char *data, uint32_t len) {
+  pcm_unpack_words(unpack, chunk, data, len, 32);
+}
+
+/**
+ *
+ */
+int32_t pcm_unpack_wire(pcm_unpack_t *unpack, pcm_chunk_message_t *chunk,
+                        const char *data, uint32_t len, uint32_t bits) {
+  switch (bits) {
+    case 16:
+      pcm_unpack_s16_wire(unpack, chunk, data, len);
+
+      return 0;
+
+    case 24:
+      pcm_unpack_s24_wire(unpack, chunk, data, len);
+
+      return 0;
+
+    case 32:
+      pcm_unpack_s32_wire(unpack, chunk, data, len);
+
+      return 0;
+
+    default:
+      return -1;
+  }
+}
@@ -0,0 +1,388 @@
+/**
+ * Fixed size slots [pcm_chunk_message_t][pcm_chunk_fragment_t][payload],
+ * carved out of as few heap blocks as possible. Free slots are kept in a
+ * queue, so the http task and the player task can get and return them
+ * without touching the heap. If the pool is replaced while chunks are still
+ * queued it is kept in a list of retiring pools until all of its slots came
+ * back.
+ */
+
+#include "pcm_pool.h"
+
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "sdkconfig.h"
+
+static const char *TAG = "PCM_POOL";
+
+#define PCM_POOL_ALIGN 4
+
+typedef struct pcm_pool_s pcm_pool_t;
+struct pcm_pool_s {
+  char *block[PCM_POOL_MAX_BLOCKS];
+  char *blockEnd[PCM_POOL_MAX_BLOCKS];
+  uint32_t blockCnt;
+
+  uint32_t caps[PCM_POOL_MAX_BLOCKS];
+
+  size_t slotSize;
+  size_t payloadSize;
+  uint32_t slotCnt;
+
+  QueueHandle_t freeSlots;
+
+  pcm_pool_t *next;  // next retiring pool
+};
+
+static SemaphoreHandle_t poolMux = NULL;
+static pcm_pool_t *currentPool = NULL;
+static pcm_pool_t *retiringPools = NULL;
+static pcm_pool_stats_t poolStats;
+
+/**
+ *
+ */
+static void pcm_pool_destroy(pcm_pool_t *pool) {
+  for (int i = 0; i < pool->blockCnt; i++) {
+    heap_caps_free(pool->block[i]);
+  }
+
+  if (pool->freeSlots != NULL) {
+    vQueueDelete(pool->freeSlots);
+  }
+
+  free(pool);
+}
+
+/**
+ * try to get a block for cnt slots, halve cnt until it fits
+ */
+static char *pcm_pool_alloc_block(size_t slotSize, uint32_t *cnt,
+                                  uint32_t *caps) {
+#if CONFIG_SPIRAM && CONFIG_SPIRAM_BOOT_INIT
+  const uint32_t capsList[] = {MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM};
+#elif CONFIG_SPIRAM
+  const uint32_t capsList[] = {MALLOC_CAP_8BIT};
+#else
+  // chunk payload is only accessed 32 bit wise, so prefer IRAM like
+  // allocate_pcm_chunk_memory() did and keep DRAM for the rest of the system
+  const uint32_t capsList[] = {MALLOC_CAP_32BIT | MALLOC_CAP_EXEC,
+                               MALLOC_CAP_8BIT};
+#endif
+  uint32_t n = *cnt;
+
+  while (n > 0) {
+    for (int i = 0; i < sizeof(capsList) / sizeof(capsList[0]); i++) {
+      char *block;
+
+      if (heap_caps_get_largest_free_block(capsList[i]) < n * slotSize) {
+        continue;
+      }
+
+      block = (char *)heap_caps_malloc(n * slotSize, capsList[i]);
+      if (block != NULL) {
+        *cnt = n;
+        *caps = capsList[i];
+
+        return block;
+      }
+    }
+
+    n /= 2;
+  }
+
+  return NULL;
+}
+
+/**
+ *
+ */
+static pcm_pool_t *pcm_pool_create(uint32_t slots, size_t payloadSize) {
+  pcm_pool_t *pool;
+  uint32_t remaining = slots;
+
+  pool = (pcm_pool_t *)calloc(1, sizeof(pcm_pool_t));
+  if (pool == NULL) {
+    return NULL;
+  }
+
+  pool->payloadSize =
+      (payloadSize + PCM_POOL_ALIGN - 1) & ~(PCM_POOL_ALIGN - 1);
+  pool->slotSize = sizeof(pcm_chunk_message_t) +
+                   sizeof(pcm_chunk_fragment_t) + pool->payloadSize;
+  pool->slotSize = (pool->slotSize + PCM_POOL_ALIGN - 1) & ~(PCM_POOL_ALIGN - 1);
+
+  pool->freeSlots = xQueueCreate(slots, sizeof(pcm_chunk_message_t *));
+  if (pool->freeSlots == NULL) {
+    pcm_pool_destroy(pool);
+
+    return NULL;
+  }
+
+  while ((remaining > 0) && (pool->blockCnt < PCM_POOL_MAX_BLOCKS)) {
+    uint32_t cnt = remaining;
+    uint32_t caps;
+    char *block = pcm_pool_alloc_block(pool->slotSize, &cnt, &caps);
+
+    if (block == NULL) {
+      break;
+    }
+
+    pool->block[pool->blockCnt] = block;
+    pool->blockEnd[pool->blockCnt] = block + cnt * pool->slotSize;
+    pool->caps[pool->blockCnt] = caps;
+    pool->blockCnt++;
+
+    for (uint32_t i = 0; i < cnt; i++) {
+      pcm_chunk_message_t *slot =
+          (pcm_chunk_message_t *)(block + i * pool->slotSize);
+
+      xQueueSend(pool->freeSlots, &slot, 0);
+    }
+
+    pool->slotCnt += cnt;
+    remaining -= cnt;
+  }
+
+  if (pool->slotCnt == 0) {
+    pcm_pool_destroy(pool);
+
+    return NULL;
+  }
+
+  if (remaining > 0) {
+    ESP_LOGW(TAG, "got %lu of %lu slots", pool->slotCnt, slots);
+  }
+
+  return pool;
+}
+
+/**
+ * returns the index of the block pcmChunk is placed in, -1 if it doesn't
+ * belong to pool
+ */
+static int pcm_pool_find_block(const pcm_pool_t *pool,
+                               const pcm_chunk_message_t *pcmChunk) {
+  const char *p = (const char *)pcmChunk;
+
+  for (int i = 0; i < pool->blockCnt; i++) {
+    if ((p >= pool->block[i]) && (p < pool->blockEnd[i])) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+/**
+ *
+ */
+int32_t pcm_pool_setup(uint32_t slots, size_t payloadSize) {
+  pcm_pool_t *pool;
+
+  if ((slots == 0) || (payloadSize == 0)) {
+    return -1;
+  }
+
+  if (poolMux == NULL) {
+    poolMux = xSemaphoreCreateMutex();
+    if (poolMux == NULL) {
+      return -2;
+    }
+  }
+
+  xSemaphoreTake(poolMux, portMAX_DELAY);
+  pool = currentPool;
+  xSemaphoreGive(poolMux);
+
+  // keep the pool if it is big enough and doesn't waste too much memory, so
+  // streams with alternating chunk sizes don't recreate it all the time
+  if ((pool != NULL) && (pool->payloadSize >= payloadSize) &&
+      (pool->slotCnt >= slots) &&
+      (pool->slotCnt * pool->payloadSize <= 2 * slots * payloadSize)) {
+    return 0;
+  }
+
+  // drop the current pool before the new one is allocated, so its memory can
+  // be reused if no chunk is queued right now
+  xSemaphoreTake(poolMux, portMAX_DELAY);
+  if (currentPool != NULL) {
+    ESP_LOGI(TAG, "replacing pool, hits %lu misses %lu high water %lu/%lu",
+             poolStats.hits, poolStats.misses, poolStats.highWater,
+             poolStats.slots);
+
+    if (uxQueueMessagesWaiting(currentPool->freeSlots) ==
+        currentPool->slotCnt) {
+      pcm_pool_destroy(currentPool);
+    } else {
+      currentPool->next = retiringPools;
+      retiringPools = currentPool;
+    }
+    currentPool = NULL;
+  }
+  poolStats.inUse = 0;
+  poolStats.highWater = 0;
+  poolStats.slots = 0;
+  poolStats.payloadSize = 0;
+  xSemaphoreGive(poolMux);
+
+  pool = pcm_pool_create(slots, payloadSize);
+  if (pool == NULL) {
+    ESP_LOGE(TAG, "couldn't create pool of %lu slots with %u bytes", slots,
+             payloadSize);
+
+    return -2;
+  }
+
+  xSemaphoreTake(poolMux, portMAX_DELAY);
+  currentPool = pool;
+  poolStats.slots = pool->slotCnt;
+  poolStats.payloadSize = pool->payloadSize;
+  xSemaphoreGive(poolMux);
+
+  ESP_LOGI(TAG, "%lu slots of %u bytes in %lu blocks", pool->slotCnt,
+           pool->payloadSize, pool->blockCnt);
+
+  return 0;
+}
+
+/**
+ *
+ */
+void pcm_pool_deinit(void) {
+  if (poolMux == NULL) {
+    return;
+  }
+
+  xSemaphoreTake(poolMux, portMAX_DELAY);
+
+  if (currentPool != NULL) {
+    pcm_pool_destroy(currentPool);
+    currentPool = NULL;
+  }
+
+  while (retiringPools != NULL) {
+    pcm_pool_t *next = retiringPools->next;
+
+    pcm_pool_destroy(retiringPools);
+    retiringPools = next;
+  }
+
+  memset(&poolStats, 0, sizeof(poolStats));
+
+  xSemaphoreGive(poolMux);
+}
+
+/**
+ *
+ */
+pcm_chunk_message_t *pcm_pool_alloc(size_t bytes) {
+  pcm_chunk_message_t *pcmChunk = NULL;
+  pcm_chunk_fragment_t *fragment;
+  int block;
+
+  if (poolMux == NULL) {
+    return NULL;
+  }
+
+  xSemaphoreTake(poolMux, portMAX_DELAY);
+
+  if ((currentPool == NULL) || (bytes > currentPool->payloadSize) ||
+      (xQueueReceive(currentPool->freeSlots, &pcmChunk, 0) != pdTRUE)) {
+    poolStats.misses++;
+
+    xSemaphoreGive(poolMux);
+
+    return NULL;
+  }
+
+  block = pcm_pool_find_block(currentPool, pcmChunk);
+
+  // only 32 bit stores, slot may be placed in IRAM
+  fragment = (pcm_chunk_fragment_t *)(pcmChunk + 1);
+  fragment->size = bytes;
+  fragment->payload = (char *)(fragment + 1);
+  fragment->nextFragment = NULL;
+
+  pcmChunk->timestamp.sec = 0;
+  pcmChunk->timestamp.usec = 0;
+  pcmChunk->totalSize = bytes;
+  pcmChunk->fragment = fragment;
+  pcmChunk->caps = currentPool->caps[block];
+
+  poolStats.hits++;
+  poolStats.inUse++;
+  if (poolStats.inUse > poolStats.highWater) {
+    poolStats.highWater = poolStats.inUse;
+  }
+
+  xSemaphoreGive(poolMux);
+
+  return pcmChunk;
+}
+
+/**
+ *
+ */
+bool pcm_pool_free(pcm_chunk_message_t *pcmChunk) {
+  pcm_pool_t **prev;
+
+  if ((poolMux == NULL) || (pcmChunk == NULL)) {
+    return false;
+  }
+
+  xSemaphoreTake(poolMux, portMAX_DELAY);
+
+  if ((currentPool != NULL) &&
+      (pcm_pool_find_block(currentPool, pcmChunk) >= 0)) {
+    xQueueSend(currentPool->freeSlots, &pcmChunk, 0);
+    poolStats.inUse--;
+
+    xSemaphoreGive(poolMux);
+
+    return true;
+  }
+
+  for (prev = &retiringPools; *prev != NULL; prev = &(*prev)->next) {
+    pcm_pool_t *pool = *prev;
+
+    if (pcm_pool_find_block(pool, pcmChunk) < 0) {
+      continue;
+    }
+
+    xQueueSend(pool->freeSlots, &pcmChunk, 0);
+
+    if (uxQueueMessagesWaiting(pool->freeSlots) == pool->slotCnt) {
+      *prev = pool->next;
+      pcm_pool_destroy(pool);
+    }
+
+    xSemaphoreGive(poolMux);
+
+    return true;
+  }
+
+  xSemaphoreGive(poolMux);
+
+  return false;
+}
+
+/**
+ *
+ */
+void pcm_pool_get_stats(pcm_pool_stats_t *stats) {
+  if (poolMux == NULL) {
+    memset(stats, 0, sizeof(pcm_pool_stats_t));
+
+    return;
+  }
+
+  xSemaphoreTake(poolMux, portMAX_DELAY);
+  *stats = poolStats;
+  xSemaphoreGive(poolMux);
+}
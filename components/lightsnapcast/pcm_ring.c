@@ -0,0 +1,275 @@
+/**
+ * Single producer / single consumer PCM ring. Cursors are published with
+ * release stores after the data they cover was written or read, and loaded
+ * with acquire on the other side, so no lock is needed.
+ */
+
+#include "pcm_ring.h"
+
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "sdkconfig.h"
+
+#define pcm_ring_load(x) __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define pcm_ring_store(x, v) __atomic_store_n(&(x), (v), __ATOMIC_RELEASE)
+
+/**
+ *
+ */
+int32_t pcm_ring_init(pcm_ring_t *ring, uint32_t frames, uint32_t frameSize,
+                      uint32_t sr) {
+#if CONFIG_SPIRAM && CONFIG_SPIRAM_BOOT_INIT
+  const uint32_t capsList[] = {MALLOC_CAP_8BIT | MALLOC_CAP_SPIRAM};
+#elif CONFIG_SPIRAM
+  const uint32_t capsList[] = {MALLOC_CAP_8BIT};
+#else
+  const uint32_t capsList[] = {MALLOC_CAP_8BIT,
+                               MALLOC_CAP_32BIT | MALLOC_CAP_EXEC};
+#endif
+
+  memset(ring, 0, sizeof(pcm_ring_t));
+
+  if ((frames == 0) || (frameSize == 0) || ((frameSize % 4) != 0) ||
+      (sr == 0)) {
+    return -1;
+  }
+
+  for (int i = 0; i < sizeof(capsList) / sizeof(capsList[0]); i++) {
+    ring->buffer = (char *)heap_caps_malloc(frames * frameSize, capsList[i]);
+    if (ring->buffer != NULL) {
+      ring->caps = capsList[i];
+
+      break;
+    }
+  }
+
+  if (ring->buffer == NULL) {
+    return -2;
+  }
+
+  ring->frames = frames;
+  ring->frameSize = frameSize;
+  ring->sr = sr;
+
+  return 0;
+}
+
+/**
+ *
+ */
+void pcm_ring_deinit(pcm_ring_t *ring) {
+  if (ring->buffer) {
+    heap_caps_free(ring->buffer);
+  }
+
+  memset(ring, 0, sizeof(pcm_ring_t));
+}
+
+/**
+ * IRAM only allows 32 bit accesses, src == NULL writes silence
+ */
+static void pcm_ring_copy(pcm_ring_t *ring, char *dst, const char *src,
+                          uint32_t bytes) {
+  if (ring->caps & MALLOC_CAP_EXEC) {
+    uint32_t *d = (uint32_t *)dst;
+    uint32_t word = 0;
+
+    for (uint32_t i = 0; i < bytes; i += 4) {
+      if (src != NULL) {
+        memcpy(&word, &src[i], 4);
+      }
+      *d++ = word;
+    }
+  } else if (src != NULL) {
+    memcpy(dst, src, bytes);
+  } else {
+    memset(dst, 0, bytes);
+  }
+}
+
+/**
+ *
+ */
+uint32_t pcm_ring_free_frames(pcm_ring_t *ring) {
+  return ring->frames - (ring->writeFrame - pcm_ring_load(ring->readFrame));
+}
+
+/**
+ *
+ */
+int32_t pcm_ring_write(pcm_ring_t *ring, int64_t time_us, const char *data,
+                       uint32_t bytes) {
+  uint32_t frames = bytes / ring->frameSize;
+  uint32_t head = ring->anchorHead;
+  uint32_t write = ring->writeFrame;
+  uint32_t pos, first;
+  bool newAnchor = true;
+
+  if (frames == 0) {
+    return 0;
+  }
+
+  if (frames > pcm_ring_free_frames(ring)) {
+    return -1;
+  }
+
+  if (head != pcm_ring_load(ring->anchorTail)) {
+    const pcm_ring_anchor_t *last =
+        &ring->anchor[(head - 1) % PCM_RING_MAX_ANCHORS];
+    int64_t expected = last->time_us + (int64_t)(write - last->frame) *
+                                           1000000LL / (int64_t)ring->sr;
+    int64_t diff = time_us - expected;
+
+    // chunk continues the previous one if it is off by less than a frame
+    newAnchor = ((diff < 0) ? -diff : diff) * (int64_t)ring->sr >= 1000000LL;
+  }
+
+  if (newAnchor) {
+    if (head - pcm_ring_load(ring->anchorTail) >= PCM_RING_MAX_ANCHORS) {
+      return -1;
+    }
+
+    ring->anchor[head % PCM_RING_MAX_ANCHORS].frame = write;
+    ring->anchor[head % PCM_RING_MAX_ANCHORS].time_us = time_us;
+    pcm_ring_store(ring->anchorHead, head + 1);
+  }
+
+  pos = write % ring->frames;
+  first = ring->frames - pos;
+  if (first > frames) {
+    first = frames;
+  }
+
+  pcm_ring_copy(ring, &ring->buffer[pos * ring->frameSize], data,
+                first * ring->frameSize);
+  if (frames > first) {
+    pcm_ring_copy(ring, ring->buffer,
+                  (data != NULL) ? &data[first * ring->frameSize] : NULL,
+                  (frames - first) * ring->frameSize);
+  }
+
+  pcm_ring_store(ring->writeFrame, write + frames);
+
+  return 0;
+}
+
+/**
+ *
+ */
+uint32_t pcm_ring_available(pcm_ring_t *ring) {
+  return pcm_ring_load(ring->writeFrame) - ring->readFrame;
+}
+
+/**
+ *
+ */
+uint32_t pcm_ring_read_span(pcm_ring_t *ring, const char **data) {
+  uint32_t available = pcm_ring_available(ring);
+  uint32_t pos = ring->readFrame % ring->frames;
+  uint32_t frames = ring->frames - pos;
+
+  if (frames > available) {
+    frames = available;
+  }
+
+  *data = &ring->buffer[pos * ring->frameSize];
+
+  return frames;
+}
+
+/**
+ * drop anchors the read cursor has passed, the newest one always stays
+ */
+static void pcm_ring_pop_anchors(pcm_ring_t *ring) {
+  uint32_t head = pcm_ring_load(ring->anchorHead);
+  uint32_t tail = ring->anchorTail;
+
+  while ((head - tail > 1) &&
+         ((int32_t)(ring->anchor[(tail + 1) % PCM_RING_MAX_ANCHORS].frame -
+                    ring->readFrame) <= 0)) {
+    tail++;
+  }
+
+  pcm_ring_store(ring->anchorTail, tail);
+}
+
+/**
+ *
+ */
+void pcm_ring_consume(pcm_ring_t *ring, uint32_t frames) {
+  uint32_t available = pcm_ring_available(ring);
+
+  if (frames > available) {
+    frames = available;
+  }
+
+  pcm_ring_store(ring->readFrame, ring->readFrame + frames);
+
+  pcm_ring_pop_anchors(ring);
+}
+
+/**
+ *
+ */
+bool pcm_ring_read_time(pcm_ring_t *ring, int64_t *time_us) {
+  const pcm_ring_anchor_t *anchor;
+
+  if (pcm_ring_available(ring) == 0) {
+    return false;
+  }
+
+  // anchors of frames published by now are visible as well
+  pcm_ring_pop_anchors(ring);
+
+  anchor = &ring->anchor[ring->anchorTail % PCM_RING_MAX_ANCHORS];
+  *time_us = anchor->time_us + (int64_t)(ring->readFrame - anchor->frame) *
+                                   1000000LL / (int64_t)ring->sr;
+
+  return true;
+}
+
+/**
+ *
+ */
+uint32_t pcm_ring_seek(pcm_ring_t *ring, int64_t time_us) {
+  uint32_t dropped = 0;
+  int64_t now;
+
+  while (pcm_ring_read_time(ring, &now) && (now < time_us)) {
+    uint32_t head = pcm_ring_load(ring->anchorHead);
+    uint32_t tail = ring->anchorTail;
+    int64_t n = ((time_us - now) * (int64_t)ring->sr + 999999LL) / 1000000LL;
+    uint32_t available = pcm_ring_available(ring);
+
+    if (n > available) {
+      n = available;
+    }
+
+    // don't skip over a discontinuity, its time is checked in the next round
+    if (head - tail > 1) {
+      uint32_t next = ring->anchor[(tail + 1) % PCM_RING_MAX_ANCHORS].frame -
+                      ring->readFrame;
+
+      if (n > next) {
+        n = next;
+      }
+    }
+
+    if (n <= 0) {
+      break;
+    }
+
+    pcm_ring_consume(ring, n);
+    dropped += n;
+  }
+
+  return dropped;
+}
+
+/**
+ *
+ */
+void pcm_ring_flush(pcm_ring_t *ring) {
+  pcm_ring_consume(ring, pcm_ring_available(ring));
+}
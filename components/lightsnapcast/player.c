@@ -23,30 +23,45 @@
 
 #include <math.h>
 
-#include "MedianFilter.h"
+#include "apll_steer.h"
 #include "driver/gptimer.h"
 #include "driver/i2s_std.h"
+#include "clock_model.h"
+#include "pcm_pack.h"
+#include "pcm_pool.h"
+#include "pcm_ring.h"
 #include "player.h"
+#include "resampler.h"
+#include "slew.h"
 #include "snapcast.h"
+#include "sync_control.h"
 
 #define USE_SAMPLE_INSERTION CONFIG_USE_SAMPLE_INSERTION
 
 #define SYNC_TASK_PRIORITY (configMAX_PRIORITIES - 1)
 #define SYNC_TASK_CORE_ID 1  // tskNO_AFFINITY
 
+// chunks held by http_get_task() and player_task() outside of the queue
+#define PCM_POOL_IN_FLIGHT_SLOTS 3
+// decode ahead window grows with decode time, see http_get_task()
+#define PCM_POOL_DECODE_AHEAD_SLACK_MS 100
+// time left after a seek to preload DMA and start the sync timer, initial
+// sync starts at the first frame due this late
+#define PLAYER_SYNC_LEAD_US 5000
+
 static const char *TAG = "PLAYER";
 
+// time constant of the playback rate control loop
+#define PLAYER_RATE_TAU_MS 10000
 #if USE_SAMPLE_INSERTION
-
-#define INSERT_SAMPLES \
-  1  //!< currently only allowed to be 1 or sync algorithm will break
-
-const uint32_t SHORT_OFFSET = 128;
-const uint32_t MINI_OFFSET = 64;
-
+// rate correction limit, crystal tolerance of server and client
+#define PLAYER_RATE_MAX_PPB 500000
+// frames resampled at once before they are written to DMA
+#define PLAYER_RESAMPLE_FRAMES 128
 #else
-const uint32_t SHORT_OFFSET = 2;
-const uint32_t MINI_OFFSET = 1;
+// rate correction limit, crystal tolerance of server and client, well
+// within the range the APLL locks at with the nominal output divider
+#define PLAYER_RATE_MAX_PPB 200000
 #endif
 
 /**
@@ -57,30 +72,34 @@ const uint32_t MINI_OFFSET = 1;
  * I2S bit clock is (apll_freq / 16)
  */
 static uint32_t apll_normal_predefine[6] = {0, 0, 0, 0, 0, 0};
-static uint32_t apll_corr_predefine[][6] = {{0, 0, 0, 0, 0, 0},
-                                            {0, 0, 0, 0, 0, 0}};
 
 static SemaphoreHandle_t latencyBufSemaphoreHandle = NULL;
 
-static bool latencyBuffFull = 0;
-
 static gptimer_handle_t gptimer = NULL;
 
-static sMedianFilter_t latencyMedianFilter;
-static sMedianNode_t latencyMedianLong[LATENCY_MEDIAN_FILTER_LEN];
-
-static sMedianFilter_t shortMedianFilter;
-static sMedianNode_t shortMedianBuffer[SHORT_BUFFER_LEN];
+static clock_model_t clockModel;
 
-static sMedianFilter_t miniMedianFilter;
-static sMedianNode_t miniMedianBuffer[MINI_BUFFER_LEN];
+static sync_control_t syncControl;
+static slew_t slew;
 
-static int64_t latencyToServer = 0;
-
-static int8_t currentDir = 0;  //!< current apll direction, see apll_adjust()
+#if USE_SAMPLE_INSERTION
+static resampler_t resampler;
+static uint32_t resampleBuf[2 * PLAYER_RESAMPLE_FRAMES];
+#else
+static apll_steer_t apllSteer;  //!< offset from apll_normal_predefine
+#endif
 
 static QueueHandle_t pcmChkQHdl = NULL;
 
+#if CONFIG_SNAPCLIENT_USE_PCM_RING_BUFFER
+static pcm_ring_t pcmRing;
+static uint32_t pcmRingChunkFrames = 0;
+// guards (re)creation of the ring against insert_pcm_chunk()
+static SemaphoreHandle_t pcmRingMux = NULL;
+// given by insert_pcm_chunk(), so player_task() can wait for data
+static SemaphoreHandle_t pcmRingDataSemaphore = NULL;
+#endif
+
 static TaskHandle_t playerTaskHandle = NULL;
 
 static QueueHandle_t snapcastSettingQueueHandle = NULL;
@@ -91,6 +110,9 @@ static uint32_t i2sDmaBufMaxLen;
 static SemaphoreHandle_t snapcastSettingsMux = NULL;
 static snapcastSetting_t currentSnapcastSetting;
 
+// wire chunks dropped undecoded by player_skip_late_chunk()
+static uint32_t skippedChunks = 0;
+
 static void tg0_timer_init(void);
 static void tg0_timer_deinit(void);
 
@@ -146,8 +168,9 @@ static esp_err_t player_setup_i2s(snapcastSetting_t *setting) {
     sr = 44100;
   }
 
-  // ensure save setting
-  int bits = setting->bits;
+  // ensure save setting, slots are as wide as the samples in a chunk, see
+  // pcm_pack_container_bits()
+  int bits = pcm_pack_container_bits(setting->bits);
   if (bits == 0) {
     bits = I2S_DATA_BIT_WIDTH_16BIT;
   }
@@ -200,25 +223,9 @@ static esp_err_t player_setup_i2s(snapcastSetting_t *setting) {
     ESP_LOGE(TAG, "ERROR, fi2s_clk");
   }
 
-#define UPPER_SR_SCALER 1.0001
-#define LOWER_SR_SCALER 0.9999
-
-  apll_corr_predefine[0][0] = bits;
-  apll_corr_predefine[0][1] = sr * UPPER_SR_SCALER;
-  if (rtc_clk_apll_coeff_calc(
-          fi2s_clk * UPPER_SR_SCALER, &apll_corr_predefine[0][5],
-          &apll_corr_predefine[0][2], &apll_corr_predefine[0][3],
-          &apll_corr_predefine[0][4]) == 0) {
-    ESP_LOGE(TAG, "ERROR, fi2s_clk * %f", UPPER_SR_SCALER);
-  }
-  apll_corr_predefine[1][0] = bits;
-  apll_corr_predefine[1][1] = sr * LOWER_SR_SCALER;
-  if (rtc_clk_apll_coeff_calc(
-          fi2s_clk * LOWER_SR_SCALER, &apll_corr_predefine[1][5],
-          &apll_corr_predefine[1][2], &apll_corr_predefine[1][3],
-          &apll_corr_predefine[1][4]) == 0) {
-    ESP_LOGE(TAG, "ERROR, fi2s_clk * %f", LOWER_SR_SCALER);
-  }
+  // corrections are derived from these, see player_rate_set()
+  apll_steer_init(&apllSteer, apll_normal_predefine[2],
+                  apll_normal_predefine[3], apll_normal_predefine[4]);
 #endif
 
   if (tx_chan) {
@@ -255,7 +262,7 @@ static esp_err_t player_setup_i2s(snapcastSetting_t *setting) {
       .clk_cfg = i2s_clkcfg,
 #if CONFIG_I2S_USE_MSB_FORMAT
       .slot_cfg =
-          I2S_STD_MSB_SLOT_DEFAULT_CONFIG(setting->bits, I2S_SLOT_MODE_STEREO),
+          I2S_STD_MSB_SLOT_DEFAULT_CONFIG(bits, I2S_SLOT_MODE_STEREO),
 #else
       .slot_cfg =
           I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(bits, I2S_SLOT_MODE_STEREO),
@@ -322,6 +329,16 @@ int deinit_player(void) {
 
   ret = destroy_pcm_queue(&pcmChkQHdl);
 
+#if CONFIG_SNAPCLIENT_USE_PCM_RING_BUFFER
+  if (pcmRingMux != NULL) {
+    xSemaphoreTake(pcmRingMux, portMAX_DELAY);
+    pcm_ring_deinit(&pcmRing);
+    xSemaphoreGive(pcmRingMux);
+  }
+#endif
+
+  pcm_pool_deinit();
+
   if (latencyBufSemaphoreHandle == NULL) {
     ESP_LOGW(TAG, "no latency buffer semaphore created?");
   } else {
@@ -373,18 +390,20 @@ int init_player(i2s_std_gpio_config_t pin_config0_, i2s_port_t i2sNum_) {
     latencyBufSemaphoreHandle = xSemaphoreCreateMutex();
   }
 
-  // init diff buff median filter
-  latencyMedianFilter.numNodes = LATENCY_MEDIAN_FILTER_LEN;
-  latencyMedianFilter.medianBuffer = latencyMedianLong;
-  reset_latency_buffer();
+#if CONFIG_SNAPCLIENT_USE_PCM_RING_BUFFER
+  if (pcmRingMux == NULL) {
+    pcmRingMux = xSemaphoreCreateMutex();
+  }
+
+  if (pcmRingDataSemaphore == NULL) {
+    pcmRingDataSemaphore = xSemaphoreCreateBinary();
+  }
+#endif
 
-  shortMedianFilter.numNodes = SHORT_BUFFER_LEN;
-  shortMedianFilter.medianBuffer = shortMedianBuffer;
-  MEDIANFILTER_Init(&shortMedianFilter);
+  reset_latency_buffer();
 
-  miniMedianFilter.numNodes = MINI_BUFFER_LEN;
-  miniMedianFilter.medianBuffer = miniMedianBuffer;
-  MEDIANFILTER_Init(&miniMedianFilter);
+  sync_control_init(&syncControl, PLAYER_RATE_TAU_MS, PLAYER_RATE_MAX_PPB,
+                    SYNC_CONTROL_SOFT_RESYNC_US, SYNC_CONTROL_HARD_RESYNC_US);
 
   tg0_timer_init();
 
@@ -434,30 +453,95 @@ int8_t player_get_snapcast_settings(snapcastSetting_t *setting) {
 /**
  *
  */
-int32_t player_latency_insert(int64_t newValue) {
-  int64_t medianValue;
+int32_t player_latency_insert(int64_t localTime_us, int64_t diff_us,
+                              int64_t rtt_us) {
+  int32_t ret;
 
-  medianValue = MEDIANFILTER_Insert(&latencyMedianFilter, newValue);
-  if (xSemaphoreTake(latencyBufSemaphoreHandle, pdMS_TO_TICKS(0)) == pdTRUE) {
-    if (MEDIANFILTER_isFull(&latencyMedianFilter, LATENCY_MEDIAN_FILTER_FULL)) {
-      latencyBuffFull = true;
+  if (xSemaphoreTake(latencyBufSemaphoreHandle, pdMS_TO_TICKS(1)) == pdFALSE) {
+    ESP_LOGW(TAG, "couldn't insert time sync sample");
 
-      //      ESP_LOGI(TAG, "(full) latency median: %lldus", medianValue);
-    }
-    //    else {
-    //      ESP_LOGI(TAG, "(not full) latency median: %lldus", medianValue);
-    //    }
+    return -1;
+  }
 
-    latencyToServer = medianValue;
+  ret = clock_model_insert(&clockModel, localTime_us, diff_us, rtt_us);
 
-    xSemaphoreGive(latencyBufSemaphoreHandle);
-  } else {
-    ESP_LOGW(TAG, "couldn't set latencyToServer = medianValue");
+  xSemaphoreGive(latencyBufSemaphoreHandle);
+
+  if (ret == 2) {
+    ESP_LOGW(TAG, "server clock stepped, time sync restarted");
+  }
+
+  return ret;
+}
+
+/**
+ *
+ */
+int32_t player_clock_skew_error(int32_t *skewErr_ppb) {
+  if (latencyBufSemaphoreHandle == NULL) {
+    return -2;
   }
 
+  if (xSemaphoreTake(latencyBufSemaphoreHandle, portMAX_DELAY) == pdFALSE) {
+    return -1;
+  }
+
+  *skewErr_ppb = clockModel.skewErr_ppb;
+
+  xSemaphoreGive(latencyBufSemaphoreHandle);
+
   return 0;
 }
 
+/**
+ * decoded audio buffered in front of the player
+ */
+static int64_t player_pcm_buffer_ms(const snapcastSetting_t *setting) {
+#if CONFIG_SNAPCLIENT_COMPRESSED_JITTER_BUFFER
+  // http_get_task() keeps compressed chunks and only decodes a short window
+  // ahead of playback
+  int64_t pcmMs = 1000LL * player_get_dma_buffer_frames() / setting->sr +
+                  CONFIG_SNAPCLIENT_DECODE_AHEAD_MARGIN_MS +
+                  PCM_POOL_DECODE_AHEAD_SLACK_MS;
+
+  if (pcmMs > setting->buf_ms) {
+    pcmMs = setting->buf_ms;
+  }
+
+  return pcmMs;
+#else
+  return setting->buf_ms;
+#endif
+}
+
+/**
+ * size the chunk pool for the PCM the player queue holds at most, plus
+ * chunks being decoded and played right now
+ */
+static void player_setup_pcm_pool(const snapcastSetting_t *setting) {
+  uint32_t slots;
+  size_t chunkBytes;
+
+  if ((setting->sr <= 0) || (setting->chkInFrames == 0) ||
+      (setting->ch == 0) || (setting->bits == 0) || (setting->buf_ms == 0)) {
+    return;
+  }
+
+#if CONFIG_SNAPCLIENT_USE_PCM_RING_BUFFER
+  // insert_pcm_chunk() copies chunks to the ring right away
+  slots = PCM_POOL_IN_FLIGHT_SLOTS;
+#else
+  slots = ceil(((float)setting->sr / (float)setting->chkInFrames) *
+               ((float)player_pcm_buffer_ms(setting) / 1000)) +
+          PCM_POOL_IN_FLIGHT_SLOTS;
+#endif
+  chunkBytes = setting->chkInFrames * setting->ch * (setting->bits / 8);
+
+  if (pcm_pool_setup(slots, chunkBytes) < 0) {
+    ESP_LOGW(TAG, "no pcm chunk pool, allocating chunks from heap");
+  }
+}
+
 /**
  *
  */
@@ -494,6 +578,8 @@ int32_t player_send_snapcast_setting(snapcastSetting_t *setting) {
           (curSet.chkInFrames == setting->chkInFrames) &&
           (curSet.codec == setting->codec) && (curSet.sr == setting->sr) &&
           (curSet.cDacLat_ms == setting->cDacLat_ms))) == false) {
+      player_setup_pcm_pool(setting);
+
       // notify needed
       ret = xQueueOverwrite(snapcastSettingQueueHandle, &settingChanged);
       if (ret != pdPASS) {
@@ -511,13 +597,6 @@ int32_t player_send_snapcast_setting(snapcastSetting_t *setting) {
  *
  */
 int32_t reset_latency_buffer(void) {
-  // init diff buff median filter
-  if (MEDIANFILTER_Init(&latencyMedianFilter) < 0) {
-    ESP_LOGE(TAG, "reset_diff_buffer: couldn't init median filter long. STOP");
-
-    return -2;
-  }
-
   if (latencyBufSemaphoreHandle == NULL) {
     ESP_LOGE(TAG, "reset_diff_buffer: latencyBufSemaphoreHandle == NULL");
 
@@ -525,8 +604,7 @@ int32_t reset_latency_buffer(void) {
   }
 
   if (xSemaphoreTake(latencyBufSemaphoreHandle, portMAX_DELAY) == pdTRUE) {
-    latencyBuffFull = false;
-    latencyToServer = 0;
+    clock_model_reset(&clockModel);
 
     xSemaphoreGive(latencyBufSemaphoreHandle);
   } else {
@@ -558,7 +636,7 @@ int32_t latency_buffer_full(bool *is_full, TickType_t wait) {
     return -1;
   }
 
-  *is_full = latencyBuffFull;
+  *is_full = clock_model_ready(&clockModel);
 
   xSemaphoreGive(latencyBufSemaphoreHandle);
 
@@ -566,9 +644,10 @@ int32_t latency_buffer_full(bool *is_full, TickType_t wait) {
 }
 
 /**
- *
+ * offset extrapolated to local time now, 0 as long as the clock model isn't
+ * ready
  */
-int32_t get_diff_to_server(int64_t *tDiff) {
+static int32_t get_diff_to_server_at(int64_t now, int64_t *tDiff) {
   static int64_t lastDiff = 0;
 
   if (latencyBufSemaphoreHandle == NULL) {
@@ -586,15 +665,26 @@ int32_t get_diff_to_server(int64_t *tDiff) {
     return -1;
   }
 
-  *tDiff = latencyToServer;
-  lastDiff = latencyToServer;  // store value, so we can return a value if
-                               // semaphore couldn't be taken
+  if (clock_model_ready(&clockModel)) {
+    *tDiff = clock_model_offset(&clockModel, now);
+  } else {
+    *tDiff = 0;
+  }
+  lastDiff = *tDiff;  // store value, so we can return a value if
+                      // semaphore couldn't be taken
 
   xSemaphoreGive(latencyBufSemaphoreHandle);
 
   return 0;
 }
 
+/**
+ *
+ */
+int32_t get_diff_to_server(int64_t *tDiff) {
+  return get_diff_to_server_at(esp_timer_get_time(), tDiff);
+}
+
 /**
  *
  */
@@ -607,7 +697,7 @@ int32_t server_now(int64_t *sNow, int64_t *diff2Server) {
 
   now = esp_timer_get_time();
 
-  if (get_diff_to_server(&diff) == -1) {
+  if (get_diff_to_server_at(now, &diff) == -1) {
     // ESP_LOGW(TAG,
     //          "server_now: can't get current diff to server. Retrieved old
     //          one");
@@ -632,6 +722,67 @@ int32_t server_now(int64_t *sNow, int64_t *diff2Server) {
   return 0;
 }
 
+/**
+ * A chunk is hopelessly late if its last frame is due before anything handed
+ * to the player now can reach the DAC, that is before the DMA buffer has
+ * played out. player_task() would only drop it after it was decoded and
+ * queued, so it is counted and should be dropped right away.
+ *
+ * @param[in] timestamp Server time of the chunk's first frame.
+ * @param[in] frames Length of the chunk, an estimate for compressed chunks.
+ * @return true if the chunk should be skipped.
+ */
+bool player_skip_late_chunk(tv_t timestamp, uint32_t frames) {
+  snapcastSetting_t setting;
+  int64_t serverNow, playout, horizon;
+
+  player_get_snapcast_settings(&setting);
+  if ((setting.sr <= 0) || (setting.buf_ms == 0)) {
+    return false;
+  }
+
+  if (server_now(&serverNow, NULL) < 0) {
+    return false;
+  }
+
+  // server time the chunk's last frame is played at, like age in
+  // player_task()
+  playout = (int64_t)timestamp.sec * 1000000LL + timestamp.usec +
+            (int64_t)setting.buf_ms * 1000LL -
+            (int64_t)setting.cDacLat_ms * 1000LL +
+            1000000LL * frames / setting.sr;
+  horizon =
+      serverNow + 1000000LL * player_get_dma_buffer_frames() / setting.sr;
+
+  if (playout >= horizon) {
+    return false;
+  }
+
+  skippedChunks++;
+
+  return true;
+}
+
+/**
+ *
+ */
+uint32_t player_get_skipped_chunks(void) { return skippedChunks; }
+
+/**
+ *
+ */
+void player_get_sync_stats(player_sync_stats_t *stats) {
+  sync_control_stats_t scStats;
+
+  sync_control_get_stats(&syncControl, &scStats);
+
+  stats->softResyncs = scStats.softResyncs;
+  stats->hardResyncs = scStats.hardResyncs;
+  stats->starved = scStats.starved;
+  stats->skippedFrames = slew.skipped;
+  stats->insertedFrames = slew.inserted;
+}
+
 /*
  * Timer group0 ISR handler
  *
@@ -741,49 +892,177 @@ static void tg0_timer1_start(uint64_t alarm_value) {
   // ESP_LOGI(TAG, "started age timer");
 }
 
-#if !USE_SAMPLE_INSERTION
-// void rtc_clk_apll_enable(bool enable, uint32_t sdm0, uint32_t sdm1, uint32_t
-// sdm2, uint32_t o_div); apll_freq = xtal_freq * (4 + sdm2 + sdm1/256 +
-// sdm0/65536)/((o_div + 2) * 2) xtal == 40MHz on lyrat v4.3 I2S bit_clock =
-// rate * (number of channels) * bits_per_sample
-void adjust_apll(int8_t direction) {
-  int sdm0, sdm1, sdm2, o_div;
-
-  // only change if necessary
-  if (currentDir == direction) {
-    return;
+/**
+ * Start I2S on the alarm set by tg0_timer1_start(), the DMA buffers are
+ * preloaded by the caller. Blocks until the alarm and returns the timer
+ * value it was notified with.
+ */
+static int64_t player_start_at_alarm(bool muted) {
+  uint32_t notifiedValue;
+
+  // Wait to be notified of a timer interrupt.
+  xTaskNotifyWait(pdFALSE,         // Don't clear bits on entry.
+                  pdFALSE,         // Don't clear bits on exit.
+                  &notifiedValue,  // Stores the notified value.
+                  portMAX_DELAY);
+
+  my_gptimer_stop(gptimer);
+
+  my_i2s_channel_enable(tx_chan);
+
+  // TODO: use a timer to un-mute non blocking
+  vTaskDelay(pdMS_TO_TICKS(2));
+  audio_set_mute(muted);
+
+  return (int64_t)notifiedValue;
+}
+
+/**
+ * Play at ppb off the nominal rate, positive is faster.
+ */
+static void player_rate_set(int32_t ppb) {
+#if USE_SAMPLE_INSERTION
+  resampler_set_ppb(&resampler, ppb);
+#else
+  // apll_freq = xtal_freq * (4 + sdm2 + sdm1/256 + sdm0/65536) /
+  // ((o_div + 2) * 2), coefficients only change every few ppm
+  if (apll_steer_update(&apllSteer, ppb)) {
+    rtc_clk_apll_coeff_set(
+        apll_normal_predefine[5], apll_steer_sdm0(&apllSteer),
+        apll_steer_sdm1(&apllSteer), apll_steer_sdm2(&apllSteer));
   }
+#endif
+}
 
-  if (direction == 1) {
-    // speed up
-    sdm0 = apll_corr_predefine[0][2];
-    sdm1 = apll_corr_predefine[0][3];
-    sdm2 = apll_corr_predefine[0][4];
-    o_div = apll_corr_predefine[0][5];
-  } else if (direction == -1) {
-    // slow down
-    sdm0 = apll_corr_predefine[1][2];
-    sdm1 = apll_corr_predefine[1][3];
-    sdm2 = apll_corr_predefine[1][4];
-    o_div = apll_corr_predefine[1][5];
-  } else {
-    // reset to normal playback speed
-    sdm0 = apll_normal_predefine[2];
-    sdm1 = apll_normal_predefine[3];
-    sdm2 = apll_normal_predefine[4];
-    o_div = apll_normal_predefine[5];
+/**
+ * Restart sync control after a (re)sync. The rate starts at the skew of
+ * the server clock estimated by the clock model, I2S runs from the same
+ * crystal as the local timer.
+ */
+static void player_rate_reset(void) {
+  int32_t skew_ppb = 0;
+
+  if (xSemaphoreTake(latencyBufSemaphoreHandle, portMAX_DELAY) == pdTRUE) {
+    if (clockModel.skewValid) {
+      skew_ppb = clockModel.skew_ppb;
+    }
 
-    direction = 0;
+    xSemaphoreGive(latencyBufSemaphoreHandle);
   }
 
-  //  periph_rtc_apll_acquire();
-  rtc_clk_apll_coeff_set(o_div, sdm0, sdm1, sdm2);
-  // rtc_clk_apll_enable(1, sdm0, sdm1, sdm2, o_div);
+#if USE_SAMPLE_INSERTION
+  resampler_reset(&resampler);
+#endif
+  slew_reset(&slew);
+  sync_control_reset(&syncControl, skew_ppb);
+  player_rate_set(syncControl.ppb);
+}
+
+/**
+ * Jump to where playback should be, without a gap. Frames are skipped or
+ * inserted at the next chunk boundaries.
+ */
+static void player_slew_start(uint32_t sr, int64_t age) {
+  int32_t frames = (int32_t)(syncControl.slew_us * (int64_t)sr / 1000000);
+
+  slew_start(&slew, frames);
 
-  currentDir = direction;
+  ESP_LOGW(TAG, "RESYNCING SOFT: age %lldus, %s %ld frames, soft %lu hard %lu",
+           age, (frames > 0) ? "skipping" : "inserting", labs(frames),
+           syncControl.stats.softResyncs, syncControl.stats.hardResyncs);
 }
+
+#if USE_SAMPLE_INSERTION
+/**
+ * Resample frames to DMA at the current rate.
+ *
+ * @param[in] data Frames, 32 bit aligned.
+ * @param[in] frames Count of frames.
+ * @param[in,out] dmaFill Frames in the DMA buffer being filled.
+ */
+static void player_write_resampled(const char *data, uint32_t frames,
+                                   uint32_t *dmaFill) {
+  uint32_t frameSize = resampler.bits / 4;
+  size_t written;
+
+  while (frames > 0) {
+    uint32_t used, n;
+
+    n = resampler_process(&resampler, (const uint32_t *)data, frames, &used,
+                          resampleBuf, PLAYER_RESAMPLE_FRAMES);
+    data += used * frameSize;
+    frames -= used;
+
+    if (n == 0) {
+      continue;
+    }
+
+    if (i2s_channel_write(tx_chan, resampleBuf, n * frameSize, &written,
+                          portMAX_DELAY) != ESP_OK) {
+      ESP_LOGE(TAG, "i2s_playback_task:  I2S write error %d", 1);
+    }
+
+    *dmaFill = (*dmaFill + written / frameSize) % i2sDmaBufMaxLen;
+  }
+}
+#endif
+
+/**
+ * Time until the next frame written hits the DAC, DMA is full up to the
+ * buffer being filled. Resampled audio is late by the frames the resampler
+ * holds back.
+ */
+static int64_t player_output_buffer_dac_time(uint32_t sr, uint32_t dmaFill) {
+  int64_t frames;
+
+  if (dmaFill == 0) {
+    frames = i2sDmaBufMaxLen * i2sDmaBufCnt;
+  } else {
+    frames = i2sDmaBufMaxLen * (i2sDmaBufCnt - 1) + dmaFill;
+  }
+
+#if USE_SAMPLE_INSERTION
+  frames += resampler_lag_frames(&resampler);
 #endif
 
+  return 1000000LL * frames / sr;
+}
+
+/**
+ * Frames to skip from a frame of the given age on, so initial sync starts
+ * with the first frame which is due PLAYER_SYNC_LEAD_US from now or later.
+ *
+ * @param[in] age Age of the frame, greater than -PLAYER_SYNC_LEAD_US.
+ * @param[in] sr Sample rate.
+ */
+static uint32_t player_sync_skip_frames(int64_t age, uint32_t sr) {
+  return (uint32_t)(((age + PLAYER_SYNC_LEAD_US) * sr + 999999) / 1000000);
+}
+
+/**
+ * Locate a byte offset in a chunk's fragments.
+ *
+ * @param[in] chnk The chunk.
+ * @param[in] offset Bytes into the chunk, less than its totalSize.
+ * @param[out] fragment Fragment holding the byte.
+ * @param[out] payload The byte.
+ * @param[out] size Bytes left in the fragment from there.
+ */
+static void player_chunk_seek(const pcm_chunk_message_t *chnk, size_t offset,
+                              pcm_chunk_fragment_t **fragment, char **payload,
+                              size_t *size) {
+  pcm_chunk_fragment_t *f = chnk->fragment;
+
+  while ((offset >= f->size) && (f->nextFragment != NULL)) {
+    offset -= f->size;
+    f = f->nextFragment;
+  }
+
+  *fragment = f;
+  *payload = f->payload + offset;
+  *size = f->size - offset;
+}
+
 /**
  *
  */
@@ -794,17 +1073,17 @@ int8_t free_pcm_chunk_fragments(pcm_chunk_fragment_t *fragment) {
     return -1;
   }
 
-  // free all fragments recursive
-  if (fragment->nextFragment == NULL) {
+  // free all fragments
+  while (fragment != NULL) {
+    pcm_chunk_fragment_t *next = fragment->nextFragment;
+
     if (fragment->payload != NULL) {
       free(fragment->payload);
       fragment->payload = NULL;
     }
 
     free(fragment);
-    fragment = NULL;
-  } else {
-    free_pcm_chunk_fragments(fragment->nextFragment);
+    fragment = next;
   }
 
   return 0;
@@ -820,6 +1099,10 @@ int8_t free_pcm_chunk(pcm_chunk_message_t *pcmChunk) {
     return -1;
   }
 
+  if (pcm_pool_free(pcmChunk) == true) {
+    return 0;
+  }
+
   free_pcm_chunk_fragments(pcmChunk->fragment);
   pcmChunk->fragment = NULL;  // was freed in free_pcm_chunk_fragments()
 
@@ -886,95 +1169,6 @@ int32_t allocate_pcm_chunk_memory_caps(pcm_chunk_message_t *pcmChunk,
   return ret;
 }
 
-/**
- *
- */
-int32_t allocate_pcm_chunk_memory_caps_fragmented(pcm_chunk_message_t *pcmChunk,
-                                                  size_t bytes, uint32_t caps) {
-  size_t largestFreeBlock, freeMem;
-  int ret = -3;
-
-  // we got valid memory for pcm_chunk_message_t
-  // first we try to allocated 32 bit aligned memory for payload
-  // check available memory first so we can decide if we need to fragment the
-  // data
-  freeMem = heap_caps_get_free_size(caps);
-  largestFreeBlock = heap_caps_get_largest_free_block(caps);
-  if (freeMem >= bytes) {
-    // ESP_LOGI(TAG, "32b f %d b %d", freeMem, largestFreeBlock);
-
-    if (largestFreeBlock >= bytes) {
-      pcmChunk->fragment->payload = (char *)heap_caps_malloc(bytes, caps);
-      if (pcmChunk->fragment->payload == NULL) {
-        ESP_LOGE(TAG, "Failed to allocate IRAM memory for pcm chunk payload");
-
-        ret = -2;
-      } else {
-        pcmChunk->totalSize = bytes;
-        pcmChunk->fragment->nextFragment = NULL;
-        pcmChunk->fragment->size = bytes;
-
-        ret = 0;
-      }
-    } else {
-      size_t remainingBytes = bytes + (largestFreeBlock % 4);
-      size_t needBytes = largestFreeBlock - (largestFreeBlock % 4);
-      pcm_chunk_fragment_t *fragment = pcmChunk->fragment;
-
-      pcmChunk->totalSize = 0;
-
-      while (remainingBytes) {
-        fragment->payload = (char *)heap_caps_malloc(needBytes, caps);
-        if (fragment->payload == NULL) {
-          ESP_LOGE(TAG,
-                   "Failed to allocate fragmented IRAM memory for "
-                   "pcm chunk payload %d %d %d %d",
-                   needBytes, remainingBytes, heap_caps_get_free_size(caps),
-                   heap_caps_get_largest_free_block(caps));
-
-          ret = -2;
-
-          break;
-        } else {
-          fragment->size = needBytes;
-          remainingBytes -= needBytes;
-          pcmChunk->totalSize += needBytes;
-
-          if (remainingBytes > 0) {
-            fragment->nextFragment =
-                (pcm_chunk_fragment_t *)calloc(1, sizeof(pcm_chunk_fragment_t));
-            if (fragment->nextFragment == NULL) {
-              ESP_LOGE(TAG,
-                       "Failed to fragmented IRAM memory "
-                       "for pcm chunk fragment");
-
-              ret = -2;
-
-              break;
-            } else {
-              fragment = fragment->nextFragment;
-              largestFreeBlock = heap_caps_get_largest_free_block(caps);
-              if (largestFreeBlock >= remainingBytes) {
-                needBytes = remainingBytes;
-              } else {
-                needBytes = largestFreeBlock - (largestFreeBlock % 4);
-              }
-            }
-          } else {
-            ret = 0;
-          }
-        }
-      }
-    }
-  } else {
-    // ESP_LOGE (TAG, "couldn't get memory to insert chunk of size %d, IRAM
-    // freemem: %d blocksize %d", decodedWireChunk->size, freeMem,
-    // largestFreeBlock);
-  }
-
-  return ret;
-}
-
 /**
  *
  */
@@ -982,6 +1176,12 @@ int32_t allocate_pcm_chunk_memory(pcm_chunk_message_t **pcmChunk,
                                   size_t bytes) {
   int ret = -3;
 
+  *pcmChunk = pcm_pool_alloc(bytes);
+  if (*pcmChunk != NULL) {
+    return 0;
+  }
+
+  // pool is empty or not set up yet, fall back to heap
   *pcmChunk = (pcm_chunk_message_t *)calloc(1, sizeof(pcm_chunk_message_t));
   if (*pcmChunk == NULL) {
     ESP_LOGE(TAG, "Failed to allocate memory for pcm chunk message");
@@ -1014,15 +1214,6 @@ int32_t allocate_pcm_chunk_memory(pcm_chunk_message_t **pcmChunk,
                                          MALLOC_CAP_32BIT | MALLOC_CAP_EXEC);
     if (ret < 0) {
       ret = allocate_pcm_chunk_memory_caps(*pcmChunk, bytes, MALLOC_CAP_8BIT);
-      //      if (ret < 0) {
-      //        //      ret = allocate_pcm_chunk_memory_caps_fragmented
-      //        //(*pcmChunk, bytes, MALLOC_CAP_32BIT | MALLOC_CAP_EXEC);
-      //        if (ret < 0) {
-      //          // allocate_pcm_chunk_memory_caps_fragmented (*pcmChunk,
-      //          bytes,
-      //          // MALLOC_CAP_8BIT);
-      //        }
-      //      }
     }
 
     if (ret < 0) {
@@ -1092,6 +1283,47 @@ int32_t insert_pcm_chunk(pcm_chunk_message_t *pcmChunk) {
     return -3;
   }
 
+#if CONFIG_SNAPCLIENT_USE_PCM_RING_BUFFER
+  int64_t timestamp_us = (int64_t)pcmChunk->timestamp.sec * 1000000LL +
+                         (int64_t)pcmChunk->timestamp.usec;
+  pcm_chunk_fragment_t *fragment = pcmChunk->fragment;
+  int32_t ret = 0;
+
+  xSemaphoreTake(pcmRingMux, portMAX_DELAY);
+
+  if (pcmRing.buffer == NULL) {
+    xSemaphoreGive(pcmRingMux);
+
+    ESP_LOGW(TAG, "pcm ring not created");
+
+    free_pcm_chunk(pcmChunk);
+
+    return -2;
+  }
+
+  while ((fragment != NULL) && (ret == 0)) {
+    // payload is NULL if memory allocation failed, play silence then
+    ret = pcm_ring_write(&pcmRing, timestamp_us, fragment->payload,
+                         fragment->size);
+
+    timestamp_us += 1000000LL * (int64_t)(fragment->size / pcmRing.frameSize) /
+                    (int64_t)pcmRing.sr;
+    fragment = fragment->nextFragment;
+  }
+
+  if (ret < 0) {
+    ESP_LOGW(TAG, "send: pcm ring full, frames waiting %lu",
+             pcmRing.frames - pcm_ring_free_frames(&pcmRing));
+  }
+
+  xSemaphoreGive(pcmRingMux);
+
+  xSemaphoreGive(pcmRingDataSemaphore);
+
+  free_pcm_chunk(pcmChunk);
+
+  return 0;
+#else
   if (pcmChkQHdl == NULL) {
     ESP_LOGW(TAG, "pcm chunk queue not created");
 
@@ -1117,6 +1349,7 @@ int32_t insert_pcm_chunk(pcm_chunk_message_t *pcmChunk) {
   }
 
   return 0;
+#endif
 }
 
 /**
@@ -1125,13 +1358,257 @@ int32_t insert_pcm_chunk(pcm_chunk_message_t *pcmChunk) {
 int32_t pcm_chunk_queue_msg_waiting(void) {
   int ret = 0;
 
+#if CONFIG_SNAPCLIENT_USE_PCM_RING_BUFFER
+  // called by the producer, count buffered frames in chunks
+  xSemaphoreTake(pcmRingMux, portMAX_DELAY);
+  if ((pcmRing.buffer != NULL) && (pcmRingChunkFrames > 0)) {
+    uint32_t frames = pcmRing.frames - pcm_ring_free_frames(&pcmRing);
+
+    ret = (frames + pcmRingChunkFrames - 1) / pcmRingChunkFrames;
+  }
+  xSemaphoreGive(pcmRingMux);
+#else
   if (pcmChkQHdl) {
     ret = uxQueueMessagesWaiting(pcmChkQHdl);
   }
+#endif
+
+  return ret;
+}
+
+/**
+ * frames the player preloads to DMA on initial sync
+ */
+uint32_t player_get_dma_buffer_frames(void) {
+  return i2sDmaBufCnt * i2sDmaBufMaxLen;
+}
+
+#if CONFIG_SNAPCLIENT_USE_PCM_RING_BUFFER
+/**
+ * (re)create the ring for the decoded audio buffered in front of DMA
+ */
+static int player_ring_setup(const snapcastSetting_t *setting) {
+  uint32_t frameSize = setting->ch * (setting->bits >> 3);
+  int64_t frames;
+  int ret;
+
+#if CONFIG_SNAPCLIENT_COMPRESSED_JITTER_BUFFER
+  frames = (int64_t)setting->sr * player_pcm_buffer_ms(setting) / 1000;
+#else
+  // some of it is placed in DMA buffer, so we can save a little RAM here
+  frames = (int64_t)setting->sr * setting->buf_ms / 1000 -
+           player_get_dma_buffer_frames();
+#endif
+
+  // chunks are only written as a whole
+  if (frames < 2 * setting->chkInFrames) {
+    frames = 2 * setting->chkInFrames;
+  }
+
+  xSemaphoreTake(pcmRingMux, portMAX_DELAY);
+  pcm_ring_deinit(&pcmRing);
+  ret = pcm_ring_init(&pcmRing, frames, frameSize, setting->sr);
+  pcmRingChunkFrames = setting->chkInFrames;
+  xSemaphoreGive(pcmRingMux);
+
+  if (ret < 0) {
+    ESP_LOGE(TAG, "couldn't create pcm ring with %lld frames: %d", frames, ret);
+  } else {
+    ESP_LOGI(TAG, "created pcm ring with %lu frames", pcmRing.frames);
+  }
 
   return ret;
 }
 
+/**
+ * get in sync again, the next sync starts at the exact frame which is due
+ * then
+ */
+static void player_ring_resync_hard(int *initialSync) {
+  my_gptimer_stop(gptimer);
+
+  audio_set_mute(true);
+
+  my_i2s_channel_disable(tx_chan);
+
+  *initialSync = 0;
+}
+
+/**
+ * Play one chunk worth of frames from the pcm ring, writing its linear spans
+ * straight to DMA. On (re)sync frames which are due already are dropped
+ * exactly, so playback starts within one frame of the server time.
+ */
+static void player_ring_play(const snapcastSetting_t *scSet, int64_t buf_us,
+                             int64_t clientDacLatency_us, int *initialSync) {
+  static uint32_t dmaFill = 0;  // frames in the DMA buffer being filled
+  int64_t serverNow, diff2Server, age, frameTime, outputBufferDacTime_us;
+  sync_control_action_t action;
+  uint32_t frameSize = pcmRing.frameSize;
+  uint32_t remaining, frames;
+  const char *data;
+  size_t written;
+
+  if (pcmRing.buffer == NULL) {
+    vTaskDelay(pdMS_TO_TICKS(100));
+
+    return;
+  }
+
+  if ((*initialSync == 0) &&
+      (pcm_ring_read_time(&pcmRing, &frameTime) == false)) {
+    // wait for insert_pcm_chunk()
+    xSemaphoreTake(pcmRingDataSemaphore, pdMS_TO_TICKS(2000));
+
+    return;
+  }
+
+  if (*initialSync == 0) {
+    if (server_now(&serverNow, &diff2Server) < 0) {
+      vTaskDelay(pdMS_TO_TICKS(1));
+
+      return;
+    }
+
+    age = serverNow - frameTime - buf_us + clientDacLatency_us;
+
+    if (age > -PLAYER_SYNC_LEAD_US) {
+      // drop what is due until DMA is loaded and the timer is set up
+      uint32_t dropped =
+          pcm_ring_seek(&pcmRing, frameTime + age + PLAYER_SYNC_LEAD_US);
+
+      ESP_LOGW(TAG, "RESYNCING HARD 1: age %lldus, dropped %lu frames", age,
+               dropped);
+
+      return;
+    }
+
+    tg0_timer1_start(-age);  // timer with 1µs ticks
+
+    my_i2s_channel_disable(tx_chan);
+
+    player_rate_reset();
+
+    // preload DMA, if the ring runs empty the rest is filled after start
+    dmaFill = 0;
+    while ((frames = pcm_ring_read_span(&pcmRing, &data)) > 0) {
+      ESP_ERROR_CHECK(i2s_channel_preload_data(tx_chan, data,
+                                               frames * frameSize, &written));
+
+#if USE_SAMPLE_INSERTION
+      resampler_prime(&resampler, (const uint32_t *)data, written / frameSize);
+#endif
+      pcm_ring_consume(&pcmRing, written / frameSize);
+      dmaFill = (dmaFill + written / frameSize) % i2sDmaBufMaxLen;
+
+      if (written < frames * frameSize) {
+        ESP_LOGI(TAG, "DMA completely loaded");
+
+        break;
+      }
+    }
+
+    // get actual age after alarm
+    age = player_start_at_alarm(scSet->muted) - (-age);
+
+    *initialSync = 1;
+
+    ESP_LOGI(TAG, "initial sync age: %lldus", age);
+
+    return;
+  }
+
+  remaining = scSet->chkInFrames;
+
+  while ((remaining > 0) &&
+         ((frames = pcm_ring_read_span(&pcmRing, &data)) > 0)) {
+    if (frames > remaining) {
+      frames = remaining;
+    }
+
+    // a pending slew replaces the first frames of the chunk
+    if (remaining == scSet->chkInFrames) {
+      uint32_t used;
+      uint32_t n = slew_process(&slew, (const uint32_t *)data, frames, &used);
+
+      if (n > 0) {
+#if USE_SAMPLE_INSERTION
+        player_write_resampled((const char *)slew.head, n, &dmaFill);
+#else
+        i2s_channel_write(tx_chan, slew.head, n * frameSize, &written,
+                          portMAX_DELAY);
+        dmaFill = (dmaFill + written / frameSize) % i2sDmaBufMaxLen;
+#endif
+
+        pcm_ring_consume(&pcmRing, used);
+        remaining -= used;
+
+        continue;
+      }
+    }
+
+#if USE_SAMPLE_INSERTION
+    player_write_resampled(data, frames, &dmaFill);
+    written = frames * frameSize;
+#else
+    i2s_channel_write(tx_chan, data, frames * frameSize, &written,
+                      portMAX_DELAY);
+    dmaFill = (dmaFill + written / frameSize) % i2sDmaBufMaxLen;
+#endif
+
+    pcm_ring_consume(&pcmRing, written / frameSize);
+    remaining -= written / frameSize;
+  }
+
+  // the last DMA buffer may be filled partly only
+  outputBufferDacTime_us = player_output_buffer_dac_time(scSet->sr, dmaFill);
+
+  if (server_now(&serverNow, &diff2Server) < 0) {
+    vTaskDelay(pdMS_TO_TICKS(1));
+
+    return;
+  }
+
+  if (pcm_ring_read_time(&pcmRing, &frameTime) == false) {
+    wifi_ap_record_t ap;
+    esp_wifi_sta_get_ap_info(&ap);
+
+    ESP_LOGW(TAG, "RESYNCING HARD 2: pcm ring empty, latency %lldus, rssi: %d",
+             diff2Server, ap.rssi);
+
+    player_ring_resync_hard(initialSync);
+
+    return;
+  }
+
+  age = sync_control_age(serverNow, frameTime, buf_us, clientDacLatency_us,
+                         outputBufferDacTime_us);
+
+  action = sync_control_update(&syncControl, age,
+                               1000000LL * scSet->chkInFrames / scSet->sr,
+                               false);
+  if (action == SYNC_CONTROL_RESYNC_HARD) {
+    wifi_ap_record_t ap;
+    esp_wifi_sta_get_ap_info(&ap);
+
+    ESP_LOGW(TAG,
+             "RESYNCING HARD 2: age %lldus, latency %lldus, frames %lu, "
+             "rssi: %d",
+             age, diff2Server, pcm_ring_available(&pcmRing), ap.rssi);
+
+    player_ring_resync_hard(initialSync);
+
+    return;
+  }
+
+  if (action == SYNC_CONTROL_RESYNC_SOFT) {
+    player_slew_start(scSet->sr, age);
+  }
+
+  player_rate_set(syncControl.ppb);
+}
+#endif
+
 /**
  *
  */
@@ -1143,14 +1620,9 @@ static void player_task(void *pvParameters) {
   int64_t chunkDuration_us = 24000;
   char *p_payload = NULL;
   size_t size = 0;
-  uint32_t notifiedValue;
   snapcastSetting_t scSet;
   uint8_t scSetChgd = 0;
-  uint64_t timer_val;
   int initialSync = 0;
-  int dir = 0;
-  int32_t dir_insert_sample = 0;
-  int64_t insertedSamplesCounter = 0;
   int64_t buf_us = 0;
   pcm_chunk_fragment_t *fragment = NULL;
   size_t written;
@@ -1158,8 +1630,12 @@ static void player_task(void *pvParameters) {
   int64_t clientDacLatency_us = 0;
   int64_t diff2Server = 0;
   int64_t outputBufferDacTime_us = 0;
+#if USE_SAMPLE_INSERTION
+  uint32_t dmaFill = 0;  // frames in the DMA buffer being filled
+#else
   int64_t dmaDescDuration_us = 0;
   size_t alreadyWritten = 0;
+#endif
 
   memset(&scSet, 0, sizeof(snapcastSetting_t));
 
@@ -1206,18 +1682,34 @@ static void player_task(void *pvParameters) {
             return;
           }
 
+#if !USE_SAMPLE_INSERTION
           dmaDescDuration_us =
               1000000LL * (int64_t)i2sDmaBufMaxLen / (int64_t)__scSet.sr;
 
-#if !USE_SAMPLE_INSERTION
-          // force adjust_apll() to set playback speed
-          currentDir = 1;
-          adjust_apll(0);
+          // coefficients for the new rate are set on the next sync
+          player_rate_set(0);
+#else
+          resampler_init(&resampler, pcm_pack_container_bits(__scSet.bits));
 #endif
+          slew_init(&slew, pcm_pack_container_bits(__scSet.bits));
 
           initialSync = 0;
         }
 
+#if CONFIG_SNAPCLIENT_USE_PCM_RING_BUFFER
+        if ((scSet.buf_ms != __scSet.buf_ms) || (scSet.sr != __scSet.sr) ||
+            (scSet.bits != __scSet.bits) || (scSet.ch != __scSet.ch) ||
+            (pcmRing.buffer == NULL) ||
+            (pcmRing.frames < 2 * __scSet.chkInFrames)) {
+          player_ring_setup(&__scSet);
+
+          initialSync = 0;
+        } else {
+          xSemaphoreTake(pcmRingMux, portMAX_DELAY);
+          pcmRingChunkFrames = __scSet.chkInFrames;
+          xSemaphoreGive(pcmRingMux);
+        }
+#else
         static uint32_t queueCreatedWithChkInFrames = UINT32_MAX;
 
         if ((scSet.buf_ms != __scSet.buf_ms) ||
@@ -1239,6 +1731,7 @@ static void player_task(void *pvParameters) {
 
           ESP_LOGI(TAG, "created new queue with %d", entries);
         }
+#endif
 
         if ((scSet.sr != __scSet.sr) || (scSet.bits != __scSet.bits) ||
             (scSet.ch != __scSet.ch) || (scSet.buf_ms != __scSet.buf_ms)) {
@@ -1277,6 +1770,12 @@ static void player_task(void *pvParameters) {
       }
     }
 
+#if CONFIG_SNAPCLIENT_USE_PCM_RING_BUFFER
+    player_ring_play(&scSet, buf_us, clientDacLatency_us, &initialSync);
+
+    continue;
+#endif
+
     if (chnk == NULL) {
       if (pcmChkQHdl != NULL) {
         ret = xQueueReceive(pcmChkQHdl, &chnk, pdMS_TO_TICKS(2000));
@@ -1321,150 +1820,145 @@ static void player_task(void *pvParameters) {
           continue;
         }
 
-        if (age < 0) {  // get initial sync using hardware timer
-          bool dmaFull = false;
-
-          MEDIANFILTER_Init(&shortMedianFilter);
-          MEDIANFILTER_Init(&miniMedianFilter);
+        if (age > -PLAYER_SYNC_LEAD_US) {
+          // too late to start with the chunk's first frame, start with the
+          // first one which is due late enough
+          size_t framesToBytes = (scSet.ch * (scSet.bits >> 3));
+          uint32_t chunkFrames = chnk->totalSize / framesToBytes;
+          uint32_t skip = player_sync_skip_frames(age, scSet.sr);
 
-          tg0_timer1_start(-age);  // timer with 1µs ticks
+          if (skip >= chunkFrames) {
+            // get count of following chunks which are completely late too
+            uint32_t c = skip / chunkFrames - 1;
 
-          my_i2s_channel_disable(tx_chan);
+            free_pcm_chunk(chnk);
+            chnk = NULL;
 
-#if !USE_SAMPLE_INSERTION
-          adjust_apll(0);  // reset to normal playback speed
-#endif
-          while (1) {
-            if (chnk == NULL) {
-              if (pcmChkQHdl != NULL) {
-                ret = xQueueReceive(pcmChkQHdl, &chnk, pdMS_TO_TICKS(100));
-                // if (ret != pdFAIL) {
-                //   ESP_LOGI(TAG, "got pcm chunk with size %d",
-                //            chnk->fragment->size);
-                // }
+            // now clear all those chunks
+            while (c--) {
+              ret = xQueueReceive(pcmChkQHdl, &chnk, pdMS_TO_TICKS(1));
+              if (ret == pdPASS) {
+                free_pcm_chunk(chnk);
+                chnk = NULL;
+              } else {
+                break;
               }
-            } else {
-              // ESP_LOGI(TAG, "got pcm chunk with size %d",
-              // chnk->fragment->size);
             }
 
-            fragment = chnk->fragment;
-            p_payload = fragment->payload;
-            size = fragment->size;
+            wifi_ap_record_t ap;
+            esp_wifi_sta_get_ap_info(&ap);
 
-            ESP_ERROR_CHECK(
-                i2s_channel_preload_data(tx_chan, p_payload, size, &written));
+            my_gptimer_stop(gptimer);
 
-            // check if DMA is full at first try here
-            if (written != size) {
-              dmaFull = true;
-            }
+            ESP_LOGW(TAG,
+                     "RESYNCING HARD 1: age %lldus, latency %lldus, free %d, "
+                     "largest block %d, rssi: %d",
+                     age, diff2Server,
+                     heap_caps_get_free_size(MALLOC_CAP_32BIT),
+                     heap_caps_get_largest_free_block(MALLOC_CAP_32BIT),
+                     ap.rssi);
 
-            size -= written;
-            p_payload += written;
+            audio_set_mute(true);
 
-            if (size == 0) {
-              if (fragment->nextFragment != NULL) {
-                fragment = fragment->nextFragment;
-                p_payload = fragment->payload;
-                size = fragment->size;
-              } else {
-                free_pcm_chunk(chnk);
-                chnk = NULL;
-              }
-            }
+            my_i2s_channel_disable(tx_chan);
 
-            if (dmaFull == true) {
-              ESP_LOGI(TAG, "DMA completely loaded");
+            continue;
+          }
 
-              alreadyWritten = 0;
-              chunkStart -=
-                  (1000000LL * (int64_t)(i2sDmaBufCnt * i2sDmaBufMaxLen) /
-                   (int64_t)scSet.sr);
+          player_chunk_seek(chnk, skip * framesToBytes, &fragment, &p_payload,
+                            &size);
 
-              break;
-            }
-          }
+          // age of the frame started with, rounded to the timer's 1µs
+          age -= (1000000LL * skip + scSet.sr / 2) / scSet.sr;
 
-          // Wait to be notified of a timer interrupt.
-          xTaskNotifyWait(pdFALSE,         // Don't clear bits on entry.
-                          pdFALSE,         // Don't clear bits on exit.
-                          &notifiedValue,  // Stores the notified value.
-                          portMAX_DELAY);
-          // or use simple task delay for this
-          // vTaskDelay( pdMS_TO_TICKS(-age / 1000) );
+          ESP_LOGI(TAG, "initial sync %lu frames into the chunk", skip);
+        } else {
+          fragment = chnk->fragment;
+          p_payload = fragment->payload;
+          size = fragment->size;
+        }
 
-          my_gptimer_stop(gptimer);
+        // get initial sync using hardware timer
+        bool dmaFull = false;
 
-          my_i2s_channel_enable(tx_chan);
+        tg0_timer1_start(-age);  // timer with 1µs ticks
 
-          // get timer value so we can get the real age
-          timer_val = (int64_t)notifiedValue;
+        my_i2s_channel_disable(tx_chan);
 
-          // get actual age after alarm
-          age = (int64_t)timer_val - (-age);
+        player_rate_reset();
+        while (1) {
+          if (chnk == NULL) {
+            if (pcmChkQHdl != NULL) {
+              ret = xQueueReceive(pcmChkQHdl, &chnk, pdMS_TO_TICKS(100));
+              // if (ret != pdFAIL) {
+              //   ESP_LOGI(TAG, "got pcm chunk with size %d",
+              //            chnk->fragment->size);
+              // }
+            }
 
-          initialSync = 1;
+            fragment = chnk->fragment;
+            p_payload = fragment->payload;
+            size = fragment->size;
+          }
 
-          // TODO: use a timer to un-mute non blocking
-          vTaskDelay(pdMS_TO_TICKS(2));
-          audio_set_mute(scSet.muted);
+          ESP_ERROR_CHECK(
+              i2s_channel_preload_data(tx_chan, p_payload, size, &written));
 
-          ESP_LOGI(TAG, "initial sync age: %lldus, chunk duration: %lldus", age,
-                   chunkDuration_us);
+#if USE_SAMPLE_INSERTION
+          resampler_prime(&resampler, (const uint32_t *)p_payload,
+                          written / (scSet.ch * (scSet.bits >> 3)));
+#endif
 
-          if (size == 0) {
-            continue;
-          }
-        } else if (age >= 0) {
-          if (chnk != NULL) {
-            free_pcm_chunk(chnk);
-            chnk = NULL;
+          // check if DMA is full at first try here
+          if (written != size) {
+            dmaFull = true;
           }
 
-          // get count of chunks we are late for
-          uint32_t c = ceil((float)age / (float)chunkDuration_us);  // round up
+          size -= written;
+          p_payload += written;
 
-          // now clear all those chunks which are probably late too
-          while (c--) {
-            ret = xQueueReceive(pcmChkQHdl, &chnk, pdMS_TO_TICKS(1));
-            if (ret == pdPASS) {
+          if (size == 0) {
+            if (fragment->nextFragment != NULL) {
+              fragment = fragment->nextFragment;
+              p_payload = fragment->payload;
+              size = fragment->size;
+            } else {
               free_pcm_chunk(chnk);
               chnk = NULL;
-            } else {
-              break;
             }
           }
 
-          wifi_ap_record_t ap;
-          esp_wifi_sta_get_ap_info(&ap);
+          if (dmaFull == true) {
+            ESP_LOGI(TAG, "DMA completely loaded");
 
-          my_gptimer_stop(gptimer);
-
-          ESP_LOGW(TAG,
-                   "RESYNCING HARD 1: age %lldus, latency %lldus, free %d, "
-                   "largest block %d, rssi: %d",
-                   age, diff2Server, heap_caps_get_free_size(MALLOC_CAP_32BIT),
-                   heap_caps_get_largest_free_block(MALLOC_CAP_32BIT), ap.rssi);
+#if USE_SAMPLE_INSERTION
+            dmaFill = 0;
+#else
+            alreadyWritten = 0;
+#endif
+            chunkStart -=
+                (1000000LL * (int64_t)(i2sDmaBufCnt * i2sDmaBufMaxLen) /
+                 (int64_t)scSet.sr);
 
-          dir = 0;
+            break;
+          }
+        }
 
-          insertedSamplesCounter = 0;
+        // get actual age after alarm
+        age = player_start_at_alarm(scSet.muted) - (-age);
 
-          audio_set_mute(true);
+        initialSync = 1;
 
-          my_i2s_channel_disable(tx_chan);
+        ESP_LOGI(TAG, "initial sync age: %lldus, chunk duration: %lldus", age,
+                 chunkDuration_us);
 
+        if (size == 0) {
           continue;
         }
       }
 
       const bool enableControlLoop = true;
 
-      const int64_t shortOffset = SHORT_OFFSET;  // µs, softsync
-      const int64_t miniOffset = MINI_OFFSET;    // µs, softsync
-      const int64_t hardResyncThreshold = 2000;  // µs, hard sync
-
       if (initialSync == 1) {
         if (size == 0) {
           fragment = chnk->fragment;
@@ -1473,29 +1967,70 @@ static void player_task(void *pvParameters) {
         }
 
         if (p_payload != NULL) {
-          do {
-            written = 0;
-
 #if USE_SAMPLE_INSERTION
-            uint32_t sampleSizeInBytes =
-                (scSet.bits >> 3) * scSet.ch * INSERT_SAMPLES;
+          size_t framesToBytes = (scSet.ch * (scSet.bits >> 3));
+
+          uint32_t used, n;
+
+          // age is taken at the frame following this chunk
+          chunkStart += 1000000LL *
+                        (int64_t)(chnk->totalSize / framesToBytes) /
+                        (int64_t)scSet.sr;
+
+          // a pending slew replaces the first frames of the chunk
+          n = slew_process(&slew, (const uint32_t *)p_payload,
+                           size / framesToBytes, &used);
+          if (n > 0) {
+            player_write_resampled((const char *)slew.head, n, &dmaFill);
+            p_payload += used * framesToBytes;
+            size -= used * framesToBytes;
+          }
 
-            if ((dir_insert_sample > 0) && (size >= sampleSizeInBytes)) {
-              size -= sampleSizeInBytes;
+          while (1) {
+            player_write_resampled(p_payload, size / framesToBytes, &dmaFill);
+
+            fragment = fragment->nextFragment;
+            if ((fragment == NULL) || (fragment->payload == NULL)) {
+              break;
             }
-#endif
+
+            p_payload = fragment->payload;
+            size = fragment->size;
+          }
+
+          size = 0;
+          free_pcm_chunk(chnk);
+          chnk = NULL;
+
+          outputBufferDacTime_us =
+              player_output_buffer_dac_time(scSet.sr, dmaFill);
+#else
+          size_t framesToBytes = (scSet.ch * (scSet.bits >> 3));
+          uint32_t used, n;
+
+          // a pending slew replaces the first frames of the chunk, chunkStart
+          // follows the frames replaced
+          n = slew_process(&slew, (const uint32_t *)p_payload,
+                           size / framesToBytes, &used);
+          if (n > 0) {
+            i2s_channel_write(tx_chan, slew.head, n * framesToBytes, &written,
+                              portMAX_DELAY);
+
+            alreadyWritten =
+                (alreadyWritten + written) % (i2sDmaBufMaxLen * framesToBytes);
+            chunkStart += 1000000LL * (int64_t)used / (int64_t)scSet.sr;
+            p_payload += used * framesToBytes;
+            size -= used * framesToBytes;
+          }
+
+          do {
+            written = 0;
+
             int64_t alreadyWrittenTime_us = 0;
-            size_t framesToBytes = (scSet.ch + (scSet.bits >> 3));
             while (size) {
               size_t i2sWriteLen;
               size_t tmpSize = i2sDmaBufMaxLen * framesToBytes;
 
-              // #if USE_SAMPLE_INSERTION
-              //               if (dir_insert_sample < 0) {
-              //         	  tmpSize -= sampleSizeInBytes;
-              //               }
-              // #endif
-
               if (size >= tmpSize) {
                 i2sWriteLen = i2sDmaBufMaxLen * framesToBytes - alreadyWritten;
 
@@ -1514,31 +2049,10 @@ static void player_task(void *pvParameters) {
               } else {  // here we are at the end of a chunk
                 i2sWriteLen = size;
 
-#if USE_SAMPLE_INSERTION
-                size_t insertedSamplesWritten = 0;
-
-                if (i2sWriteLen + sampleSizeInBytes <= i2sDmaBufMaxLen) {
-                  if (dir_insert_sample < 0) {
-                    if (i2s_channel_write(tx_chan, p_payload, sampleSizeInBytes,
-                                          &insertedSamplesWritten,
-                                          portMAX_DELAY) != ESP_OK) {
-                      ESP_LOGE(TAG, "i2s_playback_task:  I2S write error %d",
-                               1);
-                    }
-                  }
-
-                  dir_insert_sample = 0;
-                }
-#endif
-
                 i2s_channel_write(tx_chan, p_payload, i2sWriteLen, &written,
                                   portMAX_DELAY);
 
-#if USE_SAMPLE_INSERTION
-                alreadyWritten = written + insertedSamplesWritten;
-#else
                 alreadyWritten = written;
-#endif
                 alreadyWrittenTime_us =
                     1000000LL * (int64_t)(alreadyWritten / framesToBytes) /
                     (int64_t)scSet.sr;
@@ -1553,8 +2067,6 @@ static void player_task(void *pvParameters) {
               p_payload += written;
             }
 
-            dir = 0;
-
             if (size == 0) {
               if (fragment->nextFragment != NULL) {
                 fragment = fragment->nextFragment;
@@ -1565,12 +2077,12 @@ static void player_task(void *pvParameters) {
               } else {
                 free_pcm_chunk(chnk);
                 chnk = NULL;
-                dir = 0;
 
                 break;
               }
             }
           } while (1);
+#endif
         } else {
           // here we have an empty fragment because of memory allocation error.
           // fill DMA with zeros so we don't get out of sync
@@ -1595,22 +2107,17 @@ static void player_task(void *pvParameters) {
         }
 
         if (server_now(&serverNow, &diff2Server) >= 0) {
-          age = serverNow - chunkStart - buf_us + clientDacLatency_us +
-                outputBufferDacTime_us;
-
-          int64_t shortMedian, miniMedian;
-
-          shortMedian = MEDIANFILTER_Insert(&shortMedianFilter, age);
-          miniMedian = MEDIANFILTER_Insert(&miniMedianFilter, age);
+          age = sync_control_age(serverNow, chunkStart, buf_us,
+                                 clientDacLatency_us, outputBufferDacTime_us);
 
           int msgWaiting = uxQueueMessagesWaiting(pcmChkQHdl);
 
-          // resync hard if we are getting very late / early.
-          // rest gets tuned in through apll speed control or sample insertion
-          if ((msgWaiting == 0) ||
-              (MEDIANFILTER_isFull(&shortMedianFilter, 0) &&
-               ((shortMedian > hardResyncThreshold) ||
-                (shortMedian < -hardResyncThreshold)))) {
+          // resync hard if we are getting very late / early or run empty,
+          // jump if a little late / early, rest gets tuned in through the
+          // playback rate
+          sync_control_action_t action = sync_control_update(
+              &syncControl, age, chunkDuration_us, msgWaiting == 0);
+          if (action == SYNC_CONTROL_RESYNC_HARD) {
             if (chnk != NULL) {
               free_pcm_chunk(chnk);
               chnk = NULL;
@@ -1635,42 +2142,17 @@ static void player_task(void *pvParameters) {
 
             initialSync = 0;
 
-            insertedSamplesCounter = 0;
-
             continue;
           }
 
-#if USE_SAMPLE_INSERTION  // insert samples to adjust sync
-          if ((enableControlLoop == true) &&
-              (MEDIANFILTER_isFull(&shortMedianFilter, 0))) {
-            if ((shortMedian < -shortOffset) && (miniMedian < -miniOffset) &&
-                (age < -miniOffset)) {  // we are early
-              dir = -1;
-              dir_insert_sample = -1;
-              insertedSamplesCounter += INSERT_SAMPLES;
-            } else if ((shortMedian > shortOffset) &&
-                       (miniMedian > miniOffset) &&
-                       (age > miniOffset)) {  // we are late
-              dir = 1;
-              dir_insert_sample = 1;
-              insertedSamplesCounter -= INSERT_SAMPLES;
-            }
+          if (action == SYNC_CONTROL_RESYNC_SOFT) {
+            player_slew_start(scSet.sr, age);
           }
-#else  // use APLL to adjust sync
-          if ((enableControlLoop == true) &&
-              (MEDIANFILTER_isFull(&shortMedianFilter, 0))) {
-            if ((shortMedian < -shortOffset) && (miniMedian < -miniOffset) &&
-                (age < -miniOffset)) {  // we are early
-              dir = -1;
-            } else if ((shortMedian > shortOffset) &&
-                       (miniMedian > miniOffset) &&
-                       (age > miniOffset)) {  // we are late
-              dir = 1;
-            }
 
-            adjust_apll(dir);
+          // resample or tune the APLL to adjust sync
+          if (enableControlLoop == true) {
+            player_rate_set(syncControl.ppb);
           }
-#endif
 
           //        ESP_LOGI(TAG, "%d, %lldus, %lldus, %lldus, q:%d, %lld,
           //        %llu", dir, age,
@@ -1721,8 +2203,6 @@ static void player_task(void *pvParameters) {
                  uxQueueMessagesWaiting(pcmChkQHdl), sec, msec, usec);
       }
 
-      dir = 0;
-
       initialSync = 0;
 
       audio_set_mute(true);
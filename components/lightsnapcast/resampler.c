@@ -0,0 +1,289 @@
+/**
+ * Polyphase resampler. Output at a position t frames after the center tap c
+ * is sum(x[i] * k(i - c - t)) over the taps, k a Kaiser windowed sinc. The
+ * table holds k for t = p / 2^RESAMPLER_PHASE_BITS, p = 0 .. 2^bits, the last
+ * row is the first shifted by a frame. Coefficients are 2.14 fixed point and
+ * every row sums up to exactly 1, so DC and t = 0 pass unchanged. Between two
+ * rows coefficients are interpolated with 15 more fraction bits.
+ *
+ * Samples are filtered at 16 or 24 bit, the low byte of 32 bit samples is
+ * dropped, the DACs in use don't resolve it anyway.
+ */
+
+#include "resampler.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define RESAMPLER_PHASES (1 << RESAMPLER_PHASE_BITS)
+#define RESAMPLER_CENTER (RESAMPLER_TAPS / 2 - 1)
+#define RESAMPLER_COEFF_BITS 14
+#define RESAMPLER_KAISER_BETA 8.5f
+
+static int16_t filterTable[RESAMPLER_PHASES + 1][RESAMPLER_TAPS];
+static bool filterTableReady = false;
+
+/**
+ * Modified Bessel function of the first kind, order 0.
+ */
+static float resampler_bessel_i0(float x) {
+  float sum = 1.0f, term = 1.0f;
+
+  for (int k = 1; k < 32; k++) {
+    term *= (x / (2.0f * k)) * (x / (2.0f * k));
+    sum += term;
+  }
+
+  return sum;
+}
+
+/**
+ * Windowed sinc at x frames from the output position.
+ */
+static float resampler_kernel(float x) {
+  const float half = RESAMPLER_TAPS / 2;
+  float r = x / half;
+  float sinc;
+
+  if (fabsf(r) >= 1.0f) {
+    return 0.0f;
+  }
+
+  if (fabsf(x) < 1e-6f) {
+    sinc = 1.0f;
+  } else {
+    sinc = sinf((float)M_PI * x) / ((float)M_PI * x);
+  }
+
+  return sinc *
+         resampler_bessel_i0(RESAMPLER_KAISER_BETA * sqrtf(1.0f - r * r)) /
+         resampler_bessel_i0(RESAMPLER_KAISER_BETA);
+}
+
+/**
+ * Fill the table once, it is shared by all resamplers.
+ */
+static void resampler_table_init(void) {
+  if (filterTableReady) {
+    return;
+  }
+
+  for (int p = 0; p <= RESAMPLER_PHASES; p++) {
+    float t = (float)p / RESAMPLER_PHASES;
+    float h[RESAMPLER_TAPS], sum = 0;
+    int32_t total = 0;
+
+    for (int i = 0; i < RESAMPLER_TAPS; i++) {
+      h[i] = resampler_kernel(i - RESAMPLER_CENTER - t);
+      sum += h[i];
+    }
+
+    for (int i = 0; i < RESAMPLER_TAPS; i++) {
+      filterTable[p][i] =
+          (int16_t)lrintf(h[i] / sum * (1 << RESAMPLER_COEFF_BITS));
+      total += filterTable[p][i];
+    }
+
+    // rounding error goes to the biggest tap
+    filterTable[p][(t < 0.5f) ? RESAMPLER_CENTER : RESAMPLER_CENTER + 1] +=
+        (1 << RESAMPLER_COEFF_BITS) - total;
+  }
+
+  filterTableReady = true;
+}
+
+/**
+ *
+ */
+int32_t resampler_init(resampler_t *rs, uint32_t bits) {
+  if ((bits != 16) && (bits != 32)) {
+    return -1;
+  }
+
+  resampler_table_init();
+
+  memset(rs, 0, sizeof(resampler_t));
+  rs->bits = bits;
+  resampler_reset(rs);
+
+  return 0;
+}
+
+/**
+ *
+ */
+void resampler_reset(resampler_t *rs) {
+  memset(rs->hist, 0, sizeof(rs->hist));
+  rs->pos = 0;
+  rs->phase = 0;
+  rs->need = 1;
+}
+
+/**
+ *
+ */
+static inline __attribute__((always_inline)) void resampler_push(
+    resampler_t *rs, int32_t l, int32_t r) {
+  rs->pos = (rs->pos + 1) & (RESAMPLER_TAPS - 1);
+  rs->hist[rs->pos][0] = l;
+  rs->hist[rs->pos][1] = r;
+  rs->hist[rs->pos + RESAMPLER_TAPS][0] = l;
+  rs->hist[rs->pos + RESAMPLER_TAPS][1] = r;
+}
+
+/**
+ *
+ */
+void resampler_prime(resampler_t *rs, const uint32_t *in, uint32_t frames) {
+  uint32_t i = (frames > RESAMPLER_TAPS) ? frames - RESAMPLER_TAPS : 0;
+
+  for (; i < frames; i++) {
+    if (rs->bits == 16) {
+      resampler_push(rs, (int16_t)(in[i] & 0xFFFF), (int32_t)in[i] >> 16);
+    } else {
+      resampler_push(rs, (int32_t)in[2 * i] >> 8,
+                     (int32_t)in[2 * i + 1] >> 8);
+    }
+  }
+
+  // the frame after them is at the center tap once the taps ahead are in
+  rs->phase = 0;
+  rs->need = RESAMPLER_DELAY_FRAMES + 1;
+}
+
+/**
+ *
+ */
+uint32_t resampler_lag_frames(const resampler_t *rs) {
+  if (rs->need > RESAMPLER_DELAY_FRAMES + 1) {
+    return 0;
+  }
+
+  return RESAMPLER_DELAY_FRAMES + 1 - rs->need;
+}
+
+/**
+ *
+ */
+void resampler_set_ppb(resampler_t *rs, int32_t ppb) {
+  if (ppb > RESAMPLER_MAX_PPB) {
+    ppb = RESAMPLER_MAX_PPB;
+  } else if (ppb < -RESAMPLER_MAX_PPB) {
+    ppb = -RESAMPLER_MAX_PPB;
+  }
+
+  rs->step = (int32_t)((int64_t)ppb * (1LL << 32) / 1000000000LL);
+}
+
+/**
+ *
+ */
+static inline __attribute__((always_inline)) int32_t resampler_clip(
+    int64_t sample, const int32_t limit) {
+  if (sample > limit - 1) {
+    return limit - 1;
+  } else if (sample < -limit) {
+    return -limit;
+  }
+
+  return (int32_t)sample;
+}
+
+/**
+ * Kernel for a container width. Always inlined with a constant width, so
+ * every width gets its own loop.
+ */
+static inline __attribute__((always_inline)) uint32_t resampler_run(
+    resampler_t *rs, const uint32_t *in, uint32_t inFrames, uint32_t *used,
+    uint32_t *out, uint32_t outFrames, const uint32_t bits) {
+  const int32_t limit = (bits == 16) ? (1 << 15) : (1 << 23);
+  const uint32_t shift = RESAMPLER_COEFF_BITS + 15;
+  const int64_t round = 1LL << (shift - 1);
+  int32_t(*hist)[2] = rs->hist;
+  uint32_t phase = rs->phase;
+  uint32_t need = rs->need;
+  uint32_t pos = rs->pos;
+  uint32_t u = 0, produced = 0;
+
+  while (produced < outFrames) {
+    int32_t(*x)[2];
+    const int16_t *a, *b;
+    int64_t accL = 0, accR = 0, next;
+    int32_t frac;
+
+    for (; need > 0; need--, u++) {
+      int32_t l, r;
+
+      if (u == inFrames) {
+        goto done;
+      }
+
+      if (bits == 16) {
+        l = (int16_t)(in[u] & 0xFFFF);
+        r = (int32_t)in[u] >> 16;
+      } else {
+        l = (int32_t)in[2 * u] >> 8;
+        r = (int32_t)in[2 * u + 1] >> 8;
+      }
+
+      pos = (pos + 1) & (RESAMPLER_TAPS - 1);
+      hist[pos][0] = l;
+      hist[pos][1] = r;
+      hist[pos + RESAMPLER_TAPS][0] = l;
+      hist[pos + RESAMPLER_TAPS][1] = r;
+    }
+
+    // oldest frame first
+    x = &hist[pos + 1];
+
+    a = filterTable[phase >> (32 - RESAMPLER_PHASE_BITS)];
+    b = a + RESAMPLER_TAPS;
+    frac = (int32_t)((phase >> (32 - RESAMPLER_PHASE_BITS - 15)) & 0x7FFF);
+
+    // no rounding of the interpolated coefficients, it would add up
+    for (int i = 0; i < RESAMPLER_TAPS; i++) {
+      int32_t h = a[i] * (1 << 15) + (b[i] - a[i]) * frac;
+
+      accL += (int64_t)h * x[i][0];
+      accR += (int64_t)h * x[i][1];
+    }
+
+    accL = resampler_clip((accL + round) >> shift, limit);
+    accR = resampler_clip((accR + round) >> shift, limit);
+
+    if (bits == 16) {
+      out[produced] = ((uint32_t)accL & 0xFFFF) | ((uint32_t)accR << 16);
+    } else {
+      out[2 * produced] = (uint32_t)accL << 8;
+      out[2 * produced + 1] = (uint32_t)accR << 8;
+    }
+    produced++;
+
+    next = (int64_t)phase + (1LL << 32) + rs->step;
+    need = (uint32_t)(next >> 32);
+    phase = (uint32_t)next;
+  }
+
+done:
+  rs->phase = phase;
+  rs->need = need;
+  rs->pos = pos;
+
+  *used = u;
+
+  return produced;
+}
+
+/**
+ *
+ */
+uint32_t resampler_process(resampler_t *rs, const uint32_t *in,
+                           uint32_t inFrames, uint32_t *used, uint32_t *out,
+                           uint32_t outFrames) {
+  if (rs->bits == 16) {
+    return resampler_run(rs, in, inFrames, used, out, outFrames, 16);
+  }
+
+  return resampler_run(rs, in, inFrames, used, out, outFrames, 32);
+}
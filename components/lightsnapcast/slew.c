@@ -0,0 +1,112 @@
+/**
+ * Soft resync by skipping or inserting frames with a crossfade, see slew.h
+ */
+
+#include "slew.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Mix a word of a into b, a weighted by w / SLEW_FADE_FRAMES.
+ */
+static inline uint32_t slew_mix(uint32_t bits, uint32_t a, uint32_t b,
+                                int32_t w) {
+  const int32_t v = SLEW_FADE_FRAMES - w;
+
+  if (bits == 16) {
+    int32_t lo = ((int32_t)(int16_t)a * w + (int32_t)(int16_t)b * v) /
+                 SLEW_FADE_FRAMES;
+    int32_t hi = ((int32_t)(int16_t)(a >> 16) * w +
+                  (int32_t)(int16_t)(b >> 16) * v) /
+                 SLEW_FADE_FRAMES;
+
+    return ((uint32_t)hi << 16) | ((uint32_t)lo & 0xFFFF);
+  }
+
+  return (uint32_t)(int32_t)(((int64_t)(int32_t)a * w +
+                              (int64_t)(int32_t)b * v) /
+                             SLEW_FADE_FRAMES);
+}
+
+/**
+ * Fade words of from out and to in over SLEW_FADE_FRAMES frames.
+ */
+static void slew_fade(uint32_t bits, uint32_t *out, const uint32_t *from,
+                      const uint32_t *to) {
+  const uint32_t words = bits / 16;
+
+  for (uint32_t i = 0; i < SLEW_FADE_FRAMES; i++) {
+    // from fades out starting at full weight, to is at full weight after
+    for (uint32_t k = 0; k < words; k++) {
+      out[i * words + k] = slew_mix(bits, from[i * words + k],
+                                    to[i * words + k], SLEW_FADE_FRAMES - i);
+    }
+  }
+}
+
+/**
+ *
+ */
+int32_t slew_init(slew_t *sl, uint32_t bits) {
+  if ((bits != 16) && (bits != 32)) {
+    return -1;
+  }
+
+  memset(sl, 0, sizeof(slew_t));
+  sl->bits = bits;
+
+  return 0;
+}
+
+/**
+ *
+ */
+void slew_reset(slew_t *sl) { sl->pending = 0; }
+
+/**
+ *
+ */
+void slew_start(slew_t *sl, int32_t frames) { sl->pending += frames; }
+
+/**
+ *
+ */
+uint32_t slew_process(slew_t *sl, const uint32_t *in, uint32_t inFrames,
+                      uint32_t *used) {
+  const uint32_t words = sl->bits / 16;
+  int32_t n = sl->pending;
+
+  *used = 0;
+
+  if (n > SLEW_MAX_FRAMES) {
+    n = SLEW_MAX_FRAMES;
+  } else if (n < -SLEW_MAX_FRAMES) {
+    n = -SLEW_MAX_FRAMES;
+  }
+
+  if ((n == 0) || (inFrames < (uint32_t)abs(n) + SLEW_FADE_FRAMES)) {
+    return 0;
+  }
+
+  sl->pending -= n;
+
+  if (n > 0) {
+    slew_fade(sl->bits, sl->head, in, in + n * words);
+    sl->skipped += n;
+    *used = n + SLEW_FADE_FRAMES;
+
+    return SLEW_FADE_FRAMES;
+  }
+
+  // word by word, in may be IRAM
+  n = -n;
+  for (uint32_t i = 0; i < n * words; i++) {
+    sl->head[i] = in[i];
+  }
+  slew_fade(sl->bits, sl->head + n * words, in + n * words, in);
+  sl->inserted += n;
+  *used = SLEW_FADE_FRAMES;
+
+  return n + SLEW_FADE_FRAMES;
+}
@@ -0,0 +1,434 @@
+/**
+ * Splits the snapcast TCP byte stream into messages. Fixed size headers are
+ * gathered in a small staging buffer only if they are split across received
+ * buffers, otherwise they are decoded in place. Wire chunk payload is never
+ * copied but passed on as spans of the received buffers.
+ */
+
+#include "snapcast_framer.h"
+
+#include <buffer.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapcast.h"
+
+/**
+ *
+ */
+void snapcast_framer_init(snapcast_framer_t *framer,
+                          const snapcast_framer_callbacks_t *cb, void *ctx) {
+  memset(framer, 0, sizeof(snapcast_framer_t));
+
+  framer->cb = cb;
+  framer->ctx = ctx;
+
+  snapcast_framer_reset(framer);
+}
+
+/**
+ *
+ */
+void snapcast_framer_reset(snapcast_framer_t *framer) {
+  framer->state = FRAMER_STATE_BASE;
+  framer->stagingLen = 0;
+  framer->stagingNeeded = BASE_MESSAGE_SIZE;
+  framer->typedPos = 0;
+}
+
+/**
+ *
+ */
+void snapcast_framer_deinit(snapcast_framer_t *framer) {
+  if (framer->msgBuf) {
+    free(framer->msgBuf);
+    framer->msgBuf = NULL;
+  }
+
+  framer->msgBufSize = 0;
+
+  snapcast_framer_reset(framer);
+}
+
+/**
+ * Get a complete header of framer->stagingNeeded bytes. If it isn't split
+ * across buffers it is returned in place, otherwise it is gathered in the
+ * staging buffer.
+ *
+ * @return pointer to the complete header or NULL if more data is needed
+ */
+static const char *framer_gather(snapcast_framer_t *framer, const char **data,
+                                 uint32_t *len) {
+  const char *hdr;
+  uint32_t n;
+
+  if ((framer->stagingLen == 0) && (*len >= framer->stagingNeeded)) {
+    hdr = *data;
+
+    *data += framer->stagingNeeded;
+    *len -= framer->stagingNeeded;
+
+    return hdr;
+  }
+
+  n = framer->stagingNeeded - framer->stagingLen;
+  if (n > *len) {
+    n = *len;
+  }
+
+  memcpy(&framer->staging[framer->stagingLen], *data, n);
+  framer->stagingLen += n;
+  *data += n;
+  *len -= n;
+
+  if (framer->stagingLen < framer->stagingNeeded) {
+    return NULL;
+  }
+
+  framer->stagingLen = 0;
+
+  return framer->staging;
+}
+
+/**
+ *
+ */
+static void framer_message_done(snapcast_framer_t *framer) {
+  framer->messages++;
+
+  framer->state = FRAMER_STATE_BASE;
+  framer->stagingNeeded = BASE_MESSAGE_SIZE;
+  framer->typedPos = 0;
+}
+
+/**
+ *
+ */
+static int framer_msg_buf_reserve(snapcast_framer_t *framer, uint32_t size) {
+  char *tmp;
+
+  if (size <= framer->msgBufSize) {
+    return SNAPCAST_FRAMER_OK;
+  }
+
+  tmp = (char *)realloc(framer->msgBuf, size);
+  if (tmp == NULL) {
+    return SNAPCAST_FRAMER_ERR_NO_MEM;
+  }
+
+  framer->msgBuf = tmp;
+  framer->msgBufSize = size;
+
+  return SNAPCAST_FRAMER_OK;
+}
+
+/**
+ *
+ */
+static int framer_base_message_done(snapcast_framer_t *framer,
+                                    const char *hdr) {
+  int ret;
+
+  if (base_message_deserialize(&framer->base, hdr, BASE_MESSAGE_SIZE)) {
+    return SNAPCAST_FRAMER_ERR_PROTOCOL;
+  }
+
+  if (framer->cb->base_message) {
+    framer->cb->base_message(framer->ctx, &framer->base,
+                             framer->baseArrival_us);
+  }
+
+  framer->typedPos = 0;
+
+  switch (framer->base.type) {
+    case SNAPCAST_MESSAGE_WIRE_CHUNK: {
+      if (framer->base.size < WIRE_CHUNK_HEADER_SIZE) {
+        return SNAPCAST_FRAMER_ERR_PROTOCOL;
+      }
+
+      framer->state = FRAMER_STATE_TYPED_HEADER;
+      framer->stagingNeeded = WIRE_CHUNK_HEADER_SIZE;
+
+      break;
+    }
+
+    case SNAPCAST_MESSAGE_TIME: {
+      if (framer->base.size < TIME_MESSAGE_SIZE) {
+        return SNAPCAST_FRAMER_ERR_PROTOCOL;
+      }
+
+      framer->state = FRAMER_STATE_TYPED_HEADER;
+      framer->stagingNeeded = TIME_MESSAGE_SIZE;
+
+      break;
+    }
+
+    case SNAPCAST_MESSAGE_CODEC_HEADER:
+    case SNAPCAST_MESSAGE_SERVER_SETTINGS: {
+      if ((framer->base.size < sizeof(uint32_t)) ||
+          (framer->base.size > SNAPCAST_FRAMER_MAX_MESSAGE_SIZE)) {
+        return SNAPCAST_FRAMER_ERR_PROTOCOL;
+      }
+
+      // + 1 so strings can be NULL terminated in place
+      ret = framer_msg_buf_reserve(framer, framer->base.size + 1);
+      if (ret != SNAPCAST_FRAMER_OK) {
+        return ret;
+      }
+
+      framer->state = FRAMER_STATE_MESSAGE;
+
+      break;
+    }
+
+    default: {
+      // stream tags and unknown messages
+      if (framer->base.size == 0) {
+        framer_message_done(framer);
+      } else {
+        framer->state = FRAMER_STATE_SKIP;
+      }
+
+      break;
+    }
+  }
+
+  return SNAPCAST_FRAMER_OK;
+}
+
+/**
+ *
+ */
+static int framer_typed_header_done(snapcast_framer_t *framer,
+                                    const char *hdr) {
+  const snapcast_framer_callbacks_t *cb = framer->cb;
+
+  framer->typedPos = framer->stagingNeeded;
+
+  if (framer->base.type == SNAPCAST_MESSAGE_WIRE_CHUNK) {
+    if (wire_chunk_message_deserialize(&framer->wireChunk, hdr,
+                                       WIRE_CHUNK_HEADER_SIZE)) {
+      return SNAPCAST_FRAMER_ERR_PROTOCOL;
+    }
+
+    // payload is passed in spans, never as a whole
+    framer->wireChunk.payload = NULL;
+
+    if (framer->base.size != WIRE_CHUNK_HEADER_SIZE + framer->wireChunk.size) {
+      return SNAPCAST_FRAMER_ERR_PROTOCOL;
+    }
+
+    if (cb->wire_chunk_start &&
+        cb->wire_chunk_start(framer->ctx, &framer->base, &framer->wireChunk)) {
+      return SNAPCAST_FRAMER_ERR_CALLBACK;
+    }
+
+    if (framer->wireChunk.size == 0) {
+      if (cb->wire_chunk_end &&
+          cb->wire_chunk_end(framer->ctx, &framer->base, &framer->wireChunk)) {
+        return SNAPCAST_FRAMER_ERR_CALLBACK;
+      }
+
+      framer_message_done(framer);
+    } else {
+      framer->state = FRAMER_STATE_WIRE_CHUNK_PAYLOAD;
+    }
+  } else {
+    time_message_t timeMsg;
+
+    if (time_message_deserialize(&timeMsg, hdr, TIME_MESSAGE_SIZE)) {
+      return SNAPCAST_FRAMER_ERR_PROTOCOL;
+    }
+
+    if (cb->time && cb->time(framer->ctx, &framer->base, &timeMsg)) {
+      return SNAPCAST_FRAMER_ERR_CALLBACK;
+    }
+
+    if (framer->typedPos < framer->base.size) {
+      framer->state = FRAMER_STATE_SKIP;
+    } else {
+      framer_message_done(framer);
+    }
+  }
+
+  return SNAPCAST_FRAMER_OK;
+}
+
+/**
+ *
+ */
+static int framer_message_complete(snapcast_framer_t *framer) {
+  const snapcast_framer_callbacks_t *cb = framer->cb;
+  uint32_t size = framer->base.size;
+  int ret = SNAPCAST_FRAMER_OK;
+
+  if (framer->base.type == SNAPCAST_MESSAGE_CODEC_HEADER) {
+    codec_header_message_t header = {NULL, 0, NULL};
+    read_buffer_t buffer;
+    uint32_t codecLen = 0;
+
+    // codec_header_message_deserialize() trusts the codec string length
+    buffer_read_init(&buffer, framer->msgBuf, size);
+    if (buffer_read_uint32(&buffer, &codecLen) ||
+        (codecLen > size - sizeof(uint32_t))) {
+      ret = SNAPCAST_FRAMER_ERR_PROTOCOL;
+    } else if (codec_header_message_deserialize(&header, framer->msgBuf,
+                                                size)) {
+      ret = SNAPCAST_FRAMER_ERR_PROTOCOL;
+    } else if (header.size > size - (uint32_t)(header.payload -
+                                               framer->msgBuf)) {
+      ret = SNAPCAST_FRAMER_ERR_PROTOCOL;
+    } else if (cb->codec_header &&
+               cb->codec_header(framer->ctx, &framer->base, &header)) {
+      ret = SNAPCAST_FRAMER_ERR_CALLBACK;
+    }
+
+    codec_header_message_free(&header);
+  } else {
+    read_buffer_t buffer;
+    uint32_t jsonLen = 0;
+
+    buffer_read_init(&buffer, framer->msgBuf, size);
+    if (buffer_read_uint32(&buffer, &jsonLen) ||
+        (jsonLen > size - sizeof(uint32_t))) {
+      ret = SNAPCAST_FRAMER_ERR_PROTOCOL;
+    } else {
+      char *json = &framer->msgBuf[sizeof(uint32_t)];
+
+      json[jsonLen] = 0;
+
+      if (cb->server_settings &&
+          cb->server_settings(framer->ctx, &framer->base, json)) {
+        ret = SNAPCAST_FRAMER_ERR_CALLBACK;
+      }
+    }
+  }
+
+  framer_message_done(framer);
+
+  return ret;
+}
+
+/**
+ *
+ */
+void snapcast_framer_set_arrival(snapcast_framer_t *framer,
+                                 int64_t arrival_us) {
+  framer->arrival_us = arrival_us;
+}
+
+/**
+ *
+ */
+int snapcast_framer_feed(snapcast_framer_t *framer, const char *data,
+                         uint32_t len, void *owner) {
+  const snapcast_framer_callbacks_t *cb = framer->cb;
+  const char *hdr;
+  uint32_t n;
+  int ret;
+
+  while (len > 0) {
+    switch (framer->state) {
+      case FRAMER_STATE_BASE: {
+        if (framer->stagingLen == 0) {
+          framer->baseArrival_us = framer->arrival_us;
+        }
+
+        hdr = framer_gather(framer, &data, &len);
+        if (hdr) {
+          ret = framer_base_message_done(framer, hdr);
+          if (ret != SNAPCAST_FRAMER_OK) {
+            return ret;
+          }
+        }
+
+        break;
+      }
+
+      case FRAMER_STATE_TYPED_HEADER: {
+        hdr = framer_gather(framer, &data, &len);
+        if (hdr) {
+          ret = framer_typed_header_done(framer, hdr);
+          if (ret != SNAPCAST_FRAMER_OK) {
+            return ret;
+          }
+        }
+
+        break;
+      }
+
+      case FRAMER_STATE_WIRE_CHUNK_PAYLOAD: {
+        n = framer->base.size - framer->typedPos;
+        if (n > len) {
+          n = len;
+        }
+
+        if (cb->wire_chunk_data &&
+            cb->wire_chunk_data(framer->ctx, data, n, owner)) {
+          return SNAPCAST_FRAMER_ERR_CALLBACK;
+        }
+
+        data += n;
+        len -= n;
+        framer->typedPos += n;
+
+        if (framer->typedPos >= framer->base.size) {
+          if (cb->wire_chunk_end &&
+              cb->wire_chunk_end(framer->ctx, &framer->base,
+                                 &framer->wireChunk)) {
+            return SNAPCAST_FRAMER_ERR_CALLBACK;
+          }
+
+          framer_message_done(framer);
+        }
+
+        break;
+      }
+
+      case FRAMER_STATE_MESSAGE: {
+        n = framer->base.size - framer->typedPos;
+        if (n > len) {
+          n = len;
+        }
+
+        memcpy(&framer->msgBuf[framer->typedPos], data, n);
+
+        data += n;
+        len -= n;
+        framer->typedPos += n;
+
+        if (framer->typedPos >= framer->base.size) {
+          ret = framer_message_complete(framer);
+          if (ret != SNAPCAST_FRAMER_OK) {
+            return ret;
+          }
+        }
+
+        break;
+      }
+
+      case FRAMER_STATE_SKIP: {
+        n = framer->base.size - framer->typedPos;
+        if (n > len) {
+          n = len;
+        }
+
+        data += n;
+        len -= n;
+        framer->typedPos += n;
+
+        if (framer->typedPos >= framer->base.size) {
+          framer_message_done(framer);
+        }
+
+        break;
+      }
+
+      default: {
+        return SNAPCAST_FRAMER_ERR_PROTOCOL;
+      }
+    }
+  }
+
+  return SNAPCAST_FRAMER_OK;
+}
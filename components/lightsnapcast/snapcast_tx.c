@@ -0,0 +1,298 @@
+/**
+ * Preallocated transmit path for client messages. Positions are counted in
+ * bytes of the TCP stream, a slot is free again once the acknowledged byte
+ * count passed the end of its message.
+ */
+
+#include "snapcast_tx.h"
+
+#include <buffer.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+static const char *TAG = "SNAPCAST_TX";
+
+#define SNAPCAST_TX_FREE 0
+#define SNAPCAST_TX_IN_FLIGHT 1
+#define SNAPCAST_TX_ORPHAN 2
+
+// offsets in a serialized base message
+#define SNAPCAST_TX_ID_OFFSET 2
+#define SNAPCAST_TX_SENT_OFFSET 6
+
+/**
+ *
+ */
+int32_t snapcast_tx_init(snapcast_tx_t *tx) {
+  char timePayload[TIME_MESSAGE_SIZE];
+
+  memset(tx, 0, sizeof(snapcast_tx_t));
+
+  for (int i = 0; i < SNAPCAST_TX_SLOTS; i++) {
+    if (i < SNAPCAST_TX_SMALL_SLOTS) {
+      tx->slot[i].data = tx->smallData[i];
+      tx->slot[i].capacity = SNAPCAST_TX_SMALL_SIZE;
+    } else {
+      tx->slot[i].data = tx->largeData[i - SNAPCAST_TX_SMALL_SLOTS];
+      tx->slot[i].capacity = SNAPCAST_TX_LARGE_SIZE;
+    }
+  }
+
+  tx->mux = xSemaphoreCreateMutexStatic(&tx->muxBuffer);
+  if (tx->mux == NULL) {
+    return -1;
+  }
+
+  // latency is filled in by the server
+  memset(timePayload, 0, sizeof(timePayload));
+
+  return snapcast_tx_set_template(tx, SNAPCAST_MESSAGE_TIME, timePayload,
+                                  sizeof(timePayload));
+}
+
+/**
+ *
+ */
+int32_t snapcast_tx_set_template(snapcast_tx_t *tx, uint16_t type,
+                                 const char *payload, uint32_t size) {
+  snapcast_tx_template_t *tmpl = NULL;
+  base_message_t base;
+  uint32_t total = BASE_MESSAGE_SIZE + size;
+  int32_t ret = 0;
+
+  if (total > SNAPCAST_TX_LARGE_SIZE) {
+    ESP_LOGE(TAG, "message type %u too big: %lu", type,
+             (unsigned long)total);
+
+    return -1;
+  }
+
+  xSemaphoreTake(tx->mux, portMAX_DELAY);
+
+  for (int i = 0; i < SNAPCAST_TX_TEMPLATES; i++) {
+    if ((tx->templates[i].size > 0) && (tx->templates[i].type == type)) {
+      tmpl = &tx->templates[i];
+
+      break;
+    }
+  }
+
+  if ((tmpl == NULL) || (tmpl->capacity < total)) {
+    // space of a smaller template replaced here isn't reclaimed
+    if (tmpl == NULL) {
+      for (int i = 0; i < SNAPCAST_TX_TEMPLATES; i++) {
+        if (tx->templates[i].size == 0) {
+          tmpl = &tx->templates[i];
+
+          break;
+        }
+      }
+    }
+
+    if ((tmpl == NULL) || (tx->templatePoolUsed + total >
+                           SNAPCAST_TX_TEMPLATE_POOL_SIZE)) {
+      ESP_LOGE(TAG, "no space for template of message type %u", type);
+
+      ret = -1;
+      goto done;
+    }
+
+    tmpl->data = &tx->templatePool[tx->templatePoolUsed];
+    tmpl->capacity = total;
+    // keep templates word aligned
+    tx->templatePoolUsed += (total + 3) & ~3;
+  }
+
+  memset(&base, 0, sizeof(base));
+  base.type = type;
+  base.size = size;
+  if (base_message_serialize(&base, tmpl->data, BASE_MESSAGE_SIZE) != 0) {
+    ret = -1;
+    goto done;
+  }
+  memcpy(&tmpl->data[BASE_MESSAGE_SIZE], payload, size);
+
+  tmpl->type = type;
+  tmpl->size = total;
+
+done:
+  xSemaphoreGive(tx->mux);
+
+  return ret;
+}
+
+/**
+ *
+ */
+int32_t snapcast_tx_set_hello(snapcast_tx_t *tx, hello_message_t *msg) {
+  char *serialized;
+  size_t size = 0;
+  int32_t ret;
+
+  serialized = hello_message_serialize(msg, &size);
+  if (serialized == NULL) {
+    return -1;
+  }
+
+  ret = snapcast_tx_set_template(tx, SNAPCAST_MESSAGE_HELLO, serialized, size);
+
+  free(serialized);
+
+  return ret;
+}
+
+/**
+ *
+ */
+static void snapcast_tx_release(snapcast_tx_t *tx, int64_t now_us) {
+  uint32_t acked = __atomic_load_n(&tx->acked, __ATOMIC_ACQUIRE);
+
+  for (int i = 0; i < SNAPCAST_TX_SLOTS; i++) {
+    snapcast_tx_slot_t *slot = &tx->slot[i];
+
+    if ((slot->state == SNAPCAST_TX_IN_FLIGHT) &&
+        ((int32_t)(acked - slot->end) >= 0)) {
+      slot->state = SNAPCAST_TX_FREE;
+      tx->stats.inFlight--;
+    } else if ((slot->state == SNAPCAST_TX_ORPHAN) &&
+               (now_us - slot->orphan_us >= SNAPCAST_TX_ORPHAN_US)) {
+      slot->state = SNAPCAST_TX_FREE;
+      tx->stats.inFlight--;
+    }
+  }
+}
+
+/**
+ *
+ */
+int32_t snapcast_tx_send(snapcast_tx_t *tx, uint16_t type, uint16_t id,
+                         int64_t now_us, snapcast_tx_write_t write, void *ctx) {
+  const snapcast_tx_template_t *tmpl = NULL;
+  snapcast_tx_slot_t *slot = NULL;
+  write_buffer_t buffer;
+  int32_t ret = 0;
+
+  xSemaphoreTake(tx->mux, portMAX_DELAY);
+
+  for (int i = 0; i < SNAPCAST_TX_TEMPLATES; i++) {
+    if ((tx->templates[i].size > 0) && (tx->templates[i].type == type)) {
+      tmpl = &tx->templates[i];
+
+      break;
+    }
+  }
+
+  if (tmpl == NULL) {
+    ret = -1;
+    goto done;
+  }
+
+  snapcast_tx_release(tx, now_us);
+
+  // small slots come first, so the smallest fitting one is used
+  for (int i = 0; i < SNAPCAST_TX_SLOTS; i++) {
+    if ((tx->slot[i].state == SNAPCAST_TX_FREE) &&
+        (tx->slot[i].capacity >= tmpl->size)) {
+      slot = &tx->slot[i];
+
+      break;
+    }
+  }
+
+  if (slot == NULL) {
+    tx->stats.noSlot++;
+
+    ret = -2;
+    goto done;
+  }
+
+  memcpy(slot->data, tmpl->data, tmpl->size);
+
+  buffer_write_init(&buffer, &slot->data[SNAPCAST_TX_ID_OFFSET], 2);
+  buffer_write_uint16(&buffer, id);
+  buffer_write_init(&buffer, &slot->data[SNAPCAST_TX_SENT_OFFSET], 8);
+  buffer_write_int32(&buffer, now_us / 1000000);
+  buffer_write_int32(&buffer, now_us % 1000000);
+
+  if (write(ctx, slot->data, tmpl->size) < 0) {
+    // might be partly queued on a broken connection, treat it as such
+    slot->state = SNAPCAST_TX_ORPHAN;
+    slot->orphan_us = now_us;
+    tx->stats.inFlight++;
+    tx->stats.failed++;
+
+    ret = -3;
+    goto done;
+  }
+
+  // read by snapcast_tx_drained() in the transport's task
+  __atomic_store_n(&tx->written, tx->written + tmpl->size, __ATOMIC_RELEASE);
+  slot->end = tx->written;
+  slot->state = SNAPCAST_TX_IN_FLIGHT;
+  tx->stats.inFlight++;
+  tx->stats.sent++;
+
+done:
+  xSemaphoreGive(tx->mux);
+
+  return ret;
+}
+
+/**
+ *
+ */
+void snapcast_tx_acked(snapcast_tx_t *tx, uint32_t bytes) {
+  __atomic_fetch_add(&tx->acked, bytes, __ATOMIC_RELEASE);
+}
+
+/**
+ *
+ */
+void snapcast_tx_drained(snapcast_tx_t *tx) {
+  uint32_t written = __atomic_load_n(&tx->written, __ATOMIC_ACQUIRE);
+  uint32_t acked = __atomic_load_n(&tx->acked, __ATOMIC_ACQUIRE);
+
+  // acked may be ahead already if the message written last was reported
+  // before snapcast_tx_send() accounted it
+  while ((int32_t)(written - acked) > 0) {
+    if (__atomic_compare_exchange_n(&tx->acked, &acked, written, false,
+                                    __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+      break;
+    }
+  }
+}
+
+/**
+ *
+ */
+void snapcast_tx_reset(snapcast_tx_t *tx, int64_t now_us) {
+  xSemaphoreTake(tx->mux, portMAX_DELAY);
+
+  snapcast_tx_release(tx, now_us);
+
+  for (int i = 0; i < SNAPCAST_TX_SLOTS; i++) {
+    if (tx->slot[i].state == SNAPCAST_TX_IN_FLIGHT) {
+      tx->slot[i].state = SNAPCAST_TX_ORPHAN;
+      tx->slot[i].orphan_us = now_us;
+      tx->stats.orphaned++;
+    }
+  }
+
+  __atomic_store_n(&tx->written, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&tx->acked, 0, __ATOMIC_RELEASE);
+
+  xSemaphoreGive(tx->mux);
+}
+
+/**
+ *
+ */
+void snapcast_tx_get_stats(snapcast_tx_t *tx, snapcast_tx_stats_t *stats) {
+  xSemaphoreTake(tx->mux, portMAX_DELAY);
+
+  memcpy(stats, &tx->stats, sizeof(snapcast_tx_stats_t));
+
+  xSemaphoreGive(tx->mux);
+}
@@ -0,0 +1,102 @@
+/**
+ * Player sync control, see sync_control.h
+ */
+
+#include "sync_control.h"
+
+#include <string.h>
+
+/**
+ *
+ */
+void sync_control_init(sync_control_t *sc, int32_t tau_ms, int32_t max_ppb,
+                       int64_t softResync_us, int64_t hardResync_us) {
+  memset(sc, 0, sizeof(sync_control_t));
+
+  sc->shortFilter.numNodes = SYNC_CONTROL_SHORT_LEN;
+  sc->shortFilter.medianBuffer = sc->shortNodes;
+  sc->miniFilter.numNodes = SYNC_CONTROL_MINI_LEN;
+  sc->miniFilter.medianBuffer = sc->miniNodes;
+
+  rate_control_init(&sc->rate, tau_ms, max_ppb);
+  sc->softResync_us = softResync_us;
+  sc->hardResync_us = hardResync_us;
+
+  sync_control_reset(sc, 0);
+}
+
+/**
+ *
+ */
+static void sync_control_reset_filters(sync_control_t *sc) {
+  MEDIANFILTER_Init(&sc->shortFilter);
+  MEDIANFILTER_Init(&sc->miniFilter);
+
+  sc->shortMedian_us = 0;
+  sc->miniMedian_us = 0;
+}
+
+/**
+ *
+ */
+void sync_control_reset(sync_control_t *sc, int32_t skew_ppb) {
+  sync_control_reset_filters(sc);
+  sc->slew_us = 0;
+
+  rate_control_reset(&sc->rate, skew_ppb);
+  sc->ppb = sc->rate.ppb;
+}
+
+/**
+ *
+ */
+sync_control_action_t sync_control_update(sync_control_t *sc, int64_t age_us,
+                                          int64_t dt_us, bool starved) {
+  sc->stats.updates++;
+
+  sc->shortMedian_us = MEDIANFILTER_Insert(&sc->shortFilter, age_us);
+  sc->miniMedian_us = MEDIANFILTER_Insert(&sc->miniFilter, age_us);
+
+  // resync hard if we are getting very late / early, jump if a little too
+  // late / early, rest gets tuned in through the playback rate
+  if (starved) {
+    sc->stats.starved++;
+    sc->stats.hardResyncs++;
+
+    return SYNC_CONTROL_RESYNC_HARD;
+  }
+
+  if (MEDIANFILTER_isFull(&sc->shortFilter, 0)) {
+    if ((sc->shortMedian_us > sc->hardResync_us) ||
+        (sc->shortMedian_us < -sc->hardResync_us)) {
+      sc->stats.hardResyncs++;
+
+      return SYNC_CONTROL_RESYNC_HARD;
+    }
+
+    if ((sc->shortMedian_us > sc->softResync_us) ||
+        (sc->shortMedian_us < -sc->softResync_us)) {
+      sc->stats.softResyncs++;
+      sc->slew_us = sc->shortMedian_us;
+
+      // ages measured so far are off by the slew
+      sync_control_reset_filters(sc);
+
+      return SYNC_CONTROL_RESYNC_SOFT;
+    }
+  }
+
+  if (MEDIANFILTER_isFull(&sc->miniFilter, 0)) {
+    sc->ppb = rate_control_update(&sc->rate, sc->miniMedian_us, dt_us);
+  }
+
+  return SYNC_CONTROL_PLAY;
+}
+
+/**
+ *
+ */
+void sync_control_get_stats(const sync_control_t *sc,
+                            sync_control_stats_t *stats) {
+  *stats = sc->stats;
+}
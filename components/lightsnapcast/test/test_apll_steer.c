@@ -0,0 +1,160 @@
+/**
+ * APLL steering: coefficients for an offset, the average frequency between
+ * sdm0 steps, and a simulation of the sync loop with the PI controller
+ * driving the quantized APLL.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "apll_steer.h"
+#include "esp_log.h"
+#include "rate_control.h"
+#include "unity.h"
+
+static const char *TAG = "TEST_APLL";
+
+// 48 kHz: fi2s 24.576 MHz, o_div 6, apll 393.216 MHz = 40 MHz * 9.8304
+#define TEST_SDM0 149
+#define TEST_SDM1 212
+#define TEST_SDM2 5
+#define TEST_CHUNK_US 24000
+
+TEST_CASE("apll steer computes coefficients for an offset", "[lightsnapcast]") {
+  apll_steer_t st;
+
+  apll_steer_init(&st, TEST_SDM0, TEST_SDM1, TEST_SDM2);
+
+  // nominal, set once
+  TEST_ASSERT_TRUE(apll_steer_update(&st, 0));
+  TEST_ASSERT_EQUAL_UINT32(TEST_SDM0, apll_steer_sdm0(&st));
+  TEST_ASSERT_EQUAL_UINT32(TEST_SDM1, apll_steer_sdm1(&st));
+  TEST_ASSERT_EQUAL_UINT32(TEST_SDM2, apll_steer_sdm2(&st));
+  TEST_ASSERT_FALSE(apll_steer_update(&st, 0));
+  TEST_ASSERT_EQUAL_INT32(0, apll_steer_ppb(&st));
+
+  // +100 ppm is 64.4 steps of sdm0
+  apll_steer_init(&st, TEST_SDM0, TEST_SDM1, TEST_SDM2);
+  TEST_ASSERT_TRUE(apll_steer_update(&st, 100000));
+  TEST_ASSERT_EQUAL_UINT32(TEST_SDM1, apll_steer_sdm1(&st));
+  TEST_ASSERT_EQUAL_UINT32(TEST_SDM0 + 64, apll_steer_sdm0(&st));
+  TEST_ASSERT_INT32_WITHIN(1000, 100000, apll_steer_ppb(&st));
+
+  // -300 ppm borrows from sdm1
+  apll_steer_init(&st, TEST_SDM0, TEST_SDM1, TEST_SDM2);
+  apll_steer_update(&st, -300000);
+  TEST_ASSERT_EQUAL_UINT32(TEST_SDM1 - 1, apll_steer_sdm1(&st));
+  TEST_ASSERT_EQUAL_UINT32(TEST_SDM0 + 256 - 193, apll_steer_sdm0(&st));
+  TEST_ASSERT_INT32_WITHIN(1000, -300000, apll_steer_ppb(&st));
+
+  // limited to what fits into the registers
+  apll_steer_init(&st, 0, 0, 40);
+  apll_steer_update(&st, INT32_MAX);
+  TEST_ASSERT_EQUAL_UINT32(63, apll_steer_sdm2(&st));
+  TEST_ASSERT_EQUAL_UINT32(0xFF, apll_steer_sdm1(&st));
+  TEST_ASSERT_EQUAL_UINT32(0xFF, apll_steer_sdm0(&st));
+  apll_steer_update(&st, INT32_MIN);
+  TEST_ASSERT_EQUAL_UINT32(0, apll_steer_sdm2(&st));
+  TEST_ASSERT_EQUAL_UINT32(0, apll_steer_sdm1(&st));
+  TEST_ASSERT_EQUAL_UINT32(0, apll_steer_sdm0(&st));
+}
+
+TEST_CASE("apll steer averages to offsets between steps", "[lightsnapcast]") {
+  const int32_t ppb[] = {12345, -777, 500, 73210};
+  apll_steer_t st;
+
+  for (int k = 0; k < sizeof(ppb) / sizeof(ppb[0]); k++) {
+    int64_t sum = 0;
+    uint32_t changes = 0;
+
+    apll_steer_init(&st, TEST_SDM0, TEST_SDM1, TEST_SDM2);
+
+    for (int i = 0; i < 10000; i++) {
+      changes += apll_steer_update(&st, ppb[k]) ? 1 : 0;
+      sum += apll_steer_ppb(&st);
+    }
+
+    // a step is 1.55 ppm here, no more than a step away at any time
+    TEST_ASSERT_INT32_WITHIN(1600, ppb[k], apll_steer_ppb(&st));
+    TEST_ASSERT_INT32_WITHIN(10, ppb[k], (int32_t)(sum / 10000));
+    TEST_ASSERT_GREATER_THAN_UINT32(1, changes);
+  }
+}
+
+typedef struct {
+  int64_t err_ns;     // true sync error
+  int64_t maxAbs_ns;  // after settling
+  int32_t minPpb, maxPpb;
+} sim_t;
+
+/**
+ * Play chunks for duration_us with a server clock skew_ppb faster, the
+ * controller measures the error with +-noise_us and the APLL runs at the
+ * offset its coefficients give.
+ */
+static void simulate(rate_control_t *ctl, apll_steer_t *st, sim_t *sim,
+                     int32_t skew_ppb, int64_t duration_us, int64_t settle_us,
+                     int32_t noise_us) {
+  sim->minPpb = INT32_MAX;
+  sim->maxPpb = INT32_MIN;
+
+  for (int64_t t = 0; t < duration_us; t += TEST_CHUNK_US) {
+    int64_t measured = sim->err_ns / 1000;
+    int32_t ppb;
+
+    if (noise_us > 0) {
+      measured += rand() % (2 * noise_us + 1) - noise_us;
+    }
+
+    apll_steer_update(st, rate_control_update(ctl, measured, TEST_CHUNK_US));
+    ppb = apll_steer_ppb(st);
+
+    sim->err_ns += (int64_t)(skew_ppb - ppb) * TEST_CHUNK_US / 1000000;
+
+    if (t >= settle_us) {
+      if (llabs(sim->err_ns) > sim->maxAbs_ns) {
+        sim->maxAbs_ns = llabs(sim->err_ns);
+      }
+      if (ppb < sim->minPpb) {
+        sim->minPpb = ppb;
+      }
+      if (ppb > sim->maxPpb) {
+        sim->maxPpb = ppb;
+      }
+    }
+  }
+}
+
+TEST_CASE("apll steer keeps sync without pitch flutter", "[lightsnapcast]") {
+  rate_control_t ctl;
+  apll_steer_t st;
+  sim_t sim;
+
+  srand(7);
+
+  rate_control_init(&ctl, 10000, 200000);
+  apll_steer_init(&st, TEST_SDM0, TEST_SDM1, TEST_SDM2);
+
+  // 300µs early with a 37 ppm skew, no skew estimate yet
+  rate_control_reset(&ctl, 0);
+  memset(&sim, 0, sizeof(sim));
+  sim.err_ns = -300000;
+  simulate(&ctl, &st, &sim, 37000, 200LL * 1000000, 100LL * 1000000, 0);
+
+  ESP_LOGI(TAG, "clean: max error %lldns, %ld..%ldppb", sim.maxAbs_ns,
+           (long)sim.minPpb, (long)sim.maxPpb);
+  TEST_ASSERT_LESS_THAN_INT64(2000, sim.maxAbs_ns);
+  // a step or two around the skew, not +-100 ppm
+  TEST_ASSERT_INT32_WITHIN(4000, 37000, sim.minPpb);
+  TEST_ASSERT_INT32_WITHIN(4000, 37000, sim.maxPpb);
+
+  // measurement noise of the median filtered age
+  sim.maxAbs_ns = 0;
+  simulate(&ctl, &st, &sim, 37000, 200LL * 1000000, 0, 50);
+
+  ESP_LOGI(TAG, "noisy: max error %lldns, %ld..%ldppb", sim.maxAbs_ns,
+           (long)sim.minPpb, (long)sim.maxPpb);
+  TEST_ASSERT_LESS_THAN_INT64(50000, sim.maxAbs_ns);
+  TEST_ASSERT_INT32_WITHIN(25000, 37000, sim.minPpb);
+  TEST_ASSERT_INT32_WITHIN(25000, 37000, sim.maxPpb);
+}
@@ -0,0 +1,227 @@
+/**
+ * Chunk cursor: a simulated pulling decoder with a read ahead buffer like
+ * libFLAC's reads a frame stream split into wire chunks of random size.
+ * Every frame has to come out with the time stamp of its own position in the
+ * stream, no matter which chunk was being read when it was decoded.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "chunk_cursor.h"
+#include "unity.h"
+
+#define FUZZ_SR 48000
+#define FUZZ_BLOCKSIZE 1152
+// 24 ms, exact in µs
+#define FUZZ_FRAME_US (1000000LL * FUZZ_BLOCKSIZE / FUZZ_SR)
+#define FUZZ_T0 1000000000LL
+#define FUZZ_HEADER 42
+#define FUZZ_FRAMES 300
+#define FUZZ_DECODER_BUFFER 2048
+
+typedef struct fuzz_decoder_s {
+  char buffer[FUZZ_DECODER_BUFFER];
+  uint32_t len;   // valid bytes in buffer
+  uint32_t used;  // decoded bytes in buffer
+
+  uint32_t frame;  // next frame to decode
+  uint32_t checked;
+} fuzz_decoder_t;
+
+static uint32_t frameSize[FUZZ_FRAMES];
+static uint32_t frameStart[FUZZ_FRAMES + 1];
+static char stream[FUZZ_HEADER + FUZZ_FRAMES * 600];
+
+static uint32_t fuzz(uint32_t min, uint32_t max) {
+  return min + (uint32_t)rand() % (max - min + 1);
+}
+
+/**
+ * Time stamp snapserver would send for a chunk: the one of the first frame
+ * starting in it.
+ */
+static int64_t fuzz_chunk_time(uint32_t start, uint32_t len) {
+  for (uint32_t i = 0; i < FUZZ_FRAMES; i++) {
+    if ((frameStart[i] >= start) && (frameStart[i] < start + len)) {
+      return FUZZ_T0 + i * FUZZ_FRAME_US;
+    }
+  }
+
+  // no frame starts here, never used
+  return -1;
+}
+
+/**
+ * One step of process_single(): decode a frame if it is buffered completely,
+ * read more otherwise.
+ */
+static bool fuzz_decode_step(fuzz_decoder_t *dec, chunk_cursor_t *cursor) {
+  int64_t ts;
+
+  if ((dec->frame < FUZZ_FRAMES) &&
+      (dec->len - dec->used >= frameSize[dec->frame])) {
+    uint32_t size = frameSize[dec->frame];
+    uint64_t end = chunk_cursor_tell(cursor) - (dec->len - dec->used) + size;
+
+    TEST_ASSERT_EQUAL_MEMORY(&stream[frameStart[dec->frame]],
+                             &dec->buffer[dec->used], size);
+    TEST_ASSERT_EQUAL_INT32(
+        0, chunk_cursor_frame(cursor, end, FUZZ_BLOCKSIZE, FUZZ_SR, &ts));
+    TEST_ASSERT_EQUAL_INT64(FUZZ_T0 + dec->frame * FUZZ_FRAME_US, ts);
+
+    dec->used += size;
+    dec->frame++;
+    dec->checked++;
+
+    return true;
+  }
+
+  if (chunk_cursor_remaining(cursor) == 0) {
+    return false;
+  }
+
+  // keep the unused tail, read a random amount behind it
+  memmove(dec->buffer, &dec->buffer[dec->used], dec->len - dec->used);
+  dec->len -= dec->used;
+  dec->used = 0;
+
+  dec->len += chunk_cursor_read(cursor, &dec->buffer[dec->len],
+                                fuzz(1, FUZZ_DECODER_BUFFER - dec->len));
+
+  return true;
+}
+
+TEST_CASE("chunk cursor stamps frames across fuzzed chunk boundaries",
+          "[lightsnapcast]") {
+  static chunk_cursor_t cursor;
+  static fuzz_decoder_t dec;
+  sg_chain_t chain;
+
+  for (uint32_t seed = 1; seed <= 50; seed++) {
+    uint32_t pos, len;
+
+    srand(seed);
+
+    for (uint32_t i = 0; i < sizeof(stream); i++) {
+      stream[i] = (char)rand();
+    }
+
+    frameStart[0] = FUZZ_HEADER;
+    for (uint32_t i = 0; i < FUZZ_FRAMES; i++) {
+      frameSize[i] = fuzz(20, 600);
+      frameStart[i + 1] = frameStart[i] + frameSize[i];
+    }
+
+    memset(&dec, 0, sizeof(dec));
+    chunk_cursor_reset(&cursor);
+    sg_chain_init(&chain);
+
+    // codec header, the decoder takes all of it
+    sg_chain_append(&chain, stream, FUZZ_HEADER, NULL, NULL);
+    TEST_ASSERT_EQUAL_INT32(0, chunk_cursor_push(&cursor, &chain, 0));
+    TEST_ASSERT_EQUAL_UINT32(FUZZ_HEADER,
+                             chunk_cursor_read(&cursor, dec.buffer, 100));
+    chunk_cursor_sync(&cursor, chunk_cursor_tell(&cursor));
+    sg_chain_release(&chain);
+
+    for (pos = FUZZ_HEADER; pos < frameStart[FUZZ_FRAMES]; pos += len) {
+      uint32_t split;
+
+      // mostly a few frames, sometimes a part of one
+      len = fuzz(1, 1800);
+      if (pos + len > frameStart[FUZZ_FRAMES]) {
+        len = frameStart[FUZZ_FRAMES] - pos;
+      }
+
+      // a chunk may be split across pbufs
+      split = fuzz(0, len);
+      sg_chain_append(&chain, &stream[pos], split, NULL, NULL);
+      sg_chain_append(&chain, &stream[pos + split], len - split, NULL, NULL);
+
+      TEST_ASSERT_EQUAL_INT32(
+          0, chunk_cursor_push(&cursor, &chain, fuzz_chunk_time(pos, len)));
+
+      // like stream_decode_chunk(), frames may stay in the decoder buffer
+      while (chunk_cursor_remaining(&cursor) > 0) {
+        fuzz_decode_step(&dec, &cursor);
+      }
+
+      sg_chain_release(&chain);
+    }
+
+    while (fuzz_decode_step(&dec, &cursor)) {
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(FUZZ_FRAMES, dec.checked);
+    TEST_ASSERT_EQUAL_UINT64(frameStart[FUZZ_FRAMES],
+                             chunk_cursor_tell(&cursor));
+  }
+}
+
+TEST_CASE("chunk cursor skips unread bytes and drops stale chunks",
+          "[lightsnapcast]") {
+  chunk_cursor_t cursor;
+  sg_chain_t chain;
+  char data[100], out[100];
+  int64_t ts;
+
+  for (int i = 0; i < sizeof(data); i++) {
+    data[i] = i;
+  }
+
+  chunk_cursor_reset(&cursor);
+  sg_chain_init(&chain);
+  sg_chain_append(&chain, data, sizeof(data), NULL, NULL);
+
+  // nothing pushed yet
+  TEST_ASSERT_EQUAL_UINT32(0, chunk_cursor_remaining(&cursor));
+  TEST_ASSERT_EQUAL_UINT32(0, chunk_cursor_read(&cursor, out, 10));
+  TEST_ASSERT_EQUAL_INT32(-1,
+                          chunk_cursor_frame(&cursor, 10, 100, 1000, &ts));
+
+  // first chunk is read partially, the rest doesn't count
+  chunk_cursor_reset(&cursor);
+  TEST_ASSERT_EQUAL_INT32(0, chunk_cursor_push(&cursor, &chain, 5000));
+  TEST_ASSERT_EQUAL_UINT32(30, chunk_cursor_read(&cursor, out, 30));
+  TEST_ASSERT_EQUAL_INT8(29, out[29]);
+  TEST_ASSERT_EQUAL_INT32(0, chunk_cursor_push(&cursor, &chain, 9000));
+  TEST_ASSERT_EQUAL_UINT64(100, chunk_cursor_tell(&cursor));
+  TEST_ASSERT_EQUAL_UINT32(100, chunk_cursor_remaining(&cursor));
+
+  // frame at 0 and 20 come from the first chunk, 100 from the second
+  TEST_ASSERT_EQUAL_INT32(0, chunk_cursor_frame(&cursor, 20, 100, 1000, &ts));
+  TEST_ASSERT_EQUAL_INT64(5000, ts);
+  TEST_ASSERT_EQUAL_INT32(0,
+                          chunk_cursor_frame(&cursor, 100, 100, 1000, &ts));
+  TEST_ASSERT_EQUAL_INT64(105000, ts);
+  TEST_ASSERT_EQUAL_INT32(0,
+                          chunk_cursor_frame(&cursor, 150, 100, 1000, &ts));
+  TEST_ASSERT_EQUAL_INT64(9000, ts);
+  TEST_ASSERT_EQUAL_UINT32(1, cursor.count);
+
+  // a decoder falling behind loses the oldest time stamps
+  for (int i = 0; i < CHUNK_CURSOR_PENDING - 1; i++) {
+    TEST_ASSERT_EQUAL_INT32(0, chunk_cursor_push(&cursor, &chain, i));
+  }
+  TEST_ASSERT_EQUAL_INT32(-1, chunk_cursor_push(&cursor, &chain, 77));
+  TEST_ASSERT_EQUAL_UINT32(CHUNK_CURSOR_PENDING, cursor.count);
+
+  // its frames are reported as unstamped
+  TEST_ASSERT_EQUAL_INT32(-1,
+                          chunk_cursor_frame(&cursor, 180, 100, 1000, &ts));
+
+  // a decoder error drops the rest of the chunk
+  chunk_cursor_reset(&cursor);
+  TEST_ASSERT_EQUAL_INT32(0, chunk_cursor_push(&cursor, &chain, 5000));
+  TEST_ASSERT_EQUAL_UINT32(30, chunk_cursor_read(&cursor, out, 30));
+  chunk_cursor_skip(&cursor);
+  TEST_ASSERT_EQUAL_UINT32(0, chunk_cursor_remaining(&cursor));
+  TEST_ASSERT_EQUAL_UINT64(100, chunk_cursor_tell(&cursor));
+  TEST_ASSERT_EQUAL_INT32(0, chunk_cursor_push(&cursor, &chain, 9000));
+  TEST_ASSERT_EQUAL_UINT64(100, chunk_cursor_tell(&cursor));
+  TEST_ASSERT_EQUAL_INT32(0,
+                          chunk_cursor_frame(&cursor, 150, 100, 1000, &ts));
+  TEST_ASSERT_EQUAL_INT64(9000, ts);
+  TEST_ASSERT_EQUAL_UINT32(1, cursor.count);
+}
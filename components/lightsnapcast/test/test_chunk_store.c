@@ -0,0 +1,224 @@
+/**
+ * Compressed chunk store: FIFO behaviour across ring wraps and RAM needed
+ * per second of buffered audio for PCM, FLAC and OPUS chunks.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FLAC/stream_encoder.h"
+#include "chunk_store.h"
+#include "esp_log.h"
+#include "opus.h"
+#include "player.h"
+#include "unity.h"
+
+static const char *TAG = "TEST_STORE";
+
+#define TEST_BUFFER_SECONDS 3
+#define TEST_STORE_SIZE (512 * 1024)
+
+TEST_CASE("chunk store keeps order across wraps", "[lightsnapcast]") {
+  chunk_store_t store;
+  char data[600];
+  uint32_t pushed = 0, popped = 0;
+
+  TEST_ASSERT_EQUAL(0, chunk_store_init(&store, 4096));
+
+  srand(1704);
+
+  for (int i = 0; i < 20000; i++) {
+    if ((rand() % 2) == 0) {
+      uint32_t size = 1 + rand() % sizeof(data);
+      tv_t ts = {pushed, 0};
+      char *p = chunk_store_reserve(&store, &ts, size);
+
+      if (p) {
+        memset(p, (char)pushed, size);
+        chunk_store_commit(&store);
+        pushed++;
+      } else {
+        TEST_ASSERT_GREATER_THAN(0, chunk_store_count(&store));
+      }
+    } else {
+      tv_t ts;
+      uint32_t size;
+      const char *p = chunk_store_peek(&store, &ts, &size);
+
+      if (p) {
+        TEST_ASSERT_EQUAL_INT32(popped, ts.sec);
+        memset(data, (char)popped, size);
+        TEST_ASSERT_EQUAL_MEMORY(data, p, size);
+        chunk_store_pop(&store);
+        popped++;
+      } else {
+        TEST_ASSERT_EQUAL_UINT32(pushed, popped);
+      }
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(pushed - popped, chunk_store_count(&store));
+    TEST_ASSERT_LESS_OR_EQUAL(store.size, store.used);
+  }
+
+  while (chunk_store_peek(&store, NULL, &(uint32_t){0})) {
+    chunk_store_pop(&store);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, store.used);
+
+  chunk_store_deinit(&store);
+}
+
+typedef struct bench_ctx_s {
+  chunk_store_t store;
+  uint32_t sr;
+  int64_t ts;
+  uint32_t chunks;
+} bench_ctx_t;
+
+/**
+ * store a chunk like http_get_task() does and drop chunks older than the
+ * buffer length like player_task() would
+ */
+static void bench_store_chunk(bench_ctx_t *ctx, const void *data,
+                              uint32_t size, uint32_t frames) {
+  tv_t ts = {ctx->ts / 1000000, ctx->ts % 1000000};
+  char *p;
+
+  while (chunk_store_span_us(&ctx->store) >= TEST_BUFFER_SECONDS * 1000000LL) {
+    chunk_store_pop(&ctx->store);
+  }
+
+  p = chunk_store_reserve(&ctx->store, &ts, size);
+  TEST_ASSERT_NOT_NULL(p);
+  memcpy(p, data, size);
+  chunk_store_commit(&ctx->store);
+
+  ctx->ts += 1000000LL * frames / ctx->sr;
+  ctx->chunks++;
+}
+
+/**
+ * a few partials with vibrato and a little noise, compresses less than pure
+ * tones
+ */
+static void bench_signal(int16_t *pcm, uint32_t frames, uint32_t sr,
+                         uint32_t offset) {
+  for (uint32_t i = 0; i < frames; i++) {
+    double t = (double)(offset + i) / sr;
+    double v = 0.3 * sin(2 * M_PI * 220 * t + 3 * sin(2 * M_PI * 5 * t)) +
+               0.2 * sin(2 * M_PI * 330.5 * t) +
+               0.1 * sin(2 * M_PI * 1761 * t) +
+               0.05 * ((double)rand() / RAND_MAX - 0.5);
+
+    pcm[2 * i] = (int16_t)(v * 32767);
+    pcm[2 * i + 1] = (int16_t)(v * 0.8 * 32767);
+  }
+}
+
+static void bench_report(const char *codec, bench_ctx_t *ctx) {
+  int64_t span = chunk_store_span_us(&ctx->store);
+
+  TEST_ASSERT_GREATER_THAN(0, span);
+
+  ESP_LOGI(TAG, "%s: %lu chunks, %.0f bytes RAM per second of audio", codec,
+           (unsigned long)chunk_store_count(&ctx->store),
+           (double)ctx->store.used * 1000000.0 / (double)span);
+}
+
+static FLAC__StreamEncoderWriteStatus bench_flac_write(
+    const FLAC__StreamEncoder *encoder, const FLAC__byte buffer[],
+    size_t bytes, uint32_t samples, uint32_t current_frame,
+    void *client_data) {
+  // samples == 0 for metadata, snapserver sends that as codec header
+  if (samples > 0) {
+    bench_store_chunk((bench_ctx_t *)client_data, buffer, bytes, samples);
+  }
+
+  return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+}
+
+TEST_CASE("chunk store RAM per second of buffered audio",
+          "[lightsnapcast][bench]") {
+  static bench_ctx_t ctx;
+  const uint32_t seconds = TEST_BUFFER_SECONDS + 1;
+  int16_t *pcm;
+  FLAC__int32 *flacIn;
+
+  pcm = malloc(1152 * 2 * sizeof(int16_t));
+  flacIn = malloc(1152 * 2 * sizeof(FLAC__int32));
+  TEST_ASSERT_NOT_NULL(pcm);
+  TEST_ASSERT_NOT_NULL(flacIn);
+
+  // PCM, what the player queue holds today
+  {
+    const uint32_t frames = 1152, sr = 44100;
+    size_t overhead = sizeof(pcm_chunk_message_t) + sizeof(pcm_chunk_fragment_t);
+
+    ESP_LOGI(TAG, "pcm: %.0f bytes RAM per second of audio",
+             (double)sr / frames * (frames * 4 + overhead));
+  }
+
+  // FLAC 44100:16:2, one frame per wire chunk like snapserver sends it
+  memset(&ctx, 0, sizeof(ctx));
+  TEST_ASSERT_EQUAL(0, chunk_store_init(&ctx.store, TEST_STORE_SIZE));
+  ctx.sr = 44100;
+  {
+    FLAC__StreamEncoder *enc = FLAC__stream_encoder_new();
+
+    TEST_ASSERT_NOT_NULL(enc);
+    FLAC__stream_encoder_set_channels(enc, 2);
+    FLAC__stream_encoder_set_bits_per_sample(enc, 16);
+    FLAC__stream_encoder_set_sample_rate(enc, ctx.sr);
+    FLAC__stream_encoder_set_compression_level(enc, 2);
+    FLAC__stream_encoder_set_blocksize(enc, 1152);
+    TEST_ASSERT_EQUAL(FLAC__STREAM_ENCODER_INIT_STATUS_OK,
+                      FLAC__stream_encoder_init_stream(
+                          enc, bench_flac_write, NULL, NULL, NULL, &ctx));
+
+    for (uint32_t pos = 0; pos < seconds * ctx.sr; pos += 1152) {
+      bench_signal(pcm, 1152, ctx.sr, pos);
+      for (int i = 0; i < 1152 * 2; i++) {
+        flacIn[i] = pcm[i];
+      }
+      TEST_ASSERT_TRUE(
+          FLAC__stream_encoder_process_interleaved(enc, flacIn, 1152));
+    }
+
+    FLAC__stream_encoder_finish(enc);
+    FLAC__stream_encoder_delete(enc);
+  }
+  bench_report("flac", &ctx);
+  chunk_store_deinit(&ctx.store);
+
+  // OPUS 48000:16:2, 20ms frames at 192kbit/s (snapserver default)
+  memset(&ctx, 0, sizeof(ctx));
+  TEST_ASSERT_EQUAL(0, chunk_store_init(&ctx.store, TEST_STORE_SIZE));
+  ctx.sr = 48000;
+  {
+    int err;
+    OpusEncoder *enc =
+        opus_encoder_create(ctx.sr, 2, OPUS_APPLICATION_AUDIO, &err);
+    unsigned char packet[1500];
+
+    TEST_ASSERT_NOT_NULL(enc);
+    opus_encoder_ctl(enc, OPUS_SET_BITRATE(192000));
+
+    for (uint32_t pos = 0; pos < seconds * ctx.sr; pos += 960) {
+      int len;
+
+      bench_signal(pcm, 960, ctx.sr, pos);
+      len = opus_encode(enc, pcm, 960, packet, sizeof(packet));
+      TEST_ASSERT_GREATER_THAN(0, len);
+
+      bench_store_chunk(&ctx, packet, len, 960);
+    }
+
+    opus_encoder_destroy(enc);
+  }
+  bench_report("opus", &ctx);
+  chunk_store_deinit(&ctx.store);
+
+  free(flacIn);
+  free(pcm);
+}
@@ -0,0 +1,62 @@
+/**
+ * Latency histogram: log2 bucket edges, percentiles and the log format.
+ */
+
+#include <string.h>
+
+#include "latency_hist.h"
+#include "unity.h"
+
+TEST_CASE("latency histogram buckets and percentiles", "[lightsnapcast]") {
+  latency_hist_t hist;
+
+  latency_hist_reset(&hist);
+  TEST_ASSERT_EQUAL_INT64(0, latency_hist_percentile(&hist, 50));
+
+  // 90 fast ones, 9 around a ms, one outlier
+  for (int i = 0; i < 90; i++) {
+    latency_hist_add(&hist, 100);
+  }
+  for (int i = 0; i < 9; i++) {
+    latency_hist_add(&hist, 1000);
+  }
+  latency_hist_add(&hist, 30000000);
+
+  TEST_ASSERT_EQUAL_UINT32(100, hist.count);
+  TEST_ASSERT_EQUAL_UINT32(90, hist.bucket[0]);
+  TEST_ASSERT_EQUAL_UINT32(9, hist.bucket[3]);
+  TEST_ASSERT_EQUAL_UINT32(1, hist.bucket[LATENCY_HIST_BUCKETS - 1]);
+  TEST_ASSERT_EQUAL_INT64(30000000, hist.max_us);
+
+  TEST_ASSERT_EQUAL_INT64(128, latency_hist_percentile(&hist, 50));
+  TEST_ASSERT_EQUAL_INT64(128, latency_hist_percentile(&hist, 90));
+  TEST_ASSERT_EQUAL_INT64(1024, latency_hist_percentile(&hist, 99));
+  TEST_ASSERT_EQUAL_INT64(30000000, latency_hist_percentile(&hist, 100));
+
+  // edges: 127 is below the first bound, 128 is not
+  latency_hist_reset(&hist);
+  latency_hist_add(&hist, -5);
+  latency_hist_add(&hist, 127);
+  latency_hist_add(&hist, 128);
+  TEST_ASSERT_EQUAL_UINT32(2, hist.bucket[0]);
+  TEST_ASSERT_EQUAL_UINT32(1, hist.bucket[1]);
+}
+
+TEST_CASE("latency histogram format", "[lightsnapcast]") {
+  latency_hist_t hist;
+  char str[64];
+
+  latency_hist_reset(&hist);
+  TEST_ASSERT_EQUAL_UINT32(0, latency_hist_format(&hist, str, sizeof(str)));
+  TEST_ASSERT_EQUAL_STRING("", str);
+
+  latency_hist_add(&hist, 50);
+  latency_hist_add(&hist, 50);
+  latency_hist_add(&hist, 600);
+  latency_hist_format(&hist, str, sizeof(str));
+  TEST_ASSERT_EQUAL_STRING("128:2 1024:1", str);
+
+  // pairs which don't fit completely are dropped
+  latency_hist_format(&hist, str, 8);
+  TEST_ASSERT_EQUAL_STRING("128:2", str);
+}
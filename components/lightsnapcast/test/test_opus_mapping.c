@@ -0,0 +1,199 @@
+/**
+ * Opus channel mappings and routing of multichannel decoder output to the
+ * stereo player, down to a 4 channel stream encoded and decoded by libopus.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "opus_mapping.h"
+#include "opus_multistream.h"
+#include "pcm_pack.h"
+#include "unity.h"
+
+TEST_CASE("opus mapping parses OpusHead", "[lightsnapcast]") {
+  uint8_t head[32] = {'O', 'p', 'u', 's', 'H', 'e', 'a', 'd', 1, 2};
+  opus_mapping_t mapping;
+
+  // family 0, stereo
+  TEST_ASSERT_EQUAL_INT32(0, opus_mapping_parse_head(&mapping, head, 19));
+  TEST_ASSERT_EQUAL_UINT8(2, mapping.channels);
+  TEST_ASSERT_EQUAL_UINT8(1, mapping.streams);
+  TEST_ASSERT_EQUAL_UINT8(1, mapping.coupled);
+
+  // family 0 is mono or stereo only
+  head[9] = 4;
+  TEST_ASSERT_EQUAL_INT32(-1, opus_mapping_parse_head(&mapping, head, 19));
+
+  // family 1, quad in two coupled streams, the table is read as is
+  head[18] = 1;
+  head[19] = 2;
+  head[20] = 2;
+  head[21] = 2;
+  head[22] = 3;
+  head[23] = 0;
+  head[24] = 1;
+  TEST_ASSERT_EQUAL_INT32(-1, opus_mapping_parse_head(&mapping, head, 24));
+  TEST_ASSERT_EQUAL_INT32(0, opus_mapping_parse_head(&mapping, head, 25));
+  TEST_ASSERT_EQUAL_UINT8(4, mapping.channels);
+  TEST_ASSERT_EQUAL_UINT8(2, mapping.streams);
+  TEST_ASSERT_EQUAL_UINT8(2, mapping.coupled);
+  TEST_ASSERT_EQUAL_UINT8(3, mapping.mapping[1]);
+
+  // silent channel, index past the streams
+  head[22] = 255;
+  TEST_ASSERT_EQUAL_INT32(0, opus_mapping_parse_head(&mapping, head, 25));
+  head[22] = 4;
+  TEST_ASSERT_EQUAL_INT32(-1, opus_mapping_parse_head(&mapping, head, 25));
+  head[22] = 3;
+
+  // more coupled than streams, more channels than kept
+  head[20] = 3;
+  TEST_ASSERT_EQUAL_INT32(-1, opus_mapping_parse_head(&mapping, head, 25));
+  head[20] = 2;
+  head[9] = OPUS_MAPPING_MAX_CHANNELS + 1;
+  TEST_ASSERT_EQUAL_INT32(
+      -1, opus_mapping_parse_head(&mapping, head, sizeof(head)));
+  head[9] = 4;
+
+  // no OpusHead
+  head[0] = 'o';
+  TEST_ASSERT_EQUAL_INT32(-1, opus_mapping_parse_head(&mapping, head, 25));
+
+  TEST_ASSERT_EQUAL_INT32(-1, opus_mapping_default(&mapping, 0));
+  TEST_ASSERT_EQUAL_INT32(
+      -1, opus_mapping_default(&mapping, OPUS_MAPPING_MAX_CHANNELS + 1));
+}
+
+TEST_CASE("pcm pack routes two of many channels", "[lightsnapcast]") {
+  int16_t samples[4 * 6];
+  uint32_t a[2], b[4];
+  pcm_chunk_fragment_t fb = {sizeof(b), (char *)b, NULL};
+  pcm_chunk_fragment_t fa = {sizeof(a), (char *)a, &fb};
+  pcm_chunk_message_t chunk = {{0, 0}, sizeof(a) + sizeof(b), &fa, 0};
+
+  for (int i = 0; i < 4 * 6; i++) {
+    samples[i] = (int16_t)(-100 * i - 1);
+  }
+
+  memset(a, 0, sizeof(a));
+  memset(b, 0, sizeof(b));
+
+  // channels 3 and 1 of 4, truncated at the end of the chunk
+  TEST_ASSERT_EQUAL_UINT32(
+      5, pcm_pack_chunk_s16_routed(&chunk, 1, samples, 4, 3, 1, 6));
+  TEST_ASSERT_EQUAL_HEX32(0, a[0]);
+  for (int i = 0; i < 5; i++) {
+    uint32_t word = (i < 1) ? a[1 + i] : b[i - 1];
+
+    TEST_ASSERT_EQUAL_INT16(samples[4 * i + 3], (int16_t)(word >> 16));
+    TEST_ASSERT_EQUAL_INT16(samples[4 * i + 1], (int16_t)(word & 0xFFFF));
+  }
+
+  // mono on both sides
+  TEST_ASSERT_EQUAL_UINT32(
+      1, pcm_pack_chunk_s16_routed(&chunk, 0, samples, 1, 0, 0, 1));
+  TEST_ASSERT_EQUAL_HEX32(0xFFFFFFFF, a[0]);
+
+  // stereo in order is the Opus layout
+  TEST_ASSERT_EQUAL_UINT32(
+      1, pcm_pack_chunk_s16_routed(&chunk, 0, samples, 2, 0, 1, 1));
+  TEST_ASSERT_EQUAL_HEX32(0xFFFFFF9B, a[0]);
+
+  TEST_ASSERT_EQUAL_UINT32(
+      0, pcm_pack_chunk_s16_routed(&chunk, 0, samples, 4, 4, 1, 1));
+}
+
+#define QUAD_SR 48000
+#define QUAD_FRAME 960
+#define QUAD_PACKETS 25
+
+/**
+ * Root mean square of one half of the words, past the decoder's start up.
+ */
+static uint32_t quad_rms(const uint32_t *words, uint32_t count,
+                         uint32_t shift) {
+  double sum = 0;
+
+  for (uint32_t i = 0; i < count; i++) {
+    double sample = (int16_t)(words[i] >> shift);
+
+    sum += sample * sample;
+  }
+
+  return (uint32_t)sqrt(sum / count);
+}
+
+TEST_CASE("opus multistream decodes 4 channels and routes them",
+          "[lightsnapcast]") {
+  static int16_t pcm[QUAD_FRAME * 4];
+  static int16_t decoded[QUAD_FRAME * 4];
+  static uint32_t words[2][QUAD_FRAME * QUAD_PACKETS];
+  static unsigned char packet[4000];
+  unsigned char encMapping[4];
+  int streams, coupled, error;
+  OpusMSEncoder *enc;
+  OpusMSDecoder *dec;
+  opus_mapping_t mapping;
+
+  // the default mapping has to match what the surround encoder does
+  enc = opus_multistream_surround_encoder_create(
+      QUAD_SR, 4, 1, &streams, &coupled, encMapping,
+      OPUS_APPLICATION_AUDIO, &error);
+  TEST_ASSERT_NOT_NULL(enc);
+  TEST_ASSERT_EQUAL_INT32(0, opus_mapping_default(&mapping, 4));
+  TEST_ASSERT_EQUAL_INT(streams, mapping.streams);
+  TEST_ASSERT_EQUAL_INT(coupled, mapping.coupled);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(encMapping, mapping.mapping, 4);
+  opus_multistream_encoder_ctl(enc, OPUS_SET_BITRATE(256000));
+
+  dec = opus_multistream_decoder_create(QUAD_SR, mapping.channels,
+                                        mapping.streams, mapping.coupled,
+                                        mapping.mapping, &error);
+  TEST_ASSERT_NOT_NULL(dec);
+
+  for (int p = 0; p < QUAD_PACKETS; p++) {
+    // front silent, rear left loud, rear right quiet
+    for (int i = 0; i < QUAD_FRAME; i++) {
+      double t = (double)(p * QUAD_FRAME + i) / QUAD_SR;
+
+      pcm[4 * i + 0] = 0;
+      pcm[4 * i + 1] = 0;
+      pcm[4 * i + 2] = (int16_t)(10000 * sin(2 * M_PI * 440 * t));
+      pcm[4 * i + 3] = (int16_t)(2500 * sin(2 * M_PI * 1000 * t));
+    }
+
+    int len = opus_multistream_encode(enc, pcm, QUAD_FRAME, packet,
+                                      sizeof(packet));
+    TEST_ASSERT_GREATER_THAN_INT(0, len);
+
+    TEST_ASSERT_EQUAL_INT(QUAD_FRAME,
+                          opus_multistream_decode(dec, packet, len, decoded,
+                                                  QUAD_FRAME, 0));
+
+    for (int r = 0; r < 2; r++) {
+      pcm_chunk_fragment_t fragment = {QUAD_FRAME * 4,
+                                       (char *)&words[r][p * QUAD_FRAME],
+                                       NULL};
+      pcm_chunk_message_t chunk = {{0, 0}, QUAD_FRAME * 4, &fragment, 0};
+
+      // front pair and rear pair, like two clients of a bi-amped speaker
+      TEST_ASSERT_EQUAL_UINT32(
+          QUAD_FRAME, pcm_pack_chunk_s16_routed(&chunk, 0, decoded, 4,
+                                                2 * r, 2 * r + 1, QUAD_FRAME));
+    }
+  }
+
+  // sine RMS is 0.707 of the amplitude, the first packets are start up
+  uint32_t skip = 5 * QUAD_FRAME;
+  uint32_t count = (QUAD_PACKETS - 5) * QUAD_FRAME;
+
+  TEST_ASSERT_LESS_THAN_UINT32(200, quad_rms(&words[0][skip], count, 16));
+  TEST_ASSERT_LESS_THAN_UINT32(200, quad_rms(&words[0][skip], count, 0));
+  TEST_ASSERT_UINT32_WITHIN(1500, 7071, quad_rms(&words[1][skip], count, 16));
+  TEST_ASSERT_UINT32_WITHIN(500, 1768, quad_rms(&words[1][skip], count, 0));
+
+  opus_multistream_encoder_destroy(enc);
+  opus_multistream_decoder_destroy(dec);
+}
@@ -0,0 +1,609 @@
+/**
+ * PCM packing: planar decoder output interleaved into player chunks, and
+ * FLAC decode plus pack time of the direct path against the previous one,
+ * which collected frames in a realloc'ed byte buffer and copied them to the
+ * chunk afterwards. Same for Opus, where the previous path realloc'ed its
+ * output for every packet and guessed its size.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FLAC/stream_decoder.h"
+#include "FLAC/stream_encoder.h"
+#include "opus.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "pcm_pack.h"
+#include "pcm_pool.h"
+#include "player.h"
+#include "unity.h"
+
+static const char *TAG = "TEST_PACK";
+
+TEST_CASE("pcm pack interleaves 16 bit stereo across fragments",
+          "[lightsnapcast]") {
+  int32_t left[10], right[10];
+  uint32_t a[4], b[8];
+  pcm_chunk_fragment_t fb = {sizeof(b), (char *)b, NULL};
+  pcm_chunk_fragment_t fa = {sizeof(a), (char *)a, &fb};
+  pcm_chunk_message_t chunk = {{0, 0}, sizeof(a) + sizeof(b), &fa, 0};
+
+  for (int i = 0; i < 10; i++) {
+    left[i] = -1 - i;
+    right[i] = 1000 + i;
+  }
+
+  pcm_pack_s16_stereo(a, left, right, 1);
+  TEST_ASSERT_EQUAL_HEX32(0x03E8FFFF, a[0]);
+
+  memset(a, 0, sizeof(a));
+  memset(b, 0, sizeof(b));
+
+  // starts in the first fragment, continues in the second
+  TEST_ASSERT_EQUAL_UINT32(
+      10, pcm_pack_chunk_s16_stereo(&chunk, 1, left, right, 10));
+  TEST_ASSERT_EQUAL_HEX32(0, a[0]);
+  for (int i = 0; i < 10; i++) {
+    uint32_t word = (i < 3) ? a[1 + i] : b[i - 3];
+
+    TEST_ASSERT_EQUAL_INT16(left[i], (int16_t)(word & 0xFFFF));
+    TEST_ASSERT_EQUAL_INT16(right[i], (int16_t)(word >> 16));
+  }
+  TEST_ASSERT_EQUAL_HEX32(0, b[7]);
+
+  // offset in the second fragment, truncated at the end of the chunk
+  TEST_ASSERT_EQUAL_UINT32(
+      2, pcm_pack_chunk_s16_stereo(&chunk, 10, left, right, 5));
+  TEST_ASSERT_EQUAL_UINT32(
+      0, pcm_pack_chunk_s16_stereo(&chunk, 12, left, right, 5));
+}
+
+TEST_CASE("pcm pack keeps the Opus word layout", "[lightsnapcast]") {
+  int16_t samples[12];
+  uint32_t a[2], b[4];
+  pcm_chunk_fragment_t fb = {sizeof(b), (char *)b, NULL};
+  pcm_chunk_fragment_t fa = {sizeof(a), (char *)a, &fb};
+  pcm_chunk_message_t chunk = {{0, 0}, sizeof(a) + sizeof(b), &fa, 0};
+
+  for (int i = 0; i < 6; i++) {
+    samples[2 * i] = -1 - i;
+    samples[2 * i + 1] = 1000 + i;
+  }
+
+  memset(a, 0, sizeof(a));
+  memset(b, 0, sizeof(b));
+
+  // left in the upper half word, across both fragments, truncated
+  TEST_ASSERT_EQUAL_UINT32(
+      5, pcm_pack_chunk_s16_interleaved(&chunk, 1, samples, 6));
+  TEST_ASSERT_EQUAL_HEX32(0, a[0]);
+  TEST_ASSERT_EQUAL_HEX32(0xFFFF03E8, a[1]);
+  for (int i = 1; i < 5; i++) {
+    TEST_ASSERT_EQUAL_INT16(samples[2 * i], (int16_t)(b[i - 1] >> 16));
+    TEST_ASSERT_EQUAL_INT16(samples[2 * i + 1], (int16_t)(b[i - 1] & 0xFFFF));
+  }
+}
+
+TEST_CASE("pcm unpack matches the Opus layout across spans",
+          "[lightsnapcast]") {
+  int16_t samples[8];
+  uint32_t packed[4], unpacked[3];
+  pcm_chunk_fragment_t fp = {sizeof(packed), (char *)packed, NULL};
+  pcm_chunk_fragment_t fu = {sizeof(unpacked), (char *)unpacked, NULL};
+  pcm_chunk_message_t chunkPacked = {{0, 0}, sizeof(packed), &fp, 0};
+  pcm_chunk_message_t chunkUnpacked = {{0, 0}, sizeof(unpacked), &fu, 0};
+  pcm_unpack_t unpack;
+  char wire[sizeof(samples)];
+
+  for (int i = 0; i < 8; i++) {
+    samples[i] = (i & 1) ? (0x1234 + i) : (-0x1234 - i);
+  }
+
+  // wire data is little endian interleaved
+  memcpy(wire, samples, sizeof(wire));
+
+  pcm_pack_chunk_s16_interleaved(&chunkPacked, 0, samples, 4);
+
+  // frames split across spans, the last one doesn't fit
+  memset(unpacked, 0, sizeof(unpacked));
+  pcm_unpack_reset(&unpack);
+  pcm_unpack_s16_wire(&unpack, &chunkUnpacked, wire, 3);
+  pcm_unpack_s16_wire(&unpack, &chunkUnpacked, &wire[3], 6);
+  pcm_unpack_s16_wire(&unpack, &chunkUnpacked, &wire[9], 7);
+
+  TEST_ASSERT_EQUAL_UINT32(12, unpack.offset);
+  TEST_ASSERT_EQUAL_HEX32_ARRAY(packed, unpacked, 3);
+
+  // without a chunk the data is dropped
+  pcm_unpack_reset(&unpack);
+  pcm_unpack_s16_wire(&unpack, NULL, wire, sizeof(wire));
+  TEST_ASSERT_EQUAL_UINT32(0, unpack.offset);
+}
+
+TEST_CASE("pcm pack and unpack 24 and 32 bit stereo in 32 bit words",
+          "[lightsnapcast]") {
+  int32_t left[3] = {0x123456, -0x123456, 0x7FFFFF};
+  int32_t right[3] = {-1, 0x654321, -0x800000};
+  int32_t wire[6];
+  uint32_t packed[6], unpacked[6];
+  pcm_chunk_fragment_t f1 = {8, (char *)packed, NULL};
+  pcm_chunk_fragment_t f0 = {16, (char *)&packed[2], &f1};
+  pcm_chunk_fragment_t fu = {sizeof(unpacked), (char *)unpacked, NULL};
+  pcm_chunk_message_t chunk = {{0, 0}, sizeof(packed), &f0, 0};
+  pcm_chunk_message_t chunkUnpacked = {{0, 0}, sizeof(unpacked), &fu, 0};
+  pcm_unpack_t unpack;
+
+  TEST_ASSERT_EQUAL_UINT8(16, pcm_pack_container_bits(16));
+  TEST_ASSERT_EQUAL_UINT8(32, pcm_pack_container_bits(24));
+  TEST_ASSERT_EQUAL_UINT8(32, pcm_pack_container_bits(32));
+  TEST_ASSERT_EQUAL_UINT8(0, pcm_pack_container_bits(8));
+  TEST_ASSERT_NULL(pcm_pack_stereo_kernel(20));
+
+  // 24 bit samples are MSB aligned, left first, frames across fragments
+  TEST_ASSERT_EQUAL_UINT32(
+      3, pcm_pack_chunk_stereo(&chunk, 0, left, right, 3, 24));
+  TEST_ASSERT_EQUAL_HEX32(0x12345600, packed[2]);
+  TEST_ASSERT_EQUAL_HEX32(0xFFFFFF00, packed[3]);
+  TEST_ASSERT_EQUAL_HEX32(0xEDCBAA00, packed[4]);
+  TEST_ASSERT_EQUAL_HEX32(0x65432100, packed[5]);
+  TEST_ASSERT_EQUAL_HEX32(0x7FFFFF00, packed[0]);
+  TEST_ASSERT_EQUAL_HEX32(0x80000000, packed[1]);
+
+  // snapserver sends 24 bit in 4 byte samples, split anywhere
+  for (int i = 0; i < 3; i++) {
+    wire[2 * i] = left[i];
+    wire[2 * i + 1] = right[i];
+  }
+
+  pcm_unpack_reset(&unpack);
+  TEST_ASSERT_EQUAL_INT32(
+      0, pcm_unpack_wire(&unpack, &chunkUnpacked, (char *)wire, 5, 24));
+  TEST_ASSERT_EQUAL_INT32(0, pcm_unpack_wire(&unpack, &chunkUnpacked,
+                                             (char *)wire + 5, 19, 24));
+  TEST_ASSERT_EQUAL_UINT32(24, unpack.offset);
+  TEST_ASSERT_EQUAL_HEX32_ARRAY(&packed[2], unpacked, 4);
+  TEST_ASSERT_EQUAL_HEX32_ARRAY(packed, &unpacked[4], 2);
+
+  // 32 bit is taken as is
+  f0.size = 24;
+  f0.payload = (char *)packed;
+  TEST_ASSERT_EQUAL_UINT32(
+      3, pcm_pack_chunk_stereo(&chunk, 0, left, right, 3, 32));
+
+  pcm_unpack_reset(&unpack);
+  pcm_unpack_s32_wire(&unpack, &chunkUnpacked, (char *)wire, sizeof(wire));
+  TEST_ASSERT_EQUAL_HEX32_ARRAY(packed, unpacked, 6);
+  TEST_ASSERT_EQUAL_HEX32(0x00123456, unpacked[0]);
+  TEST_ASSERT_EQUAL_HEX32(0xFF800000, unpacked[5]);
+
+  TEST_ASSERT_EQUAL_INT32(
+      -1, pcm_unpack_wire(&unpack, &chunkUnpacked, (char *)wire, 4, 20));
+}
+
+TEST_CASE("pcm unpack handles random spans at any alignment",
+          "[lightsnapcast]") {
+  static int16_t samples[2 * 300];
+  static uint32_t packed[300], unpacked[300];
+  static char wire[sizeof(samples) + 3];
+  pcm_chunk_fragment_t fp = {sizeof(packed), (char *)packed, NULL};
+  pcm_chunk_fragment_t fu = {sizeof(unpacked), (char *)unpacked, NULL};
+  pcm_chunk_message_t chunkPacked = {{0, 0}, sizeof(packed), &fp, 0};
+  pcm_chunk_message_t chunkUnpacked = {{0, 0}, sizeof(unpacked), &fu, 0};
+  pcm_unpack_t unpack;
+
+  srand(7);
+  for (int i = 0; i < 2 * 300; i++) {
+    samples[i] = (int16_t)rand();
+  }
+
+  pcm_pack_chunk_s16_interleaved(&chunkPacked, 0, samples, 300);
+
+  for (uint32_t seed = 0; seed < 40; seed++) {
+    // wire data starts wherever the pbuf payload does
+    char *data = &wire[seed & 3];
+    uint32_t pos = 0;
+
+    memcpy(data, samples, sizeof(samples));
+
+    // the last 20 frames don't fit some chunks and are dropped
+    fu.size = (seed & 4) ? sizeof(unpacked) - 80 : sizeof(unpacked);
+    memset(unpacked, 0, sizeof(unpacked));
+    pcm_unpack_reset(&unpack);
+
+    while (pos < sizeof(samples)) {
+      uint32_t len = 1 + rand() % 97;
+
+      if (pos + len > sizeof(samples)) {
+        len = sizeof(samples) - pos;
+      }
+
+      pcm_unpack_s16_wire(&unpack, &chunkUnpacked, &data[pos], len);
+      pos += len;
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(fu.size, unpack.offset);
+    TEST_ASSERT_EQUAL_HEX32_ARRAY(packed, unpacked, fu.size / 4);
+    if (fu.size < sizeof(unpacked)) {
+      TEST_ASSERT_EQUAL_HEX32(0, unpacked[fu.size / 4]);
+    }
+  }
+}
+
+TEST_CASE("pcm pack saturates fixed point stereo to 16 bit",
+          "[lightsnapcast]") {
+  // Tremor's full scale is 1 << 24
+  const int32_t left[5] = {0, 1 << 24, -(1 << 24), 3 << 22, -512};
+  const int32_t right[5] = {511, (1 << 24) - 512, -(3 << 22), 1 << 30, -513};
+  const uint32_t expected[5] = {0x00000000, 0x7FFF7FFF, 0xA0008000,
+                                0x7FFF6000, 0xFFFEFFFF};
+  uint32_t a[2], b[4];
+  pcm_chunk_fragment_t fb = {sizeof(b), (char *)b, NULL};
+  pcm_chunk_fragment_t fa = {sizeof(a), (char *)a, &fb};
+  pcm_chunk_message_t chunk = {{0, 0}, sizeof(a) + sizeof(b), &fa, 0};
+
+  memset(a, 0, sizeof(a));
+  memset(b, 0, sizeof(b));
+
+  TEST_ASSERT_EQUAL_UINT32(
+      5, pcm_pack_chunk_fixed_s16_stereo(&chunk, 1, left, right, 5, 24));
+  TEST_ASSERT_EQUAL_HEX32(0, a[0]);
+  TEST_ASSERT_EQUAL_HEX32(expected[0], a[1]);
+  TEST_ASSERT_EQUAL_HEX32_ARRAY(&expected[1], b, 4);
+
+  // 16 bit input with 15 fraction bits passes unchanged
+  TEST_ASSERT_EQUAL_UINT32(
+      1, pcm_pack_chunk_fixed_s16_stereo(&chunk, 0, &left[4], &right[4], 1,
+                                         15));
+  TEST_ASSERT_EQUAL_HEX32(0xFDFFFE00, a[0]);
+
+  TEST_ASSERT_EQUAL_UINT32(
+      0, pcm_pack_chunk_fixed_s16_stereo(&chunk, 0, left, right, 5, 14));
+}
+
+#define BENCH_SR 44100
+#define BENCH_BLOCKSIZE 1152
+// whole blocks, about 5 s
+#define BENCH_FRAMES (192 * BENCH_BLOCKSIZE)
+
+typedef struct bench_stream_s {
+  FLAC__byte *data;
+  size_t len, pos;
+
+  // previous path: frames collected in a growing byte buffer
+  uint8_t *outData;
+  uint32_t outBytes;
+
+  bool direct;
+  uint32_t frames;
+  uint32_t checksum;
+} bench_stream_t;
+
+static FLAC__StreamEncoderWriteStatus bench_encode_write(
+    const FLAC__StreamEncoder *encoder, const FLAC__byte buffer[],
+    size_t bytes, uint32_t samples, uint32_t current_frame,
+    void *client_data) {
+  bench_stream_t *s = (bench_stream_t *)client_data;
+
+  s->data = realloc(s->data, s->len + bytes);
+  if (s->data == NULL) {
+    return FLAC__STREAM_ENCODER_WRITE_STATUS_FATAL_ERROR;
+  }
+
+  memcpy(&s->data[s->len], buffer, bytes);
+  s->len += bytes;
+
+  return FLAC__STREAM_ENCODER_WRITE_STATUS_OK;
+}
+
+static FLAC__StreamDecoderReadStatus bench_read(
+    const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes,
+    void *client_data) {
+  bench_stream_t *s = (bench_stream_t *)client_data;
+
+  if (s->pos >= s->len) {
+    *bytes = 0;
+
+    return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+  }
+
+  if (*bytes > s->len - s->pos) {
+    *bytes = s->len - s->pos;
+  }
+
+  memcpy(buffer, &s->data[s->pos], *bytes);
+  s->pos += *bytes;
+
+  return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
+
+static uint32_t bench_checksum(uint32_t checksum,
+                               const pcm_chunk_message_t *chunk) {
+  const uint32_t *words = (const uint32_t *)chunk->fragment->payload;
+
+  for (uint32_t i = 0; i < chunk->fragment->size / 4; i++) {
+    checksum = checksum * 31 + words[i];
+  }
+
+  return checksum;
+}
+
+static FLAC__StreamDecoderWriteStatus bench_write(
+    const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame,
+    const FLAC__int32 *const buffer[], void *client_data) {
+  bench_stream_t *s = (bench_stream_t *)client_data;
+  uint32_t blocksize = frame->header.blocksize;
+  pcm_chunk_message_t *chunk;
+
+  s->frames += blocksize;
+
+  if (s->direct) {
+    if (allocate_pcm_chunk_memory(&chunk, blocksize * 4) < 0) {
+      return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+    }
+
+    pcm_pack_chunk_s16_stereo(chunk, 0, buffer[0], buffer[1], blocksize);
+  } else {
+    s->outData = realloc(s->outData, s->outBytes + blocksize * 4);
+    if (s->outData == NULL) {
+      return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+    }
+
+    for (uint32_t i = 0; i < blocksize; i++) {
+      s->outData[s->outBytes + 4 * i] = (uint8_t)(buffer[0][i]);
+      s->outData[s->outBytes + 4 * i + 1] = (uint8_t)(buffer[0][i] >> 8);
+      s->outData[s->outBytes + 4 * i + 2] = (uint8_t)(buffer[1][i]);
+      s->outData[s->outBytes + 4 * i + 3] = (uint8_t)(buffer[1][i] >> 8);
+    }
+    s->outBytes += blocksize * 4;
+
+    // end of the wire chunk, one frame per chunk like snapserver sends it
+    if (allocate_pcm_chunk_memory(&chunk, s->outBytes) < 0) {
+      return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+    }
+
+    for (uint32_t i = 0; i < s->outBytes; i += 4) {
+      uint32_t tmpData;
+
+      memcpy(&tmpData, &s->outData[i], 4);
+      *(volatile uint32_t *)(&chunk->fragment->payload[i]) = tmpData;
+    }
+
+    free(s->outData);
+    s->outData = NULL;
+    s->outBytes = 0;
+  }
+
+  s->checksum = bench_checksum(s->checksum, chunk);
+  free_pcm_chunk(chunk);
+
+  return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+static void bench_error(const FLAC__StreamDecoder *decoder,
+                        FLAC__StreamDecoderErrorStatus status,
+                        void *client_data) {
+  TEST_FAIL_MESSAGE(FLAC__StreamDecoderErrorStatusString[status]);
+}
+
+static int64_t bench_decode(bench_stream_t *s, bool direct) {
+  FLAC__StreamDecoder *dec = FLAC__stream_decoder_new();
+  int64_t start;
+
+  TEST_ASSERT_NOT_NULL(dec);
+  TEST_ASSERT_EQUAL(FLAC__STREAM_DECODER_INIT_STATUS_OK,
+                    FLAC__stream_decoder_init_stream(
+                        dec, bench_read, NULL, NULL, NULL, NULL, bench_write,
+                        NULL, bench_error, s));
+
+  s->pos = 0;
+  s->direct = direct;
+  s->frames = 0;
+  s->checksum = 0;
+
+  start = esp_timer_get_time();
+  TEST_ASSERT_TRUE(FLAC__stream_decoder_process_until_end_of_stream(dec));
+  start = esp_timer_get_time() - start;
+
+  FLAC__stream_decoder_finish(dec);
+  FLAC__stream_decoder_delete(dec);
+
+  TEST_ASSERT_EQUAL_UINT32(BENCH_FRAMES, s->frames);
+
+  return start;
+}
+
+TEST_CASE("FLAC decode and pack time per second of audio",
+          "[lightsnapcast][bench]") {
+  static bench_stream_t s;
+  FLAC__int32 *in = malloc(BENCH_BLOCKSIZE * 2 * sizeof(FLAC__int32));
+  FLAC__StreamEncoder *enc = FLAC__stream_encoder_new();
+  int64_t previousUs, directUs;
+  uint32_t previousSum;
+
+  TEST_ASSERT_NOT_NULL(in);
+  TEST_ASSERT_NOT_NULL(enc);
+
+  memset(&s, 0, sizeof(s));
+
+  FLAC__stream_encoder_set_channels(enc, 2);
+  FLAC__stream_encoder_set_bits_per_sample(enc, 16);
+  FLAC__stream_encoder_set_sample_rate(enc, BENCH_SR);
+  FLAC__stream_encoder_set_compression_level(enc, 2);
+  FLAC__stream_encoder_set_blocksize(enc, BENCH_BLOCKSIZE);
+  TEST_ASSERT_EQUAL(FLAC__STREAM_ENCODER_INIT_STATUS_OK,
+                    FLAC__stream_encoder_init_stream(
+                        enc, bench_encode_write, NULL, NULL, NULL, &s));
+
+  srand(1704);
+  for (uint32_t pos = 0; pos < BENCH_FRAMES; pos += BENCH_BLOCKSIZE) {
+    for (uint32_t i = 0; i < BENCH_BLOCKSIZE; i++) {
+      double t = (double)(pos + i) / BENCH_SR;
+      double v = 0.3 * sin(2 * M_PI * 220 * t) +
+                 0.1 * sin(2 * M_PI * 1761 * t) +
+                 0.05 * ((double)rand() / RAND_MAX - 0.5);
+
+      in[2 * i] = (FLAC__int32)(v * 32767);
+      in[2 * i + 1] = (FLAC__int32)(-v * 0.8 * 32767);
+    }
+
+    TEST_ASSERT_TRUE(
+        FLAC__stream_encoder_process_interleaved(enc, in, BENCH_BLOCKSIZE));
+  }
+
+  FLAC__stream_encoder_finish(enc);
+  FLAC__stream_encoder_delete(enc);
+  free(in);
+
+  // chunks come from the pool like in the player
+  TEST_ASSERT_EQUAL(0, pcm_pool_setup(4, BENCH_BLOCKSIZE * 4));
+
+  previousUs = bench_decode(&s, false);
+  previousSum = s.checksum;
+  directUs = bench_decode(&s, true);
+
+  // both paths produce the same player chunks
+  TEST_ASSERT_EQUAL_HEX32(previousSum, s.checksum);
+
+  ESP_LOGI(TAG,
+           "flac decode + pack per second of audio: previous %lldus, direct "
+           "%lldus",
+           previousUs * BENCH_SR / BENCH_FRAMES,
+           directUs * BENCH_SR / BENCH_FRAMES);
+
+  pcm_pool_deinit();
+  free(s.data);
+}
+
+#define OPUS_BENCH_SR 48000
+// 20 ms frames, about 5 s
+#define OPUS_BENCH_FRAME 960
+#define OPUS_BENCH_PACKETS 250
+#define OPUS_BENCH_MAX_PACKET 1500
+
+typedef struct opus_bench_s {
+  unsigned char *data;
+  uint32_t len[OPUS_BENCH_PACKETS];
+  uint32_t checksum;
+} opus_bench_t;
+
+static int64_t opus_bench_decode(opus_bench_t *s, bool preallocated) {
+  OpusDecoder *dec = malloc(opus_decoder_get_size(2));
+  opus_int16 *pcm = malloc(OPUS_BENCH_FRAME * 2 * sizeof(opus_int16));
+  pcm_chunk_message_t *chunk;
+  int64_t start;
+
+  TEST_ASSERT_NOT_NULL(dec);
+  TEST_ASSERT_NOT_NULL(pcm);
+  TEST_ASSERT_EQUAL(OPUS_OK, opus_decoder_init(dec, OPUS_BENCH_SR, 2));
+
+  s->checksum = 0;
+
+  start = esp_timer_get_time();
+  for (int p = 0; p < OPUS_BENCH_PACKETS; p++) {
+    const unsigned char *packet = &s->data[p * OPUS_BENCH_MAX_PACKET];
+    int frames;
+
+    if (preallocated) {
+      frames = opus_packet_get_nb_samples(packet, s->len[p], OPUS_BENCH_SR);
+      frames = opus_decode(dec, packet, s->len[p], pcm, frames, 0);
+      TEST_ASSERT_EQUAL(OPUS_BENCH_FRAME, frames);
+
+      TEST_ASSERT_EQUAL(0, allocate_pcm_chunk_memory(&chunk, frames * 4));
+      pcm_pack_chunk_s16_interleaved(chunk, 0, pcm, frames);
+    } else {
+      // realloc per packet, doubling until the guess is big enough
+      int samplesPerFrame =
+          opus_packet_get_samples_per_frame(packet, OPUS_BENCH_SR);
+      opus_int16 *audio = NULL;
+
+      do {
+        audio = realloc(audio, samplesPerFrame * 4);
+        TEST_ASSERT_NOT_NULL(audio);
+
+        frames = opus_decode(dec, packet, s->len[p], audio, samplesPerFrame, 0);
+        samplesPerFrame <<= 1;
+      } while (frames < 0);
+
+      TEST_ASSERT_EQUAL(0, allocate_pcm_chunk_memory(&chunk, frames * 4));
+      for (int i = 0; i < frames; i++) {
+        ((volatile uint32_t *)chunk->fragment->payload)[i] =
+            ((uint32_t)audio[2 * i] << 16) | (uint16_t)audio[2 * i + 1];
+      }
+
+      free(audio);
+    }
+
+    s->checksum = bench_checksum(s->checksum, chunk);
+    free_pcm_chunk(chunk);
+  }
+  start = esp_timer_get_time() - start;
+
+  free(pcm);
+  free(dec);
+
+  return start;
+}
+
+TEST_CASE("Opus decode and pack time per second of audio",
+          "[lightsnapcast][bench]") {
+  static opus_bench_t s;
+  opus_int16 *in = malloc(OPUS_BENCH_FRAME * 2 * sizeof(opus_int16));
+  OpusEncoder *enc;
+  int64_t previousUs, preallocatedUs;
+  uint32_t previousSum;
+  int error;
+
+  TEST_ASSERT_NOT_NULL(in);
+
+  s.data = malloc(OPUS_BENCH_PACKETS * OPUS_BENCH_MAX_PACKET);
+  TEST_ASSERT_NOT_NULL(s.data);
+
+  enc = opus_encoder_create(OPUS_BENCH_SR, 2, OPUS_APPLICATION_AUDIO, &error);
+  TEST_ASSERT_EQUAL(OPUS_OK, error);
+  opus_encoder_ctl(enc, OPUS_SET_BITRATE(128000));
+
+  srand(1704);
+  for (int p = 0; p < OPUS_BENCH_PACKETS; p++) {
+    opus_int32 len;
+
+    for (int i = 0; i < OPUS_BENCH_FRAME; i++) {
+      double t = (double)(p * OPUS_BENCH_FRAME + i) / OPUS_BENCH_SR;
+      double v = 0.3 * sin(2 * M_PI * 220 * t) +
+                 0.1 * sin(2 * M_PI * 1761 * t) +
+                 0.05 * ((double)rand() / RAND_MAX - 0.5);
+
+      in[2 * i] = (opus_int16)(v * 32767);
+      in[2 * i + 1] = (opus_int16)(-v * 0.8 * 32767);
+    }
+
+    len = opus_encode(enc, in, OPUS_BENCH_FRAME,
+                      &s.data[p * OPUS_BENCH_MAX_PACKET],
+                      OPUS_BENCH_MAX_PACKET);
+    TEST_ASSERT_GREATER_THAN(0, len);
+    s.len[p] = len;
+  }
+
+  opus_encoder_destroy(enc);
+  free(in);
+
+  TEST_ASSERT_EQUAL(0, pcm_pool_setup(4, OPUS_BENCH_FRAME * 4));
+
+  previousUs = opus_bench_decode(&s, false);
+  previousSum = s.checksum;
+  preallocatedUs = opus_bench_decode(&s, true);
+
+  // both paths produce the same player chunks
+  TEST_ASSERT_EQUAL_HEX32(previousSum, s.checksum);
+
+  ESP_LOGI(TAG,
+           "opus decode + pack per second of audio: previous %lldus, "
+           "preallocated %lldus",
+           previousUs * OPUS_BENCH_SR / (OPUS_BENCH_PACKETS * OPUS_BENCH_FRAME),
+           preallocatedUs * OPUS_BENCH_SR /
+               (OPUS_BENCH_PACKETS * OPUS_BENCH_FRAME));
+
+  pcm_pool_deinit();
+  free(s.data);
+}
@@ -0,0 +1,162 @@
+/**
+ * PCM chunk pool: one hour of simulated playback must not touch the heap
+ * once the pool is set up.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "pcm_pool.h"
+#include "player.h"
+#include "sdkconfig.h"
+#include "unity.h"
+
+#if CONFIG_HEAP_TRACING_STANDALONE
+#include "esp_heap_trace.h"
+#endif
+
+static const char *TAG = "TEST_POOL";
+
+#define TEST_SR 44100
+#define TEST_CHUNK_FRAMES 1152
+#define TEST_CHUNK_BYTES (TEST_CHUNK_FRAMES * 2 * 2)
+#define TEST_BUFFER_MS 1000
+#define TEST_SLOTS (TEST_SR * TEST_BUFFER_MS / 1000 / TEST_CHUNK_FRAMES + 3)
+
+#if CONFIG_HEAP_TRACING_STANDALONE
+static heap_trace_record_t traceRecords[16];
+#endif
+
+TEST_CASE("pcm pool serves an hour of playback without heap allocations",
+          "[lightsnapcast]") {
+  static pcm_chunk_message_t *queue[TEST_SLOTS];
+  const uint32_t chunks = 3600LL * TEST_SR / TEST_CHUNK_FRAMES;
+  uint32_t head = 0, tail = 0, queued = 0, produced = 0;
+  size_t freeBefore8, freeBefore32;
+  pcm_pool_stats_t before, after;
+
+  TEST_ASSERT_EQUAL(0, pcm_pool_setup(TEST_SLOTS, TEST_CHUNK_BYTES));
+  pcm_pool_get_stats(&before);
+  TEST_ASSERT_EQUAL_UINT32(TEST_SLOTS, before.slots);
+
+  freeBefore8 = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  freeBefore32 = heap_caps_get_free_size(MALLOC_CAP_32BIT | MALLOC_CAP_EXEC);
+
+#if CONFIG_HEAP_TRACING_STANDALONE
+  TEST_ESP_OK(heap_trace_init_standalone(traceRecords, 16));
+  TEST_ESP_OK(heap_trace_start(HEAP_TRACE_ALL));
+#endif
+
+  srand(1704);
+
+  // decoder delivers chunks in bursts, player drains them at a steady rate
+  while (produced < chunks) {
+    uint32_t burst = 1 + rand() % 4;
+
+    while ((burst-- > 0) && (queued < TEST_SLOTS - 1) && (produced < chunks)) {
+      pcm_chunk_message_t *chnk;
+
+      TEST_ASSERT_EQUAL(0, allocate_pcm_chunk_memory(&chnk, TEST_CHUNK_BYTES));
+      TEST_ASSERT_NOT_NULL(chnk->fragment->payload);
+      TEST_ASSERT_NULL(chnk->fragment->nextFragment);
+      TEST_ASSERT_EQUAL_UINT32(TEST_CHUNK_BYTES, chnk->totalSize);
+
+      chnk->timestamp.sec = produced;
+      ((uint32_t *)chnk->fragment->payload)[0] = produced;
+      ((uint32_t *)chnk->fragment->payload)[TEST_CHUNK_BYTES / 4 - 1] =
+          produced;
+
+      queue[head] = chnk;
+      head = (head + 1) % TEST_SLOTS;
+      queued++;
+      produced++;
+    }
+
+    if ((queued > TEST_SLOTS / 2) || (produced == chunks)) {
+      pcm_chunk_message_t *chnk = queue[tail];
+      uint32_t expected = produced - queued;
+
+      TEST_ASSERT_EQUAL_INT32(expected, chnk->timestamp.sec);
+      TEST_ASSERT_EQUAL_UINT32(expected,
+                               ((uint32_t *)chnk->fragment->payload)[0]);
+      TEST_ASSERT_EQUAL_UINT32(
+          expected,
+          ((uint32_t *)chnk->fragment->payload)[TEST_CHUNK_BYTES / 4 - 1]);
+
+      TEST_ASSERT_EQUAL(0, free_pcm_chunk(chnk));
+      tail = (tail + 1) % TEST_SLOTS;
+      queued--;
+    }
+  }
+
+  while (queued > 0) {
+    TEST_ASSERT_EQUAL(0, free_pcm_chunk(queue[tail]));
+    tail = (tail + 1) % TEST_SLOTS;
+    queued--;
+  }
+
+#if CONFIG_HEAP_TRACING_STANDALONE
+  TEST_ESP_OK(heap_trace_stop());
+  TEST_ASSERT_EQUAL(0, heap_trace_get_count());
+#endif
+
+  TEST_ASSERT_EQUAL(freeBefore8, heap_caps_get_free_size(MALLOC_CAP_8BIT));
+  TEST_ASSERT_EQUAL(freeBefore32, heap_caps_get_free_size(MALLOC_CAP_32BIT |
+                                                          MALLOC_CAP_EXEC));
+
+  pcm_pool_get_stats(&after);
+  TEST_ASSERT_EQUAL_UINT32(0, after.misses - before.misses);
+  TEST_ASSERT_EQUAL_UINT32(chunks, after.hits - before.hits);
+  TEST_ASSERT_EQUAL_UINT32(0, after.inUse);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(TEST_SLOTS - 1, after.highWater);
+
+  ESP_LOGI(TAG, "%lu chunks, high water %lu of %lu slots",
+           (unsigned long)chunks, (unsigned long)after.highWater,
+           (unsigned long)after.slots);
+
+  pcm_pool_deinit();
+}
+
+TEST_CASE("pcm pool falls back to heap and retires replaced pools",
+          "[lightsnapcast]") {
+  pcm_chunk_message_t *chnk[3];
+  pcm_chunk_message_t *big;
+  pcm_pool_stats_t stats;
+
+  TEST_ASSERT_EQUAL(0, pcm_pool_setup(2, 64));
+
+  TEST_ASSERT_EQUAL(0, allocate_pcm_chunk_memory(&chnk[0], 64));
+  TEST_ASSERT_EQUAL(0, allocate_pcm_chunk_memory(&chnk[1], 64));
+  // pool is empty
+  TEST_ASSERT_EQUAL(0, allocate_pcm_chunk_memory(&chnk[2], 64));
+  // too big for a slot
+  TEST_ASSERT_EQUAL(0, allocate_pcm_chunk_memory(&big, 128));
+
+  pcm_pool_get_stats(&stats);
+  TEST_ASSERT_EQUAL_UINT32(2, stats.hits);
+  TEST_ASSERT_EQUAL_UINT32(2, stats.misses);
+  TEST_ASSERT_EQUAL_UINT32(2, stats.inUse);
+
+  // bigger chunks replace the pool, chunks in use go back to the old one
+  TEST_ASSERT_EQUAL(0, pcm_pool_setup(2, 128));
+  TEST_ASSERT_EQUAL(0, free_pcm_chunk(big));
+  TEST_ASSERT_EQUAL(0, allocate_pcm_chunk_memory(&big, 128));
+  TEST_ASSERT_EQUAL(0, free_pcm_chunk(chnk[0]));
+  TEST_ASSERT_EQUAL(0, free_pcm_chunk(chnk[1]));
+  TEST_ASSERT_EQUAL(0, free_pcm_chunk(chnk[2]));
+  TEST_ASSERT_EQUAL(0, free_pcm_chunk(big));
+
+  pcm_pool_get_stats(&stats);
+  TEST_ASSERT_EQUAL_UINT32(3, stats.hits);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.inUse);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.highWater);
+
+  // same settings keep the pool
+  TEST_ASSERT_EQUAL(0, pcm_pool_setup(2, 100));
+  pcm_pool_get_stats(&stats);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.highWater);
+
+  pcm_pool_deinit();
+}
@@ -0,0 +1,126 @@
+/**
+ * PCM ring: frames keep their server time across wraps and discontinuities,
+ * seeking lands on the exact frame.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcm_ring.h"
+#include "unity.h"
+
+#define TEST_SR 48000
+#define TEST_FRAME_SIZE 4
+
+static int64_t frame_time(uint32_t frame) {
+  return 1000000000LL + (int64_t)frame * 1000000LL / TEST_SR;
+}
+
+static void fill_chunk(uint32_t *pcm, uint32_t firstFrame, uint32_t frames) {
+  for (uint32_t i = 0; i < frames; i++) {
+    pcm[i] = firstFrame + i;
+  }
+}
+
+TEST_CASE("pcm ring keeps frame times across wraps", "[lightsnapcast]") {
+  static uint32_t pcm[960];
+  pcm_ring_t ring;
+  uint32_t written = 0, read = 0;
+
+  TEST_ASSERT_EQUAL(0, pcm_ring_init(&ring, 4000, TEST_FRAME_SIZE, TEST_SR));
+
+  srand(1704);
+
+  for (int round = 0; round < 5000; round++) {
+    if ((rand() % 2) == 0) {
+      uint32_t frames = 120 * (1 + rand() % 8);
+      int32_t ret;
+
+      fill_chunk(pcm, written, frames);
+      ret = pcm_ring_write(&ring, frame_time(written), (const char *)pcm,
+                           frames * TEST_FRAME_SIZE);
+      if (ret == 0) {
+        written += frames;
+      } else {
+        TEST_ASSERT_LESS_THAN_UINT32(frames, pcm_ring_free_frames(&ring));
+      }
+    } else {
+      uint32_t want = 1 + rand() % 700;
+      int64_t t;
+
+      while ((want > 0) && pcm_ring_read_time(&ring, &t)) {
+        const char *data;
+        uint32_t frames = pcm_ring_read_span(&ring, &data);
+        uint32_t first;
+
+        TEST_ASSERT_EQUAL_INT64(frame_time(read), t);
+
+        if (frames > want) {
+          frames = want;
+        }
+
+        memcpy(&first, data, sizeof(first));
+        TEST_ASSERT_EQUAL_UINT32(read, first);
+        memcpy(&first, &data[(frames - 1) * TEST_FRAME_SIZE], sizeof(first));
+        TEST_ASSERT_EQUAL_UINT32(read + frames - 1, first);
+
+        pcm_ring_consume(&ring, frames);
+        read += frames;
+        want -= frames;
+      }
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(written - read, pcm_ring_available(&ring));
+  }
+
+  // all chunks were contiguous, the first anchor is the only one
+  TEST_ASSERT_EQUAL_UINT32(1, ring.anchorHead - ring.anchorTail);
+
+  pcm_ring_deinit(&ring);
+}
+
+TEST_CASE("pcm ring seeks to the exact frame", "[lightsnapcast]") {
+  static uint32_t pcm[1152];
+  pcm_ring_t ring;
+  int64_t t;
+  const char *data;
+  uint32_t frame;
+
+  TEST_ASSERT_EQUAL(0, pcm_ring_init(&ring, 8 * 1152, TEST_FRAME_SIZE, TEST_SR));
+
+  for (int i = 0; i < 4; i++) {
+    fill_chunk(pcm, i * 1152, 1152);
+    TEST_ASSERT_EQUAL(0, pcm_ring_write(&ring, frame_time(i * 1152),
+                                        (const char *)pcm, sizeof(pcm)));
+  }
+
+  // somewhere inside the third chunk
+  TEST_ASSERT_EQUAL_UINT32(2 * 1152 + 77,
+                           pcm_ring_seek(&ring, frame_time(2 * 1152 + 77)));
+  TEST_ASSERT_TRUE(pcm_ring_read_time(&ring, &t));
+  TEST_ASSERT_EQUAL_INT64(frame_time(2 * 1152 + 77), t);
+  pcm_ring_read_span(&ring, &data);
+  memcpy(&frame, data, sizeof(frame));
+  TEST_ASSERT_EQUAL_UINT32(2 * 1152 + 77, frame);
+
+  // a time between two frames rounds up to the next one
+  TEST_ASSERT_EQUAL_UINT32(1, pcm_ring_seek(&ring, frame_time(2 * 1152 + 77) + 1));
+
+  // a gap in the stream gets its own anchor, seek stops at it
+  fill_chunk(pcm, 10 * 1152, 1152);
+  TEST_ASSERT_EQUAL(0, pcm_ring_write(&ring, frame_time(10 * 1152),
+                                      (const char *)pcm, sizeof(pcm)));
+  TEST_ASSERT_EQUAL_UINT32(2, ring.anchorHead - ring.anchorTail);
+  pcm_ring_seek(&ring, frame_time(10 * 1152 + 5));
+  TEST_ASSERT_TRUE(pcm_ring_read_time(&ring, &t));
+  TEST_ASSERT_EQUAL_INT64(frame_time(10 * 1152 + 5), t);
+  TEST_ASSERT_EQUAL_UINT32(1, ring.anchorHead - ring.anchorTail);
+  TEST_ASSERT_EQUAL_UINT32(1152 - 5, pcm_ring_available(&ring));
+
+  // seeking past the end empties the ring
+  pcm_ring_seek(&ring, frame_time(100 * 1152));
+  TEST_ASSERT_EQUAL_UINT32(0, pcm_ring_available(&ring));
+  TEST_ASSERT_FALSE(pcm_ring_read_time(&ring, &t));
+
+  pcm_ring_deinit(&ring);
+}
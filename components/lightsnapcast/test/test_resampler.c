@@ -0,0 +1,237 @@
+/**
+ * Resampler: bit exact pass through at ratio 1, input consumed at the set
+ * ratio no matter how it is split, and THD+N of sine tones resampled at a
+ * drift correction ratio against the ideal sine at the same positions.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "resampler.h"
+#include "unity.h"
+
+static const char *TAG = "TEST_RESAMPLER";
+
+#define TEST_SR 48000
+#define TEST_FRAMES 4800
+// 32 bit containers take two words a frame
+#define TEST_WORDS (2 * TEST_FRAMES)
+
+/**
+ * Feed in random pieces into random sized output space.
+ */
+static uint32_t resample_split(resampler_t *rs, const uint32_t *in,
+                               uint32_t inFrames, uint32_t *out,
+                               uint32_t outFrames) {
+  uint32_t frameWords = rs->bits / 16;
+  uint32_t pos = 0, produced = 0;
+
+  while ((pos < inFrames) && (produced < outFrames)) {
+    uint32_t n = 1 + (uint32_t)rand() % 300;
+    uint32_t m = 1 + (uint32_t)rand() % 300;
+    uint32_t used;
+
+    if (n > inFrames - pos) {
+      n = inFrames - pos;
+    }
+    if (m > outFrames - produced) {
+      m = outFrames - produced;
+    }
+
+    produced += resampler_process(rs, &in[pos * frameWords], n, &used,
+                                  &out[produced * frameWords], m);
+    pos += used;
+  }
+
+  return produced;
+}
+
+TEST_CASE("resampler passes frames through at ratio 1", "[lightsnapcast]") {
+  static uint32_t in[TEST_WORDS], out[TEST_WORDS];
+  const uint32_t delay = RESAMPLER_DELAY_FRAMES;
+  resampler_t rs;
+
+  srand(3);
+  for (int i = 0; i < TEST_WORDS; i++) {
+    in[i] = (uint32_t)rand() ^ ((uint32_t)rand() << 16);
+  }
+
+  TEST_ASSERT_EQUAL_INT32(-1, resampler_init(&rs, 24));
+
+  // 16 bit, two samples a word
+  TEST_ASSERT_EQUAL_INT32(0, resampler_init(&rs, 16));
+  TEST_ASSERT_EQUAL_UINT32(TEST_FRAMES,
+                           resample_split(&rs, in, TEST_FRAMES, out,
+                                          TEST_FRAMES));
+  TEST_ASSERT_EQUAL_HEX32(0, out[0]);
+  TEST_ASSERT_EQUAL_HEX32(0, out[delay - 1]);
+  TEST_ASSERT_EQUAL_HEX32_ARRAY(in, &out[delay], TEST_FRAMES - delay);
+
+  // 32 bit words, the low byte is dropped
+  TEST_ASSERT_EQUAL_INT32(0, resampler_init(&rs, 32));
+  TEST_ASSERT_EQUAL_UINT32(TEST_FRAMES,
+                           resample_split(&rs, in, TEST_FRAMES, out,
+                                          TEST_FRAMES));
+  for (uint32_t i = 0; i < 2 * (TEST_FRAMES - delay); i++) {
+    TEST_ASSERT_EQUAL_HEX32(in[i] & 0xFFFFFF00, out[2 * delay + i]);
+  }
+
+  // frames preloaded to DMA directly, output continues right after them
+  for (uint32_t bits = 16; bits <= 32; bits += 16) {
+    uint32_t frameWords = bits / 16;
+    uint32_t used;
+
+    resampler_init(&rs, bits);
+    TEST_ASSERT_EQUAL_UINT32(delay, resampler_lag_frames(&rs));
+
+    resampler_prime(&rs, in, 1000);
+    resampler_prime(&rs, &in[1000 * frameWords], 3);
+    TEST_ASSERT_EQUAL_UINT32(0, resampler_lag_frames(&rs));
+
+    TEST_ASSERT_EQUAL_UINT32(
+        TEST_FRAMES - 1003 - delay,
+        resampler_process(&rs, &in[1003 * frameWords], TEST_FRAMES - 1003,
+                          &used, out, TEST_FRAMES));
+    TEST_ASSERT_EQUAL_UINT32(TEST_FRAMES - 1003, used);
+    TEST_ASSERT_EQUAL_UINT32(delay, resampler_lag_frames(&rs));
+
+    for (uint32_t i = 0; i < (TEST_FRAMES - 1003 - delay) * frameWords;
+         i++) {
+      uint32_t mask = (bits == 16) ? 0xFFFFFFFF : 0xFFFFFF00;
+
+      TEST_ASSERT_EQUAL_HEX32(in[1003 * frameWords + i] & mask, out[i]);
+    }
+  }
+
+  // history is cleared, the ratio kept
+  resampler_set_ppb(&rs, 1000);
+  resampler_reset(&rs);
+  TEST_ASSERT_EQUAL_UINT32(0, rs.phase);
+  TEST_ASSERT_EQUAL_INT32(4294, rs.step);
+}
+
+TEST_CASE("resampler consumes input at the set ratio", "[lightsnapcast]") {
+  static uint32_t in[TEST_WORDS], out[TEST_WORDS];
+  const int32_t ppb[] = {500000, -500000, 100, -RESAMPLER_MAX_PPB};
+  resampler_t rs;
+
+  memset(in, 0, sizeof(in));
+  srand(4);
+
+  for (int k = 0; k < sizeof(ppb) / sizeof(ppb[0]); k++) {
+    uint64_t consumed = 0, produced = 0;
+
+    resampler_init(&rs, 16);
+    resampler_set_ppb(&rs, ppb[k]);
+
+    // 100 s of audio
+    for (int i = 0; i < 1000; i++) {
+      uint32_t used, n;
+
+      n = resampler_process(&rs, in, TEST_FRAMES, &used, out, TEST_FRAMES);
+      TEST_ASSERT_LESS_OR_EQUAL_UINT32(TEST_FRAMES, n);
+
+      consumed += used;
+      produced += n;
+    }
+
+    // output k is at input position k * ratio - delay, input up to the
+    // frame after the next output may be consumed already
+    int64_t last = (int64_t)((double)(produced - 1) * (1.0 + ppb[k] * 1e-9));
+    TEST_ASSERT_INT_WITHIN(1, last + 2, (int64_t)consumed);
+  }
+
+  // limited
+  resampler_set_ppb(&rs, INT32_MAX);
+  TEST_ASSERT_EQUAL_INT32(
+      (int32_t)((int64_t)RESAMPLER_MAX_PPB * (1LL << 32) / 1000000000LL),
+      rs.step);
+}
+
+/**
+ * THD+N in dB of a full scale sine at freq resampled at ppb, measured
+ * against the ideal sine at the output positions.
+ */
+static int32_t resampler_thdn_db(uint32_t bits, double freq, int32_t ppb) {
+  static uint32_t in[TEST_WORDS], out[TEST_WORDS];
+  const double amp = (bits == 16) ? 32767.0 * 0.9 : 8388607.0 * 0.9;
+  const double w = 2.0 * M_PI * freq / TEST_SR;
+  double signal = 0, noise = 0;
+  resampler_t rs;
+  uint32_t used, n;
+
+  for (int i = 0; i < TEST_FRAMES; i++) {
+    int32_t s = (int32_t)lrint(amp * sin(w * i));
+
+    if (bits == 16) {
+      in[i] = ((uint32_t)s & 0xFFFF) | ((uint32_t)s << 16);
+    } else {
+      in[2 * i] = (uint32_t)s << 8;
+      in[2 * i + 1] = (uint32_t)s << 8;
+    }
+  }
+
+  resampler_init(&rs, bits);
+  resampler_set_ppb(&rs, ppb);
+  n = resampler_process(&rs, in, TEST_FRAMES, &used, out, TEST_FRAMES);
+
+  // skip the start up, the phase of output k is exact in 0.32 fixed point
+  for (uint32_t k = 2 * RESAMPLER_TAPS; k < n; k++) {
+    double pos = (double)k * (1.0 + rs.step / 4294967296.0) -
+                 RESAMPLER_DELAY_FRAMES;
+    double ref = amp * sin(w * pos);
+    int32_t y = (bits == 16) ? (int16_t)(out[k] & 0xFFFF)
+                             : (int32_t)out[2 * k] >> 8;
+
+    signal += ref * ref;
+    noise += (y - ref) * (y - ref);
+  }
+
+  return (int32_t)lrint(10.0 * log10(noise / signal));
+}
+
+TEST_CASE("resampler THD+N at drift correction ratios", "[lightsnapcast]") {
+  const double freq[] = {100, 1000, 5000, 10000, 15000, 20000};
+
+  for (int i = 0; i < sizeof(freq) / sizeof(freq[0]); i++) {
+    ESP_LOGI(TAG, "%5.0fHz: THD+N 16 bit %lddB, 24 bit %lddB", freq[i],
+             (long)resampler_thdn_db(16, freq[i], 300000),
+             (long)resampler_thdn_db(32, freq[i], -300000));
+  }
+
+  // 16 taps pass up to 15 kHz cleanly, the rest is coefficient precision
+  TEST_ASSERT_LESS_THAN_INT32(-85, resampler_thdn_db(16, 1000, 300000));
+  TEST_ASSERT_LESS_THAN_INT32(-85, resampler_thdn_db(16, 1000, -300000));
+  TEST_ASSERT_LESS_THAN_INT32(-85, resampler_thdn_db(32, 1000, 300000));
+  TEST_ASSERT_LESS_THAN_INT32(-75, resampler_thdn_db(16, 10000, 300000));
+  TEST_ASSERT_LESS_THAN_INT32(-75, resampler_thdn_db(32, 15000, -300000));
+}
+
+TEST_CASE("resampler time per second of audio", "[lightsnapcast]") {
+  static uint32_t in[TEST_WORDS], out[TEST_WORDS];
+  const uint32_t bits[] = {16, 32};
+  resampler_t rs;
+
+  for (int i = 0; i < TEST_WORDS; i++) {
+    in[i] = (uint32_t)rand();
+  }
+
+  for (int b = 0; b < 2; b++) {
+    uint32_t used;
+    int64_t start;
+
+    resampler_init(&rs, bits[b]);
+    resampler_set_ppb(&rs, 300000);
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < TEST_SR / TEST_FRAMES; i++) {
+      resampler_process(&rs, in, TEST_FRAMES, &used, out, TEST_FRAMES);
+    }
+
+    ESP_LOGI(TAG, "%lu bit: %lldus per second of audio",
+             (unsigned long)bits[b], esp_timer_get_time() - start);
+  }
+}
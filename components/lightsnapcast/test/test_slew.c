@@ -0,0 +1,138 @@
+/**
+ * Slew: exact count of frames skipped or inserted, the crossfaded head joins
+ * the chunk without a step, and large slews spread over chunk boundaries.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slew.h"
+#include "unity.h"
+
+#define TEST_FRAMES 1152
+#define TEST_AMPLITUDE 0x40000000
+
+/**
+ * Slowly rising sine, 32 bit containers, left and right the same.
+ */
+static void test_sine(uint32_t *buf, uint32_t frames) {
+  for (uint32_t i = 0; i < frames; i++) {
+    int32_t v = (int32_t)(TEST_AMPLITUDE * sinf(2.0f * (float)M_PI * i / 480));
+
+    buf[2 * i] = (uint32_t)v;
+    buf[2 * i + 1] = (uint32_t)v;
+  }
+}
+
+/**
+ * Play a chunk through the slew, return the frames played.
+ */
+static uint32_t test_play(slew_t *sl, const uint32_t *in, uint32_t *out) {
+  uint32_t used, n;
+
+  n = slew_process(sl, in, TEST_FRAMES, &used);
+  memcpy(out, sl->head, n * 2 * sizeof(uint32_t));
+  memcpy(&out[2 * n], &in[2 * used],
+         (TEST_FRAMES - used) * 2 * sizeof(uint32_t));
+
+  return n + TEST_FRAMES - used;
+}
+
+/**
+ * Largest step between two frames of the left channel.
+ */
+static int64_t test_max_step(const uint32_t *buf, uint32_t frames) {
+  int64_t max = 0;
+
+  for (uint32_t i = 1; i < frames; i++) {
+    int64_t d = llabs((int64_t)(int32_t)buf[2 * i] -
+                      (int64_t)(int32_t)buf[2 * (i - 1)]);
+
+    if (d > max) {
+      max = d;
+    }
+  }
+
+  return max;
+}
+
+TEST_CASE("slew skips and inserts frames without a step", "[lightsnapcast]") {
+  static uint32_t in[2 * TEST_FRAMES];
+  static uint32_t out[2 * (TEST_FRAMES + SLEW_MAX_FRAMES)];
+  // steepest slope of the sine plus the fade's from one peak to the other
+  const int64_t slope = (int64_t)(2 * M_PI * TEST_AMPLITUDE / 480) + 1 +
+                        2LL * TEST_AMPLITUDE / SLEW_FADE_FRAMES;
+  slew_t sl;
+
+  test_sine(in, TEST_FRAMES);
+  TEST_ASSERT_EQUAL_INT32(0, slew_init(&sl, 32));
+  TEST_ASSERT_EQUAL_INT32(-1, slew_init(&sl, 24));
+  TEST_ASSERT_EQUAL_INT32(0, slew_init(&sl, 32));
+
+  // nothing pending, passed through
+  TEST_ASSERT_EQUAL_UINT32(TEST_FRAMES, test_play(&sl, in, out));
+  TEST_ASSERT_EQUAL_MEMORY(in, out, sizeof(in));
+
+  // skip
+  slew_start(&sl, 100);
+  TEST_ASSERT_EQUAL_UINT32(TEST_FRAMES - 100, test_play(&sl, in, out));
+  TEST_ASSERT_EQUAL_UINT32(in[0], out[0]);
+  TEST_ASSERT_EQUAL_MEMORY(&in[2 * (100 + SLEW_FADE_FRAMES)],
+                           &out[2 * SLEW_FADE_FRAMES],
+                           (TEST_FRAMES - 100 - SLEW_FADE_FRAMES) * 8);
+  TEST_ASSERT_LESS_THAN_INT64(slope,
+                              test_max_step(out, TEST_FRAMES - 100));
+  TEST_ASSERT_EQUAL_INT32(0, sl.pending);
+
+  // insert
+  slew_start(&sl, -100);
+  TEST_ASSERT_EQUAL_UINT32(TEST_FRAMES + 100, test_play(&sl, in, out));
+  TEST_ASSERT_EQUAL_MEMORY(in, out, 100 * 8);
+  TEST_ASSERT_EQUAL_MEMORY(&in[2 * SLEW_FADE_FRAMES],
+                           &out[2 * (100 + SLEW_FADE_FRAMES)],
+                           (TEST_FRAMES - SLEW_FADE_FRAMES) * 8);
+  TEST_ASSERT_LESS_THAN_INT64(slope,
+                              test_max_step(out, TEST_FRAMES + 100));
+
+  TEST_ASSERT_EQUAL_UINT32(100, sl.skipped);
+  TEST_ASSERT_EQUAL_UINT32(100, sl.inserted);
+}
+
+TEST_CASE("slew spreads large jumps over chunks", "[lightsnapcast]") {
+  static uint32_t in[2 * TEST_FRAMES];
+  static uint32_t out[2 * (TEST_FRAMES + SLEW_MAX_FRAMES)];
+  uint32_t used, total = 0;
+  slew_t sl;
+
+  test_sine(in, TEST_FRAMES);
+  slew_init(&sl, 32);
+
+  slew_start(&sl, 2 * SLEW_MAX_FRAMES + 10);
+  for (int i = 0; i < 4; i++) {
+    total += test_play(&sl, in, out);
+  }
+  TEST_ASSERT_EQUAL_UINT32(4 * TEST_FRAMES - 2 * SLEW_MAX_FRAMES - 10, total);
+  TEST_ASSERT_EQUAL_INT32(0, sl.pending);
+
+  // put off while the chunk is too short, dropped on reset
+  slew_start(&sl, -SLEW_MAX_FRAMES);
+  TEST_ASSERT_EQUAL_UINT32(
+      0, slew_process(&sl, in, SLEW_HEAD_MAX_FRAMES - 1, &used));
+  TEST_ASSERT_EQUAL_UINT32(0, used);
+  TEST_ASSERT_EQUAL_INT32(-SLEW_MAX_FRAMES, sl.pending);
+  slew_reset(&sl);
+  TEST_ASSERT_EQUAL_UINT32(0, slew_process(&sl, in, TEST_FRAMES, &used));
+
+  // 16 bit samples are mixed per half word
+  slew_init(&sl, 16);
+  for (int i = 0; i < 2 * SLEW_FADE_FRAMES; i++) {
+    in[i] = (i < SLEW_FADE_FRAMES) ? 0x7FFF8000 : 0x00000000;
+  }
+  slew_start(&sl, SLEW_FADE_FRAMES);
+  TEST_ASSERT_EQUAL_UINT32(SLEW_FADE_FRAMES,
+                           slew_process(&sl, in, 2 * SLEW_FADE_FRAMES, &used));
+  TEST_ASSERT_EQUAL_UINT32(2 * SLEW_FADE_FRAMES, used);
+  TEST_ASSERT_EQUAL_HEX32(0x7FFF8000, sl.head[0]);
+  TEST_ASSERT_EQUAL_HEX32(0x3FFFC000, sl.head[SLEW_FADE_FRAMES / 2]);
+}
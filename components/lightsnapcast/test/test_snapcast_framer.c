@@ -0,0 +1,323 @@
+/**
+ * Feeds a synthetic snapcast stream split at random boundaries through the
+ * framer, checks every message arrives intact and reports throughput.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "buffer.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "snapcast.h"
+#include "snapcast_framer.h"
+#include "unity.h"
+
+static const char *TAG = "TEST_FRAMER";
+
+#define TEST_CHUNK_SIZE 4608  // 26ms of 44100:16:2 PCM
+#define TEST_STREAM_CHUNKS 200
+#define TEST_ROUNDS 20
+
+typedef struct test_ctx_s {
+  uint32_t wireChunks;
+  uint32_t timeMessages;
+  uint32_t codecHeaders;
+  uint32_t serverSettings;
+  uint32_t payloadBytes;
+  uint32_t payloadSum;
+  int32_t lastTimestampSec;
+} test_ctx_t;
+
+static int test_wire_chunk_start(void *ctx, const base_message_t *base,
+                                 const wire_chunk_message_t *chunk) {
+  test_ctx_t *t = (test_ctx_t *)ctx;
+
+  t->lastTimestampSec = chunk->timestamp.sec;
+
+  return 0;
+}
+
+static int test_wire_chunk_data(void *ctx, const char *data, uint32_t len,
+                                void *owner) {
+  test_ctx_t *t = (test_ctx_t *)ctx;
+
+  for (uint32_t i = 0; i < len; i++) {
+    t->payloadSum += (uint8_t)data[i];
+  }
+  t->payloadBytes += len;
+
+  return 0;
+}
+
+static int test_wire_chunk_end(void *ctx, const base_message_t *base,
+                               const wire_chunk_message_t *chunk) {
+  test_ctx_t *t = (test_ctx_t *)ctx;
+
+  t->wireChunks++;
+
+  return 0;
+}
+
+static int test_codec_header(void *ctx, const base_message_t *base,
+                             const codec_header_message_t *header) {
+  test_ctx_t *t = (test_ctx_t *)ctx;
+
+  TEST_ASSERT_EQUAL_STRING("pcm", header->codec);
+  TEST_ASSERT_EQUAL_UINT32(44, header->size);
+
+  t->codecHeaders++;
+
+  return 0;
+}
+
+static int test_server_settings(void *ctx, const base_message_t *base,
+                                const char *json) {
+  test_ctx_t *t = (test_ctx_t *)ctx;
+
+  TEST_ASSERT_EQUAL_STRING("{\"bufferMs\":1000}", json);
+
+  t->serverSettings++;
+
+  return 0;
+}
+
+static int test_time(void *ctx, const base_message_t *base,
+                     const time_message_t *time) {
+  test_ctx_t *t = (test_ctx_t *)ctx;
+
+  TEST_ASSERT_EQUAL_INT32(1, time->latency.sec);
+  TEST_ASSERT_EQUAL_INT32(2345, time->latency.usec);
+
+  t->timeMessages++;
+
+  return 0;
+}
+
+static const snapcast_framer_callbacks_t test_callbacks = {
+    .base_message = NULL,
+    .wire_chunk_start = test_wire_chunk_start,
+    .wire_chunk_data = test_wire_chunk_data,
+    .wire_chunk_end = test_wire_chunk_end,
+    .codec_header = test_codec_header,
+    .server_settings = test_server_settings,
+    .time = test_time,
+};
+
+static void write_base(write_buffer_t *buffer, uint16_t type, uint32_t size) {
+  base_message_t base = {type, 1, 0, {0, 0}, {0, 0}, size};
+
+  TEST_ASSERT_EQUAL(0, base_message_serialize(
+                           &base, &buffer->buffer[buffer->index],
+                           buffer->size - buffer->index));
+  buffer->index += BASE_MESSAGE_SIZE;
+}
+
+/**
+ * build a stream like snapserver sends it after the hello message
+ */
+static size_t build_stream(char *data, size_t size, uint32_t *payloadSum) {
+  write_buffer_t buffer;
+  const char *json = "{\"bufferMs\":1000}";
+  char pcmHeader[44];
+
+  buffer_write_init(&buffer, data, size);
+
+  write_base(&buffer, SNAPCAST_MESSAGE_SERVER_SETTINGS, 4 + strlen(json));
+  buffer_write_uint32(&buffer, strlen(json));
+  buffer_write_buffer(&buffer, json, strlen(json));
+
+  memset(pcmHeader, 0, sizeof(pcmHeader));
+  write_base(&buffer, SNAPCAST_MESSAGE_CODEC_HEADER,
+             4 + 3 + 4 + sizeof(pcmHeader));
+  buffer_write_uint32(&buffer, 3);
+  buffer_write_buffer(&buffer, "pcm", 3);
+  buffer_write_uint32(&buffer, sizeof(pcmHeader));
+  buffer_write_buffer(&buffer, pcmHeader, sizeof(pcmHeader));
+
+  *payloadSum = 0;
+  for (int i = 0; i < TEST_STREAM_CHUNKS; i++) {
+    write_base(&buffer, SNAPCAST_MESSAGE_WIRE_CHUNK,
+               WIRE_CHUNK_HEADER_SIZE + TEST_CHUNK_SIZE);
+    buffer_write_int32(&buffer, i);
+    buffer_write_int32(&buffer, 0);
+    buffer_write_uint32(&buffer, TEST_CHUNK_SIZE);
+    for (int j = 0; j < TEST_CHUNK_SIZE; j++) {
+      uint8_t b = (uint8_t)(i + j);
+
+      buffer_write_uint8(&buffer, b);
+      *payloadSum += b;
+    }
+
+    if ((i % 40) == 0) {
+      write_base(&buffer, SNAPCAST_MESSAGE_TIME, TIME_MESSAGE_SIZE);
+      buffer_write_int32(&buffer, 1);
+      buffer_write_int32(&buffer, 2345);
+
+      write_base(&buffer, SNAPCAST_MESSAGE_STREAM_TAGS, 5);
+      buffer_write_buffer(&buffer, "tags!", 5);
+    }
+  }
+
+  return buffer.index;
+}
+
+TEST_CASE("snapcast framer split at random boundaries", "[lightsnapcast]") {
+  snapcast_framer_t framer;
+  test_ctx_t ctx;
+  uint32_t payloadSum;
+  size_t streamSize = TEST_STREAM_CHUNKS * (TEST_CHUNK_SIZE + 64) + 1024;
+  char *stream = malloc(streamSize);
+  int64_t parseTime = 0;
+  uint32_t messages = 0;
+
+  TEST_ASSERT_NOT_NULL(stream);
+
+  streamSize = build_stream(stream, streamSize, &payloadSum);
+
+  srand(1704);
+
+  for (int round = 0; round < TEST_ROUNDS; round++) {
+    size_t pos = 0;
+
+    memset(&ctx, 0, sizeof(ctx));
+    snapcast_framer_init(&framer, &test_callbacks, &ctx);
+
+    while (pos < streamSize) {
+      // mostly MSS sized segments, sometimes tiny ones to split headers
+      size_t len = (rand() % 4) ? (1 + rand() % 1460) : (1 + rand() % 30);
+      int64_t start;
+
+      if (len > streamSize - pos) {
+        len = streamSize - pos;
+      }
+
+      start = esp_timer_get_time();
+      TEST_ASSERT_EQUAL(SNAPCAST_FRAMER_OK,
+                        snapcast_framer_feed(&framer, &stream[pos], len, NULL));
+      parseTime += esp_timer_get_time() - start;
+
+      pos += len;
+    }
+
+    TEST_ASSERT_EQUAL(FRAMER_STATE_BASE, framer.state);
+    TEST_ASSERT_EQUAL_UINT32(TEST_STREAM_CHUNKS, ctx.wireChunks);
+    TEST_ASSERT_EQUAL_UINT32(TEST_STREAM_CHUNKS * TEST_CHUNK_SIZE,
+                             ctx.payloadBytes);
+    TEST_ASSERT_EQUAL_UINT32(payloadSum, ctx.payloadSum);
+    TEST_ASSERT_EQUAL_INT32(TEST_STREAM_CHUNKS - 1, ctx.lastTimestampSec);
+    TEST_ASSERT_EQUAL_UINT32(TEST_STREAM_CHUNKS / 40, ctx.timeMessages);
+    TEST_ASSERT_EQUAL_UINT32(1, ctx.codecHeaders);
+    TEST_ASSERT_EQUAL_UINT32(1, ctx.serverSettings);
+
+    messages += framer.messages;
+
+    snapcast_framer_deinit(&framer);
+  }
+
+  // the test callbacks touch every payload byte, so this is an upper bound
+  if (parseTime > 0) {
+    ESP_LOGI(TAG, "%.2f MB/s, %.3f us/message",
+             (double)streamSize * TEST_ROUNDS / (double)parseTime,
+             (double)parseTime / (double)messages);
+  }
+
+  free(stream);
+}
+
+TEST_CASE("snapcast framer rejects broken messages", "[lightsnapcast]") {
+  snapcast_framer_t framer;
+  test_ctx_t ctx;
+  char data[64];
+  write_buffer_t buffer;
+
+  memset(&ctx, 0, sizeof(ctx));
+  snapcast_framer_init(&framer, &test_callbacks, &ctx);
+
+  // wire chunk size doesn't match base message size
+  buffer_write_init(&buffer, data, sizeof(data));
+  write_base(&buffer, SNAPCAST_MESSAGE_WIRE_CHUNK, WIRE_CHUNK_HEADER_SIZE + 4);
+  buffer_write_int32(&buffer, 0);
+  buffer_write_int32(&buffer, 0);
+  buffer_write_uint32(&buffer, 100);
+
+  TEST_ASSERT_EQUAL(SNAPCAST_FRAMER_ERR_PROTOCOL,
+                    snapcast_framer_feed(&framer, data, buffer.index, NULL));
+
+  // codec string longer than the message
+  snapcast_framer_reset(&framer);
+  buffer_write_init(&buffer, data, sizeof(data));
+  write_base(&buffer, SNAPCAST_MESSAGE_CODEC_HEADER, 8);
+  buffer_write_uint32(&buffer, 0xFFFFFFFF);
+  buffer_write_uint32(&buffer, 0);
+
+  TEST_ASSERT_EQUAL(SNAPCAST_FRAMER_ERR_PROTOCOL,
+                    snapcast_framer_feed(&framer, data, buffer.index, NULL));
+  TEST_ASSERT_EQUAL_UINT32(0, ctx.codecHeaders);
+
+  snapcast_framer_deinit(&framer);
+}
+
+typedef struct arrival_ctx_s {
+  int64_t baseArrival;
+  int64_t timeArrival[4];
+  uint32_t timeMessages;
+} arrival_ctx_t;
+
+static void test_base_message(void *ctx, base_message_t *base,
+                              int64_t arrival_us) {
+  ((arrival_ctx_t *)ctx)->baseArrival = arrival_us;
+}
+
+static int test_time_arrival(void *ctx, const base_message_t *base,
+                             const time_message_t *time) {
+  arrival_ctx_t *t = (arrival_ctx_t *)ctx;
+
+  t->timeArrival[t->timeMessages++ % 4] = t->baseArrival;
+
+  return 0;
+}
+
+TEST_CASE("snapcast framer stamps messages with their first byte's arrival",
+          "[lightsnapcast]") {
+  static const snapcast_framer_callbacks_t cb = {
+      .base_message = test_base_message,
+      .time = test_time_arrival,
+  };
+  snapcast_framer_t framer;
+  arrival_ctx_t ctx;
+  char data[128];
+  write_buffer_t buffer;
+  size_t timeSize = BASE_MESSAGE_SIZE + TIME_MESSAGE_SIZE;
+
+  memset(&ctx, 0, sizeof(ctx));
+  snapcast_framer_init(&framer, &cb, &ctx);
+
+  buffer_write_init(&buffer, data, sizeof(data));
+  for (int i = 0; i < 3; i++) {
+    write_base(&buffer, SNAPCAST_MESSAGE_TIME, TIME_MESSAGE_SIZE);
+    buffer_write_int32(&buffer, 1);
+    buffer_write_int32(&buffer, 2345);
+  }
+
+  // first message split inside its base header, the second one starts in
+  // the same buffer, the third one right at its end
+  snapcast_framer_set_arrival(&framer, 1000);
+  TEST_ASSERT_EQUAL(SNAPCAST_FRAMER_OK,
+                    snapcast_framer_feed(&framer, data, 10, NULL));
+  snapcast_framer_set_arrival(&framer, 2000);
+  TEST_ASSERT_EQUAL(SNAPCAST_FRAMER_OK,
+                    snapcast_framer_feed(&framer, &data[10],
+                                         2 * timeSize - 10 + 1, NULL));
+  snapcast_framer_set_arrival(&framer, 3000);
+  TEST_ASSERT_EQUAL(SNAPCAST_FRAMER_OK,
+                    snapcast_framer_feed(&framer, &data[2 * timeSize + 1],
+                                         timeSize - 1, NULL));
+
+  TEST_ASSERT_EQUAL_UINT32(3, ctx.timeMessages);
+  TEST_ASSERT_EQUAL_INT64(1000, ctx.timeArrival[0]);
+  TEST_ASSERT_EQUAL_INT64(2000, ctx.timeArrival[1]);
+  TEST_ASSERT_EQUAL_INT64(2000, ctx.timeArrival[2]);
+
+  snapcast_framer_deinit(&framer);
+}
@@ -0,0 +1,212 @@
+/**
+ * Transmit arena: messages come from patched templates and a buffer is only
+ * reused once the transport acknowledged it.
+ */
+
+#include <string.h>
+
+#include "snapcast.h"
+#include "snapcast_tx.h"
+#include "unity.h"
+
+typedef struct {
+  const char *data[32];
+  uint32_t size[32];
+  uint32_t count;
+  bool fail;
+} fake_transport_t;
+
+static int32_t fake_write(void *ctx, const char *data, uint32_t size) {
+  fake_transport_t *t = (fake_transport_t *)ctx;
+
+  if (t->fail) {
+    return -1;
+  }
+
+  t->data[t->count % 32] = data;
+  t->size[t->count % 32] = size;
+  t->count++;
+
+  return 0;
+}
+
+TEST_CASE("snapcast tx patches time message templates", "[lightsnapcast]") {
+  static snapcast_tx_t tx;
+  fake_transport_t t;
+  base_message_t base;
+
+  memset(&t, 0, sizeof(t));
+  TEST_ASSERT_EQUAL(0, snapcast_tx_init(&tx));
+
+  TEST_ASSERT_EQUAL(0, snapcast_tx_send(&tx, SNAPCAST_MESSAGE_TIME, 4711,
+                                        1234567890123LL, fake_write, &t));
+  TEST_ASSERT_EQUAL_UINT32(1, t.count);
+  TEST_ASSERT_EQUAL_UINT32(BASE_MESSAGE_SIZE + TIME_MESSAGE_SIZE, t.size[0]);
+
+  TEST_ASSERT_EQUAL(0, base_message_deserialize(&base, t.data[0], t.size[0]));
+  TEST_ASSERT_EQUAL_UINT16(SNAPCAST_MESSAGE_TIME, base.type);
+  TEST_ASSERT_EQUAL_UINT16(4711, base.id);
+  TEST_ASSERT_EQUAL_INT32(1234567, base.sent.sec);
+  TEST_ASSERT_EQUAL_INT32(890123, base.sent.usec);
+  TEST_ASSERT_EQUAL_UINT32(TIME_MESSAGE_SIZE, base.size);
+  for (int i = 0; i < TIME_MESSAGE_SIZE; i++) {
+    TEST_ASSERT_EQUAL(0, t.data[0][BASE_MESSAGE_SIZE + i]);
+  }
+
+  // no template for this one
+  TEST_ASSERT_EQUAL(-1, snapcast_tx_send(&tx, SNAPCAST_MESSAGE_STREAM_TAGS, 1,
+                                         0, fake_write, &t));
+}
+
+TEST_CASE("snapcast tx reuses buffers only after acknowledgement",
+          "[lightsnapcast]") {
+  static snapcast_tx_t tx;
+  fake_transport_t t;
+  snapcast_tx_stats_t stats;
+  const uint32_t msgSize = BASE_MESSAGE_SIZE + TIME_MESSAGE_SIZE;
+  const char *first;
+  int64_t now = 1000000;
+
+  memset(&t, 0, sizeof(t));
+  TEST_ASSERT_EQUAL(0, snapcast_tx_init(&tx));
+
+  for (int i = 0; i < SNAPCAST_TX_SMALL_SLOTS; i++) {
+    TEST_ASSERT_EQUAL(0, snapcast_tx_send(&tx, SNAPCAST_MESSAGE_TIME, i, now,
+                                          fake_write, &t));
+  }
+  // time messages fall back to the large slots
+  for (int i = 0; i < SNAPCAST_TX_LARGE_SLOTS; i++) {
+    TEST_ASSERT_EQUAL(0, snapcast_tx_send(&tx, SNAPCAST_MESSAGE_TIME, i, now,
+                                          fake_write, &t));
+  }
+  TEST_ASSERT_EQUAL(-2, snapcast_tx_send(&tx, SNAPCAST_MESSAGE_TIME, 99, now,
+                                         fake_write, &t));
+
+  // all buffers are distinct
+  for (int i = 0; i < SNAPCAST_TX_SLOTS; i++) {
+    for (int k = i + 1; k < SNAPCAST_TX_SLOTS; k++) {
+      TEST_ASSERT_TRUE(t.data[i] != t.data[k]);
+    }
+  }
+
+  // half of the first message isn't enough
+  first = t.data[0];
+  snapcast_tx_acked(&tx, msgSize / 2);
+  TEST_ASSERT_EQUAL(-2, snapcast_tx_send(&tx, SNAPCAST_MESSAGE_TIME, 99, now,
+                                         fake_write, &t));
+  snapcast_tx_acked(&tx, msgSize - msgSize / 2);
+  TEST_ASSERT_EQUAL(0, snapcast_tx_send(&tx, SNAPCAST_MESSAGE_TIME, 100, now,
+                                        fake_write, &t));
+  TEST_ASSERT_TRUE(first == t.data[SNAPCAST_TX_SLOTS]);
+
+  snapcast_tx_get_stats(&tx, &stats);
+  TEST_ASSERT_EQUAL_UINT32(SNAPCAST_TX_SLOTS + 1, stats.sent);
+  TEST_ASSERT_EQUAL_UINT32(2, stats.noSlot);
+  TEST_ASSERT_EQUAL_UINT32(SNAPCAST_TX_SLOTS, stats.inFlight);
+
+  // new connection, old buffers may still be referenced for a while
+  snapcast_tx_reset(&tx, now);
+  snapcast_tx_acked(&tx, 1000);
+  TEST_ASSERT_EQUAL(-2, snapcast_tx_send(&tx, SNAPCAST_MESSAGE_TIME, 101, now,
+                                         fake_write, &t));
+  now += SNAPCAST_TX_ORPHAN_US;
+  TEST_ASSERT_EQUAL(0, snapcast_tx_send(&tx, SNAPCAST_MESSAGE_TIME, 102, now,
+                                        fake_write, &t));
+
+  snapcast_tx_get_stats(&tx, &stats);
+  TEST_ASSERT_EQUAL_UINT32(SNAPCAST_TX_SLOTS, stats.orphaned);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.inFlight);
+
+  // a failed write keeps its slot until the orphan timeout, the previous
+  // message is acknowledged by now
+  t.fail = true;
+  TEST_ASSERT_EQUAL(-3, snapcast_tx_send(&tx, SNAPCAST_MESSAGE_TIME, 103, now,
+                                         fake_write, &t));
+  snapcast_tx_get_stats(&tx, &stats);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.failed);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.inFlight);
+}
+
+TEST_CASE("snapcast tx frees all buffers once the transport drained",
+          "[lightsnapcast]") {
+  static snapcast_tx_t tx;
+  fake_transport_t t;
+  snapcast_tx_stats_t stats;
+  const uint32_t msgSize = BASE_MESSAGE_SIZE + TIME_MESSAGE_SIZE;
+  int64_t now = 1000000;
+
+  memset(&t, 0, sizeof(t));
+  TEST_ASSERT_EQUAL(0, snapcast_tx_init(&tx));
+
+  for (int i = 0; i < SNAPCAST_TX_SLOTS; i++) {
+    TEST_ASSERT_EQUAL(0, snapcast_tx_send(&tx, SNAPCAST_MESSAGE_TIME, i, now,
+                                          fake_write, &t));
+  }
+
+  // only the last acknowledgement is reported
+  snapcast_tx_acked(&tx, msgSize);
+  TEST_ASSERT_EQUAL(0, snapcast_tx_send(&tx, SNAPCAST_MESSAGE_TIME, 10, now,
+                                        fake_write, &t));
+  TEST_ASSERT_EQUAL(-2, snapcast_tx_send(&tx, SNAPCAST_MESSAGE_TIME, 11, now,
+                                         fake_write, &t));
+
+  snapcast_tx_drained(&tx);
+  TEST_ASSERT_EQUAL(0, snapcast_tx_send(&tx, SNAPCAST_MESSAGE_TIME, 12, now,
+                                        fake_write, &t));
+  snapcast_tx_get_stats(&tx, &stats);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.inFlight);
+
+  // reported ahead of the drain, acked doesn't go back
+  snapcast_tx_acked(&tx, 2 * msgSize);
+  snapcast_tx_drained(&tx);
+  for (int i = 0; i < SNAPCAST_TX_SLOTS; i++) {
+    TEST_ASSERT_EQUAL(0, snapcast_tx_send(&tx, SNAPCAST_MESSAGE_TIME, 13 + i,
+                                          now, fake_write, &t));
+  }
+  // the bytes reported ahead cover the first of them
+  snapcast_tx_get_stats(&tx, &stats);
+  TEST_ASSERT_EQUAL_UINT32(SNAPCAST_TX_SLOTS - 1, stats.inFlight);
+}
+
+TEST_CASE("snapcast tx keeps the hello message across reconnects",
+          "[lightsnapcast]") {
+  static snapcast_tx_t tx;
+  fake_transport_t t;
+  base_message_t base;
+  hello_message_t hello = {
+      .mac = "00:11:22:33:44:55",
+      .hostname = "snapclient",
+      .version = "0.0.3",
+      .client_name = "libsnapcast",
+      .os = "esp32",
+      .arch = "xtensa",
+      .instance = 1,
+      .id = "00:11:22:33:44:55",
+      .protocol_version = 2,
+  };
+  uint32_t jsonSize;
+
+  memset(&t, 0, sizeof(t));
+  TEST_ASSERT_EQUAL(0, snapcast_tx_init(&tx));
+  TEST_ASSERT_EQUAL(0, snapcast_tx_set_hello(&tx, &hello));
+
+  for (int i = 0; i < 2; i++) {
+    snapcast_tx_reset(&tx, 0);
+    TEST_ASSERT_EQUAL(0, snapcast_tx_send(&tx, SNAPCAST_MESSAGE_HELLO, i, 0,
+                                          fake_write, &t));
+    TEST_ASSERT_EQUAL(0, base_message_deserialize(&base, t.data[i],
+                                                  BASE_MESSAGE_SIZE));
+    TEST_ASSERT_EQUAL_UINT16(SNAPCAST_MESSAGE_HELLO, base.type);
+    TEST_ASSERT_EQUAL_UINT16(i, base.id);
+    TEST_ASSERT_EQUAL_UINT32(t.size[i] - BASE_MESSAGE_SIZE, base.size);
+
+    // payload is the length prefixed JSON
+    memcpy(&jsonSize, &t.data[i][BASE_MESSAGE_SIZE], 4);
+    TEST_ASSERT_EQUAL_UINT32(base.size - 4, jsonSize);
+    TEST_ASSERT_EQUAL('{', t.data[i][BASE_MESSAGE_SIZE + 4]);
+    TEST_ASSERT_EQUAL('}', t.data[i][t.size[i] - 1]);
+  }
+
+  // each connection got its own large slot
+  TEST_ASSERT_TRUE(t.data[0] != t.data[1]);
+}
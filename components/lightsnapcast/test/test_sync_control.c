@@ -0,0 +1,135 @@
+/**
+ * Player sync control: hard resyncs on starvation and on a short median far
+ * out of bounds, soft resyncs a little out of bounds, rate control from the
+ * mini median once it is full.
+ */
+
+#include <string.h>
+
+#include "sync_control.h"
+#include "unity.h"
+
+#define TEST_CHUNK_US 24000
+
+static void test_init(sync_control_t *sc) {
+  sync_control_init(sc, 10000, 500000, SYNC_CONTROL_SOFT_RESYNC_US,
+                    SYNC_CONTROL_HARD_RESYNC_US);
+}
+
+TEST_CASE("sync control resyncs hard when far off", "[lightsnapcast]") {
+  static sync_control_t sc;
+  sync_control_stats_t stats;
+
+  // without the soft tier in between
+  sync_control_init(&sc, 10000, 500000, SYNC_CONTROL_HARD_RESYNC_US,
+                    SYNC_CONTROL_HARD_RESYNC_US);
+
+  // single outliers don't count until the short median is full
+  for (int i = 0; i < SYNC_CONTROL_SHORT_LEN - 1; i++) {
+    TEST_ASSERT_EQUAL(SYNC_CONTROL_PLAY,
+                      sync_control_update(&sc, 60000, TEST_CHUNK_US, false));
+  }
+  TEST_ASSERT_EQUAL(SYNC_CONTROL_RESYNC_HARD,
+                    sync_control_update(&sc, 60000, TEST_CHUNK_US, false));
+  TEST_ASSERT_EQUAL_INT64(60000, sc.shortMedian_us);
+
+  // running empty always resyncs
+  sync_control_reset(&sc, 0);
+  TEST_ASSERT_EQUAL(SYNC_CONTROL_RESYNC_HARD,
+                    sync_control_update(&sc, 0, TEST_CHUNK_US, true));
+
+  // early is as bad as late, just within is fine
+  sync_control_reset(&sc, 0);
+  for (int i = 0; i < SYNC_CONTROL_SHORT_LEN; i++) {
+    TEST_ASSERT_EQUAL(
+        SYNC_CONTROL_PLAY,
+        sync_control_update(&sc, -SYNC_CONTROL_HARD_RESYNC_US, TEST_CHUNK_US,
+                            false));
+  }
+
+  // beyond once more than half of the short ages are
+  for (int i = 0; i < SYNC_CONTROL_SHORT_LEN / 2; i++) {
+    TEST_ASSERT_EQUAL(
+        SYNC_CONTROL_PLAY,
+        sync_control_update(&sc, -SYNC_CONTROL_HARD_RESYNC_US - 1,
+                            TEST_CHUNK_US, false));
+  }
+  TEST_ASSERT_EQUAL(
+      SYNC_CONTROL_RESYNC_HARD,
+      sync_control_update(&sc, -SYNC_CONTROL_HARD_RESYNC_US - 1,
+                          TEST_CHUNK_US, false));
+
+  sync_control_get_stats(&sc, &stats);
+  TEST_ASSERT_EQUAL_UINT32(
+      2 * SYNC_CONTROL_SHORT_LEN + SYNC_CONTROL_SHORT_LEN / 2 + 2,
+      stats.updates);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.softResyncs);
+  TEST_ASSERT_EQUAL_UINT32(3, stats.hardResyncs);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.starved);
+}
+
+TEST_CASE("sync control resyncs soft when a little off", "[lightsnapcast]") {
+  static sync_control_t sc;
+  sync_control_stats_t stats;
+  int32_t ppb;
+
+  test_init(&sc);
+  sync_control_reset(&sc, 25000);
+
+  // just within the soft limit the rate is steered
+  for (int i = 0; i < SYNC_CONTROL_SHORT_LEN; i++) {
+    TEST_ASSERT_EQUAL(SYNC_CONTROL_PLAY,
+                      sync_control_update(&sc, SYNC_CONTROL_SOFT_RESYNC_US,
+                                          TEST_CHUNK_US, false));
+  }
+  TEST_ASSERT_GREATER_THAN_INT32(25000, sc.ppb);
+
+  // slew by the short median once most ages are beyond
+  for (int i = 0; i < SYNC_CONTROL_SHORT_LEN / 2; i++) {
+    TEST_ASSERT_EQUAL(SYNC_CONTROL_PLAY,
+                      sync_control_update(&sc, -7000, TEST_CHUNK_US, false));
+  }
+  TEST_ASSERT_EQUAL(SYNC_CONTROL_RESYNC_SOFT,
+                    sync_control_update(&sc, -7000, TEST_CHUNK_US, false));
+  TEST_ASSERT_EQUAL_INT64(-7000, sc.slew_us);
+  ppb = sc.ppb;
+
+  // ages before the slew are forgotten, the rate is kept
+  TEST_ASSERT_EQUAL_INT64(0, sc.shortMedian_us);
+  TEST_ASSERT_EQUAL(SYNC_CONTROL_PLAY,
+                    sync_control_update(&sc, 0, TEST_CHUNK_US, false));
+  TEST_ASSERT_EQUAL_INT64(0, sc.shortMedian_us);
+  TEST_ASSERT_EQUAL_INT32(ppb, sc.ppb);
+
+  sync_control_get_stats(&sc, &stats);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.softResyncs);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.hardResyncs);
+}
+
+TEST_CASE("sync control steers the rate from the mini median",
+          "[lightsnapcast]") {
+  static sync_control_t sc;
+
+  test_init(&sc);
+  TEST_ASSERT_EQUAL_INT32(0, sc.ppb);
+
+  // starts at the skew
+  sync_control_reset(&sc, 25000);
+  TEST_ASSERT_EQUAL_INT32(25000, sc.ppb);
+
+  // unchanged until the mini median is full
+  for (int i = 0; i < SYNC_CONTROL_MINI_LEN - 1; i++) {
+    sync_control_update(&sc, 100, TEST_CHUNK_US, false);
+    TEST_ASSERT_EQUAL_INT32(25000, sc.ppb);
+  }
+
+  // late, play faster, an outlier doesn't move the median
+  sync_control_update(&sc, 100, TEST_CHUNK_US, false);
+  TEST_ASSERT_GREATER_THAN_INT32(25000, sc.ppb);
+  sync_control_update(&sc, -1500, TEST_CHUNK_US, false);
+  TEST_ASSERT_EQUAL_INT64(100, sc.miniMedian_us);
+  TEST_ASSERT_GREATER_THAN_INT32(25000, sc.ppb);
+
+  TEST_ASSERT_EQUAL_INT64(1000, sync_control_age(10000, 5000, 6000, 500,
+                                                 1500));
+}
@@ -0,0 +1,13 @@
+#
+# Tremor integer Vorbis decoder and libogg, see CMakeLists.txt
+#
+
+ifdef CONFIG_SNAPCLIENT_USE_OGG
+COMPONENT_SRCDIRS := tremor ogg/src
+COMPONENT_OBJEXCLUDE := tremor/ivorbisfile_example.o tremor/framing.o tremor/bitwise.o
+COMPONENT_ADD_INCLUDEDIRS := include ogg/include tremor
+CFLAGS += -Wno-unused-variable -Wno-maybe-uninitialized
+else
+COMPONENT_SRCDIRS :=
+COMPONENT_ADD_INCLUDEDIRS :=
+endif
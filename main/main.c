@@ -9,6 +9,7 @@
 #include <string.h>
 
 #include "esp_event.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 #include "esp_mac.h"
 #include "esp_system.h"
@@ -16,6 +17,8 @@
 #include "esp_wifi.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "hal/gpio_types.h"
 #if CONFIG_SNAPCLIENT_USE_INTERNAL_ETHERNET || \
@@ -35,9 +38,11 @@
 #include "lwip/api.h"
 #include "lwip/dns.h"
 #include "lwip/err.h"
+#include "lwip/pbuf.h"
 #include "lwip/netdb.h"
 #include "lwip/sockets.h"
 #include "lwip/sys.h"
+#include "lwip/tcp.h"
 #include "mdns.h"
 #include "net_functions.h"
 
@@ -54,20 +59,37 @@
 
 // Opus decoder is implemented as a subcomponet from master git repo
 #include "opus.h"
+#include "opus_multistream.h"
 
 // flac decoder is implemented as a subcomponet from master git repo
 #include "FLAC/stream_decoder.h"
+
+#if CONFIG_SNAPCLIENT_USE_OGG
+// Vorbis decoder is Tremor, integer only, with libogg from master git repos
+#include "ivorbiscodec.h"
+#include "ogg/ogg.h"
+#endif
 #include "ota_server.h"
 #include "player.h"
 #include "snapcast.h"
+#include "chunk_cursor.h"
+#include "chunk_store.h"
+#include "opus_mapping.h"
+#include "pcm_pack.h"
+#include "snapcast_framer.h"
+#include "snapcast_tx.h"
+#include "sg_buffer.h"
+#include "clock_model.h"
+#include "latency_hist.h"
+#include "sync_scheduler.h"
 #include "ui_http_server.h"
 
-static bool isCachedChunk = false;
-static uint32_t cachedBlocks = 0;
-
 static FLAC__StreamDecoderReadStatus read_callback(
     const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes,
     void *client_data);
+static FLAC__StreamDecoderTellStatus tell_callback(
+    const FLAC__StreamDecoder *decoder, FLAC__uint64 *absolute_byte_offset,
+    void *client_data);
 static FLAC__StreamDecoderWriteStatus write_callback(
     const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame,
     const FLAC__int32 *const buffer[], void *client_data);
@@ -85,6 +107,16 @@ const char *VERSION_STRING = "0.0.3";
 #define HTTP_TASK_PRIORITY 9
 #define HTTP_TASK_CORE_ID tskNO_AFFINITY
 
+#if CONFIG_SNAPCLIENT_DECODE_TASK
+// below http_get_task() so reception and time sync preempt decoding
+#define DECODE_TASK_PRIORITY (HTTP_TASK_PRIORITY - 1)
+#if CONFIG_FREERTOS_UNICORE
+#define DECODE_TASK_CORE_ID tskNO_AFFINITY
+#else
+#define DECODE_TASK_CORE_ID CONFIG_SNAPCLIENT_DECODE_TASK_CORE_ID
+#endif
+#endif
+
 #define OTA_TASK_PRIORITY 6
 #define OTA_TASK_CORE_ID tskNO_AFFINITY
 // 1  // tskNO_AFFINITY
@@ -92,9 +124,6 @@ const char *VERSION_STRING = "0.0.3";
 TaskHandle_t t_ota_task = NULL;
 TaskHandle_t t_http_get_task = NULL;
 
-#define FAST_SYNC_LATENCY_BUF 10000      // in µs
-#define NORMAL_SYNC_LATENCY_BUF 1000000  // in µs
-
 struct timeval tdif, tavg;
 
 /* snapast parameters; configurable in menuconfig */
@@ -136,19 +165,8 @@ audioDACdata_t audioDAC_data;
 static QueueHandle_t audioDACQHdl = NULL;
 SemaphoreHandle_t audioDACSemaphore = NULL;
 
-typedef struct decoderData_s {
-  uint32_t type;  // should be SNAPCAST_MESSAGE_CODEC_HEADER
-                  // or SNAPCAST_MESSAGE_WIRE_CHUNK
-  uint8_t *inData;
-  tv_t timestamp;
-  uint8_t *outData;
-  uint32_t bytes;
-} decoderData_t;
-
 void time_sync_msg_cb(void *args);
 
-static char base_message_serialized[BASE_MESSAGE_SIZE];
-
 static const esp_timer_create_args_t tSyncArgs = {
     .callback = &time_sync_msg_cb,
     .dispatch_method = ESP_TIMER_TASK,
@@ -159,170 +177,297 @@ struct netconn *lwipNetconn;
 
 static int id_counter = 0;
 
-static OpusDecoder *opusDecoder = NULL;
+// client to server messages, sent without heap allocations
+static snapcast_tx_t snapcastTx;
 
-static decoderData_t decoderChunk = {
-    .type = SNAPCAST_MESSAGE_INVALID,
-    .inData = NULL,
-    .timestamp = {0, 0},
-    .outData = NULL,
-    .bytes = 0,
-};
+// arrival times of received pbufs, stamped in the tcpip task by
+// netconn_event_cb() and picked up by http_get_task()
+#define RX_ARRIVAL_LEN 16
 
-static decoderData_t pcmChunk = {
-    .type = SNAPCAST_MESSAGE_INVALID,
-    .inData = NULL,
-    .timestamp = {0, 0},
-    .outData = NULL,
-    .bytes = 0,
-};
+typedef struct rxArrival_s {
+  uint32_t end;  // stream position after the pbuf
+  int64_t time_us;
+} rxArrival_t;
+
+static rxArrival_t rxArrival[RX_ARRIVAL_LEN];
+static uint32_t rxArrivalHead = 0;   // written by the tcpip task only
+static uint32_t rxArrivalTail = 0;   // written by http_get_task() only
+static uint32_t rxArrivalBytes = 0;  // stream position, tcpip task only
 
 /**
  *
  */
-void time_sync_msg_cb(void *args) {
-  base_message_t base_message_tx;
-  //  struct timeval now;
-  int64_t now;
-  // time_message_t time_message_tx = {{0, 0}};
-  int rc1;
-
-  // causes kernel panic, which shouldn't happen though?
-  // Isn't it called from timer task instead of ISR?
-  // xSemaphoreGive(timeSyncSemaphoreHandle);
-
-  //  result = gettimeofday(&now, NULL);
-  ////  ESP_LOGI(TAG, "time of day: %d", (int32_t)now.tv_sec +
-  ///(int32_t)now.tv_usec);
-  //  if (result) {
-  //    ESP_LOGI(TAG, "Failed to gettimeofday");
-  //
-  //    return;
-  //  }
+static void rx_arrival_push(uint32_t len) {
+  uint32_t head = rxArrivalHead;
 
-  uint8_t *p_pkt = (uint8_t *)malloc(BASE_MESSAGE_SIZE + TIME_MESSAGE_SIZE);
-  if (p_pkt == NULL) {
-    ESP_LOGW(
-        TAG,
-        "%s: Failed to get memory for time sync message. Skipping this round.",
-        __func__);
+  rxArrivalBytes += len;
 
+  // if full, the pbuf gets the arrival time of a later one or its receive
+  // time in http_get_task()
+  if (head - __atomic_load_n(&rxArrivalTail, __ATOMIC_ACQUIRE) >=
+      RX_ARRIVAL_LEN) {
     return;
   }
 
-  memset(p_pkt, 0, BASE_MESSAGE_SIZE + TIME_MESSAGE_SIZE);
+  rxArrival[head % RX_ARRIVAL_LEN].end = rxArrivalBytes;
+  rxArrival[head % RX_ARRIVAL_LEN].time_us = esp_timer_get_time();
+  __atomic_store_n(&rxArrivalHead, head + 1, __ATOMIC_RELEASE);
+}
 
-  base_message_tx.type = SNAPCAST_MESSAGE_TIME;
-  base_message_tx.id = id_counter++;
-  base_message_tx.refersTo = 0;
-  base_message_tx.received.sec = 0;
-  base_message_tx.received.usec = 0;
-  now = esp_timer_get_time();
-  base_message_tx.sent.sec = now / 1000000;
-  base_message_tx.sent.usec = now - base_message_tx.sent.sec * 1000000;
-  base_message_tx.size = TIME_MESSAGE_SIZE;
-  rc1 = base_message_serialize(&base_message_tx, (char *)&p_pkt[0],
-                               BASE_MESSAGE_SIZE);
-  if (rc1) {
-    ESP_LOGE(TAG, "Failed to serialize base message for time");
+/**
+ * Arrival time of the pbuf holding stream position pos, 0 if unknown
+ */
+static int64_t rx_arrival_get(uint32_t pos) {
+  uint32_t head = __atomic_load_n(&rxArrivalHead, __ATOMIC_ACQUIRE);
+  uint32_t tail = rxArrivalTail;
+  int64_t time_us = 0;
+
+  // drop pbufs which were passed already
+  while ((tail != head) &&
+         ((int32_t)(rxArrival[tail % RX_ARRIVAL_LEN].end - pos) <= 0)) {
+    tail++;
+  }
 
-    return;
+  if (tail != head) {
+    time_us = rxArrival[tail % RX_ARRIVAL_LEN].time_us;
   }
 
-  //  memset(&time_message_tx, 0, sizeof(time_message_tx));
-  //  result = time_message_serialize(&time_message_tx,
-  //  &p_pkt[BASE_MESSAGE_SIZE],
-  //                                  TIME_MESSAGE_SIZE);
-  //  if (result) {
-  //    ESP_LOGI(TAG, "Failed to serialize time message");
-  //
-  //    return;
-  //  }
+  __atomic_store_n(&rxArrivalTail, tail, __ATOMIC_RELEASE);
 
-  rc1 = netconn_write(lwipNetconn, p_pkt, BASE_MESSAGE_SIZE + TIME_MESSAGE_SIZE,
-                      NETCONN_NOCOPY);
-  if (rc1 != ERR_OK) {
-    ESP_LOGW(TAG, "error writing timesync msg");
+  return time_us;
+}
+
+/**
+ * no connection may be active
+ */
+static void rx_arrival_reset(void) {
+  rxArrivalHead = 0;
+  rxArrivalTail = 0;
+  rxArrivalBytes = 0;
+}
 
+/**
+ * lwIP reports acknowledged bytes with SENDPLUS only while the send buffer
+ * is above its low water mark, acknowledgements arriving below it are lost.
+ * Once the send queue is empty every byte written was acknowledged, so the
+ * arena may reuse all buffers then. SENDPLUS is raised from the tcpip task,
+ * so the pcb can be read. RCVPLUS is the earliest point a received pbuf can
+ * be time stamped.
+ */
+static void netconn_event_cb(struct netconn *conn, enum netconn_evt evt,
+                             u16_t len) {
+  if ((conn != lwipNetconn) || (len == 0)) {
     return;
   }
 
-  free(p_pkt);
-
-  //  ESP_LOGI(TAG, "%s: sent time sync message", __func__);
-
-  //  xSemaphoreGiveFromISR(timeSyncSemaphoreHandle, &xHigherPriorityTaskWoken);
-  //  if (xHigherPriorityTaskWoken) {
-  //    portYIELD_FROM_ISR();
-  //  }
+  if (evt == NETCONN_EVT_SENDPLUS) {
+    snapcast_tx_acked(&snapcastTx, len);
+    if ((conn->pcb.tcp != NULL) && (tcp_sndqueuelen(conn->pcb.tcp) == 0)) {
+      snapcast_tx_drained(&snapcastTx);
+    }
+  } else if (evt == NETCONN_EVT_RCVPLUS) {
+    // pbuf was just queued for netconn_recv()
+    rx_arrival_push(len);
+  }
 }
 
 /**
  *
  */
-static FLAC__StreamDecoderReadStatus read_callback(
-    const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes,
-    void *client_data) {
-  snapcastSetting_t *scSet = (snapcastSetting_t *)client_data;
-  //  decoderData_t *flacData;
+static int32_t netconn_tx_write(void *ctx, const char *data, uint32_t size) {
+  struct netconn *conn = (struct netconn *)ctx;
 
-  (void)scSet;
+  if (conn == NULL) {
+    return -1;
+  }
 
-  // xQueueReceive(decoderReadQHdl, &flacData, portMAX_DELAY);
-  // if (xQueueReceive(decoderReadQHdl, &flacData, pdMS_TO_TICKS(100)))
-  if (decoderChunk.inData) {
-    //	   ESP_LOGI(TAG, "in flac read cb %ld %p", flacData->bytes,
-    // flacData->inData);
+  // data stays untouched until acknowledged, see netconn_event_cb()
+  if (netconn_write(conn, data, size, NETCONN_NOCOPY) != ERR_OK) {
+    return -1;
+  }
 
-    if (decoderChunk.bytes <= 0) {
-      //	    free_flac_data(flacData);
+  return 0;
+}
 
-      return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
-    }
+// Opus decoder state and its output, allocated per codec header so decoding
+// a packet doesn't allocate. Every stream is decoded as multistream, mono
+// and stereo are a single stream of it.
+static OpusMSDecoder *opusDecoder = NULL;
+static opus_int16 *opusPcm = NULL;
+static uint32_t opusPcmFrames = 0;
+static opus_mapping_t opusMapping;
+
+// decoded channels played left and right
+static uint8_t opusRoute[2] = {0, 1};
+
+// output buffer is sized for snapserver's default frame and grows if a
+// packet holds more
+#define OPUS_PCM_DEFAULT_MS 20
+
+#if CONFIG_SNAPCLIENT_USE_OGG
+// Ogg demuxer and Vorbis decoder state, set up per codec header like the
+// other decoders. Pages are gathered in sync's buffer, which only grows for
+// a wire chunk larger than all before.
+typedef struct oggSession_s {
+  bool open;
+  ogg_sync_state sync;
+  ogg_stream_state stream;
+  bool streamInit;  // stream takes the serial number of the first page
+
+  bool opus;  // Ogg/Opus, packets go to opusDecoder
+  vorbis_info info;
+  vorbis_comment comment;
+  vorbis_dsp_state dsp;
+  vorbis_block block;
+  bool vorbisInit;       // dsp and block are set up
+  uint32_t chunkFrames;  // most frames a Vorbis packet completes
+} oggSession_t;
+
+static oggSession_t oggSession = {.open = false};
+
+// Tremor's samples are fixed point, 1.0 is 1 << 24
+#define VORBIS_FRACTION_BITS 24
+#endif
 
-    isCachedChunk = false;
+// sample format of the decoded chunks. Written by whoever decodes, the decode
+// task if there is one, and merged into scSet by stream_send_setting() only
+typedef struct decodeFormat_s {
+  codec_type_t codec;
+  int32_t sr;
+  uint8_t ch;
+  i2s_data_bit_width_t bits;
+  uint32_t chkInFrames;
+} decodeFormat_t;
+
+// codec header the decoders are set up for, they are kept across
+// reconnects as long as the server sends the same one
+typedef struct codecSession_s {
+  codec_type_t codec;
+  char *header;
+  uint32_t headerSize;
+
+  // sample format of the header, for FLAC found by metadata_callback()
+  int32_t sr;
+  uint8_t ch;
+  i2s_data_bit_width_t bits;
+  uint8_t pcmBits;
+} codecSession_t;
+
+static codecSession_t codecSession = {.codec = NONE};
+
+// compressed decoder input, either the received pbufs themselves or a heap
+// copy of the wire chunk
+static sg_chain_t decoderInput;
+
+// FLAC decoder input, frames are stamped by the wire chunk they start in
+static chunk_cursor_t flacInput;
+
+// used if an OPUS packet is split across pbufs
+static char *opusPacket = NULL;
+static uint32_t opusPacketSize = 0;
+
+#if CONFIG_SNAPCLIENT_DECODE_TASK
+// wire chunks handed from http_get_task() to the decode task, the chunk
+// being received holds one job
+#define DECODE_JOBS 4
+
+typedef enum decodeJobType_e {
+  DECODE_JOB_COMPRESSED = 0,
+  DECODE_JOB_PCM,
+  DECODE_JOB_SYNC,  // decode task is idle once it gets here
+} decodeJobType_t;
+
+typedef struct decodeJob_s {
+  decodeJobType_t type;
+  tv_t timestamp;
+  sg_chain_t input;              // compressed chunk
+  pcm_chunk_message_t *pcmData;  // PCM chunk, unpacked already
+  uint32_t pcmFrames;
+  int64_t queued_us;
+} decodeJob_t;
 
-    //	  if (flacData->inData == NULL) {
-    //	    free_flac_data(flacData);
-    //
-    //	    return FLAC__STREAM_DECODER_READ_STATUS_ABORT;
-    //	  }
+static decodeJob_t decodeJob[DECODE_JOBS];
 
-    if (decoderChunk.bytes <= *bytes) {
-      memcpy(buffer, decoderChunk.inData, decoderChunk.bytes);
-      *bytes = decoderChunk.bytes;
+// indices of jobs waiting for the decode task and of unused ones
+static QueueHandle_t decodeReadyQ = NULL;
+static QueueHandle_t decodeFreeQ = NULL;
+static StaticQueue_t decodeReadyQBuffer, decodeFreeQBuffer;
+static uint8_t decodeReadyQStorage[DECODE_JOBS];
+static uint8_t decodeFreeQStorage[DECODE_JOBS];
 
-      // ESP_LOGW(TAG, "read all flac inData %d", *bytes);
+static SemaphoreHandle_t decodeSyncSemaphore = NULL;
+static StaticSemaphore_t decodeSyncSemaphoreBuffer;
 
-      free(decoderChunk.inData);
-      decoderChunk.inData = NULL;
-      decoderChunk.bytes = 0;
-    } else {
-      memcpy(buffer, decoderChunk.inData, *bytes);
+TaskHandle_t t_decode_task = NULL;
+#endif
 
-      memmove(decoderChunk.inData, decoderChunk.inData + *bytes,
-              decoderChunk.bytes - *bytes);
-      decoderChunk.bytes -= *bytes;
-      decoderChunk.inData =
-          (uint8_t *)realloc(decoderChunk.inData, decoderChunk.bytes);
+// scSet is shared by http_get_task() and the decode task, each writes its own
+// fields under the mutex
+static SemaphoreHandle_t scSetMutex = NULL;
+static StaticSemaphore_t scSetMutexBuffer;
 
-      // ESP_LOGW(TAG, "didn't read all flac inData %d", *bytes);
-      //	    flacData->inData += *bytes;
-      //	    flacData->bytes -= *bytes;
-    }
+#if CONFIG_SNAPCLIENT_COMPRESSED_JITTER_BUFFER
+// compressed wire chunks waiting to be decoded just in time
+static chunk_store_t chunkStore;
+
+// netconn_recv() returns at least this often so we can keep decoding ahead
+#define DECODE_AHEAD_RECV_TIMEOUT_MS 10
+#endif
+
+/**
+ *
+ */
+void time_sync_msg_cb(void *args) {
+  int32_t rc1;
 
-    // free_flac_data(flacData);
+  // causes kernel panic, which shouldn't happen though?
+  // Isn't it called from timer task instead of ISR?
+  // xSemaphoreGive(timeSyncSemaphoreHandle);
 
-    // xQueueSend (flacReadQHdl, &flacData, portMAX_DELAY);
+  rc1 = snapcast_tx_send(&snapcastTx, SNAPCAST_MESSAGE_TIME, id_counter++,
+                         esp_timer_get_time(), netconn_tx_write, lwipNetconn);
+  if (rc1 == -2) {
+    ESP_LOGW(TAG, "%s: all time sync messages in flight. Skipping this round.",
+             __func__);
+  } else if (rc1 < 0) {
+    ESP_LOGW(TAG, "error writing timesync msg");
+  }
 
-    // xSemaphoreGive(decoderReadSemaphore);
+  //  ESP_LOGI(TAG, "%s: sent time sync message", __func__);
+}
 
-    // ESP_LOGE(TAG, "%s: data processed", __func__);
+/**
+ *
+ */
+static FLAC__StreamDecoderReadStatus read_callback(
+    const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes,
+    void *client_data) {
+  decodeFormat_t *fmt = (decodeFormat_t *)client_data;
 
-    return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
-  } else {
+  (void)fmt;
+
+  if (chunk_cursor_remaining(&flacInput) == 0) {
     return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
   }
+
+  // the only copy of compressed data, straight from the received buffers
+  *bytes = chunk_cursor_read(&flacInput, (char *)buffer, *bytes);
+
+  return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
+
+/**
+ * Lets the decoder report where a frame ended, see write_callback().
+ */
+static FLAC__StreamDecoderTellStatus tell_callback(
+    const FLAC__StreamDecoder *decoder, FLAC__uint64 *absolute_byte_offset,
+    void *client_data) {
+  (void)decoder;
+  (void)client_data;
+
+  *absolute_byte_offset = chunk_cursor_tell(&flacInput);
+
+  return FLAC__STREAM_DECODER_TELL_STATUS_OK;
 }
 
 /**
@@ -331,33 +476,30 @@ static FLAC__StreamDecoderReadStatus read_callback(
 static FLAC__StreamDecoderWriteStatus write_callback(
     const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame,
     const FLAC__int32 *const buffer[], void *client_data) {
-  size_t i;
-  snapcastSetting_t *scSet = (snapcastSetting_t *)client_data;
+  decodeFormat_t *fmt = (decodeFormat_t *)client_data;
+  pcm_chunk_message_t *chunk;
+  FLAC__uint64 frameEnd;
+  int64_t ts;
 
+  // samples take their player width, 24 bit ones a 32 bit word
   size_t bytes = frame->header.blocksize * frame->header.channels *
-                 frame->header.bits_per_sample / 8;
-
-  (void)decoder;
+                 pcm_pack_container_bits(frame->header.bits_per_sample) / 8;
 
-  if (isCachedChunk) {
-    cachedBlocks += frame->header.blocksize;
-  }
-
-  //  ESP_LOGI(TAG, "in flac write cb %ld %d, pcmChunk.bytes %ld",
-  //  frame->header.blocksize, bytes, pcmChunk.bytes);
+  //  ESP_LOGI(TAG, "in flac write cb %ld %d", frame->header.blocksize,
+  //  bytes);
 
-  if (frame->header.channels != scSet->ch) {
+  if (frame->header.channels != fmt->ch) {
     ESP_LOGE(TAG,
              "ERROR: frame header reports different channel count %ld than "
              "previous metadata block %d",
-             frame->header.channels, scSet->ch);
+             frame->header.channels, fmt->ch);
     return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
   }
-  if (frame->header.bits_per_sample != scSet->bits) {
+  if (pcm_pack_container_bits(frame->header.bits_per_sample) != fmt->bits) {
     ESP_LOGE(TAG,
              "ERROR: frame header reports different bps %ld than previous "
              "metadata block %d",
-             frame->header.bits_per_sample, scSet->bits);
+             frame->header.bits_per_sample, fmt->bits);
     return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
   }
   if (buffer[0] == NULL) {
@@ -369,24 +511,41 @@ static FLAC__StreamDecoderWriteStatus write_callback(
     return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
   }
 
-  pcmChunk.outData =
-      (uint8_t *)realloc(pcmChunk.outData, pcmChunk.bytes + bytes);
-  if (!pcmChunk.outData) {
-    ESP_LOGE(TAG, "%s, failed to allocate PCM chunk payload", __func__);
-    return FLAC__STREAM_DECODER_WRITE_STATUS_ABORT;
+  fmt->chkInFrames = frame->header.blocksize;
+
+  // frames buffered by the decoder may come from an earlier wire chunk than
+  // the one being read, so stamp them by where they start in the stream.
+  // Frames are dropped on failure, the decoder stays usable.
+  if ((FLAC__stream_decoder_get_decode_position(decoder, &frameEnd) == 0) ||
+      (chunk_cursor_frame(&flacInput, frameEnd, frame->header.blocksize,
+                          fmt->sr, &ts) < 0)) {
+    ESP_LOGW(TAG, "%s, no time stamp for frame", __func__);
+
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
   }
 
-  for (i = 0; i < frame->header.blocksize; i++) {
-    // write little endian
-    pcmChunk.outData[pcmChunk.bytes + 4 * i] = (uint8_t)(buffer[0][i]);
-    pcmChunk.outData[pcmChunk.bytes + 4 * i + 1] = (uint8_t)(buffer[0][i] >> 8);
-    pcmChunk.outData[pcmChunk.bytes + 4 * i + 2] = (uint8_t)(buffer[1][i]);
-    pcmChunk.outData[pcmChunk.bytes + 4 * i + 3] = (uint8_t)(buffer[1][i] >> 8);
+  // a FLAC frame is exactly one player chunk, usually served by the pool
+  if (allocate_pcm_chunk_memory(&chunk, bytes) < 0) {
+    ESP_LOGE(TAG, "%s, failed to allocate PCM chunk", __func__);
+
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
   }
 
-  pcmChunk.bytes += bytes;
+  pcm_pack_chunk_stereo(chunk, 0, buffer[0], buffer[1],
+                        frame->header.blocksize,
+                        frame->header.bits_per_sample);
+
+  chunk->timestamp.sec = ts / 1000000LL;
+  chunk->timestamp.usec = ts % 1000000LL;
+
+#if CONFIG_USE_DSP_PROCESSOR
+  if (chunk->fragment->payload) {
+    dsp_processor_worker(chunk->fragment->payload, chunk->fragment->size,
+                         fmt->sr, fmt->bits);
+  }
+#endif
 
-  scSet->chkInFrames = frame->header.blocksize;
+  insert_pcm_chunk(chunk);
 
   return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
 }
@@ -397,20 +556,21 @@ static FLAC__StreamDecoderWriteStatus write_callback(
 void metadata_callback(const FLAC__StreamDecoder *decoder,
                        const FLAC__StreamMetadata *metadata,
                        void *client_data) {
-  snapcastSetting_t *scSet = (snapcastSetting_t *)client_data;
+  decodeFormat_t *fmt = (decodeFormat_t *)client_data;
 
   (void)decoder;
 
   if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO) {
     // ESP_LOGI(TAG, "in flac meta cb");
 
-    // save for later
-    scSet->sr = metadata->data.stream_info.sample_rate;
-    scSet->ch = metadata->data.stream_info.channels;
-    scSet->bits = metadata->data.stream_info.bits_per_sample;
+    // save for later, the player runs at the width frames are packed to
+    fmt->sr = metadata->data.stream_info.sample_rate;
+    fmt->ch = metadata->data.stream_info.channels;
+    fmt->bits = pcm_pack_container_bits(
+        metadata->data.stream_info.bits_per_sample);
 
-    ESP_LOGI(TAG, "fLaC sampleformat: %ld:%d:%d", scSet->sr, scSet->bits,
-             scSet->ch);
+    ESP_LOGI(TAG, "fLaC sampleformat: %ld:%ld:%d", fmt->sr,
+             metadata->data.stream_info.bits_per_sample, fmt->ch);
 
     // ESP_LOGE(TAG, "%s: data processed", __func__);
   }
@@ -464,1976 +624,2217 @@ void audio_set_volume(int volume) {
 /**
  *
  */
-static void http_get_task(void *pvParameters) {
-  char *start;
-  base_message_t base_message_rx;
-  hello_message_t hello_message;
-  wire_chunk_message_t wire_chnk = {{0, 0}, 0, NULL};
-  char *hello_message_serialized = NULL;
-  int result;
-  int64_t now, trx, tdif, ttx;
-  time_message_t time_message_rx = {{0, 0}};
-  int64_t tmpDiffToServer;
-  int64_t lastTimeSync = 0;
-  esp_timer_handle_t timeSyncMessageTimer = NULL;
-  esp_err_t err = 0;
-  server_settings_message_t server_settings_message;
-  bool received_header = false;
-  mdns_result_t *r;
-  codec_type_t codec = NONE;
-  snapcastSetting_t scSet;
-  pcm_chunk_message_t *pcmData = NULL;
-  ip_addr_t remote_ip;
-  uint16_t remotePort = 0;
-  int rc1 = ERR_OK, rc2 = ERR_OK;
-  struct netbuf *firstNetBuf = NULL;
-  uint16_t len;
-  uint64_t timeout = FAST_SYNC_LATENCY_BUF;
-  char *codecString = NULL;
-  char *codecPayload = NULL;
-  char *serverSettingsString = NULL;
+static int64_t tv_to_us(const tv_t *tv) {
+  return (int64_t)tv->sec * 1000000LL + (int64_t)tv->usec;
+}
 
-  // create a timer to send time sync messages every x µs
-  esp_timer_create(&tSyncArgs, &timeSyncMessageTimer);
+/**
+ *
+ */
+static tv_t us_to_tv(int64_t us) {
+  tv_t tv = {.sec = us / 1000000LL, .usec = us % 1000000LL};
 
-#if CONFIG_SNAPCLIENT_USE_MDNS
-  ESP_LOGI(TAG, "Enable mdns");
-  mdns_init();
+  return tv;
+}
+
+typedef struct rttJitter_s {
+  bool valid;
+  int32_t srtt_us;
+  int32_t rttVar_us;
+} rttJitter_t;
+
+/**
+ * state of the current server connection, shared by the framer callbacks
+ */
+typedef struct streamCtx_s {
+  snapcastSetting_t scSet;
+  decodeFormat_t fmt;
+  codec_type_t codec;
+  bool received_header;
+  bool fatal;  // unrecoverable error, http_get_task() stops
+
+  pcm_chunk_message_t *pcmData;
+  uint32_t chunkSize;
+  uint32_t payloadOffset;
+  char *copyBuf;  // wire chunk is copied to heap instead of keeping pbufs
+  bool stored;    // wire chunk goes to chunkStore
+  sg_chain_t *input;  // compressed wire chunk being received
+
+#if CONFIG_SNAPCLIENT_DECODE_TASK
+  decodeJob_t *job;  // holds input
 #endif
 
-  while (1) {
-    // do some house keeping
-    {
-      received_header = false;
+  int64_t decodeAvgUs;
+  int64_t decodePeakUs;
+
+  // wire chunk latency per stage, first byte received to chunk complete,
+  // waiting for the decode task and decoding including DSP
+  int64_t chunkArrival_us;
+  latency_hist_t histReceive;
+  latency_hist_t histQueue;
+  latency_hist_t histDecode;
+  uint32_t histCnt;
+
+  uint32_t storeStatsCnt;
+  pcm_unpack_t pcmUnpack;
+  uint8_t pcmBits;  // PCM sample width on the wire, fmt.bits is the player's
+
+  // startup latency: connected, codec header set up, cleared once the first
+  // chunk is decoded
+  int64_t connect_us;
+  int64_t header_us;
+
+  // wire chunks skipped by stream_skip_late() in a row, the decoder has to
+  // resync on the next one decoded
+  uint32_t lateRun;
+  bool decoderGap;
+
+  // chunks which failed to decode since start
+  uint32_t decodeErrors;
+
+  esp_timer_handle_t timeSyncMessageTimer;
+  uint64_t timeout;
+  int64_t lastTimeSync;
+  sync_scheduler_t syncScheduler;
+
+  // round trip time jitter with receive time stamped at arrival and at the
+  // parser, which is late by everything parsed and decoded before
+  int64_t parsed_us;
+  rttJitter_t rttArrival;
+  rttJitter_t rttParsed;
+  uint32_t rttSamples;
+} streamCtx_t;
 
-      timeout = FAST_SYNC_LATENCY_BUF;
+/**
+ *
+ */
+static void wire_chunk_pbuf_free(void *owner) {
+  pbuf_free((struct pbuf *)owner);
+}
 
-      esp_timer_stop(timeSyncMessageTimer);
+/**
+ * Replace the pbufs collected so far by a heap copy of the complete wire
+ * chunk, retry until there is enough memory.
+ */
+static void wire_chunk_to_heap(streamCtx_t *stream) {
+  while (!stream->copyBuf) {
+    stream->copyBuf = sg_chain_flatten(stream->input, stream->chunkSize);
+    if (!stream->copyBuf) {
+      ESP_LOGW(TAG,
+               "malloc wire chunk copy failed, wait "
+               "1ms and try again");
+
+      vTaskDelay(pdMS_TO_TICKS(1));
+    }
+  }
+}
 
-      if (opusDecoder != NULL) {
-        opus_decoder_destroy(opusDecoder);
-        opusDecoder = NULL;
-      }
+/**
+ *
+ */
+static BaseType_t stream_send_setting(streamCtx_t *stream) {
+  snapcastSetting_t *scSet = &stream->scSet;
+  BaseType_t ret;
+
+  xSemaphoreTake(scSetMutex, portMAX_DELAY);
+  scSet->codec = stream->fmt.codec;
+  scSet->sr = stream->fmt.sr;
+  scSet->ch = stream->fmt.ch;
+  scSet->bits = stream->fmt.bits;
+  scSet->chkInFrames = stream->fmt.chkInFrames;
+  ret = player_send_snapcast_setting(scSet);
+  xSemaphoreGive(scSetMutex);
+
+  return ret;
+}
 
-      if (flacDecoder != NULL) {
-        FLAC__stream_decoder_finish(flacDecoder);
-        FLAC__stream_decoder_delete(flacDecoder);
-        flacDecoder = NULL;
-      }
+/**
+ *
+ */
+static void stream_base_message_cb(void *ctx, base_message_t *base,
+                                   int64_t arrival_us) {
+  streamCtx_t *stream = (streamCtx_t *)ctx;
+  int64_t now = esp_timer_get_time();
+
+  stream->parsed_us = now;
+  if (arrival_us > 0) {
+    now = arrival_us;
+  }
 
-      if (decoderChunk.inData) {
-        free(decoderChunk.inData);
-        decoderChunk.inData = NULL;
-      }
+  base->received.sec = now / 1000000;
+  base->received.usec = now - base->received.sec * 1000000;
+}
 
-      if (decoderChunk.outData) {
-        free(decoderChunk.outData);
-        decoderChunk.outData = NULL;
-      }
+/**
+ * Statistics only, histograms are reset by whichever task logs them and may
+ * lose a count.
+ */
+static void stream_latency_report(streamCtx_t *stream) {
+  const char *name[] = {"receive", "queue", "decode"};
+  latency_hist_t *hist[] = {&stream->histReceive, &stream->histQueue,
+                            &stream->histDecode};
+  char str[128];
 
-      if (codecString) {
-        free(codecString);
-        codecString = NULL;
-      }
+  if (++stream->histCnt < 500) {
+    return;
+  }
 
-      if (codecPayload) {
-        free(codecPayload);
-        codecPayload = NULL;
-      }
+  stream->histCnt = 0;
 
-      if (codecPayload) {
-        free(serverSettingsString);
-        serverSettingsString = NULL;
-      }
+  for (int i = 0; i < sizeof(hist) / sizeof(hist[0]); i++) {
+    if (hist[i]->count == 0) {
+      continue;
     }
 
-#if SNAPCAST_SERVER_USE_MDNS
-    // Find snapcast server
-    // Connect to first snapcast server found
-    r = NULL;
-    err = 0;
-    while (!r || err) {
-      ESP_LOGI(TAG, "Lookup snapcast service on network");
-      esp_err_t err = mdns_query_ptr("_snapcast", "_tcp", 3000, 20, &r);
-      if (err) {
-        ESP_LOGE(TAG, "Query Failed");
-        vTaskDelay(pdMS_TO_TICKS(1000));
-      }
+    latency_hist_format(hist[i], str, sizeof(str));
+    ESP_LOGI(TAG, "%s latency p50 %lldus p99 %lldus max %lldus, hist %s",
+             name[i], latency_hist_percentile(hist[i], 50),
+             latency_hist_percentile(hist[i], 99), hist[i]->max_us, str);
 
-      if (!r) {
-        ESP_LOGW(TAG, "No results found!");
-        vTaskDelay(pdMS_TO_TICKS(1000));
-      }
-    }
+    latency_hist_reset(hist[i]);
+  }
+}
 
-    mdns_ip_addr_t *a = r->addr;
-    if (a) {
-      ip_addr_copy(remote_ip, (a->addr));
-      remote_ip.type = a->addr.type;
-      remotePort = r->port;
-      ESP_LOGI(TAG, "Found %s:%d", ipaddr_ntoa(&remote_ip), remotePort);
+/**
+ *
+ */
+static void stream_decode_time_update(streamCtx_t *stream, int64_t us) {
+  latency_hist_add(&stream->histDecode, us);
+  stream_latency_report(stream);
 
-      mdns_query_results_free(r);
-    } else {
-      mdns_query_results_free(r);
+  if (stream->header_us > 0) {
+    int64_t now = esp_timer_get_time();
 
-      ESP_LOGW(TAG, "No IP found in MDNS query");
+    ESP_LOGI(TAG, "first audio %lldms after connect, %lldms after header",
+             (now - stream->connect_us) / 1000,
+             (now - stream->header_us) / 1000);
 
-      continue;
+    stream->header_us = 0;
+  }
+
+  if (stream->decodeAvgUs == 0) {
+    stream->decodeAvgUs = us;
+  } else {
+    stream->decodeAvgUs += (us - stream->decodeAvgUs) / 16;
+  }
+
+  // peak decays slowly so a single slow chunk isn't remembered forever
+  stream->decodePeakUs -= stream->decodePeakUs / 256;
+  if (us > stream->decodePeakUs) {
+    stream->decodePeakUs = us;
+  }
+}
+
+/**
+ * Pick the decoded channels played on the stereo output, see
+ * CONFIG_SNAPCLIENT_OPUS_LEFT_CHANNEL. Streams without them play their first
+ * two channels, mono on both sides.
+ */
+static void opus_session_route(const opus_mapping_t *mapping) {
+  uint32_t left = CONFIG_SNAPCLIENT_OPUS_LEFT_CHANNEL;
+  uint32_t right = CONFIG_SNAPCLIENT_OPUS_RIGHT_CHANNEL;
+
+  if ((left >= mapping->channels) || (right >= mapping->channels)) {
+    left = 0;
+    right = (mapping->channels > 1) ? 1 : 0;
+
+    if (mapping->channels > 2) {
+      ESP_LOGW(TAG, "configured Opus channels not in stream, playing %lu/%lu",
+               left, right);
     }
-#else
-    // configure a failsafe snapserver according to CONFIG values
-    struct sockaddr_in servaddr;
+  }
 
-    servaddr.sin_family = AF_INET;
-    inet_pton(AF_INET, SNAPCAST_SERVER_HOST, &(servaddr.sin_addr.s_addr));
-    servaddr.sin_port = htons(SNAPCAST_SERVER_PORT);
+  opusRoute[0] = left;
+  opusRoute[1] = right;
 
-    inet_pton(AF_INET, SNAPCAST_SERVER_HOST, &(remote_ip.u_addr.ip4.addr));
-    remote_ip.type = IPADDR_TYPE_V4;
-    remotePort = SNAPCAST_SERVER_PORT;
+  ESP_LOGI(TAG, "Opus channels: %d in %d streams, playing %d/%d",
+           mapping->channels, mapping->streams, opusRoute[0], opusRoute[1]);
+}
 
-    ESP_LOGI(TAG, "try connecting to static configuration %s:%d",
-             ipaddr_ntoa(&remote_ip), remotePort);
+/**
+ * The decoder state is touched all over for every packet, so keep it in
+ * internal RAM if there is room.
+ */
+static int opus_session_open(uint32_t sr, const opus_mapping_t *mapping) {
+#if CONFIG_SPIRAM
+  const uint32_t capsList[] = {MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT,
+                               MALLOC_CAP_8BIT};
+#else
+  const uint32_t capsList[] = {MALLOC_CAP_8BIT};
 #endif
+  int size =
+      opus_multistream_decoder_get_size(mapping->streams, mapping->coupled);
+  int error;
 
-    if (lwipNetconn != NULL) {
-      netconn_delete(lwipNetconn);
-      lwipNetconn = NULL;
+  if (size <= 0) {
+    return -1;
+  }
+
+  for (int i = 0; i < sizeof(capsList) / sizeof(capsList[0]); i++) {
+    opusDecoder = (OpusMSDecoder *)heap_caps_malloc(size, capsList[i]);
+    if (opusDecoder != NULL) {
+      break;
     }
+  }
 
-    lwipNetconn = netconn_new(NETCONN_TCP);
-    if (lwipNetconn == NULL) {
-      ESP_LOGE(TAG, "can't create netconn");
+  if (opusDecoder == NULL) {
+    return -1;
+  }
 
-      continue;
-    }
+  error = opus_multistream_decoder_init(opusDecoder, sr, mapping->channels,
+                                        mapping->streams, mapping->coupled,
+                                        mapping->mapping);
+  if (error != OPUS_OK) {
+    ESP_LOGE(TAG, "%s: %s", __func__, opus_strerror(error));
 
-    rc1 = netconn_bind(lwipNetconn, IPADDR_ANY, 0);
-    if (rc1 != ERR_OK) {
-      ESP_LOGE(TAG, "can't bind local IP");
-    }
+    heap_caps_free(opusDecoder);
+    opusDecoder = NULL;
 
-    rc2 = netconn_connect(lwipNetconn, &remote_ip, remotePort);
-    if (rc2 != ERR_OK) {
-      ESP_LOGE(TAG, "can't connect to remote %s:%d, err %d",
-               ipaddr_ntoa(&remote_ip), remotePort, rc2);
-    }
+    return -1;
+  }
 
-    if (rc1 != ERR_OK || rc2 != ERR_OK) {
-      netconn_close(lwipNetconn);
-      netconn_delete(lwipNetconn);
-      lwipNetconn = NULL;
+  // all channels are decoded, two of them are packed
+  opusPcmFrames = sr * OPUS_PCM_DEFAULT_MS / 1000;
+  opusPcm = (opus_int16 *)malloc(opusPcmFrames * mapping->channels *
+                                 sizeof(opus_int16));
+  if (opusPcm == NULL) {
+    opusPcmFrames = 0;
 
-      continue;
-    }
+    heap_caps_free(opusDecoder);
+    opusDecoder = NULL;
 
-    ESP_LOGI(TAG, "netconn connected");
+    return -1;
+  }
 
-    if (reset_latency_buffer() < 0) {
-      ESP_LOGE(TAG,
-               "reset_diff_buffer: couldn't reset median filter long. STOP");
-      return;
-    }
+  opusMapping = *mapping;
+  opus_session_route(mapping);
 
-    char mac_address[18];
-    uint8_t base_mac[6];
-    // Get MAC address for WiFi station
-#if CONFIG_SNAPCLIENT_USE_INTERNAL_ETHERNET || \
-    CONFIG_SNAPCLIENT_USE_SPI_ETHERNET
-    esp_read_mac(base_mac, ESP_MAC_ETH);
-#else
-    esp_read_mac(base_mac, ESP_MAC_WIFI_STA);
-#endif
-    sprintf(mac_address, "%02X:%02X:%02X:%02X:%02X:%02X", base_mac[0],
-            base_mac[1], base_mac[2], base_mac[3], base_mac[4], base_mac[5]);
+  return 0;
+}
 
-    now = esp_timer_get_time();
+/**
+ *
+ */
+static void opus_session_close(void) {
+  if (opusDecoder != NULL) {
+    heap_caps_free(opusDecoder);
+    opusDecoder = NULL;
+  }
 
-    // init base message
-    base_message_rx.type = SNAPCAST_MESSAGE_HELLO;
-    base_message_rx.id = id_counter++;
-    base_message_rx.refersTo = 0x0000;
-    base_message_rx.sent.sec = now / 1000000;
-    base_message_rx.sent.usec = now - base_message_rx.sent.sec * 1000000;
-    base_message_rx.received.sec = 0;
-    base_message_rx.received.usec = 0;
-    base_message_rx.size = 0x00000000;
-
-    // init hello message
-    hello_message.mac = mac_address;
-    hello_message.hostname = SNAPCAST_CLIENT_NAME;
-    hello_message.version = (char *)VERSION_STRING;
-    hello_message.client_name = "libsnapcast";
-    hello_message.os = "esp32";
-    hello_message.arch = "xtensa";
-    hello_message.instance = 1;
-    hello_message.id = mac_address;
-    hello_message.protocol_version = 2;
-
-    if (hello_message_serialized == NULL) {
-      hello_message_serialized = hello_message_serialize(
-          &hello_message, (size_t *)&(base_message_rx.size));
-      if (!hello_message_serialized) {
-        ESP_LOGE(TAG, "Failed to serialize hello message");
-        return;
-      }
-    }
+  free(opusPcm);
+  opusPcm = NULL;
+  opusPcmFrames = 0;
+}
 
-    result = base_message_serialize(&base_message_rx, base_message_serialized,
-                                    BASE_MESSAGE_SIZE);
-    if (result) {
-      ESP_LOGE(TAG, "Failed to serialize base message");
-      return;
-    }
+#if CONFIG_SNAPCLIENT_USE_OGG
+/**
+ * Set up the Ogg demuxer with the pages of the codec header, which hold the
+ * header packets of the stream, and the decoder they ask for: Vorbis, or
+ * Opus for Ogg/Opus.
+ */
+static int ogg_session_open(decodeFormat_t *fmt, const char *header,
+                            uint32_t size) {
+  ogg_page page;
+  ogg_packet packet;
+  opus_mapping_t mapping;
+  uint32_t headers = 0;
+  char *buffer;
+
+  ogg_sync_init(&oggSession.sync);
+  vorbis_info_init(&oggSession.info);
+  vorbis_comment_init(&oggSession.comment);
+  oggSession.open = true;
+
+  buffer = ogg_sync_buffer(&oggSession.sync, size);
+  if (buffer == NULL) {
+    return -1;
+  }
 
-    rc1 = netconn_write(lwipNetconn, base_message_serialized, BASE_MESSAGE_SIZE,
-                        NETCONN_NOCOPY);
-    if (rc1 != ERR_OK) {
-      ESP_LOGE(TAG, "netconn failed to send base message");
+  memcpy(buffer, header, size);
+  ogg_sync_wrote(&oggSession.sync, size);
 
-      continue;
+  while (ogg_sync_pageout(&oggSession.sync, &page) == 1) {
+    if (!oggSession.streamInit) {
+      ogg_stream_init(&oggSession.stream, ogg_page_serialno(&page));
+      oggSession.streamInit = true;
     }
-    rc1 = netconn_write(lwipNetconn, hello_message_serialized,
-                        base_message_rx.size, NETCONN_NOCOPY);
-    if (rc1 != ERR_OK) {
-      ESP_LOGE(TAG, "netconn failed to send hello message");
 
+    if (ogg_stream_pagein(&oggSession.stream, &page) < 0) {
       continue;
     }
 
-    ESP_LOGI(TAG, "netconn sent hello message");
+    while (ogg_stream_packetout(&oggSession.stream, &packet) == 1) {
+      if ((headers == 0) && (packet.bytes >= 19) &&
+          (memcmp(packet.packet, "OpusHead", 8) == 0)) {
+        oggSession.opus = true;
 
-    free(hello_message_serialized);
-    hello_message_serialized = NULL;
+        // Pre skip isn't applied, the server's time stamps are taken to
+        // include it
+        if (opus_mapping_parse_head(&mapping, packet.packet, packet.bytes) <
+            0) {
+          ESP_LOGE(TAG, "Ogg/Opus channel mapping %d not supported",
+                   packet.packet[18]);
 
-    // init default setting
-    scSet.buf_ms = 500;
-    scSet.codec = NONE;
-    scSet.bits = 16;
-    scSet.ch = 2;
-    scSet.sr = 44100;
-    scSet.chkInFrames = 0;
-    scSet.volume = 0;
-    scSet.muted = true;
-
-    uint64_t startTime, endTime;
-    //    size_t currentPos = 0;
-    size_t typedMsgCurrentPos = 0;
-    uint32_t typedMsgLen = 0;
-    uint32_t offset = 0;
-    uint32_t payloadOffset = 0;
-    uint32_t tmpData = 0;
-    int32_t payloadDataShift = 0;
-
-#define BASE_MESSAGE_STATE 0
-#define TYPED_MESSAGE_STATE 1
-
-    // 0 ... base message, 1 ... typed message
-    uint32_t state = BASE_MESSAGE_STATE;
-    uint32_t internalState = 0;
+          return -1;
+        }
 
-    firstNetBuf = NULL;
+        // Opus decodes to 16 bit at any rate we ask for, played in stereo
+        fmt->ch = 2;
+        fmt->sr = 48000;
+        fmt->bits = 16;
+      }
 
-    while (1) {
-      rc2 = netconn_recv(lwipNetconn, &firstNetBuf);
-      if (rc2 != ERR_OK) {
-        if (rc2 == ERR_CONN) {
-          netconn_close(lwipNetconn);
+      // OpusTags follows OpusHead, the decoder has no use for it
+      if (!oggSession.opus && (vorbis_synthesis_headerin(
+                                   &oggSession.info, &oggSession.comment,
+                                   &packet) != 0)) {
+        ESP_LOGE(TAG, "Ogg stream is neither Vorbis nor Opus");
 
-          // restart and try to reconnect
-          break;
-        }
+        return -1;
+      }
 
-        if (firstNetBuf != NULL) {
-          netbuf_delete(firstNetBuf);
+      headers++;
+    }
+  }
 
-          firstNetBuf = NULL;
-        }
-        continue;
-      }
+  if (oggSession.opus) {
+    ESP_LOGI(TAG, "Ogg/Opus sample format: %ld:16:%d", fmt->sr,
+             mapping.channels);
 
-      // now parse the data
-      netbuf_first(firstNetBuf);
-      do {
-        // currentPos = 0;
+    return opus_session_open(fmt->sr, &mapping);
+  }
 
-        rc1 = netbuf_data(firstNetBuf, (void **)&start, &len);
-        if (rc1 == ERR_OK) {
-          // ESP_LOGI (TAG, "netconn rx,"
-          // "data len: %d, %d", len, netbuf_len(firstNetBuf) -
-          // currentPos);
-        } else {
-          ESP_LOGE(TAG, "netconn rx, couldn't get data");
+  // identification, comment and setup header
+  if (headers < 3) {
+    ESP_LOGE(TAG, "Vorbis header incomplete");
 
-          continue;
-        }
+    return -1;
+  }
+
+  if (oggSession.info.channels != 2) {
+    ESP_LOGE(TAG, "Vorbis with %d channels not supported",
+             oggSession.info.channels);
+
+    return -1;
+  }
+
+  if ((vorbis_synthesis_init(&oggSession.dsp, &oggSession.info) != 0) ||
+      (vorbis_block_init(&oggSession.dsp, &oggSession.block) != 0)) {
+    ESP_LOGE(TAG, "Failed to init Vorbis decoder");
+
+    return -1;
+  }
 
-        while (len > 0) {
-          rc1 = ERR_OK;  // probably not necessary
-
-          switch (state) {
-            // decode base message
-            case BASE_MESSAGE_STATE: {
-              switch (internalState) {
-                case 0:
-                  base_message_rx.type = *start & 0xFF;
-                  internalState++;
-                  break;
-
-                case 1:
-                  base_message_rx.type |= (*start & 0xFF) << 8;
-                  internalState++;
-                  break;
-
-                case 2:
-                  base_message_rx.id = *start & 0xFF;
-                  internalState++;
-                  break;
-
-                case 3:
-                  base_message_rx.id |= (*start & 0xFF) << 8;
-                  internalState++;
-                  break;
-
-                case 4:
-                  base_message_rx.refersTo = *start & 0xFF;
-                  internalState++;
-                  break;
-
-                case 5:
-                  base_message_rx.refersTo |= (*start & 0xFF) << 8;
-                  internalState++;
-                  break;
-
-                case 6:
-                  base_message_rx.sent.sec = *start & 0xFF;
-                  internalState++;
-                  break;
-
-                case 7:
-                  base_message_rx.sent.sec |= (*start & 0xFF) << 8;
-                  internalState++;
-                  break;
-
-                case 8:
-                  base_message_rx.sent.sec |= (*start & 0xFF) << 16;
-                  internalState++;
-                  break;
-
-                case 9:
-                  base_message_rx.sent.sec |= (*start & 0xFF) << 24;
-                  internalState++;
-                  break;
-
-                case 10:
-                  base_message_rx.sent.usec = *start & 0xFF;
-                  internalState++;
-                  break;
-
-                case 11:
-                  base_message_rx.sent.usec |= (*start & 0xFF) << 8;
-                  internalState++;
-                  break;
-
-                case 12:
-                  base_message_rx.sent.usec |= (*start & 0xFF) << 16;
-                  internalState++;
-                  break;
-
-                case 13:
-                  base_message_rx.sent.usec |= (*start & 0xFF) << 24;
-                  internalState++;
-                  break;
-
-                case 14:
-                  base_message_rx.received.sec = *start & 0xFF;
-                  internalState++;
-                  break;
-
-                case 15:
-                  base_message_rx.received.sec |= (*start & 0xFF) << 8;
-                  internalState++;
-                  break;
-
-                case 16:
-                  base_message_rx.received.sec |= (*start & 0xFF) << 16;
-                  internalState++;
-                  break;
-
-                case 17:
-                  base_message_rx.received.sec |= (*start & 0xFF) << 24;
-                  internalState++;
-                  break;
-
-                case 18:
-                  base_message_rx.received.usec = *start & 0xFF;
-                  internalState++;
-                  break;
-
-                case 19:
-                  base_message_rx.received.usec |= (*start & 0xFF) << 8;
-                  internalState++;
-                  break;
-
-                case 20:
-                  base_message_rx.received.usec |= (*start & 0xFF) << 16;
-                  internalState++;
-                  break;
-
-                case 21:
-                  base_message_rx.received.usec |= (*start & 0xFF) << 24;
-                  internalState++;
-                  break;
-
-                case 22:
-                  base_message_rx.size = *start & 0xFF;
-                  internalState++;
-                  break;
-
-                case 23:
-                  base_message_rx.size |= (*start & 0xFF) << 8;
-                  internalState++;
-                  break;
-
-                case 24:
-                  base_message_rx.size |= (*start & 0xFF) << 16;
-                  internalState++;
-                  break;
-
-                case 25:
-                  base_message_rx.size |= (*start & 0xFF) << 24;
-                  internalState = 0;
-
-                  now = esp_timer_get_time();
-
-                  base_message_rx.received.sec = now / 1000000;
-                  base_message_rx.received.usec =
-                      now - base_message_rx.received.sec * 1000000;
-
-                  typedMsgCurrentPos = 0;
-
-                  //                   ESP_LOGI(TAG,"BM type %d ts %d.%d",
-                  //                   base_message_rx.type,
-                  //                   base_message_rx.received.sec,
-                  //                   base_message_rx.received.usec);
-                  // ESP_LOGI(TAG,"%d, %d.%d", base_message_rx.type,
-                  //                   base_message_rx.received.sec,
-                  //                   base_message_rx.received.usec);
-                  // ESP_LOGI(TAG,"%d, %llu", base_message_rx.type,
-                  //		   1000000ULL * base_message_rx.received.sec +
-                  // base_message_rx.received.usec);
-
-                  state = TYPED_MESSAGE_STATE;
-                  break;
-              }
-
-              // currentPos++;++;
-              len--;
-              start++;
-
-              break;
-            }
-
-            // decode typed message
-            case TYPED_MESSAGE_STATE: {
-              switch (base_message_rx.type) {
-                case SNAPCAST_MESSAGE_WIRE_CHUNK: {
-                  switch (internalState) {
-                    case 0: {
-                      wire_chnk.timestamp.sec = *start & 0xFF;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      if (len == 0) {
-                        break;
-                      }
-                    }
-
-                    case 1: {
-                      wire_chnk.timestamp.sec |= (*start & 0xFF) << 8;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      if (len == 0) {
-                        break;
-                      }
-                    }
-
-                    case 2: {
-                      wire_chnk.timestamp.sec |= (*start & 0xFF) << 16;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
+  oggSession.vorbisInit = true;
 
-                      internalState++;
+  // long blocks overlap by half, a packet completes at most that many
+  // frames, so every player chunk fits the pool's slots
+  oggSession.chunkFrames = vorbis_info_blocksize(&oggSession.info, 1) / 2;
 
-                      if (len == 0) {
-                        break;
-                      }
-                    }
+  fmt->sr = oggSession.info.rate;
+  fmt->ch = oggSession.info.channels;
+  fmt->bits = 16;
+  fmt->chkInFrames = oggSession.chunkFrames;
 
-                    case 3: {
-                      wire_chnk.timestamp.sec |= (*start & 0xFF) << 24;
+  ESP_LOGI(TAG, "Vorbis sample format: %ld:16:%d", fmt->sr, fmt->ch);
+
+  return 0;
+}
+
+/**
+ *
+ */
+static void ogg_session_close(void) {
+  if (!oggSession.open) {
+    return;
+  }
 
-                      // ESP_LOGI(TAG,
-                      // "wire chunk time sec: %d",
-                      // wire_chnk.timestamp.sec);
+  if (oggSession.vorbisInit) {
+    vorbis_block_clear(&oggSession.block);
+    vorbis_dsp_clear(&oggSession.dsp);
+  }
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
+  vorbis_comment_clear(&oggSession.comment);
+  vorbis_info_clear(&oggSession.info);
 
-                      internalState++;
+  if (oggSession.streamInit) {
+    ogg_stream_clear(&oggSession.stream);
+  }
 
-                      if (len == 0) {
-                        break;
-                      }
-                    }
+  ogg_sync_clear(&oggSession.sync);
 
-                    case 4: {
-                      wire_chnk.timestamp.usec = (*start & 0xFF);
+  memset(&oggSession, 0, sizeof(oggSession));
+}
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
+/**
+ * Drop partial pages and packets and what the decoder keeps for overlapping
+ * the next packet.
+ */
+static void ogg_session_restart(void) {
+  if (!oggSession.open) {
+    return;
+  }
 
-                      internalState++;
+  ogg_sync_reset(&oggSession.sync);
 
-                      if (len == 0) {
-                        break;
-                      }
-                    }
+  if (oggSession.streamInit) {
+    ogg_stream_reset(&oggSession.stream);
+  }
 
-                    case 5: {
-                      wire_chnk.timestamp.usec |= (*start & 0xFF) << 8;
+  if (oggSession.opus) {
+    if (opusDecoder != NULL) {
+      opus_multistream_decoder_ctl(opusDecoder, OPUS_RESET_STATE);
+    }
+  } else if (oggSession.vorbisInit) {
+    vorbis_synthesis_restart(&oggSession.dsp);
+  }
+}
+#endif
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
+/**
+ * Release the decoders and forget the codec header they were set up for.
+ */
+static void codec_session_close(void) {
+  if (flacDecoder != NULL) {
+    FLAC__stream_decoder_finish(flacDecoder);
+    FLAC__stream_decoder_delete(flacDecoder);
+    flacDecoder = NULL;
+  }
 
-                      internalState++;
+#if CONFIG_SNAPCLIENT_USE_OGG
+  ogg_session_close();
+#endif
+  opus_session_close();
 
-                      if (len == 0) {
-                        break;
-                      }
-                    }
+  free(codecSession.header);
+  codecSession.header = NULL;
+  codecSession.headerSize = 0;
+  codecSession.codec = NONE;
+}
 
-                    case 6: {
-                      wire_chnk.timestamp.usec |= (*start & 0xFF) << 16;
+/**
+ * Snapserver resends the same codec header on every connect, the decoders
+ * set up for it can be used again.
+ */
+static bool codec_session_matches(codec_type_t codec,
+                                  const codec_header_message_t *header) {
+  return (codecSession.header != NULL) && (codecSession.codec == codec) &&
+         (codecSession.headerSize == header->size) &&
+         (memcmp(codecSession.header, header->payload, header->size) == 0);
+}
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
+/**
+ * Set up the decoder for a codec header and remember the header.
+ */
+static int codec_session_open(streamCtx_t *stream,
+                              const codec_header_message_t *header) {
+  decodeFormat_t *fmt = &stream->fmt;
+  const char *codecPayload = header->payload;
+
+  if (stream->codec == OPUS) {
+    opus_mapping_t mapping;
+    uint16_t channels;
+    uint32_t rate;
+    uint16_t bits;
+
+    memcpy(&rate, codecPayload + 4, sizeof(rate));
+    memcpy(&bits, codecPayload + 8, sizeof(bits));
+    memcpy(&channels, codecPayload + 10, sizeof(channels));
+
+    // Opus always decodes to 16 bit, two channels of it are played
+    fmt->codec = stream->codec;
+    fmt->bits = 16;
+    fmt->ch = 2;
+    fmt->sr = rate;
+
+    ESP_LOGI(TAG, "Opus sample format: %ld:%d:%d\n", rate, bits, channels);
+
+    // the header has no mapping table, more than two channels are taken to
+    // be coded like libopus' surround encoder does
+    if (opus_mapping_default(&mapping, channels) < 0) {
+      ESP_LOGE(TAG, "Opus with %d channels not supported", channels);
+
+      return -1;
+    }
 
-                      internalState++;
+    if (opus_session_open(fmt->sr, &mapping) < 0) {
+      ESP_LOGI(TAG, "Failed to init opus coder");
 
-                      if (len == 0) {
-                        break;
-                      }
-                    }
+      return -1;
+    }
 
-                    case 7: {
-                      wire_chnk.timestamp.usec |= (*start & 0xFF) << 24;
+    ESP_LOGI(TAG, "Initialized opus Decoder");
+  } else if (stream->codec == FLAC) {
+    // codecPayload stays valid until the metadata is processed below
+    sg_chain_release(&decoderInput);
+    sg_chain_append(&decoderInput, codecPayload, header->size, NULL, NULL);
+    chunk_cursor_reset(&flacInput);
+    chunk_cursor_push(&flacInput, &decoderInput, 0);
 
-                      // ESP_LOGI(TAG,
-                      // "wire chunk time usec: %d",
-                      // wire_chnk.timestamp.usec);
+    flacDecoder = FLAC__stream_decoder_new();
+    if (flacDecoder == NULL) {
+      ESP_LOGE(TAG, "Failed to init flac decoder");
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
+      return -1;
+    }
 
-                      internalState++;
+    FLAC__StreamDecoderInitStatus init_status =
+        FLAC__stream_decoder_init_stream(
+            flacDecoder, read_callback, NULL, tell_callback, NULL, NULL,
+            write_callback, metadata_callback, error_callback, fmt);
+    if (init_status != FLAC__STREAM_DECODER_INIT_STATUS_OK) {
+      ESP_LOGE(TAG, "ERROR: initializing decoder: %s\n",
+               FLAC__StreamDecoderInitStatusString[init_status]);
 
-                      if (len == 0) {
-                        break;
-                      }
-                    }
+      return -1;
+    }
 
-                    case 8: {
-                      wire_chnk.size = (*start & 0xFF);
+    FLAC__stream_decoder_process_until_end_of_metadata(flacDecoder);
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
+    // the first frame starts right after the metadata
+    FLAC__uint64 metadataEnd;
+    if (FLAC__stream_decoder_get_decode_position(flacDecoder, &metadataEnd) ==
+        0) {
+      metadataEnd = chunk_cursor_tell(&flacInput);
+    }
+    chunk_cursor_sync(&flacInput, metadataEnd);
 
-                      internalState++;
+    sg_chain_release(&decoderInput);
 
-                      if (len == 0) {
-                        break;
-                      }
-                    }
+    if (fmt->bits == 0) {
+      ESP_LOGE(TAG, "FLAC sample width not supported");
 
-                    case 9: {
-                      wire_chnk.size |= (*start & 0xFF) << 8;
+      return -1;
+    }
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
+    // ESP_LOGI(TAG, "%s: processed codec header", __func__);
+#if CONFIG_SNAPCLIENT_USE_OGG
+  } else if (stream->codec == OGG) {
+    fmt->codec = stream->codec;
 
-                      internalState++;
+    if (ogg_session_open(fmt, codecPayload, header->size) < 0) {
+      ESP_LOGE(TAG, "Failed to init Ogg decoder");
 
-                      if (len == 0) {
-                        break;
-                      }
-                    }
+      return -1;
+    }
+#endif
+  } else if (stream->codec == PCM) {
+    uint16_t channels;
+    uint32_t rate;
+    uint16_t bits;
 
-                    case 10: {
-                      wire_chnk.size |= (*start & 0xFF) << 16;
+    memcpy(&channels, codecPayload + 22, sizeof(channels));
+    memcpy(&rate, codecPayload + 24, sizeof(rate));
+    memcpy(&bits, codecPayload + 34, sizeof(bits));
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
+    // 24 bit comes in 4 bytes like 32 bit, both are played as 32 bit
+    fmt->codec = stream->codec;
+    fmt->bits = pcm_pack_container_bits(bits);
+    fmt->ch = channels;
+    fmt->sr = rate;
+    stream->pcmBits = bits;
 
-                      internalState++;
+    ESP_LOGI(TAG, "pcm sampleformat: %ld:%d:%d", fmt->sr, bits, fmt->ch);
 
-                      if (len == 0) {
-                        break;
-                      }
-                    }
+    if (fmt->bits == 0) {
+      ESP_LOGE(TAG, "PCM sample width not supported");
 
-                    case 11: {
-                      wire_chnk.size |= (*start & 0xFF) << 24;
+      return -1;
+    }
+  }
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
+  // the header is only compared, a failed copy just prevents reuse
+  codecSession.header = (char *)malloc(header->size);
+  if (codecSession.header != NULL) {
+    memcpy(codecSession.header, codecPayload, header->size);
+    codecSession.headerSize = header->size;
+    codecSession.codec = stream->codec;
+    codecSession.sr = fmt->sr;
+    codecSession.ch = fmt->ch;
+    codecSession.bits = fmt->bits;
+    codecSession.pcmBits = stream->pcmBits;
+  }
 
-                      internalState++;
+  return 0;
+}
 
-                      // TODO: we could use wire chunk directly maybe?
-                      decoderChunk.bytes = wire_chnk.size;
-                      while (!decoderChunk.inData) {
-                        decoderChunk.inData =
-                            (uint8_t *)malloc(decoderChunk.bytes);
-                        if (!decoderChunk.inData) {
-                          ESP_LOGW(TAG,
-                                   "malloc decoderChunk.inData failed, wait "
-                                   "1ms and try again");
+/**
+ * Start the decoders over for the codec header they were set up for, without
+ * reallocating them or parsing FLAC metadata again.
+ */
+static void codec_session_restart(streamCtx_t *stream) {
+  decodeFormat_t *fmt = &stream->fmt;
+
+  fmt->codec = codecSession.codec;
+  fmt->sr = codecSession.sr;
+  fmt->ch = codecSession.ch;
+  fmt->bits = codecSession.bits;
+  stream->pcmBits = codecSession.pcmBits;
+
+  if ((stream->codec == FLAC) && (flacDecoder != NULL)) {
+    // the stream continues after the metadata, with position 0 for the
+    // first frame
+    FLAC__stream_decoder_flush(flacDecoder);
+    chunk_cursor_reset(&flacInput);
+  } else if ((stream->codec == OPUS) && (opusDecoder != NULL)) {
+    opus_multistream_decoder_ctl(opusDecoder, OPUS_RESET_STATE);
+#if CONFIG_SNAPCLIENT_USE_OGG
+  } else if (stream->codec == OGG) {
+    ogg_session_restart();
+
+    if (oggSession.vorbisInit) {
+      fmt->chkInFrames = oggSession.chunkFrames;
+    }
+#endif
+  }
+}
 
-                          vTaskDelay(pdMS_TO_TICKS(1));
-                        }
-                      }
+/**
+ * Check a wire chunk against the player's playout position before spending
+ * time on it. Waiting for reception, the decode queue or the compressed
+ * buffer may have made it too late to be played, the player would only drop
+ * it after decoding.
+ */
+static bool stream_skip_late(streamCtx_t *stream, tv_t timestamp) {
+  // compressed chunks are estimated by the last decoded one
+  if (!player_skip_late_chunk(timestamp, stream->fmt.chkInFrames)) {
+    if (stream->lateRun > 0) {
+      ESP_LOGW(TAG, "skipped %lu late chunks, %lu since start",
+               stream->lateRun, player_get_skipped_chunks());
+
+      stream->lateRun = 0;
+    }
 
-                      payloadOffset = 0;
+    return false;
+  }
 
-#if 0
-                       ESP_LOGI(TAG, "chunk with size: %u, at time %ld.%ld",
-                    		   	   	   	   	 wire_chnk.size,
-                                             wire_chnk.timestamp.sec,
-                                             wire_chnk.timestamp.usec);
-#endif
-
-                      if (len == 0) {
-                        break;
-                      }
-                    }
-
-                    case 12: {
-                      size_t tmp_size;
-
-                      if ((base_message_rx.size - typedMsgCurrentPos) <= len) {
-                        tmp_size = base_message_rx.size - typedMsgCurrentPos;
-                      } else {
-                        tmp_size = len;
-                      }
-
-                      if (received_header == true) {
-                        switch (codec) {
-                          case OPUS:
-                          case FLAC: {
-                            memcpy(&decoderChunk.inData[payloadOffset], start,
-                                   tmp_size);
-                            payloadOffset += tmp_size;
-                            decoderChunk.outData = NULL;
-                            decoderChunk.type = SNAPCAST_MESSAGE_WIRE_CHUNK;
-
-                            break;
-                          }
-
-                          case PCM: {
-                            size_t _tmp = tmp_size;
-
-                            offset = 0;
-
-                            if (pcmData == NULL) {
-                              if (allocate_pcm_chunk_memory(
-                                      &pcmData, wire_chnk.size) < 0) {
-                                pcmData = NULL;
-                              }
-
-                              tmpData = 0;
-                              payloadDataShift = 3;
-                              payloadOffset = 0;
-                            }
-
-                            while (_tmp--) {
-                              tmpData |= ((uint32_t)start[offset++]
-                                          << (8 * payloadDataShift));
-
-                              payloadDataShift--;
-                              if (payloadDataShift < 0) {
-                                payloadDataShift = 3;
-
-                                if ((pcmData) && (pcmData->fragment->payload)) {
-                                  volatile uint32_t *sample;
-                                  uint8_t dummy1;
-                                  uint32_t dummy2 = 0;
-
-                                  // TODO: find a more
-                                  // clever way to do this,
-                                  // best would be to
-                                  // actually store it the
-                                  // right way in the first
-                                  // place
-                                  dummy1 = tmpData >> 24;
-                                  dummy2 |= (uint32_t)dummy1 << 16;
-                                  dummy1 = tmpData >> 16;
-                                  dummy2 |= (uint32_t)dummy1 << 24;
-                                  dummy1 = tmpData >> 8;
-                                  dummy2 |= (uint32_t)dummy1 << 0;
-                                  dummy1 = tmpData >> 0;
-                                  dummy2 |= (uint32_t)dummy1 << 8;
-                                  tmpData = dummy2;
-
-                                  sample = (volatile uint32_t *)(&(
-                                      pcmData->fragment
-                                          ->payload[payloadOffset]));
-                                  *sample = (volatile uint32_t)tmpData;
-
-                                  payloadOffset += 4;
-                                }
-
-                                tmpData = 0;
-                              }
-                            }
-
-                            break;
-                          }
-
-                          default: {
-                            ESP_LOGE(TAG, "Decoder (1) not supported");
-
-                            return;
-
-                            break;
-                          }
-                        }
-                      }
-
-                      typedMsgCurrentPos += tmp_size;
-                      start += tmp_size;
-                      // currentPos += tmp_size;
-                      len -= tmp_size;
-
-                      if (typedMsgCurrentPos >= base_message_rx.size) {
-                        if (received_header == true) {
-                          switch (codec) {
-                            case OPUS: {
-                              int frame_size = -1;
-                              int samples_per_frame;
-                              opus_int16 *audio = NULL;
-
-                              samples_per_frame =
-                                  opus_packet_get_samples_per_frame(
-                                      decoderChunk.inData, scSet.sr);
-                              if (samples_per_frame < 0) {
-                                ESP_LOGE(TAG,
-                                         "couldn't get samples per frame count "
-                                         "of packet");
-                              }
-
-                              scSet.chkInFrames = samples_per_frame;
-
-                              // ESP_LOGW(TAG, "%d, %llu, %llu",
-                              // samples_per_frame, 1000000ULL *
-                              // samples_per_frame / scSet.sr,
-                              // 1000000ULL *
-                              // wire_chnk.timestamp.sec +
-                              // wire_chnk.timestamp.usec);
-
-                              // ESP_LOGW(TAG, "got OPUS decoded chunk size: %ld
-                              // " "frames from encoded chunk with size %d,
-                              // allocated audio buffer %d", scSet.chkInFrames,
-                              // wire_chnk.size, samples_per_frame);
-
-                              size_t bytes;
-                              do {
-                                bytes = samples_per_frame *
-                                        (scSet.ch * scSet.bits >> 3);
-
-                                while ((audio = (opus_int16 *)realloc(
-                                            audio, bytes)) == NULL) {
-                                  ESP_LOGE(TAG,
-                                           "couldn't realloc memory for OPUS "
-                                           "audio %d",
-                                           bytes);
-
-                                  vTaskDelay(pdMS_TO_TICKS(1));
-                                }
-
-                                frame_size = opus_decode(
-                                    opusDecoder, decoderChunk.inData,
-                                    decoderChunk.bytes, (opus_int16 *)audio,
-                                    samples_per_frame, 0);
-
-                                samples_per_frame <<= 1;
-                              } while (frame_size < 0);
-
-                              free(decoderChunk.inData);
-                              decoderChunk.inData = NULL;
-
-                              pcm_chunk_message_t *new_pcmChunk = NULL;
-
-                              // ESP_LOGW(TAG, "OPUS decode: %d", frame_size);
-
-                              if (allocate_pcm_chunk_memory(&new_pcmChunk,
-                                                            bytes) < 0) {
-                                pcmData = NULL;
-                              } else {
-                                new_pcmChunk->timestamp = wire_chnk.timestamp;
-
-                                if (new_pcmChunk->fragment->payload) {
-                                  volatile uint32_t *sample;
-                                  uint32_t tmpData;
-                                  uint32_t cnt = 0;
-
-                                  for (int i = 0; i < bytes; i += 4) {
-                                    sample = (volatile uint32_t *)(&(
-                                        new_pcmChunk->fragment->payload[i]));
-                                    tmpData = (((uint32_t)audio[cnt] << 16) &
-                                               0xFFFF0000) |
-                                              (((uint32_t)audio[cnt + 1] << 0) &
-                                               0x0000FFFF);
-                                    *sample = (volatile uint32_t)tmpData;
-
-                                    cnt += 2;
-                                  }
-                                }
-
-                                free(audio);
-                                audio = NULL;
+  if (stream->lateRun == 0) {
+    ESP_LOGW(TAG, "chunks are late, skipping them undecoded");
+  }
 
-#if CONFIG_USE_DSP_PROCESSOR
-                                if (new_pcmChunk->fragment->payload) {
-                                  dsp_processor_worker(
-                                      new_pcmChunk->fragment->payload,
-                                      new_pcmChunk->fragment->size, scSet.sr);
-                                }
-#endif
-
-                                insert_pcm_chunk(new_pcmChunk);
-                              }
-
-                              if (player_send_snapcast_setting(&scSet) !=
-                                  pdPASS) {
-                                ESP_LOGE(TAG,
-                                         "Failed to notify "
-                                         "sync task about "
-                                         "codec. Did you "
-                                         "init player?");
-
-                                return;
-                              }
-
-                              break;
-                            }
-
-                            case FLAC: {
-                              isCachedChunk = true;
-                              cachedBlocks = 0;
-
-                              while (decoderChunk.bytes > 0) {
-                                if (FLAC__stream_decoder_process_single(
-                                        flacDecoder) == 0) {
-                                  ESP_LOGE(
-                                      TAG,
-                                      "%s: FLAC__stream_decoder_process_single "
-                                      "failed",
-                                      __func__);
-
-                                  // TODO: should insert some abort condition?
-                                  vTaskDelay(pdMS_TO_TICKS(10));
-                                }
-                              }
-
-                              // alternating chunk sizes need time stamp repair
-                              if ((cachedBlocks > 0) && (scSet.sr != 0)) {
-                                uint64_t diffUs =
-                                    1000000ULL * cachedBlocks / scSet.sr;
-
-                                uint64_t timestamp =
-                                    1000000ULL * wire_chnk.timestamp.sec +
-                                    wire_chnk.timestamp.usec;
-
-                                timestamp = timestamp - diffUs;
-
-                                wire_chnk.timestamp.sec =
-                                    timestamp / 1000000ULL;
-                                wire_chnk.timestamp.usec =
-                                    timestamp % 1000000ULL;
-                              }
-
-                              pcm_chunk_message_t *new_pcmChunk;
-                              int32_t ret = allocate_pcm_chunk_memory(
-                                  &new_pcmChunk, pcmChunk.bytes);
-
-                              scSet.chkInFrames =
-                                  FLAC__stream_decoder_get_blocksize(
-                                      flacDecoder);
-
-                              // ESP_LOGE (TAG, "block size: %ld",
-                              // scSet.chkInFrames * scSet.bits / 8 * scSet.ch);
-                              // ESP_LOGI(TAG, "new_pcmChunk with size %ld",
-                              // new_pcmChunk->totalSize);
-
-                              if (ret == 0) {
-                                pcm_chunk_fragment_t *fragment =
-                                    new_pcmChunk->fragment;
-                                uint32_t fragmentCnt = 0;
-
-                                if (fragment->payload != NULL) {
-                                  uint32_t frames =
-                                      pcmChunk.bytes /
-                                      (scSet.ch * (scSet.bits / 8));
-
-                                  for (int i = 0; i < frames; i++) {
-                                    // TODO: for now fragmented payload is not
-                                    // supported and the whole chunk is expected
-                                    // to be in the first fragment
-                                    uint32_t tmpData;
-                                    memcpy(&tmpData,
-                                           &pcmChunk.outData[fragmentCnt],
-                                           (scSet.ch * (scSet.bits / 8)));
-
-                                    if (fragment != NULL) {
-                                      volatile uint32_t *test =
-                                          (volatile uint32_t *)(&(
-                                              fragment->payload[fragmentCnt]));
-                                      *test = (volatile uint32_t)tmpData;
-                                    }
-
-                                    fragmentCnt +=
-                                        (scSet.ch * (scSet.bits / 8));
-                                    if (fragmentCnt >= fragment->size) {
-                                      fragmentCnt = 0;
-
-                                      fragment = fragment->nextFragment;
-                                    }
-                                  }
-                                }
-
-                                new_pcmChunk->timestamp = wire_chnk.timestamp;
+  stream->lateRun++;
+  stream->decoderGap = true;
 
-#if CONFIG_USE_DSP_PROCESSOR
-                                if (new_pcmChunk->fragment->payload) {
-                                  dsp_processor_worker(
-                                      new_pcmChunk->fragment->payload,
-                                      new_pcmChunk->fragment->size, scSet.sr);
-                                }
+  return true;
+}
 
+/**
+ * Chunks were skipped, the next one doesn't continue the last decoded. Drop
+ * what the decoders buffered or predict from it.
+ */
+static void stream_decoder_resync(streamCtx_t *stream) {
+  stream->decoderGap = false;
+
+  if ((stream->codec == FLAC) && (flacDecoder != NULL)) {
+    // a partial frame would be completed with bytes of the next chunk
+    FLAC__stream_decoder_flush(flacDecoder);
+    chunk_cursor_sync(&flacInput, chunk_cursor_tell(&flacInput));
+  } else if ((stream->codec == OPUS) && (opusDecoder != NULL)) {
+    opus_multistream_decoder_ctl(opusDecoder, OPUS_RESET_STATE);
+#if CONFIG_SNAPCLIENT_USE_OGG
+  } else if (stream->codec == OGG) {
+    // a page continued from a skipped one is dropped by the demuxer
+    ogg_session_restart();
 #endif
+  }
+}
+
+/**
+ * Decode an Opus packet into a player chunk.
+ *
+ * @return Count of frames decoded, -1 on error.
+ */
+static int stream_opus_packet(streamCtx_t *stream,
+                              const unsigned char *packet, uint32_t packetLen,
+                              tv_t timestamp) {
+  decodeFormat_t *fmt = &stream->fmt;
+  pcm_chunk_message_t *new_pcmChunk = NULL;
+  int frames;
+
+  // all frames of the packet, not just the first one
+  frames = opus_packet_get_nb_samples(packet, packetLen, fmt->sr);
+  if (frames <= 0) {
+    ESP_LOGE(TAG, "couldn't get sample count of packet: %d", frames);
+
+    return -1;
+  }
+
+  // only packets longer than any before need a bigger buffer
+  if (frames > opusPcmFrames) {
+    opus_int16 *pcm = (opus_int16 *)realloc(
+        opusPcm, frames * opusMapping.channels * sizeof(opus_int16));
+
+    if (pcm == NULL) {
+      ESP_LOGE(TAG, "couldn't realloc memory for OPUS audio %d", frames);
+
+      return -1;
+    }
+
+    opusPcm = pcm;
+    opusPcmFrames = frames;
+  }
 
-                                insert_pcm_chunk(new_pcmChunk);
-                              }
+  frames = opus_multistream_decode(opusDecoder, packet, packetLen, opusPcm,
+                                   frames, 0);
+  if (frames < 0) {
+    ESP_LOGE(TAG, "OPUS decode: %s", opus_strerror(frames));
 
-                              free(pcmChunk.outData);
-                              pcmChunk.outData = NULL;
-                              pcmChunk.bytes = 0;
+    return -1;
+  }
+
+  fmt->chkInFrames = frames;
 
-                              if (player_send_snapcast_setting(&scSet) !=
-                                  pdPASS) {
-                                ESP_LOGE(TAG,
-                                         "Failed to "
-                                         "notify "
-                                         "sync task "
-                                         "about "
-                                         "codec. Did you "
-                                         "init player?");
+  if (allocate_pcm_chunk_memory(&new_pcmChunk,
+                                frames * (fmt->ch * fmt->bits >> 3)) < 0) {
+    stream->pcmData = NULL;
+  } else {
+    new_pcmChunk->timestamp = timestamp;
 
-                                return;
-                              }
+    pcm_pack_chunk_s16_routed(new_pcmChunk, 0, opusPcm, opusMapping.channels,
+                              opusRoute[0], opusRoute[1], frames);
 
-                              break;
-                            }
+#if CONFIG_USE_DSP_PROCESSOR
+    if (new_pcmChunk->fragment->payload) {
+      dsp_processor_worker(new_pcmChunk->fragment->payload,
+                           new_pcmChunk->fragment->size, fmt->sr, fmt->bits);
+    }
+#endif
 
-                            case PCM: {
-                              size_t decodedSize = wire_chnk.size;
+    insert_pcm_chunk(new_pcmChunk);
+  }
 
-                              // ESP_LOGW(TAG, "got PCM chunk,"
-                              //               "typedMsgCurrentPos %d",
-                              //               typedMsgCurrentPos);
+  return frames;
+}
 
-                              if (pcmData) {
-                                pcmData->timestamp = wire_chnk.timestamp;
-                              }
+#if CONFIG_SNAPCLIENT_USE_OGG
+/**
+ * Decode a Vorbis packet, the frames it completes go to a player chunk. The
+ * first packet after a restart completes none, it is only overlapped with
+ * the next one.
+ *
+ * @return Count of frames decoded, -1 on error.
+ */
+static int stream_vorbis_packet(streamCtx_t *stream, ogg_packet *packet,
+                                tv_t timestamp) {
+  decodeFormat_t *fmt = &stream->fmt;
+  pcm_chunk_message_t *chunk;
+  ogg_int32_t **pcm;
+  int frames;
+  int ret;
+
+  ret = vorbis_synthesis(&oggSession.block, packet);
+  if (ret != 0) {
+    ESP_LOGW(TAG, "Vorbis packet not decoded: %d", ret);
+
+    return -1;
+  }
 
-                              scSet.chkInFrames =
-                                  decodedSize /
-                                  ((size_t)scSet.ch * (size_t)(scSet.bits / 8));
+  vorbis_synthesis_blockin(&oggSession.dsp, &oggSession.block);
 
-                              // ESP_LOGW(TAG,
-                              //          "got PCM decoded chunk size: %ld
-                              //          frames", scSet.chkInFrames);
+  // decoded in place in the decoder's buffers, no copy until packed
+  frames = vorbis_synthesis_pcmout(&oggSession.dsp, &pcm);
+  if (frames <= 0) {
+    return 0;
+  }
 
-                              if (player_send_snapcast_setting(&scSet) !=
-                                  pdPASS) {
-                                ESP_LOGE(TAG,
-                                         "Failed to notify "
-                                         "sync task about "
-                                         "codec. Did you "
-                                         "init player?");
+  if (allocate_pcm_chunk_memory(&chunk,
+                                frames * (fmt->ch * fmt->bits >> 3)) < 0) {
+    ESP_LOGE(TAG, "%s, failed to allocate PCM chunk", __func__);
+  } else {
+    chunk->timestamp = timestamp;
 
-                                return;
-                              }
+    pcm_pack_chunk_fixed_s16_stereo(chunk, 0, pcm[0], pcm[1], frames,
+                                    VORBIS_FRACTION_BITS);
 
 #if CONFIG_USE_DSP_PROCESSOR
-                              if ((pcmData) && (pcmData->fragment->payload)) {
-                                dsp_processor_worker(pcmData->fragment->payload,
-                                                     pcmData->fragment->size,
-                                                     scSet.sr);
-                              }
+    if (chunk->fragment->payload) {
+      dsp_processor_worker(chunk->fragment->payload, chunk->fragment->size,
+                           fmt->sr, fmt->bits);
+    }
 #endif
 
-                              if (pcmData) {
-                                insert_pcm_chunk(pcmData);
-                              }
+    insert_pcm_chunk(chunk);
+  }
+
+  // the frames are gone even if they couldn't be played
+  vorbis_synthesis_read(&oggSession.dsp, frames);
+
+  return frames;
+}
+
+/**
+ * Demux the Ogg pages of a wire chunk and decode their packets. The chunk's
+ * time stamp is the one of the first frame decoded from it, the frames of
+ * later packets follow seamlessly.
+ */
+static void stream_decode_ogg(streamCtx_t *stream, sg_chain_t *input,
+                              tv_t timestamp) {
+  int64_t ts = tv_to_us(&timestamp);
+  uint32_t frames = 0;  // decoded from the chunk so far
+  sg_cursor_t cursor;
+  ogg_page page;
+  ogg_packet packet;
+  char *buffer;
+  int ret;
+
+  // a page is only complete once all of it is in sync's buffer
+  buffer = ogg_sync_buffer(&oggSession.sync, input->len);
+  if (buffer == NULL) {
+    ESP_LOGE(TAG, "couldn't get Ogg buffer for %ld bytes", input->len);
+
+    return;
+  }
 
-                              pcmData = NULL;
+  sg_cursor_init(&cursor, input);
+  ogg_sync_wrote(&oggSession.sync,
+                 sg_cursor_read(&cursor, buffer, input->len));
 
-                              free(decoderChunk.inData);
-                              decoderChunk.inData = NULL;
+  while ((ret = ogg_sync_pageout(&oggSession.sync, &page)) != 0) {
+    if (ret < 0) {
+      ESP_LOGW(TAG, "%s: skipped bytes to the next Ogg page", __func__);
 
-                              break;
-                            }
+      continue;
+    }
 
-                            default: {
-                              ESP_LOGE(TAG,
-                                       "Decoder (2) not "
-                                       "supported");
+    if (ogg_stream_pagein(&oggSession.stream, &page) < 0) {
+      ESP_LOGW(TAG, "%s: page of another Ogg stream", __func__);
 
-                              return;
+      continue;
+    }
 
-                              break;
-                            }
-                          }
-                        }
+    // -1 marks a gap of lost pages, the decoder simply goes on
+    while ((ret = ogg_stream_packetout(&oggSession.stream, &packet)) != 0) {
+      tv_t packetTime =
+          us_to_tv(ts + (int64_t)frames * 1000000LL / stream->fmt.sr);
 
-                        state = BASE_MESSAGE_STATE;
-                        internalState = 0;
+      if (ret < 0) {
+        continue;
+      }
 
-                        typedMsgCurrentPos = 0;
-                      }
+      if (oggSession.opus) {
+        // a resent OpusTags isn't audio
+        if ((packet.bytes >= 8) &&
+            (memcmp(packet.packet, "OpusTags", 8) == 0)) {
+          continue;
+        }
 
-                      break;
-                    }
+        ret = stream_opus_packet(stream, packet.packet, packet.bytes,
+                                 packetTime);
+      } else {
+        ret = stream_vorbis_packet(stream, &packet, packetTime);
+      }
 
-                    default: {
-                      ESP_LOGE(TAG,
-                               "wire chunk decoder "
-                               "shouldn't get here");
+      if (ret > 0) {
+        frames += ret;
+      }
+    }
+  }
+}
+#endif
 
-                      break;
-                    }
-                  }
+/**
+ * Decode the compressed wire chunk in input and pass it to the player. input
+ * is released afterwards.
+ */
+static int stream_decode_chunk(streamCtx_t *stream, sg_chain_t *input,
+                               tv_t timestamp) {
+  decodeFormat_t *fmt = &stream->fmt;
+  int64_t decodeStart = esp_timer_get_time();
 
-                  break;
-                }
+  if (stream_skip_late(stream, timestamp)) {
+    sg_chain_release(input);
 
-                case SNAPCAST_MESSAGE_CODEC_HEADER: {
-                  switch (internalState) {
-                    case 0: {
-                      typedMsgLen = *start & 0xFF;
+    return 0;
+  }
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
+  if (stream->decoderGap) {
+    stream_decoder_resync(stream);
+  }
 
-                      internalState++;
+  switch (stream->codec) {
+    case OPUS: {
+      const unsigned char *packet;
+      uint32_t packetLen = input->len;
+      int frames;
 
-                      if (len == 0) {
-                        break;
-                      }
-                    }
+      // opus_decode() needs the packet in one piece
+      if ((input->count > 1) && (opusPacketSize < packetLen)) {
+        char *buf = (char *)realloc(opusPacket, packetLen);
 
-                    case 1: {
-                      typedMsgLen |= (*start & 0xFF) << 8;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
+        if (buf == NULL) {
+          // the old buffer is kept for smaller packets
+          ESP_LOGE(TAG, "couldn't realloc memory for OPUS packet %lu",
+                   packetLen);
 
-                      internalState++;
+          sg_chain_release(input);
 
-                      if (len == 0) {
-                        break;
-                      }
-                    }
+          break;
+        }
 
-                    case 2: {
-                      typedMsgLen |= (*start & 0xFF) << 16;
+        opusPacket = buf;
+        opusPacketSize = packetLen;
+      }
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
+      packet = (const unsigned char *)sg_chain_linearize(input, opusPacket,
+                                                         opusPacketSize);
+      if (packet == NULL) {
+        ESP_LOGE(TAG, "empty OPUS packet");
 
-                      internalState++;
+        sg_chain_release(input);
 
-                      if (len == 0) {
-                        break;
-                      }
-                    }
+        break;
+      }
 
-                    case 3: {
-                      typedMsgLen |= (*start & 0xFF) << 24;
+      frames = stream_opus_packet(stream, packet, packetLen, timestamp);
 
-                      codecString =
-                          malloc(typedMsgLen + 1);  // allocate memory for
-                                                    // codec string
-                      if (codecString == NULL) {
-                        ESP_LOGE(TAG,
-                                 "couldn't get memory "
-                                 "for codec string");
+      sg_chain_release(input);
 
-                        return;
-                      }
+      if (frames < 0) {
+        break;
+      }
 
-                      offset = 0;
-                      // ESP_LOGI(TAG,
-                      // "codec header string is %d long",
-                      // typedMsgLen);
+      if (stream_send_setting(stream) != pdPASS) {
+        ESP_LOGE(TAG,
+                 "Failed to notify "
+                 "sync task about "
+                 "codec. Did you "
+                 "init player?");
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
+        stream->fatal = true;
 
-                      internalState++;
-
-                      if (len == 0) {
-                        break;
-                      }
-                    }
+        return -1;
+      }
 
-                    case 4: {
-                      if (len >= typedMsgLen) {
-                        memcpy(&codecString[offset], start, typedMsgLen);
+      break;
+    }
 
-                        offset += typedMsgLen;
+#if CONFIG_SNAPCLIENT_USE_OGG
+    case OGG: {
+      stream_decode_ogg(stream, input, timestamp);
 
-                        typedMsgCurrentPos += typedMsgLen;
-                        start += typedMsgLen;
-                        // currentPos += typedMsgLen;
-                        len -= typedMsgLen;
-                      } else {
-                        memcpy(&codecString[offset], start, typedMsgLen);
-
-                        offset += len;
-
-                        typedMsgCurrentPos += len;
-                        start += len;
-                        // currentPos += len;
-                        len -= len;
-                      }
-
-                      if (offset == typedMsgLen) {
-                        // NULL terminate string
-                        codecString[typedMsgLen] = 0;
+      sg_chain_release(input);
 
-                        // ESP_LOGI (TAG, "got codec string: %s", tmp);
+      if (stream_send_setting(stream) != pdPASS) {
+        ESP_LOGE(TAG,
+                 "Failed to notify sync task about codec. Did you init "
+                 "player?");
 
-                        if (strcmp(codecString, "opus") == 0) {
-                          codec = OPUS;
-                        } else if (strcmp(codecString, "flac") == 0) {
-                          codec = FLAC;
-                        } else if (strcmp(codecString, "pcm") == 0) {
-                          codec = PCM;
-                        } else {
-                          codec = NONE;
+        stream->fatal = true;
 
-                          ESP_LOGI(TAG, "Codec : %s not supported",
-                                   codecString);
-                          ESP_LOGI(TAG,
-                                   "Change encoder codec to "
-                                   "opus, flac or pcm in "
-                                   "/etc/snapserver.conf on "
-                                   "server");
-
-                          return;
-                        }
+        return -1;
+      }
 
-                        free(codecString);
-                        codecString = NULL;
-
-                        internalState++;
-                      }
-
-                      if (len == 0) {
-                        break;
-                      }
-                    }
-
-                    case 5: {
-                      typedMsgLen = *start & 0xFF;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      if (len == 0) {
-                        break;
-                      }
-                    }
-
-                    case 6: {
-                      typedMsgLen |= (*start & 0xFF) << 8;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      if (len == 0) {
-                        break;
-                      }
-                    }
-
-                    case 7: {
-                      typedMsgLen |= (*start & 0xFF) << 16;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      if (len == 0) {
-                        break;
-                      }
-                    }
-
-                    case 8: {
-                      typedMsgLen |= (*start & 0xFF) << 24;
-
-                      codecPayload = malloc(typedMsgLen);  // allocate memory
-                                                           // for codec payload
-                      if (codecPayload == NULL) {
-                        ESP_LOGE(TAG,
-                                 "couldn't get memory "
-                                 "for codec payload");
-
-                        return;
-                      }
-
-                      offset = 0;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      if (len == 0) {
-                        break;
-                      }
-                    }
-
-                    case 9: {
-                      if (len >= typedMsgLen) {
-                        memcpy(&codecPayload[offset], start, typedMsgLen);
-
-                        offset += typedMsgLen;
-
-                        typedMsgCurrentPos += typedMsgLen;
-                        start += typedMsgLen;
-                        // currentPos += typedMsgLen;
-                        len -= typedMsgLen;
-                      } else {
-                        memcpy(&codecPayload[offset], start, len);
-
-                        offset += len;
-
-                        typedMsgCurrentPos += len;
-                        start += len;
-                        // currentPos += len;
-                        len -= len;
-                      }
-
-                      if (offset == typedMsgLen) {
-                        // first ensure everything is set up
-                        // correctly and resources are
-                        // available
-
-                        if (flacDecoder != NULL) {
-                          FLAC__stream_decoder_finish(flacDecoder);
-                          FLAC__stream_decoder_delete(flacDecoder);
-                          flacDecoder = NULL;
-                        }
-
-                        if (opusDecoder != NULL) {
-                          opus_decoder_destroy(opusDecoder);
-                          opusDecoder = NULL;
-                        }
-
-                        if (codec == OPUS) {
-                          uint16_t channels;
-                          uint32_t rate;
-                          uint16_t bits;
-
-                          memcpy(&rate, codecPayload + 4, sizeof(rate));
-                          memcpy(&bits, codecPayload + 8, sizeof(bits));
-                          memcpy(&channels, codecPayload + 10,
-                                 sizeof(channels));
-
-                          scSet.codec = codec;
-                          scSet.bits = bits;
-                          scSet.ch = channels;
-                          scSet.sr = rate;
-
-                          ESP_LOGI(TAG, "Opus sample format: %ld:%d:%d\n", rate,
-                                   bits, channels);
-
-                          int error = 0;
-
-                          opusDecoder =
-                              opus_decoder_create(scSet.sr, scSet.ch, &error);
-                          if (error != 0) {
-                            ESP_LOGI(TAG, "Failed to init opus coder");
-                            return;
-                          }
-
-                          ESP_LOGI(TAG, "Initialized opus Decoder: %d", error);
-                        } else if (codec == FLAC) {
-                          decoderChunk.bytes = typedMsgLen;
-                          decoderChunk.inData =
-                              (uint8_t *)malloc(decoderChunk.bytes);
-                          memcpy(decoderChunk.inData, codecPayload,
-                                 typedMsgLen);
-                          decoderChunk.outData = NULL;
-                          decoderChunk.type = SNAPCAST_MESSAGE_CODEC_HEADER;
-
-                          flacDecoder = FLAC__stream_decoder_new();
-                          if (flacDecoder == NULL) {
-                            ESP_LOGE(TAG, "Failed to init flac decoder");
-                            return;
-                          }
-
-                          FLAC__StreamDecoderInitStatus init_status =
-                              FLAC__stream_decoder_init_stream(
-                                  flacDecoder, read_callback, NULL, NULL, NULL,
-                                  NULL, write_callback, metadata_callback,
-                                  error_callback, &scSet);
-                          if (init_status !=
-                              FLAC__STREAM_DECODER_INIT_STATUS_OK) {
-                            ESP_LOGE(TAG, "ERROR: initializing decoder: %s\n",
-                                     FLAC__StreamDecoderInitStatusString
-                                         [init_status]);
-
-                            return;
-                          }
-
-                          FLAC__stream_decoder_process_until_end_of_metadata(
-                              flacDecoder);
-
-                          // ESP_LOGI(TAG, "%s: processed codec header",
-                          // __func__);
-                        } else if (codec == PCM) {
-                          uint16_t channels;
-                          uint32_t rate;
-                          uint16_t bits;
-
-                          memcpy(&channels, codecPayload + 22,
-                                 sizeof(channels));
-                          memcpy(&rate, codecPayload + 24, sizeof(rate));
-                          memcpy(&bits, codecPayload + 34, sizeof(bits));
-
-                          scSet.codec = codec;
-                          scSet.bits = bits;
-                          scSet.ch = channels;
-                          scSet.sr = rate;
-
-                          ESP_LOGI(TAG, "pcm sampleformat: %ld:%d:%d", scSet.sr,
-                                   scSet.bits, scSet.ch);
-                        } else {
-                          ESP_LOGE(TAG,
-                                   "codec header decoder "
-                                   "shouldn't get here after "
-                                   "codec string was detected");
-
-                          return;
-                        }
-
-                        free(codecPayload);
-                        codecPayload = NULL;
-
-                        if (player_send_snapcast_setting(&scSet) != pdPASS) {
-                          ESP_LOGE(TAG,
-                                   "Failed to notify sync task. "
-                                   "Did you init player?");
-
-                          return;
-                        }
-
-                        // ESP_LOGI(TAG, "done codec header msg");
-
-                        state = BASE_MESSAGE_STATE;
-                        internalState = 0;
-
-                        received_header = true;
-                        esp_timer_stop(timeSyncMessageTimer);
-                        if (!esp_timer_is_active(timeSyncMessageTimer)) {
-                          esp_timer_start_periodic(timeSyncMessageTimer,
-                                                   timeout);
-                        }
-                      }
-
-                      break;
-                    }
-
-                    default: {
-                      ESP_LOGE(TAG,
-                               "codec header decoder "
-                               "shouldn't get here");
-
-                      break;
-                    }
-                  }
-
-                  break;
-                }
-
-                case SNAPCAST_MESSAGE_SERVER_SETTINGS: {
-                  switch (internalState) {
-                    case 0: {
-                      typedMsgLen = *start & 0xFF;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      if (len == 0) {
-                        break;
-                      }
-                    }
-
-                    case 1: {
-                      typedMsgLen |= (*start & 0xFF) << 8;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      if (len == 0) {
-                        break;
-                      }
-                    }
-
-                    case 2: {
-                      typedMsgLen |= (*start & 0xFF) << 16;
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      if (len == 0) {
-                        break;
-                      }
-                    }
-
-                    case 3: {
-                      typedMsgLen |= (*start & 0xFF) << 24;
-
-                      // ESP_LOGI(TAG,"server settings string is %lu"
-                      //              " long", typedMsgLen);
-
-                      // now get some memory for server settings
-                      // string
-                      serverSettingsString = malloc(typedMsgLen + 1);
-                      if (serverSettingsString == NULL) {
-                        ESP_LOGE(TAG,
-                                 "couldn't get memory for "
-                                 "server settings string");
-                      }
-
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      offset = 0;
-
-                      if (len == 0) {
-                        break;
-                      }
-                    }
-
-                    case 4: {
-                      size_t tmpSize =
-                          base_message_rx.size - typedMsgCurrentPos;
-
-                      if (len > 0) {
-                        if (tmpSize < len) {
-                          if (serverSettingsString) {
-                            memcpy(&serverSettingsString[offset], start,
-                                   tmpSize);
-                          }
-                          offset += tmpSize;
-
-                          start += tmpSize;
-                          // currentPos += tmpSize;  // will be
-                          //  incremented by 1
-                          //  later so -1 here
-                          typedMsgCurrentPos += tmpSize;
-                          len -= tmpSize;
-                        } else {
-                          if (serverSettingsString) {
-                            memcpy(&serverSettingsString[offset], start, len);
-                          }
-                          offset += len;
-
-                          start += len;
-                          // currentPos += len;  // will be incremented
-                          //  by 1 later so -1
-                          //  here
-                          typedMsgCurrentPos += len;
-                          len = 0;
-                        }
-                      }
-
-                      if (typedMsgCurrentPos >= base_message_rx.size) {
-                        if (serverSettingsString) {
-                          // ESP_LOGI(TAG, "done server settings %lu/%lu",
-                          //								offset,
-                          //								typedMsgLen);
-
-                          // NULL terminate string
-                          serverSettingsString[typedMsgLen] = 0;
-
-                          // ESP_LOGI(TAG, "got string: %s",
-                          // serverSettingsString);
-
-                          result = server_settings_message_deserialize(
-                              &server_settings_message, serverSettingsString);
-                          if (result) {
-                            ESP_LOGE(TAG,
-                                     "Failed to read server "
-                                     "settings: %d",
-                                     result);
-                          } else {
-                            // log mute state, buffer, latency
-                            ESP_LOGI(TAG, "Buffer length:  %ld",
-                                     server_settings_message.buffer_ms);
-                            ESP_LOGI(TAG, "Latency:        %ld",
-                                     server_settings_message.latency);
-                            ESP_LOGI(TAG, "Mute:           %d",
-                                     server_settings_message.muted);
-                            ESP_LOGI(TAG, "Setting volume: %ld",
-                                     server_settings_message.volume);
-                          }
-
-                          // Volume setting using ADF HAL
-                          // abstraction
-                          if (scSet.muted != server_settings_message.muted) {
-#if SNAPCAST_USE_SOFT_VOL
-                            if (server_settings_message.muted) {
-                              dsp_processor_set_volome(0.0);
-                            } else {
-                              dsp_processor_set_volome(
-                                  (double)server_settings_message.volume / 100);
-                            }
+      break;
+    }
 #endif
-                            audio_set_mute(server_settings_message.muted);
-                          }
 
-                          if (scSet.volume != server_settings_message.volume) {
-#if SNAPCAST_USE_SOFT_VOL
-                            if (!server_settings_message.muted) {
-                              dsp_processor_set_volome(
-                                  (double)server_settings_message.volume / 100);
-                            }
-#else
-                            audio_set_volume(server_settings_message.volume);
-#endif
-                          }
+    case FLAC: {
+      // the chunk is read in place, frames are inserted from write_callback()
+      if (chunk_cursor_push(&flacInput, input, tv_to_us(&timestamp)) < 0) {
+        ESP_LOGW(TAG, "%s: dropped time stamp of undecoded chunk", __func__);
+      }
+
+      while (chunk_cursor_remaining(&flacInput) > 0) {
+        FLAC__bool ok = FLAC__stream_decoder_process_single(flacDecoder);
+        FLAC__StreamDecoderState state =
+            FLAC__stream_decoder_get_state(flacDecoder);
+
+        // read_callback() ends the stream if the chunk runs out in the middle
+        // of a frame or of the search for one. libFLAC returns true without
+        // reading anything in that state, as when aborted, until flushed.
+        // Drop the rest of the chunk and carry on with the next one.
+        if (ok && (state != FLAC__STREAM_DECODER_END_OF_STREAM) &&
+            (state != FLAC__STREAM_DECODER_ABORTED)) {
+          continue;
+        }
+
+        stream->decodeErrors++;
+
+        ESP_LOGE(TAG, "%s: FLAC decoder failed in state %s, %lu errors",
+                 __func__, FLAC__StreamDecoderStateString[state],
+                 stream->decodeErrors);
 
-                          scSet.cDacLat_ms = server_settings_message.latency;
-                          scSet.buf_ms = server_settings_message.buffer_ms;
-                          scSet.muted = server_settings_message.muted;
-                          scSet.volume = server_settings_message.volume;
+        FLAC__stream_decoder_flush(flacDecoder);
+        chunk_cursor_skip(&flacInput);
 
-                          if (player_send_snapcast_setting(&scSet) != pdPASS) {
-                            ESP_LOGE(TAG,
-                                     "Failed to notify sync task. "
-                                     "Did you init player?");
+        break;
+      }
+
+      sg_chain_release(input);
+
+      if (stream_send_setting(stream) != pdPASS) {
+        ESP_LOGE(TAG,
+                 "Failed to "
+                 "notify "
+                 "sync task "
+                 "about "
+                 "codec. Did you "
+                 "init player?");
 
-                            return;
-                          }
+        stream->fatal = true;
 
-                          free(serverSettingsString);
-                          serverSettingsString = NULL;
-                        }
+        return -1;
+      }
+
+      break;
+    }
 
-                        state = BASE_MESSAGE_STATE;
-                        internalState = 0;
+    default: {
+      sg_chain_release(input);
 
-                        typedMsgCurrentPos = 0;
-                      }
+      break;
+    }
+  }
 
-                      break;
-                    }
+  stream_decode_time_update(stream, esp_timer_get_time() - decodeStart);
 
-                    default: {
-                      ESP_LOGE(TAG,
-                               "server settings decoder "
-                               "shouldn't get here");
+  return 0;
+}
 
-                      break;
-                    }
-                  }
+#if CONFIG_SNAPCLIENT_COMPRESSED_JITTER_BUFFER
+/**
+ * Count of decoded chunks the player queue should hold. On initial sync the
+ * player preloads the whole DMA buffer, afterwards we have to stay ahead of
+ * playback while blocking in netconn_recv() and while decoding a slow chunk.
+ */
+static uint32_t stream_decode_ahead_chunks(streamCtx_t *stream) {
+  decodeFormat_t *fmt = &stream->fmt;
+  int64_t chunkUs, aheadUs;
 
-                  break;
-                }
+  if ((fmt->sr <= 0) || (fmt->chkInFrames == 0)) {
+    return 1;
+  }
 
-                case SNAPCAST_MESSAGE_STREAM_TAGS: {
-                  size_t tmpSize = base_message_rx.size - typedMsgCurrentPos;
+  chunkUs = 1000000LL * fmt->chkInFrames / fmt->sr;
+  if (chunkUs <= 0) {
+    return 1;
+  }
 
-                  if (tmpSize < len) {
-                    start += tmpSize;
-                    // currentPos += tmpSize;
-                    typedMsgCurrentPos += tmpSize;
-                    len -= tmpSize;
-                  } else {
-                    start += len;
-                    // currentPos += len;
+  aheadUs = 1000000LL * player_get_dma_buffer_frames() / fmt->sr +
+            DECODE_AHEAD_RECV_TIMEOUT_MS * 1000LL + 2 * stream->decodePeakUs +
+            CONFIG_SNAPCLIENT_DECODE_AHEAD_MARGIN_MS * 1000LL;
 
-                    typedMsgCurrentPos += len;
-                    len = 0;
-                  }
+  return (aheadUs + chunkUs - 1) / chunkUs + 1;
+}
 
-                  if (typedMsgCurrentPos >= base_message_rx.size) {
-                    // ESP_LOGI(TAG,
-                    // "done stream tags with length %d %d %d",
-                    // base_message_rx.size, currentPos,
-                    // tmpSize);
+/**
+ * Decode the oldest stored chunk.
+ */
+static int stream_decode_stored(streamCtx_t *stream) {
+  const char *data;
+  tv_t timestamp;
+  uint32_t size;
+  int ret;
 
-                    typedMsgCurrentPos = 0;
-                    // currentPos = 0;
+  data = chunk_store_peek(&chunkStore, &timestamp, &size);
+  if (data == NULL) {
+    return 0;
+  }
 
-                    state = BASE_MESSAGE_STATE;
-                    internalState = 0;
-                  }
+  sg_chain_release(&decoderInput);
+  sg_chain_append(&decoderInput, data, size, NULL, NULL);
 
-                  break;
-                }
+  ret = stream_decode_chunk(stream, &decoderInput, timestamp);
 
-                case SNAPCAST_MESSAGE_TIME: {
-                  switch (internalState) {
-                    case 0: {
-                      time_message_rx.latency.sec = *start;
+  chunk_store_pop(&chunkStore);
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
+  return ret;
+}
 
-                      internalState++;
+/**
+ * Keep just enough decoded chunks in the player queue, the rest of the
+ * buffer stays compressed.
+ */
+static int stream_decode_ahead(streamCtx_t *stream) {
+  uint32_t ahead = stream_decode_ahead_chunks(stream);
 
-                      if (len == 0) {
-                        break;
-                      }
-                    }
+  while ((chunk_store_count(&chunkStore) > 0) &&
+         (pcm_chunk_queue_msg_waiting() < ahead)) {
+    if (stream_decode_stored(stream) < 0) {
+      return -1;
+    }
+  }
 
-                    case 1: {
-                      time_message_rx.latency.sec |= (int32_t)*start << 8;
+  if (++stream->storeStatsCnt >= 1000) {
+    int64_t spanUs = chunk_store_span_us(&chunkStore);
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
+    stream->storeStatsCnt = 0;
 
-                      internalState++;
+    ESP_LOGI(TAG,
+             "jitter buffer: %lu chunks, %lldms, %lu bytes (%lld bytes/s, "
+             "high water %lu), decode avg %lldus peak %lldus, ahead %lu",
+             chunk_store_count(&chunkStore), spanUs / 1000, chunkStore.used,
+             (spanUs > 0) ? (1000000LL * chunkStore.used / spanUs) : 0LL,
+             chunkStore.highWater, stream->decodeAvgUs, stream->decodePeakUs,
+             ahead);
+  }
 
-                      if (len == 0) {
-                        break;
-                      }
-                    }
+  return 0;
+}
 
-                    case 2: {
-                      time_message_rx.latency.sec |= (int32_t)*start << 16;
+/**
+ * Reserve room for a compressed chunk, decode the oldest ones if the store is
+ * full.
+ */
+static char *stream_store_reserve(streamCtx_t *stream, const tv_t *timestamp,
+                                  uint32_t size) {
+  char *data;
+
+  while ((data = chunk_store_reserve(&chunkStore, timestamp, size)) == NULL) {
+    if (chunk_store_count(&chunkStore) == 0) {
+      // chunk is bigger than the store or store isn't allocated
+      return NULL;
+    }
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
+    if (stream_decode_stored(stream) < 0) {
+      return NULL;
+    }
+  }
 
-                      internalState++;
-
-                      if (len == 0) {
-                        break;
-                      }
-                    }
+  return data;
+}
+#endif
 
-                    case 3: {
-                      time_message_rx.latency.sec |= (int32_t)*start << 24;
+/**
+ * Pass a received PCM chunk to the player.
+ */
+static int stream_pcm_chunk(streamCtx_t *stream, pcm_chunk_message_t *pcmData,
+                            uint32_t frames, tv_t timestamp) {
+  int64_t start = esp_timer_get_time();
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      if (len == 0) {
-                        break;
-                      }
-                    }
-
-                    case 4: {
-                      time_message_rx.latency.usec = *start;
+  stream->fmt.chkInFrames = frames;
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      if (len == 0) {
-                        break;
-                      }
-                    }
-
-                    case 5: {
-                      time_message_rx.latency.usec |= (int32_t)*start << 8;
+  // PCM has no decoder state to keep consistent
+  if ((pcmData) && (stream_skip_late(stream, timestamp))) {
+    free_pcm_chunk(pcmData);
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      if (len == 0) {
-                        break;
-                      }
-                    }
+    return 0;
+  }
 
-                    case 6: {
-                      time_message_rx.latency.usec |= (int32_t)*start << 16;
+  if (pcmData) {
+    pcmData->timestamp = timestamp;
+  }
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
-
-                      internalState++;
-
-                      if (len == 0) {
-                        break;
-                      }
-                    }
-
-                    case 7: {
-                      time_message_rx.latency.usec |= (int32_t)*start << 24;
+  if (stream_send_setting(stream) != pdPASS) {
+    ESP_LOGE(TAG,
+             "Failed to notify "
+             "sync task about "
+             "codec. Did you "
+             "init player?");
 
-                      typedMsgCurrentPos++;
-                      start++;
-                      // currentPos++;
-                      len--;
-                      if (typedMsgCurrentPos >= base_message_rx.size) {
-                        // ESP_LOGI(TAG, "done time message");
-
-                        typedMsgCurrentPos = 0;
-
-                        state = BASE_MESSAGE_STATE;
-                        internalState = 0;
-
-                        trx =
-                            (int64_t)base_message_rx.received.sec * 1000000LL +
-                            (int64_t)base_message_rx.received.usec;
-                        ttx = (int64_t)base_message_rx.sent.sec * 1000000LL +
-                              (int64_t)base_message_rx.sent.usec;
-                        tdif = trx - ttx;
-                        trx = (int64_t)time_message_rx.latency.sec * 1000000LL +
-                              (int64_t)time_message_rx.latency.usec;
-                        tmpDiffToServer = (trx - tdif) / 2;
-
-                        int64_t diff;
-
-                        // clear diffBuffer if last update is
-                        // older than a minute
-                        diff = now - lastTimeSync;
-                        if (diff > 60000000LL) {
-                          ESP_LOGW(TAG,
-                                   "Last time sync older "
-                                   "than a minute. "
-                                   "Clearing time buffer");
-
-                          reset_latency_buffer();
-
-                          timeout = FAST_SYNC_LATENCY_BUF;
-
-                          esp_timer_stop(timeSyncMessageTimer);
-                          if (received_header == true) {
-                            if (!esp_timer_is_active(timeSyncMessageTimer)) {
-                              esp_timer_start_periodic(timeSyncMessageTimer,
-                                                       timeout);
-                            }
-                          }
-                        }
-
-                        player_latency_insert(tmpDiffToServer);
-
-                        // ESP_LOGI(TAG, "Current latency:%lld:",
-                        // tmpDiffToServer);
-
-                        // store current time
-                        lastTimeSync = now;
-
-                        if (received_header == true) {
-                          if (!esp_timer_is_active(timeSyncMessageTimer)) {
-                            esp_timer_start_periodic(timeSyncMessageTimer,
-                                                     timeout);
-                          }
-
-                          bool is_full = false;
-                          latency_buffer_full(&is_full, portMAX_DELAY);
-                          if ((is_full == true) &&
-                              (timeout < NORMAL_SYNC_LATENCY_BUF)) {
-                            timeout = NORMAL_SYNC_LATENCY_BUF;
-
-                            ESP_LOGI(TAG, "latency buffer full");
-
-                            if (esp_timer_is_active(timeSyncMessageTimer)) {
-                              esp_timer_stop(timeSyncMessageTimer);
-                            }
-
-                            esp_timer_start_periodic(timeSyncMessageTimer,
-                                                     timeout);
-                          } else if ((is_full == false) &&
-                                     (timeout > FAST_SYNC_LATENCY_BUF)) {
-                            timeout = FAST_SYNC_LATENCY_BUF;
-
-                            ESP_LOGI(TAG, "latency buffer not full");
-
-                            if (esp_timer_is_active(timeSyncMessageTimer)) {
-                              esp_timer_stop(timeSyncMessageTimer);
-                            }
-
-                            esp_timer_start_periodic(timeSyncMessageTimer,
-                                                     timeout);
-                          }
-                        }
-                      } else {
-                        ESP_LOGE(TAG,
-                                 "error time message, this "
-                                 "shouldn't happen! %d %ld",
-                                 typedMsgCurrentPos, base_message_rx.size);
-
-                        typedMsgCurrentPos = 0;
-
-                        state = BASE_MESSAGE_STATE;
-                        internalState = 0;
-                      }
-
-                      break;
-                    }
-
-                    default: {
-                      ESP_LOGE(TAG,
-                               "time message decoder shouldn't "
-                               "get here %d %ld %ld",
-                               typedMsgCurrentPos, base_message_rx.size,
-                               internalState);
-
-                      break;
-                    }
-                  }
-
-                  break;
-                }
-
-                default: {
-                  typedMsgCurrentPos++;
-                  start++;
-                  // currentPos++;
-                  len--;
-
-                  if (typedMsgCurrentPos >= base_message_rx.size) {
-                    ESP_LOGI(TAG, "done unknown typed message %d",
-                             base_message_rx.type);
-
-                    state = BASE_MESSAGE_STATE;
-                    internalState = 0;
-
-                    typedMsgCurrentPos = 0;
-                  }
+    if (pcmData) {
+      free_pcm_chunk(pcmData);
+    }
 
-                  break;
-                }
-              }
-
-              break;
-            }
-
-            default: {
-              break;
-            }
-          }
+    stream->fatal = true;
 
-          if (rc1 != ERR_OK) {
-            break;
-          }
-        }
-      } while (netbuf_next(firstNetBuf) >= 0);
+    return -1;
+  }
 
-      netbuf_delete(firstNetBuf);
+#if CONFIG_USE_DSP_PROCESSOR
+  if ((pcmData) && (pcmData->fragment->payload)) {
+    dsp_processor_worker(pcmData->fragment->payload, pcmData->fragment->size,
+                         stream->fmt.sr, stream->fmt.bits);
+  }
+#endif
+
+  if (pcmData) {
+    insert_pcm_chunk(pcmData);
+  }
+
+  stream_decode_time_update(stream, esp_timer_get_time() - start);
+
+  return 0;
+}
+
+#if CONFIG_SNAPCLIENT_DECODE_TASK
+/**
+ * Blocks while the decode task is behind, so reception is throttled the
+ * same way as decoding inline.
+ */
+static decodeJob_t *decode_job_get(decodeJobType_t type) {
+  uint8_t idx;
+  decodeJob_t *job;
+
+  xQueueReceive(decodeFreeQ, &idx, portMAX_DELAY);
+
+  job = &decodeJob[idx];
+  job->type = type;
+  job->pcmData = NULL;
+  sg_chain_release(&job->input);
+
+  return job;
+}
+
+/**
+ *
+ */
+static void decode_job_put(QueueHandle_t queue, decodeJob_t *job) {
+  uint8_t idx = job - decodeJob;
+
+  job->queued_us = esp_timer_get_time();
+  xQueueSend(queue, &idx, portMAX_DELAY);
+}
+
+/**
+ * Wait until all queued chunks are decoded, decoders and chunkStore may be
+ * touched by http_get_task() afterwards.
+ */
+static void decode_sync(void) {
+  decode_job_put(decodeReadyQ, decode_job_get(DECODE_JOB_SYNC));
+  xSemaphoreTake(decodeSyncSemaphore, portMAX_DELAY);
+}
+
+/**
+ *
+ */
+static int stream_decode_job(streamCtx_t *stream, decodeJob_t *job) {
+  latency_hist_add(&stream->histQueue, esp_timer_get_time() - job->queued_us);
+
+  if (job->type == DECODE_JOB_PCM) {
+    pcm_chunk_message_t *pcmData = job->pcmData;
+
+    job->pcmData = NULL;
+
+    return stream_pcm_chunk(stream, pcmData, job->pcmFrames, job->timestamp);
+  }
+
+#if CONFIG_SNAPCLIENT_COMPRESSED_JITTER_BUFFER
+  // the decode task owns the store, chunks are copied in once complete
+  char *data = stream_store_reserve(stream, &job->timestamp, job->input.len);
+  if (data) {
+    sg_cursor_t cursor;
+
+    sg_cursor_init(&cursor, &job->input);
+    sg_cursor_read(&cursor, data, job->input.len);
+    sg_chain_release(&job->input);
+
+    chunk_store_commit(&chunkStore);
+
+    return stream_decode_ahead(stream);
+  }
+#endif
+
+  return stream_decode_chunk(stream, &job->input, job->timestamp);
+}
+
+/**
+ * Decodes wire chunks received by http_get_task(), so a slow chunk doesn't
+ * stall reception and time sync.
+ */
+static void decode_task(void *pvParameters) {
+  streamCtx_t *stream = (streamCtx_t *)pvParameters;
+  TickType_t timeout = portMAX_DELAY;
+  decodeJob_t *job;
+  uint8_t idx;
+
+#if CONFIG_SNAPCLIENT_COMPRESSED_JITTER_BUFFER
+  // wake up regularly to decode stored chunks the player will need soon
+  timeout = pdMS_TO_TICKS(DECODE_AHEAD_RECV_TIMEOUT_MS);
+#endif
+
+  while (1) {
+    if (xQueueReceive(decodeReadyQ, &idx, timeout) != pdTRUE) {
+#if CONFIG_SNAPCLIENT_COMPRESSED_JITTER_BUFFER
+      if ((stream->received_header == true) && (stream->fatal == false)) {
+        stream_decode_ahead(stream);
+      }
+#endif
+
+      continue;
+    }
+
+    job = &decodeJob[idx];
+
+    if (job->type == DECODE_JOB_SYNC) {
+      xSemaphoreGive(decodeSyncSemaphore);
+    } else if (stream->fatal == false) {
+      stream_decode_job(stream, job);
+    }
+
+    // leftovers of skipped jobs
+    sg_chain_release(&job->input);
+    if (job->pcmData) {
+      free_pcm_chunk(job->pcmData);
+      job->pcmData = NULL;
+    }
+
+    xQueueSend(decodeFreeQ, &idx, portMAX_DELAY);
+  }
+}
+
+/**
+ *
+ */
+static int decode_task_init(streamCtx_t *stream) {
+  decodeReadyQ = xQueueCreateStatic(DECODE_JOBS, sizeof(uint8_t),
+                                    decodeReadyQStorage, &decodeReadyQBuffer);
+  decodeFreeQ = xQueueCreateStatic(DECODE_JOBS, sizeof(uint8_t),
+                                   decodeFreeQStorage, &decodeFreeQBuffer);
+  decodeSyncSemaphore =
+      xSemaphoreCreateBinaryStatic(&decodeSyncSemaphoreBuffer);
+
+  for (uint8_t i = 0; i < DECODE_JOBS; i++) {
+    sg_chain_init(&decodeJob[i].input);
+    decodeJob[i].pcmData = NULL;
+
+    xQueueSend(decodeFreeQ, &i, 0);
+  }
+
+  // opus_decode() needs about as much stack as http_get_task() had before
+  if (xTaskCreatePinnedToCore(&decode_task, "decode", 15 * 1024, stream,
+                              DECODE_TASK_PRIORITY, &t_decode_task,
+                              DECODE_TASK_CORE_ID) != pdPASS) {
+    return -1;
+  }
+
+  return 0;
+}
+#endif
+
+/**
+ *
+ */
+static int stream_wire_chunk_start_cb(void *ctx, const base_message_t *base,
+                                      const wire_chunk_message_t *chunk) {
+  streamCtx_t *stream = (streamCtx_t *)ctx;
+
+  if (stream->received_header == false) {
+    return 0;
+  }
+
+#if 0
+  ESP_LOGI(TAG, "chunk with size: %lu, at time %ld.%ld", chunk->size,
+           chunk->timestamp.sec, chunk->timestamp.usec);
+#endif
+
+  stream->chunkArrival_us = tv_to_us(&base->received);
+
+  switch (stream->codec) {
+    case OPUS:
+    case OGG:
+    case FLAC: {
+#if CONFIG_SNAPCLIENT_DECODE_TASK
+      stream->job = decode_job_get(DECODE_JOB_COMPRESSED);
+      stream->input = &stream->job->input;
+#endif
+
+      sg_chain_release(stream->input);
+
+      stream->chunkSize = chunk->size;
+      stream->payloadOffset = 0;
+      stream->copyBuf = NULL;
+      stream->stored = false;
+
+#if CONFIG_SNAPCLIENT_COMPRESSED_JITTER_BUFFER && \
+    !CONFIG_SNAPCLIENT_DECODE_TASK
+      stream->copyBuf =
+          stream_store_reserve(stream, &chunk->timestamp, chunk->size);
+      if (stream->copyBuf) {
+        stream->stored = true;
+
+        break;
+      }
+#endif
+
+#if !CONFIG_SNAPCLIENT_ZERO_COPY_WIRE_CHUNKS
+      wire_chunk_to_heap(stream);
+#endif
+
+      break;
+    }
+
+    case PCM: {
+      if (stream->pcmData == NULL) {
+        if (allocate_pcm_chunk_memory(&stream->pcmData, chunk->size) < 0) {
+          stream->pcmData = NULL;
+        }
+      }
+
+      pcm_unpack_reset(&stream->pcmUnpack);
+
+      break;
+    }
+
+    default: {
+      ESP_LOGE(TAG, "Decoder (1) not supported");
+
+      stream->fatal = true;
+
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int stream_wire_chunk_data_cb(void *ctx, const char *data,
+                                     uint32_t len, void *owner) {
+  streamCtx_t *stream = (streamCtx_t *)ctx;
+
+  if (stream->received_header == false) {
+    return 0;
+  }
+
+  switch (stream->codec) {
+    case OPUS:
+    case OGG:
+    case FLAC: {
+      if ((stream->copyBuf == NULL) && (owner != NULL)) {
+        // keep the pbuf instead of copying its payload
+        if (sg_chain_append(stream->input, data, len, owner,
+                            wire_chunk_pbuf_free) == 0) {
+          pbuf_ref((struct pbuf *)owner);
+          stream->payloadOffset += len;
+
+          break;
+        }
+      }
+
+      wire_chunk_to_heap(stream);
+
+      memcpy(&stream->copyBuf[stream->payloadOffset], data, len);
+      stream->payloadOffset += len;
+
+      break;
+    }
+
+    case PCM: {
+      pcm_unpack_wire(&stream->pcmUnpack, stream->pcmData, data, len,
+                      stream->pcmBits);
+
+      break;
+    }
+
+    default: {
+      ESP_LOGE(TAG, "Decoder (1) not supported");
+
+      stream->fatal = true;
+
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int stream_wire_chunk_end_cb(void *ctx, const base_message_t *base,
+                                    const wire_chunk_message_t *chunk) {
+  streamCtx_t *stream = (streamCtx_t *)ctx;
+  decodeFormat_t *fmt = &stream->fmt;
+  tv_t timestamp = chunk->timestamp;
+#if CONFIG_SNAPCLIENT_DECODE_TASK
+  decodeJob_t *job;
+#endif
+
+  (void)base;
+
+  if (stream->received_header == false) {
+    return 0;
+  }
+
+  latency_hist_add(&stream->histReceive,
+                   esp_timer_get_time() - stream->chunkArrival_us);
+
+  switch (stream->codec) {
+    case OPUS:
+    case OGG:
+    case FLAC: {
+#if CONFIG_SNAPCLIENT_COMPRESSED_JITTER_BUFFER
+      if (stream->stored) {
+        chunk_store_commit(&chunkStore);
+        stream->stored = false;
+
+        return stream_decode_ahead(stream);
+      }
+#endif
+
+#if CONFIG_SNAPCLIENT_DECODE_TASK
+      job = stream->job;
+      job->timestamp = timestamp;
+
+      // the job's input belongs to the decode task from now on
+      stream->job = NULL;
+      stream->input = NULL;
+
+      decode_job_put(decodeReadyQ, job);
+
+      return 0;
+#else
+      return stream_decode_chunk(stream, stream->input, timestamp);
+#endif
+    }
+
+    case PCM: {
+      size_t decodedSize = chunk->size;
+      pcm_chunk_message_t *pcmData = stream->pcmData;
+      uint32_t frames;
+
+      stream->pcmData = NULL;
+
+      // the format is only changed by a codec header, with the decode task
+      // idle
+      frames = decodedSize / ((size_t)fmt->ch * (size_t)(fmt->bits / 8));
+
+      // ESP_LOGW(TAG, "got PCM decoded chunk size: %ld frames", frames);
+
+#if CONFIG_SNAPCLIENT_DECODE_TASK
+      job = decode_job_get(DECODE_JOB_PCM);
+      job->timestamp = timestamp;
+      job->pcmData = pcmData;
+      job->pcmFrames = frames;
+
+      decode_job_put(decodeReadyQ, job);
+
+      return 0;
+#else
+      return stream_pcm_chunk(stream, pcmData, frames, timestamp);
+#endif
+    }
+
+    default: {
+      ESP_LOGE(TAG,
+               "Decoder (2) not "
+               "supported");
+
+      stream->fatal = true;
+
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int stream_codec_header_cb(void *ctx, const base_message_t *base,
+                                  const codec_header_message_t *header) {
+  streamCtx_t *stream = (streamCtx_t *)ctx;
+  int64_t headerStart = esp_timer_get_time();
+  bool reused = false;
+
+  (void)base;
+
+#if CONFIG_SNAPCLIENT_DECODE_TASK
+  // codec, decoders and chunkStore are ours until the next chunk is queued
+  decode_sync();
+#endif
+
+  // ESP_LOGI (TAG, "got codec string: %s", header->codec);
+
+  if (strcmp(header->codec, "opus") == 0) {
+    stream->codec = OPUS;
+  } else if (strcmp(header->codec, "flac") == 0) {
+    stream->codec = FLAC;
+#if CONFIG_SNAPCLIENT_USE_OGG
+  } else if (strcmp(header->codec, "ogg") == 0) {
+    stream->codec = OGG;
+#endif
+  } else if (strcmp(header->codec, "pcm") == 0) {
+    stream->codec = PCM;
+  } else {
+    stream->codec = NONE;
+
+    ESP_LOGI(TAG, "Codec : %s not supported", header->codec);
+    ESP_LOGI(TAG,
+             "Change encoder codec to "
+#if CONFIG_SNAPCLIENT_USE_OGG
+             "opus, flac, ogg or pcm in "
+#else
+             "opus, flac or pcm in "
+#endif
+             "/etc/snapserver.conf on "
+             "server");
+
+    stream->fatal = true;
+
+    return -1;
+  }
+
+  // first ensure everything is set up correctly and resources are available
+
+#if CONFIG_SNAPCLIENT_COMPRESSED_JITTER_BUFFER
+  // stored chunks belong to the previous decoder
+  chunk_store_reset(&chunkStore);
+#endif
+
+  // decoders start over
+  stream->decoderGap = false;
+
+  if (codec_session_matches(stream->codec, header)) {
+    codec_session_restart(stream);
+
+    reused = true;
+  } else {
+    codec_session_close();
+
+    if (codec_session_open(stream, header) < 0) {
+      stream->fatal = true;
+
+      return -1;
+    }
+  }
+
+  stream->header_us = esp_timer_get_time();
+
+  ESP_LOGI(TAG, "%s codec header set up in %lldus",
+           reused ? "reused" : "new", stream->header_us - headerStart);
+
+  if (stream_send_setting(stream) != pdPASS) {
+    ESP_LOGE(TAG,
+             "Failed to notify sync task. "
+             "Did you init player?");
+
+    stream->fatal = true;
+
+    return -1;
+  }
+
+  // ESP_LOGI(TAG, "done codec header msg");
+
+  stream->received_header = true;
+  esp_timer_stop(stream->timeSyncMessageTimer);
+  if (!esp_timer_is_active(stream->timeSyncMessageTimer)) {
+    esp_timer_start_periodic(stream->timeSyncMessageTimer, stream->timeout);
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int stream_server_settings_cb(void *ctx, const base_message_t *base,
+                                     const char *json) {
+  streamCtx_t *stream = (streamCtx_t *)ctx;
+  snapcastSetting_t *scSet = &stream->scSet;
+  server_settings_message_t server_settings_message;
+  int result;
+
+  (void)base;
+
+  // ESP_LOGI(TAG, "got string: %s", json);
+
+  result = server_settings_message_deserialize(&server_settings_message, json);
+  if (result) {
+    ESP_LOGE(TAG,
+             "Failed to read server "
+             "settings: %d",
+             result);
+
+    return 0;
+  }
+
+  // log mute state, buffer, latency
+  ESP_LOGI(TAG, "Buffer length:  %ld", server_settings_message.buffer_ms);
+  ESP_LOGI(TAG, "Latency:        %ld", server_settings_message.latency);
+  ESP_LOGI(TAG, "Mute:           %d", server_settings_message.muted);
+  ESP_LOGI(TAG, "Setting volume: %ld", server_settings_message.volume);
+
+  // Volume setting using ADF HAL abstraction
+  if (scSet->muted != server_settings_message.muted) {
+#if SNAPCAST_USE_SOFT_VOL
+    if (server_settings_message.muted) {
+      dsp_processor_set_volome(0.0);
+    } else {
+      dsp_processor_set_volome((double)server_settings_message.volume / 100);
+    }
+#endif
+    audio_set_mute(server_settings_message.muted);
+  }
+
+  if (scSet->volume != server_settings_message.volume) {
+#if SNAPCAST_USE_SOFT_VOL
+    if (!server_settings_message.muted) {
+      dsp_processor_set_volome((double)server_settings_message.volume / 100);
+    }
+#else
+    audio_set_volume(server_settings_message.volume);
+#endif
+  }
+
+  xSemaphoreTake(scSetMutex, portMAX_DELAY);
+
+  scSet->cDacLat_ms = server_settings_message.latency;
+  scSet->buf_ms = server_settings_message.buffer_ms;
+  scSet->muted = server_settings_message.muted;
+  scSet->volume = server_settings_message.volume;
+
+  result = player_send_snapcast_setting(scSet);
+
+  xSemaphoreGive(scSetMutex);
+
+  if (result != pdPASS) {
+    ESP_LOGE(TAG,
+             "Failed to notify sync task. "
+             "Did you init player?");
+
+    stream->fatal = true;
+
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * smoothed like TCP does
+ */
+static void rtt_jitter_update(rttJitter_t *jitter, int64_t rtt) {
+  int32_t err;
+
+  if (jitter->valid == false) {
+    jitter->srtt_us = rtt;
+    jitter->rttVar_us = rtt / 2;
+    jitter->valid = true;
+
+    return;
+  }
+
+  err = (int32_t)rtt - jitter->srtt_us;
+  jitter->rttVar_us += (((err < 0) ? -err : err) - jitter->rttVar_us) / 4;
+  jitter->srtt_us += err / 8;
+}
+
+/**
+ *
+ */
+static int stream_time_cb(void *ctx, const base_message_t *base,
+                          const time_message_t *time) {
+  streamCtx_t *stream = (streamCtx_t *)ctx;
+  int64_t now, trx, tdif, ttx;
+  int64_t tmpDiffToServer;
+  int64_t diff, interval;
+  int32_t ret, skewErr = CLOCK_MODEL_UNKNOWN_SKEW_PPB;
+  bool is_full = false;
+
+  // ESP_LOGI(TAG, "done time message");
+
+  now = tv_to_us(&base->received);
+
+  trx = now;
+  ttx = tv_to_us(&base->sent);
+  tdif = trx - ttx;
+  trx = tv_to_us(&time->latency);
+  tmpDiffToServer = (trx - tdif) / 2;
+
+  // clear diffBuffer if last update is older than a minute
+  diff = now - stream->lastTimeSync;
+  if (diff > 60000000LL) {
+    ESP_LOGW(TAG,
+             "Last time sync older "
+             "than a minute. "
+             "Clearing time buffer");
+
+    reset_latency_buffer();
+
+    sync_scheduler_reset(&stream->syncScheduler);
+    stream->timeout = sync_scheduler_interval(&stream->syncScheduler);
+
+    esp_timer_stop(stream->timeSyncMessageTimer);
+    if (stream->received_header == true) {
+      if (!esp_timer_is_active(stream->timeSyncMessageTimer)) {
+        esp_timer_start_periodic(stream->timeSyncMessageTimer,
+                                 stream->timeout);
+      }
+    }
+  }
+
+  // server receive - client send plus client receive - server send
+  ret = player_latency_insert(now, tmpDiffToServer, trx + tdif);
+
+  latency_buffer_full(&is_full, portMAX_DELAY);
+  player_clock_skew_error(&skewErr);
+  interval = sync_scheduler_update(&stream->syncScheduler, trx + tdif, ret,
+                                   is_full, skewErr);
+
+  rtt_jitter_update(&stream->rttArrival, trx + tdif);
+  rtt_jitter_update(&stream->rttParsed,
+                    trx + tdif + (stream->parsed_us - now));
+  if ((++stream->rttSamples % 32) == 0) {
+    ESP_LOGI(TAG, "rtt jitter %ldus stamped at arrival, %ldus at parser",
+             stream->rttArrival.rttVar_us, stream->rttParsed.rttVar_us);
+  }
+
+  // ESP_LOGI(TAG, "Current latency:%lld:", tmpDiffToServer);
+
+  // store current time
+  stream->lastTimeSync = now;
+
+  if (stream->received_header == true) {
+    if (!esp_timer_is_active(stream->timeSyncMessageTimer)) {
+      esp_timer_start_periodic(stream->timeSyncMessageTimer, stream->timeout);
+    }
+
+    // timer keeps running periodically, so a lost response doesn't stop
+    // time sync
+    if ((uint64_t)interval != stream->timeout) {
+      sync_scheduler_stats_t stats;
+
+      sync_scheduler_get_stats(&stream->syncScheduler, &stats);
+      ESP_LOGD(TAG,
+               "time sync every %lldus, rtt %ld+-%ldus, bursts %lu (%lu "
+               "degraded), %lu samples",
+               interval, stats.srtt_us, stats.rttVar_us, stats.bursts,
+               stats.degradations, stats.samples);
+
+      stream->timeout = interval;
+
+      if (esp_timer_is_active(stream->timeSyncMessageTimer)) {
+        esp_timer_stop(stream->timeSyncMessageTimer);
+      }
+
+      esp_timer_start_periodic(stream->timeSyncMessageTimer, stream->timeout);
+    }
+  }
+
+  return 0;
+}
+
+static const snapcast_framer_callbacks_t streamCallbacks = {
+    .base_message = stream_base_message_cb,
+    .wire_chunk_start = stream_wire_chunk_start_cb,
+    .wire_chunk_data = stream_wire_chunk_data_cb,
+    .wire_chunk_end = stream_wire_chunk_end_cb,
+    .codec_header = stream_codec_header_cb,
+    .server_settings = stream_server_settings_cb,
+    .time = stream_time_cb,
+};
+
+/**
+ *
+ */
+static void http_get_task(void *pvParameters) {
+  char *start;
+  hello_message_t hello_message;
+  bool helloTemplate = false;
+  uint32_t rxPos = 0;
+  int64_t arrival;
+  int result;
+  int64_t now;
+  esp_err_t err = 0;
+  mdns_result_t *r;
+  ip_addr_t remote_ip;
+  uint16_t remotePort = 0;
+  int rc1 = ERR_OK, rc2 = ERR_OK;
+  struct netbuf *firstNetBuf = NULL;
+  uint16_t len;
+  static streamCtx_t stream;
+  static snapcast_framer_t framer;
+
+  memset(&stream, 0, sizeof(stream));
+
+  stream.input = &decoderInput;
+
+  scSetMutex = xSemaphoreCreateMutexStatic(&scSetMutexBuffer);
+
+  // create a timer to send time sync messages every x µs
+  esp_timer_create(&tSyncArgs, &stream.timeSyncMessageTimer);
+
+  snapcast_framer_init(&framer, &streamCallbacks, &stream);
+
+  if (snapcast_tx_init(&snapcastTx) < 0) {
+    ESP_LOGE(TAG, "couldn't set up transmit arena");
+
+    return;
+  }
+
+#if CONFIG_SNAPCLIENT_COMPRESSED_JITTER_BUFFER
+  if (chunk_store_init(&chunkStore,
+                       CONFIG_SNAPCLIENT_COMPRESSED_JITTER_BUFFER_SIZE *
+                           1024) < 0) {
+    ESP_LOGE(TAG, "couldn't allocate jitter buffer, decoding immediately");
+  }
+#endif
+
+#if CONFIG_SNAPCLIENT_DECODE_TASK
+  if (decode_task_init(&stream) < 0) {
+    ESP_LOGE(TAG, "couldn't create decode task");
+
+    return;
+  }
+#endif
+
+#if CONFIG_SNAPCLIENT_USE_MDNS
+  ESP_LOGI(TAG, "Enable mdns");
+  mdns_init();
+#endif
+
+  while (1) {
+    // do some house keeping
+    {
+#if CONFIG_SNAPCLIENT_DECODE_TASK
+      // let the decode task finish what was queued before tearing down
+      decode_sync();
+
+      if (stream.job) {
+        sg_chain_release(&stream.job->input);
+        decode_job_put(decodeFreeQ, stream.job);
+        stream.job = NULL;
+      }
+#endif
+
+      stream.received_header = false;
+      stream.codec = NONE;
+
+      sync_scheduler_reset(&stream.syncScheduler);
+      stream.timeout = sync_scheduler_interval(&stream.syncScheduler);
+
+      esp_timer_stop(stream.timeSyncMessageTimer);
+
+      // decoders are kept for the codec header of the next connection,
+      // see codec_session_matches()
+
+      sg_chain_release(&decoderInput);
+      stream.input = &decoderInput;
+
+#if CONFIG_SNAPCLIENT_COMPRESSED_JITTER_BUFFER
+      chunk_store_reset(&chunkStore);
+#endif
+
+      if (stream.pcmData) {
+        free_pcm_chunk(stream.pcmData);
+        stream.pcmData = NULL;
+      }
+
+      snapcast_framer_reset(&framer);
+    }
+
+#if SNAPCAST_SERVER_USE_MDNS
+    // Find snapcast server
+    // Connect to first snapcast server found
+    r = NULL;
+    err = 0;
+    while (!r || err) {
+      ESP_LOGI(TAG, "Lookup snapcast service on network");
+      esp_err_t err = mdns_query_ptr("_snapcast", "_tcp", 3000, 20, &r);
+      if (err) {
+        ESP_LOGE(TAG, "Query Failed");
+        vTaskDelay(pdMS_TO_TICKS(1000));
+      }
+
+      if (!r) {
+        ESP_LOGW(TAG, "No results found!");
+        vTaskDelay(pdMS_TO_TICKS(1000));
+      }
+    }
+
+    mdns_ip_addr_t *a = r->addr;
+    if (a) {
+      ip_addr_copy(remote_ip, (a->addr));
+      remote_ip.type = a->addr.type;
+      remotePort = r->port;
+      ESP_LOGI(TAG, "Found %s:%d", ipaddr_ntoa(&remote_ip), remotePort);
+
+      mdns_query_results_free(r);
+    } else {
+      mdns_query_results_free(r);
+
+      ESP_LOGW(TAG, "No IP found in MDNS query");
+
+      continue;
+    }
+#else
+    // configure a failsafe snapserver according to CONFIG values
+    struct sockaddr_in servaddr;
+
+    servaddr.sin_family = AF_INET;
+    inet_pton(AF_INET, SNAPCAST_SERVER_HOST, &(servaddr.sin_addr.s_addr));
+    servaddr.sin_port = htons(SNAPCAST_SERVER_PORT);
+
+    inet_pton(AF_INET, SNAPCAST_SERVER_HOST, &(remote_ip.u_addr.ip4.addr));
+    remote_ip.type = IPADDR_TYPE_V4;
+    remotePort = SNAPCAST_SERVER_PORT;
+
+    ESP_LOGI(TAG, "try connecting to static configuration %s:%d",
+             ipaddr_ntoa(&remote_ip), remotePort);
+#endif
+
+    if (lwipNetconn != NULL) {
+      netconn_delete(lwipNetconn);
+      lwipNetconn = NULL;
+    }
+
+    rx_arrival_reset();
+    rxPos = 0;
+
+    lwipNetconn = netconn_new_with_callback(NETCONN_TCP, netconn_event_cb);
+    if (lwipNetconn == NULL) {
+      ESP_LOGE(TAG, "can't create netconn");
+
+      continue;
+    }
+
+    rc1 = netconn_bind(lwipNetconn, IPADDR_ANY, 0);
+    if (rc1 != ERR_OK) {
+      ESP_LOGE(TAG, "can't bind local IP");
+    }
+
+    rc2 = netconn_connect(lwipNetconn, &remote_ip, remotePort);
+    if (rc2 != ERR_OK) {
+      ESP_LOGE(TAG, "can't connect to remote %s:%d, err %d",
+               ipaddr_ntoa(&remote_ip), remotePort, rc2);
+    }
+
+    if (rc1 != ERR_OK || rc2 != ERR_OK) {
+      netconn_close(lwipNetconn);
+      netconn_delete(lwipNetconn);
+      lwipNetconn = NULL;
+
+      continue;
+    }
+
+    ESP_LOGI(TAG, "netconn connected");
+
+    stream.connect_us = esp_timer_get_time();
+    stream.header_us = 0;
+
+#if CONFIG_SNAPCLIENT_COMPRESSED_JITTER_BUFFER && \
+    !CONFIG_SNAPCLIENT_DECODE_TASK
+    netconn_set_recvtimeout(lwipNetconn, DECODE_AHEAD_RECV_TIMEOUT_MS);
+#endif
+
+    if (reset_latency_buffer() < 0) {
+      ESP_LOGE(TAG,
+               "reset_diff_buffer: couldn't reset median filter long. STOP");
+      return;
+    }
+
+    char mac_address[18];
+    uint8_t base_mac[6];
+    // Get MAC address for WiFi station
+#if CONFIG_SNAPCLIENT_USE_INTERNAL_ETHERNET || \
+    CONFIG_SNAPCLIENT_USE_SPI_ETHERNET
+    esp_read_mac(base_mac, ESP_MAC_ETH);
+#else
+    esp_read_mac(base_mac, ESP_MAC_WIFI_STA);
+#endif
+    sprintf(mac_address, "%02X:%02X:%02X:%02X:%02X:%02X", base_mac[0],
+            base_mac[1], base_mac[2], base_mac[3], base_mac[4], base_mac[5]);
+
+    // serialized once, the arena keeps it across reconnects
+    if (helloTemplate == false) {
+      hello_message.mac = mac_address;
+      hello_message.hostname = SNAPCAST_CLIENT_NAME;
+      hello_message.version = (char *)VERSION_STRING;
+      hello_message.client_name = "libsnapcast";
+      hello_message.os = "esp32";
+      hello_message.arch = "xtensa";
+      hello_message.instance = 1;
+      hello_message.id = mac_address;
+      hello_message.protocol_version = 2;
+
+      if (snapcast_tx_set_hello(&snapcastTx, &hello_message) < 0) {
+        ESP_LOGE(TAG, "Failed to serialize hello message");
+        return;
+      }
+
+      helloTemplate = true;
+    }
+
+    now = esp_timer_get_time();
+
+    snapcast_tx_reset(&snapcastTx, now);
+
+    result = snapcast_tx_send(&snapcastTx, SNAPCAST_MESSAGE_HELLO, id_counter++,
+                              now, netconn_tx_write, lwipNetconn);
+    if (result < 0) {
+      ESP_LOGE(TAG, "netconn failed to send hello message");
+
+      continue;
+    }
+
+    ESP_LOGI(TAG, "netconn sent hello message");
+
+    // init default setting
+    stream.scSet.buf_ms = 500;
+    stream.scSet.codec = NONE;
+    stream.scSet.bits = 16;
+    stream.scSet.ch = 2;
+    stream.scSet.sr = 44100;
+    stream.scSet.chkInFrames = 0;
+    stream.fmt.codec = NONE;
+    stream.fmt.bits = 16;
+    stream.fmt.ch = 2;
+    stream.fmt.sr = 44100;
+    stream.fmt.chkInFrames = 0;
+    stream.scSet.volume = 0;
+    stream.scSet.muted = true;
+
+    firstNetBuf = NULL;
+
+    while (1) {
+      rc2 = netconn_recv(lwipNetconn, &firstNetBuf);
+#if CONFIG_SNAPCLIENT_COMPRESSED_JITTER_BUFFER && \
+    !CONFIG_SNAPCLIENT_DECODE_TASK
+      if (rc2 == ERR_TIMEOUT) {
+        // nothing received, decode stored chunks the player will need soon
+        if (stream.received_header == true) {
+          if (stream_decode_ahead(&stream) < 0) {
+            return;
+          }
+        }
+
+        continue;
+      }
+#endif
+
+      if (rc2 != ERR_OK) {
+        if (rc2 == ERR_CONN) {
+          netconn_close(lwipNetconn);
+
+          // restart and try to reconnect
+          break;
+        }
+
+        if (firstNetBuf != NULL) {
+          netbuf_delete(firstNetBuf);
+
+          firstNetBuf = NULL;
+        }
+        continue;
+      }
+
+      arrival = rx_arrival_get(rxPos);
+      if (arrival == 0) {
+        arrival = esp_timer_get_time();
+      }
+      snapcast_framer_set_arrival(&framer, arrival);
+      rxPos += netbuf_len(firstNetBuf);
+
+      // now parse the data
+      netbuf_first(firstNetBuf);
+      do {
+        rc1 = netbuf_data(firstNetBuf, (void **)&start, &len);
+        if (rc1 != ERR_OK) {
+          ESP_LOGE(TAG, "netconn rx, couldn't get data");
+
+          continue;
+        }
+
+        // pass the pbuf too, wire chunk payload may be kept in it
+        rc1 = snapcast_framer_feed(&framer, start, len, firstNetBuf->ptr);
+        if (rc1 != SNAPCAST_FRAMER_OK) {
+          break;
+        }
+      } while (netbuf_next(firstNetBuf) >= 0);
+
+      netbuf_delete(firstNetBuf);
+
+      if (stream.fatal == true) {
+        return;
+      }
 
-      if (rc1 != ERR_OK) {
-        ESP_LOGE(TAG, "Data error, closing netconn");
+      if (rc1 != SNAPCAST_FRAMER_OK) {
+        ESP_LOGE(TAG, "Data error %d, closing netconn", rc1);
 
         netconn_close(lwipNetconn);
 
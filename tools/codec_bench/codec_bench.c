@@ -0,0 +1,1448 @@
+/**
+ * Host benchmark of the snapclient decode paths. Recorded snapcast streams
+ * are fed through the framer in TCP segment sized pieces and decoded by the
+ * same FLAC, Ogg (Vorbis or Opus), Opus and PCM code the client runs.
+ * Reports real time factor, cycles per audio frame, peak heap and
+ * allocations per chunk as one JSON object per recording. With -k the pack and unpack kernels for each sample
+ * width and the drift correction resampler are timed on their own. With -f
+ * only the framer runs, on recordings split at random boundaries. With -g
+ * FLAC recordings get garbage chunks inserted the decoder has to recover
+ * from.
+ *
+ * usage: codec_bench [-f] [-g] [-k] [-r repeat] [-s segment] recording...
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "FLAC/stream_decoder.h"
+#include "chunk_cursor.h"
+#if CODEC_BENCH_OGG
+#include "ivorbiscodec.h"
+#include "ogg/ogg.h"
+#endif
+#include "opus.h"
+#include "opus_mapping.h"
+#include "opus_multistream.h"
+#include "pcm_pack.h"
+#include "resampler.h"
+#include "sg_buffer.h"
+#include "snapcast.h"
+#include "snapcast_framer.h"
+
+#define BENCH_SEGMENT_DEFAULT 1460
+#define BENCH_OPUS_MAX_MS 120
+// Tremor's samples are fixed point, 1.0 is 1 << 24
+#define BENCH_VORBIS_FRACTION_BITS 24
+// kernel runs, a FLAC frame of 4096 at a time
+#define BENCH_KERNEL_FRAMES 4096
+#define BENCH_KERNEL_PASSES 2000
+// PCM payload in the first pbuf starts behind the 26 byte base and 12 byte
+// wire chunk header
+#define BENCH_KERNEL_WIRE_OFFSET 38
+// framer runs split recordings like the framer's unit test, every fourth
+// piece is at most this small so headers get split too
+#define BENCH_FRAMER_TINY 30
+// -g puts a chunk without a FLAC frame sync code in front of every 16th
+// wire chunk
+#define BENCH_GARBAGE_EVERY 16
+#define BENCH_GARBAGE_SIZE 1024
+
+// heap accounting, every allocation carries its size in front
+#define HEAP_HEADER 16
+
+typedef struct bench_heap_s {
+  int64_t current;
+  int64_t peak;
+  uint64_t allocs;
+} bench_heap_t;
+
+static bench_heap_t heap;
+
+void *__real_malloc(size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+/**
+ *
+ */
+static void heap_add(int64_t size) {
+  heap.current += size;
+  if (heap.current > heap.peak) {
+    heap.peak = heap.current;
+  }
+}
+
+/**
+ *
+ */
+void *__wrap_malloc(size_t size) {
+  char *p = __real_malloc(size + HEAP_HEADER);
+
+  if (p == NULL) {
+    return NULL;
+  }
+
+  memcpy(p, &size, sizeof(size));
+  heap_add(size);
+  heap.allocs++;
+
+  return p + HEAP_HEADER;
+}
+
+/**
+ *
+ */
+void __wrap_free(void *ptr) {
+  char *p = (char *)ptr - HEAP_HEADER;
+  size_t size;
+
+  if (ptr == NULL) {
+    return;
+  }
+
+  memcpy(&size, p, sizeof(size));
+  heap.current -= size;
+
+  __real_free(p);
+}
+
+/**
+ *
+ */
+void *__wrap_calloc(size_t n, size_t size) {
+  void *p;
+
+  if ((size != 0) && (n > SIZE_MAX / size)) {
+    return NULL;
+  }
+
+  p = __wrap_malloc(n * size);
+  if (p != NULL) {
+    memset(p, 0, n * size);
+  }
+
+  return p;
+}
+
+/**
+ *
+ */
+void *__wrap_realloc(void *ptr, size_t size) {
+  char *p;
+  size_t old;
+
+  if (ptr == NULL) {
+    return __wrap_malloc(size);
+  }
+
+  if (size == 0) {
+    __wrap_free(ptr);
+
+    return NULL;
+  }
+
+  p = (char *)ptr - HEAP_HEADER;
+  memcpy(&old, p, sizeof(old));
+
+  p = __real_realloc(p, size + HEAP_HEADER);
+  if (p == NULL) {
+    return NULL;
+  }
+
+  memcpy(p, &size, sizeof(size));
+  heap.current -= old;
+  heap_add(size);
+  heap.allocs++;
+
+  return p + HEAP_HEADER;
+}
+
+typedef struct bench_s {
+  const char *name;
+  snapcast_framer_t framer;
+
+  codec_type_t codec;
+  uint32_t sr;
+  uint32_t ch;
+  uint32_t bits;
+
+  FLAC__StreamDecoder *flacDecoder;
+  chunk_cursor_t flacInput;
+  uint32_t flacMaxBlocksize;
+
+  OpusMSDecoder *opusDecoder;
+  opus_mapping_t opusMapping;
+  uint8_t opusRoute[2];  // channels played, like the client's defaults
+  opus_int16 *opusPcm;
+  uint32_t opusPcmFrames;
+  char *opusPacket;
+  uint32_t opusPacketSize;
+
+#if CODEC_BENCH_OGG
+  bool oggOpen;
+  ogg_sync_state oggSync;
+  ogg_stream_state oggStream;
+  bool oggStreamInit;
+  bool oggOpus;  // Ogg/Opus, packets go to opusDecoder
+  vorbis_info vorbisInfo;
+  vorbis_comment vorbisComment;
+  vorbis_dsp_state vorbisDsp;
+  vorbis_block vorbisBlock;
+  bool vorbisInit;
+#endif
+
+  pcm_unpack_t pcmUnpack;
+
+  // wire chunk payload, spans point into the recording
+  sg_chain_t input;
+
+  // player chunk, reused so its allocation doesn't count
+  pcm_chunk_message_t chunk;
+  pcm_chunk_fragment_t fragment;
+
+  int64_t start_ns;
+  uint64_t startCycles;
+
+  uint32_t chunks;
+  uint64_t frames;
+  int64_t decode_ns;
+  uint64_t cycles;
+  uint64_t allocs;
+  uint32_t checksum;
+  uint32_t errors;
+
+  bool garbage;  // insert garbage chunks, see BENCH_GARBAGE_EVERY
+  uint32_t garbageChunks;
+} bench_t;
+
+// no 0xFF byte, so there is no frame sync code in it
+static char benchGarbage[BENCH_GARBAGE_SIZE];
+
+/**
+ *
+ */
+static int64_t bench_now_ns(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * 0 where there is no cycle counter, cycles_per_frame is reported as 0 then.
+ */
+static uint64_t bench_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Measure a decode step, allocations done by it count.
+ */
+static void bench_begin(bench_t *b) {
+  b->allocs -= heap.allocs;
+  b->startCycles = bench_cycles();
+  b->start_ns = bench_now_ns();
+}
+
+/**
+ *
+ */
+static void bench_end(bench_t *b) {
+  b->decode_ns += bench_now_ns() - b->start_ns;
+  b->cycles += bench_cycles() - b->startCycles;
+  b->allocs += heap.allocs;
+}
+
+/**
+ * Player chunk for size bytes, grown outside of the measurement.
+ */
+static int bench_chunk_reserve(bench_t *b, uint32_t size) {
+  if (size > b->fragment.size) {
+    char *payload = realloc(b->fragment.payload, size);
+
+    if (payload == NULL) {
+      return -1;
+    }
+
+    b->fragment.payload = payload;
+    b->fragment.size = size;
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+static void bench_chunk_done(bench_t *b, uint32_t frames) {
+  const uint32_t *words = (const uint32_t *)b->fragment.payload;
+  uint32_t count = frames * pcm_pack_container_bits(b->bits) / 16;
+
+  for (uint32_t i = 0; i < count; i++) {
+    b->checksum = b->checksum * 31 + words[i];
+  }
+
+  b->frames += frames;
+}
+
+/**
+ *
+ */
+static FLAC__StreamDecoderReadStatus bench_flac_read(
+    const FLAC__StreamDecoder *decoder, FLAC__byte buffer[], size_t *bytes,
+    void *client_data) {
+  bench_t *b = (bench_t *)client_data;
+
+  if (chunk_cursor_remaining(&b->flacInput) == 0) {
+    return FLAC__STREAM_DECODER_READ_STATUS_END_OF_STREAM;
+  }
+
+  *bytes = chunk_cursor_read(&b->flacInput, (char *)buffer, *bytes);
+
+  return FLAC__STREAM_DECODER_READ_STATUS_CONTINUE;
+}
+
+/**
+ *
+ */
+static FLAC__StreamDecoderTellStatus bench_flac_tell(
+    const FLAC__StreamDecoder *decoder, FLAC__uint64 *absolute_byte_offset,
+    void *client_data) {
+  bench_t *b = (bench_t *)client_data;
+
+  *absolute_byte_offset = chunk_cursor_tell(&b->flacInput);
+
+  return FLAC__STREAM_DECODER_TELL_STATUS_OK;
+}
+
+/**
+ * Same work as write_callback() in main.c.
+ */
+static FLAC__StreamDecoderWriteStatus bench_flac_write(
+    const FLAC__StreamDecoder *decoder, const FLAC__Frame *frame,
+    const FLAC__int32 *const buffer[], void *client_data) {
+  bench_t *b = (bench_t *)client_data;
+  uint32_t blocksize = frame->header.blocksize;
+  FLAC__uint64 frameEnd;
+  int64_t ts;
+
+  if ((frame->header.channels != 2) ||
+      (frame->header.bits_per_sample != b->bits) ||
+      (blocksize * pcm_pack_container_bits(b->bits) / 4 > b->fragment.size)) {
+    b->errors++;
+
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+  }
+
+  if ((FLAC__stream_decoder_get_decode_position(decoder, &frameEnd) == 0) ||
+      (chunk_cursor_frame(&b->flacInput, frameEnd, blocksize, b->sr, &ts) <
+       0)) {
+    b->errors++;
+
+    return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+  }
+
+  pcm_pack_chunk_stereo(&b->chunk, 0, buffer[0], buffer[1], blocksize,
+                        b->bits);
+  bench_chunk_done(b, blocksize);
+
+  return FLAC__STREAM_DECODER_WRITE_STATUS_CONTINUE;
+}
+
+/**
+ *
+ */
+static void bench_flac_metadata(const FLAC__StreamDecoder *decoder,
+                                const FLAC__StreamMetadata *metadata,
+                                void *client_data) {
+  bench_t *b = (bench_t *)client_data;
+
+  if (metadata->type == FLAC__METADATA_TYPE_STREAMINFO) {
+    b->sr = metadata->data.stream_info.sample_rate;
+    b->ch = metadata->data.stream_info.channels;
+    b->bits = metadata->data.stream_info.bits_per_sample;
+    b->flacMaxBlocksize = metadata->data.stream_info.max_blocksize;
+  }
+}
+
+/**
+ *
+ */
+static void bench_flac_error(const FLAC__StreamDecoder *decoder,
+                             FLAC__StreamDecoderErrorStatus status,
+                             void *client_data) {
+  bench_t *b = (bench_t *)client_data;
+
+  b->errors++;
+}
+
+/**
+ * Decode what the current chunk holds like the client's
+ * stream_decode_chunk(), dropping its rest if the decoder ran out of input
+ * in the middle of a frame or of the search for one.
+ */
+static void bench_decode_flac(bench_t *b) {
+  while (chunk_cursor_remaining(&b->flacInput) > 0) {
+    FLAC__bool ok = FLAC__stream_decoder_process_single(b->flacDecoder);
+    FLAC__StreamDecoderState state =
+        FLAC__stream_decoder_get_state(b->flacDecoder);
+
+    if (ok && (state != FLAC__STREAM_DECODER_END_OF_STREAM) &&
+        (state != FLAC__STREAM_DECODER_ABORTED)) {
+      continue;
+    }
+
+    b->errors++;
+
+    FLAC__stream_decoder_flush(b->flacDecoder);
+    chunk_cursor_skip(&b->flacInput);
+
+    break;
+  }
+}
+
+/**
+ * A garbage chunk ahead of the wire chunk, not timed.
+ */
+static void bench_decode_garbage(bench_t *b, int64_t time_us) {
+  sg_chain_t garbage;
+
+  sg_chain_init(&garbage);
+  if (sg_chain_append(&garbage, benchGarbage, sizeof(benchGarbage), NULL,
+                      NULL) == 0) {
+    chunk_cursor_push(&b->flacInput, &garbage, time_us);
+    bench_decode_flac(b);
+    b->garbageChunks++;
+  }
+  sg_chain_release(&garbage);
+}
+
+/**
+ *
+ */
+static void bench_codec_close(bench_t *b) {
+  if (b->flacDecoder != NULL) {
+    FLAC__stream_decoder_finish(b->flacDecoder);
+    FLAC__stream_decoder_delete(b->flacDecoder);
+    b->flacDecoder = NULL;
+  }
+
+#if CODEC_BENCH_OGG
+  if (b->oggOpen) {
+    if (b->vorbisInit) {
+      vorbis_block_clear(&b->vorbisBlock);
+      vorbis_dsp_clear(&b->vorbisDsp);
+      b->vorbisInit = false;
+    }
+
+    vorbis_comment_clear(&b->vorbisComment);
+    vorbis_info_clear(&b->vorbisInfo);
+
+    if (b->oggStreamInit) {
+      ogg_stream_clear(&b->oggStream);
+      b->oggStreamInit = false;
+    }
+
+    ogg_sync_clear(&b->oggSync);
+    b->oggOpus = false;
+    b->oggOpen = false;
+  }
+#endif
+
+  free(b->opusDecoder);
+  b->opusDecoder = NULL;
+  free(b->opusPcm);
+  b->opusPcm = NULL;
+  b->opusPcmFrames = 0;
+}
+
+/**
+ * Opus decoder and output for sr and opusMapping, like opus_session_open()
+ * in main.c.
+ */
+static int bench_opus_open(bench_t *b) {
+  const opus_mapping_t *mapping = &b->opusMapping;
+  int error;
+
+  b->ch = mapping->channels;
+  b->opusRoute[0] = 0;
+  b->opusRoute[1] = (mapping->channels > 1) ? 1 : 0;
+
+  b->opusDecoder = malloc(
+      opus_multistream_decoder_get_size(mapping->streams, mapping->coupled));
+  if (b->opusDecoder == NULL) {
+    return -1;
+  }
+
+  error = opus_multistream_decoder_init(b->opusDecoder, b->sr,
+                                        mapping->channels, mapping->streams,
+                                        mapping->coupled, mapping->mapping);
+  if (error != OPUS_OK) {
+    fprintf(stderr, "%s: %s\n", b->name, opus_strerror(error));
+
+    return -1;
+  }
+
+  b->opusPcmFrames = b->sr * BENCH_OPUS_MAX_MS / 1000;
+  b->opusPcm = malloc(b->opusPcmFrames * b->ch * sizeof(opus_int16));
+  if ((b->opusPcm == NULL) ||
+      (bench_chunk_reserve(b, b->opusPcmFrames * 4) < 0)) {
+    return -1;
+  }
+
+  return 0;
+}
+
+#if CODEC_BENCH_OGG
+/**
+ * Like ogg_session_open() in main.c.
+ */
+static int bench_ogg_open(bench_t *b, const char *header, uint32_t size) {
+  ogg_page page;
+  ogg_packet packet;
+  uint32_t headers = 0;
+  char *buffer;
+
+  ogg_sync_init(&b->oggSync);
+  vorbis_info_init(&b->vorbisInfo);
+  vorbis_comment_init(&b->vorbisComment);
+  b->oggOpen = true;
+
+  buffer = ogg_sync_buffer(&b->oggSync, size);
+  if (buffer == NULL) {
+    return -1;
+  }
+
+  memcpy(buffer, header, size);
+  ogg_sync_wrote(&b->oggSync, size);
+
+  while (ogg_sync_pageout(&b->oggSync, &page) == 1) {
+    if (!b->oggStreamInit) {
+      ogg_stream_init(&b->oggStream, ogg_page_serialno(&page));
+      b->oggStreamInit = true;
+    }
+
+    if (ogg_stream_pagein(&b->oggStream, &page) < 0) {
+      continue;
+    }
+
+    while (ogg_stream_packetout(&b->oggStream, &packet) == 1) {
+      if ((headers == 0) && (packet.bytes >= 19) &&
+          (memcmp(packet.packet, "OpusHead", 8) == 0)) {
+        if (opus_mapping_parse_head(&b->opusMapping, packet.packet,
+                                    packet.bytes) < 0) {
+          return -1;
+        }
+
+        b->oggOpus = true;
+        b->sr = 48000;
+        b->bits = 16;
+      }
+
+      if (!b->oggOpus &&
+          (vorbis_synthesis_headerin(&b->vorbisInfo, &b->vorbisComment,
+                                     &packet) != 0)) {
+        fprintf(stderr, "%s: Ogg stream is neither Vorbis nor Opus\n",
+                b->name);
+
+        return -1;
+      }
+
+      headers++;
+    }
+  }
+
+  if (b->oggOpus) {
+    return bench_opus_open(b);
+  }
+
+  if ((headers < 3) ||
+      (vorbis_synthesis_init(&b->vorbisDsp, &b->vorbisInfo) != 0) ||
+      (vorbis_block_init(&b->vorbisDsp, &b->vorbisBlock) != 0)) {
+    return -1;
+  }
+
+  b->vorbisInit = true;
+  b->sr = b->vorbisInfo.rate;
+  b->ch = b->vorbisInfo.channels;
+  b->bits = 16;
+
+  // a packet completes at most half a long block
+  return bench_chunk_reserve(b, vorbis_info_blocksize(&b->vorbisInfo, 1) * 2);
+}
+#endif
+
+/**
+ * Like stream_codec_header_cb() in main.c.
+ */
+static int bench_codec_header(void *ctx, const base_message_t *base,
+                              const codec_header_message_t *header) {
+  bench_t *b = (bench_t *)ctx;
+  const char *payload = header->payload;
+  uint16_t u16;
+  uint32_t u32;
+
+  bench_codec_close(b);
+
+  if (strcmp(header->codec, "flac") == 0) {
+    FLAC__uint64 metadataEnd;
+
+    b->codec = FLAC;
+
+    b->flacDecoder = FLAC__stream_decoder_new();
+    if ((b->flacDecoder == NULL) ||
+        (FLAC__stream_decoder_init_stream(
+             b->flacDecoder, bench_flac_read, NULL, bench_flac_tell, NULL,
+             NULL, bench_flac_write, bench_flac_metadata, bench_flac_error,
+             b) != FLAC__STREAM_DECODER_INIT_STATUS_OK)) {
+      return -1;
+    }
+
+    sg_chain_release(&b->input);
+    sg_chain_append(&b->input, payload, header->size, NULL, NULL);
+    chunk_cursor_reset(&b->flacInput);
+    chunk_cursor_push(&b->flacInput, &b->input, 0);
+
+    FLAC__stream_decoder_process_until_end_of_metadata(b->flacDecoder);
+
+    if (FLAC__stream_decoder_get_decode_position(b->flacDecoder,
+                                                 &metadataEnd) == 0) {
+      metadataEnd = chunk_cursor_tell(&b->flacInput);
+    }
+    chunk_cursor_sync(&b->flacInput, metadataEnd);
+
+    sg_chain_release(&b->input);
+
+    if ((b->flacMaxBlocksize == 0) ||
+        (bench_chunk_reserve(b, b->flacMaxBlocksize * 8) < 0)) {
+      return -1;
+    }
+#if CODEC_BENCH_OGG
+  } else if (strcmp(header->codec, "ogg") == 0) {
+    b->codec = OGG;
+
+    if (bench_ogg_open(b, payload, header->size) < 0) {
+      return -1;
+    }
+#endif
+  } else if (strcmp(header->codec, "opus") == 0) {
+    b->codec = OPUS;
+
+    if (header->size < 12) {
+      return -1;
+    }
+
+    memcpy(&u32, payload + 4, sizeof(u32));
+    b->sr = u32;
+    memcpy(&u16, payload + 8, sizeof(u16));
+    b->bits = u16;
+    memcpy(&u16, payload + 10, sizeof(u16));
+    if ((opus_mapping_default(&b->opusMapping, u16) < 0) ||
+        (bench_opus_open(b) < 0)) {
+      return -1;
+    }
+  } else if (strcmp(header->codec, "pcm") == 0) {
+    b->codec = PCM;
+
+    if (header->size < 36) {
+      return -1;
+    }
+
+    memcpy(&u16, payload + 22, sizeof(u16));
+    b->ch = u16;
+    memcpy(&u32, payload + 24, sizeof(u32));
+    b->sr = u32;
+    memcpy(&u16, payload + 34, sizeof(u16));
+    b->bits = u16;
+  } else {
+    fprintf(stderr, "%s: codec %s not supported\n", b->name, header->codec);
+
+    return -1;
+  }
+
+  // Opus is decoded to 16 bit whatever the header says
+  if (b->codec == OPUS) {
+    b->bits = 16;
+  }
+
+  // Opus plays two of any count of channels
+  if (((b->ch != 2) && (b->opusDecoder == NULL)) ||
+      (pcm_pack_container_bits(b->bits) == 0) || (b->sr == 0)) {
+    fprintf(stderr,
+            "%s: only 16, 24 and 32 bit stereo is supported, got %u:%u:%u\n",
+            b->name, b->sr, b->bits, b->ch);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int bench_wire_chunk_start(void *ctx, const base_message_t *base,
+                                  const wire_chunk_message_t *chunk) {
+  bench_t *b = (bench_t *)ctx;
+
+  sg_chain_release(&b->input);
+
+  if (b->codec == PCM) {
+    if (bench_chunk_reserve(b, chunk->size) < 0) {
+      return -1;
+    }
+
+    pcm_unpack_reset(&b->pcmUnpack);
+  }
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int bench_wire_chunk_data(void *ctx, const char *data, uint32_t len,
+                                 void *owner) {
+  bench_t *b = (bench_t *)ctx;
+
+  switch (b->codec) {
+    case FLAC:
+    case OGG:
+    case OPUS:
+      // the recording outlives the chunk, like a referenced pbuf
+      if (sg_chain_append(&b->input, data, len, NULL, NULL) != 0) {
+        fprintf(stderr, "%s: wire chunk has too many segments\n", b->name);
+
+        return -1;
+      }
+
+      break;
+
+    case PCM:
+      bench_begin(b);
+      pcm_unpack_wire(&b->pcmUnpack, &b->chunk, data, len, b->bits);
+      bench_end(b);
+
+      break;
+
+    default:
+      break;
+  }
+
+  return 0;
+}
+
+/**
+ * Like stream_opus_packet() in main.c.
+ */
+static void bench_opus_packet(bench_t *b, const unsigned char *packet,
+                              uint32_t packetLen) {
+  int frames;
+
+  frames = opus_packet_get_nb_samples(packet, packetLen, b->sr);
+  if ((frames <= 0) || (frames > b->opusPcmFrames)) {
+    b->errors++;
+
+    return;
+  }
+
+  frames = opus_multistream_decode(b->opusDecoder, packet, packetLen,
+                                   b->opusPcm, frames, 0);
+  if (frames < 0) {
+    b->errors++;
+
+    return;
+  }
+
+  pcm_pack_chunk_s16_routed(&b->chunk, 0, b->opusPcm, b->opusMapping.channels,
+                            b->opusRoute[0], b->opusRoute[1], frames);
+  bench_chunk_done(b, frames);
+}
+
+/**
+ * Like stream_decode_chunk() in main.c.
+ */
+static int bench_decode_opus(bench_t *b) {
+  const unsigned char *packet;
+  uint32_t packetLen = b->input.len;
+
+  if ((b->input.count > 1) && (b->opusPacketSize < packetLen)) {
+    char *buf = realloc(b->opusPacket, packetLen);
+
+    if (buf == NULL) {
+      return -1;
+    }
+
+    b->opusPacket = buf;
+    b->opusPacketSize = packetLen;
+  }
+
+  packet = (const unsigned char *)sg_chain_linearize(&b->input, b->opusPacket,
+                                                     b->opusPacketSize);
+  if (packet == NULL) {
+    b->errors++;
+
+    return 0;
+  }
+
+  bench_opus_packet(b, packet, packetLen);
+
+  return 0;
+}
+
+#if CODEC_BENCH_OGG
+/**
+ * Like stream_decode_ogg() in main.c, the wire chunk is copied to the Ogg
+ * sync buffer and its packets are decoded one after the other.
+ */
+static int bench_decode_ogg(bench_t *b) {
+  sg_cursor_t cursor;
+  ogg_page page;
+  ogg_packet packet;
+  char *buffer;
+  int ret;
+
+  buffer = ogg_sync_buffer(&b->oggSync, b->input.len);
+  if (buffer == NULL) {
+    return -1;
+  }
+
+  sg_cursor_init(&cursor, &b->input);
+  ogg_sync_wrote(&b->oggSync, sg_cursor_read(&cursor, buffer, b->input.len));
+
+  while ((ret = ogg_sync_pageout(&b->oggSync, &page)) != 0) {
+    if ((ret < 0) || (ogg_stream_pagein(&b->oggStream, &page) < 0)) {
+      b->errors++;
+
+      continue;
+    }
+
+    while ((ret = ogg_stream_packetout(&b->oggStream, &packet)) != 0) {
+      ogg_int32_t **pcm;
+      int frames;
+
+      if (ret < 0) {
+        b->errors++;
+
+        continue;
+      }
+
+      if (b->oggOpus) {
+        if ((packet.bytes < 8) ||
+            (memcmp(packet.packet, "OpusTags", 8) != 0)) {
+          bench_opus_packet(b, packet.packet, packet.bytes);
+        }
+
+        continue;
+      }
+
+      if (vorbis_synthesis(&b->vorbisBlock, &packet) != 0) {
+        b->errors++;
+
+        continue;
+      }
+
+      vorbis_synthesis_blockin(&b->vorbisDsp, &b->vorbisBlock);
+
+      frames = vorbis_synthesis_pcmout(&b->vorbisDsp, &pcm);
+      if (frames <= 0) {
+        continue;
+      }
+
+      if (pcm_pack_chunk_fixed_s16_stereo(&b->chunk, 0, pcm[0], pcm[1],
+                                          frames,
+                                          BENCH_VORBIS_FRACTION_BITS) <
+          frames) {
+        b->errors++;
+      } else {
+        bench_chunk_done(b, frames);
+      }
+
+      vorbis_synthesis_read(&b->vorbisDsp, frames);
+    }
+  }
+
+  return 0;
+}
+#endif
+
+/**
+ *
+ */
+static int bench_wire_chunk_end(void *ctx, const base_message_t *base,
+                                const wire_chunk_message_t *chunk) {
+  bench_t *b = (bench_t *)ctx;
+  int ret = 0;
+
+  b->chunks++;
+
+  switch (b->codec) {
+    case FLAC: {
+      int64_t time_us = (int64_t)chunk->timestamp.sec * 1000000LL +
+                        chunk->timestamp.usec;
+
+      if (b->garbage && (b->chunks % BENCH_GARBAGE_EVERY == 0)) {
+        bench_decode_garbage(b, time_us);
+      }
+
+      bench_begin(b);
+
+      chunk_cursor_push(&b->flacInput, &b->input, time_us);
+      bench_decode_flac(b);
+
+      bench_end(b);
+
+      break;
+    }
+
+    case OPUS:
+      bench_begin(b);
+      ret = bench_decode_opus(b);
+      bench_end(b);
+
+      break;
+
+#if CODEC_BENCH_OGG
+    case OGG:
+      bench_begin(b);
+      ret = bench_decode_ogg(b);
+      bench_end(b);
+
+      break;
+#endif
+
+    case PCM:
+      bench_chunk_done(
+          b, b->pcmUnpack.offset / (pcm_pack_container_bits(b->bits) / 4));
+
+      break;
+
+    default:
+      break;
+  }
+
+  sg_chain_release(&b->input);
+
+  return ret;
+}
+
+static const snapcast_framer_callbacks_t benchCallbacks = {
+    .wire_chunk_start = bench_wire_chunk_start,
+    .wire_chunk_data = bench_wire_chunk_data,
+    .wire_chunk_end = bench_wire_chunk_end,
+    .codec_header = bench_codec_header,
+};
+
+/**
+ *
+ */
+static char *bench_load(const char *path, uint32_t *len) {
+  FILE *f = fopen(path, "rb");
+  char *data = NULL;
+  long size;
+
+  if (f == NULL) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+
+    return NULL;
+  }
+
+  if ((fseek(f, 0, SEEK_END) == 0) && ((size = ftell(f)) > 0) &&
+      (fseek(f, 0, SEEK_SET) == 0)) {
+    data = __real_malloc(size);
+    if ((data != NULL) && (fread(data, 1, size, f) != (size_t)size)) {
+      __real_free(data);
+      data = NULL;
+    }
+
+    *len = size;
+  }
+
+  fclose(f);
+
+  if (data == NULL) {
+    fprintf(stderr, "%s: can't read recording\n", path);
+  }
+
+  return data;
+}
+
+/**
+ * One pass over a recording.
+ */
+static int bench_run(bench_t *b, const char *data, uint32_t len,
+                     uint32_t segment) {
+  int ret = 0;
+
+  memset(&heap, 0, sizeof(heap));
+
+  sg_chain_init(&b->input);
+  b->chunk.fragment = &b->fragment;
+  snapcast_framer_init(&b->framer, &benchCallbacks, b);
+
+  for (uint32_t pos = 0; pos < len; pos += segment) {
+    uint32_t n = (len - pos < segment) ? (len - pos) : segment;
+
+    ret = snapcast_framer_feed(&b->framer, &data[pos], n, NULL);
+    if (ret != SNAPCAST_FRAMER_OK) {
+      fprintf(stderr, "%s: stream error %d at byte %u\n", b->name, ret, pos);
+
+      break;
+    }
+  }
+
+  snapcast_framer_deinit(&b->framer);
+  bench_codec_close(b);
+  sg_chain_release(&b->input);
+  free(b->opusPacket);
+  free(b->fragment.payload);
+
+  return ret;
+}
+
+/**
+ *
+ */
+static void bench_report(const bench_t *b, int64_t peakHeap) {
+  static const char *codecName[] = {"none", "pcm", "flac", "ogg", "opus"};
+  double audio_s = (b->sr > 0) ? (double)b->frames / b->sr : 0;
+  double decode_s = b->decode_ns / 1e9;
+
+  printf(
+      "{\"stream\":\"%s\",\"codec\":\"%s\",\"sr\":%u,\"ch\":%u,\"bits\":%u,"
+      "\"chunks\":%u,\"frames\":%" PRIu64
+      ",\"audio_s\":%.3f,\"decode_s\":%.6f,\"rtf\":%.6f,"
+      "\"cycles_per_frame\":%.1f,\"peak_heap\":%" PRId64
+      ",\"allocs_per_chunk\":%.3f,\"garbage\":%u,\"errors\":%u,"
+      "\"checksum\":\"%08x\"}\n",
+      b->name, codecName[b->codec], b->sr, b->ch, b->bits, b->chunks,
+      b->frames, audio_s, decode_s, (audio_s > 0) ? decode_s / audio_s : 0,
+      (b->frames > 0) ? (double)b->cycles / b->frames : 0, peakHeap,
+      (b->chunks > 0) ? (double)b->allocs / b->chunks : 0, b->garbageChunks,
+      b->errors, b->checksum);
+}
+
+// what the framer passed on, so its work can't be skipped
+typedef struct bench_framer_s {
+  uint32_t chunks;
+  uint64_t payload;
+} bench_framer_t;
+
+/**
+ *
+ */
+static int bench_framer_data(void *ctx, const char *data, uint32_t len,
+                             void *owner) {
+  ((bench_framer_t *)ctx)->payload += len;
+
+  return 0;
+}
+
+/**
+ *
+ */
+static int bench_framer_end(void *ctx, const base_message_t *base,
+                            const wire_chunk_message_t *chunk) {
+  ((bench_framer_t *)ctx)->chunks++;
+
+  return 0;
+}
+
+static const snapcast_framer_callbacks_t benchFramerCallbacks = {
+    .wire_chunk_data = bench_framer_data,
+    .wire_chunk_end = bench_framer_end,
+};
+
+/**
+ * Time the framer alone on a recording split at random boundaries of up to
+ * segment bytes, the fastest of repeat passes counts.
+ */
+static int bench_framer(const char *name, const char *data, uint32_t len,
+                        uint32_t repeat, uint32_t segment) {
+  snapcast_framer_t framer;
+  bench_framer_t f;
+  uint32_t *splits, count = 0, messages = 0;
+  int64_t best_ns = INT64_MAX;
+  uint64_t bestCycles = 0;
+  int ret = 0;
+
+  // drawn up front so rand() isn't timed, the same for every pass
+  splits = __real_malloc(len * sizeof(uint32_t));
+  if (splits == NULL) {
+    return -1;
+  }
+
+  srand(1704);
+  for (uint32_t pos = 0; pos < len; pos += splits[count++]) {
+    uint32_t n = (rand() % 4) ? 1 + rand() % segment
+                              : 1 + rand() % BENCH_FRAMER_TINY;
+
+    splits[count] = (n < len - pos) ? n : len - pos;
+  }
+
+  for (uint32_t r = 0; (r < repeat) && (ret == 0); r++) {
+    const char *pos = data;
+    uint64_t cycles;
+    int64_t ns;
+
+    memset(&f, 0, sizeof(f));
+    snapcast_framer_init(&framer, &benchFramerCallbacks, &f);
+
+    cycles = bench_cycles();
+    ns = bench_now_ns();
+
+    for (uint32_t i = 0; i < count; i++) {
+      ret = snapcast_framer_feed(&framer, pos, splits[i], NULL);
+      if (ret != SNAPCAST_FRAMER_OK) {
+        fprintf(stderr, "%s: stream error %d at byte %u\n", name, ret,
+                (uint32_t)(pos - data));
+
+        break;
+      }
+
+      pos += splits[i];
+    }
+
+    ns = bench_now_ns() - ns;
+    cycles = bench_cycles() - cycles;
+    if (ns < best_ns) {
+      best_ns = ns;
+      bestCycles = cycles;
+    }
+
+    messages = framer.messages;
+    snapcast_framer_deinit(&framer);
+  }
+
+  __real_free(splits);
+
+  printf(
+      "{\"framer\":\"%s\",\"bytes\":%u,\"segments\":%u,\"messages\":%u,"
+      "\"chunks\":%u,\"payload\":%" PRIu64
+      ",\"mb_per_s\":%.1f,\"ns_per_message\":%.1f,"
+      "\"cycles_per_message\":%.1f}\n",
+      name, len, count, messages, f.chunks, f.payload,
+      (best_ns > 0) ? len * 1e3 / best_ns : 0,
+      (messages > 0) ? (double)best_ns / messages : 0,
+      (messages > 0) ? (double)bestCycles / messages : 0);
+
+  return ret;
+}
+
+// synthetic audio for the kernels, in each of the layouts they take
+typedef struct bench_kernel_s {
+  uint32_t bits;
+  int32_t left[BENCH_KERNEL_FRAMES];
+  int32_t right[BENCH_KERNEL_FRAMES];
+  int16_t interleaved[2 * BENCH_KERNEL_FRAMES];
+  int32_t wire[2 * BENCH_KERNEL_FRAMES];
+  char segments[BENCH_KERNEL_WIRE_OFFSET + sizeof(int32_t) * 2 *
+                BENCH_KERNEL_FRAMES];
+
+  uint32_t out[2 * BENCH_KERNEL_FRAMES];
+  uint32_t packed[2 * BENCH_KERNEL_FRAMES];  // player words, resampler input
+  pcm_chunk_fragment_t fragment;
+  pcm_chunk_message_t chunk;
+  pcm_unpack_t unpack;
+  resampler_t resampler;
+} bench_kernel_t;
+
+/**
+ *
+ */
+static void bench_kernel_pack(bench_kernel_t *k) {
+  pcm_pack_chunk_stereo(&k->chunk, 0, k->left, k->right, BENCH_KERNEL_FRAMES,
+                        k->bits);
+}
+
+/**
+ * A wire chunk in one span, like a PCM chunk in a single TCP segment.
+ */
+static void bench_kernel_unpack(bench_kernel_t *k) {
+  const char *data = (k->bits == 16) ? (const char *)k->interleaved
+                                     : (const char *)k->wire;
+  uint32_t len = BENCH_KERNEL_FRAMES * 2 * ((k->bits == 16) ? 2 : 4);
+
+  pcm_unpack_reset(&k->unpack);
+  pcm_unpack_wire(&k->unpack, &k->chunk, data, len, k->bits);
+}
+
+/**
+ * A wire chunk in TCP segments, the first one starting misaligned.
+ */
+static void bench_kernel_unpack_segments(bench_kernel_t *k) {
+  uint32_t len = BENCH_KERNEL_FRAMES * 2 * ((k->bits == 16) ? 2 : 4);
+  const char *data = &k->segments[BENCH_KERNEL_WIRE_OFFSET];
+  uint32_t n = BENCH_SEGMENT_DEFAULT - BENCH_KERNEL_WIRE_OFFSET;
+
+  pcm_unpack_reset(&k->unpack);
+  for (uint32_t pos = 0; pos < len; pos += n, n = BENCH_SEGMENT_DEFAULT) {
+    pcm_unpack_wire(&k->unpack, &k->chunk, &data[pos],
+                    (len - pos < n) ? (len - pos) : n, k->bits);
+  }
+}
+
+/**
+ * 16 bit unpacking as the client did it before pcm_unpack_s16_wire(), a byte
+ * and a byte shuffle at a time, to compare against.
+ */
+static void bench_kernel_unpack_bytewise(bench_kernel_t *k) {
+  const char *data = (const char *)k->interleaved;
+  uint32_t len = BENCH_KERNEL_FRAMES * 4;
+  uint32_t offset = 0;
+  uint32_t tmpData = 0;
+  int32_t shift = 3;
+
+  while (len--) {
+    tmpData |= ((uint32_t)(uint8_t)data[offset++] << (8 * shift));
+
+    shift--;
+    if (shift < 0) {
+      volatile uint32_t *sample;
+      uint8_t dummy1;
+      uint32_t dummy2 = 0;
+
+      shift = 3;
+
+      dummy1 = tmpData >> 24;
+      dummy2 |= (uint32_t)dummy1 << 16;
+      dummy1 = tmpData >> 16;
+      dummy2 |= (uint32_t)dummy1 << 24;
+      dummy1 = tmpData >> 8;
+      dummy2 |= (uint32_t)dummy1 << 0;
+      dummy1 = tmpData >> 0;
+      dummy2 |= (uint32_t)dummy1 << 8;
+
+      sample = (volatile uint32_t *)&k->out[offset / 4 - 1];
+      *sample = dummy2;
+
+      tmpData = 0;
+    }
+  }
+}
+
+/**
+ *
+ */
+static void bench_kernel_pack_interleaved(bench_kernel_t *k) {
+  pcm_pack_chunk_s16_interleaved(&k->chunk, 0, k->interleaved,
+                                 BENCH_KERNEL_FRAMES);
+}
+
+/**
+ * Drift correction of a chunk, the client clock 300 ppm slow.
+ */
+static void bench_kernel_resample(bench_kernel_t *k) {
+  uint32_t used;
+
+  resampler_reset(&k->resampler);
+  resampler_process(&k->resampler, k->packed, BENCH_KERNEL_FRAMES, &used,
+                    k->out, BENCH_KERNEL_FRAMES);
+}
+
+/**
+ * Time a kernel, the fastest of BENCH_KERNEL_PASSES counts.
+ */
+static void bench_kernel(const char *name, bench_kernel_t *k,
+                         void (*run)(bench_kernel_t *)) {
+  uint32_t words = BENCH_KERNEL_FRAMES * pcm_pack_container_bits(k->bits) / 16;
+  int64_t best_ns = INT64_MAX;
+  uint64_t bestCycles = 0;
+  uint32_t checksum = 0;
+
+  for (uint32_t p = 0; p < BENCH_KERNEL_PASSES; p++) {
+    uint64_t cycles = bench_cycles();
+    int64_t ns = bench_now_ns();
+
+    run(k);
+
+    ns = bench_now_ns() - ns;
+    cycles = bench_cycles() - cycles;
+    if (ns < best_ns) {
+      best_ns = ns;
+      bestCycles = cycles;
+    }
+  }
+
+  for (uint32_t i = 0; i < words; i++) {
+    checksum = checksum * 31 + k->out[i];
+  }
+
+  printf(
+      "{\"kernel\":\"%s\",\"bits\":%u,\"frames\":%u,\"ns_per_frame\":%.3f,"
+      "\"cycles_per_frame\":%.2f,\"checksum\":\"%08x\"}\n",
+      name, k->bits, BENCH_KERNEL_FRAMES, (double)best_ns / BENCH_KERNEL_FRAMES,
+      (double)bestCycles / BENCH_KERNEL_FRAMES, checksum);
+}
+
+/**
+ * Pack and unpack kernels of each sample width on synthetic audio.
+ */
+static void bench_kernels(void) {
+  static bench_kernel_t k;
+  static const uint32_t widths[] = {16, 24, 32};
+
+  k.fragment.size = sizeof(k.out);
+  k.fragment.payload = (char *)k.out;
+  k.chunk.totalSize = sizeof(k.out);
+  k.chunk.fragment = &k.fragment;
+
+  for (uint32_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+    k.bits = widths[w];
+
+    // samples of the stream's width, sign extended like decoders do
+    srand(1);
+    for (uint32_t i = 0; i < BENCH_KERNEL_FRAMES; i++) {
+      uint32_t shift = 32 - k.bits;
+
+      k.left[i] = (int32_t)((uint32_t)rand() << shift) >> shift;
+      k.right[i] = (int32_t)((uint32_t)rand() << shift) >> shift;
+      k.interleaved[2 * i] = k.left[i];
+      k.interleaved[2 * i + 1] = k.right[i];
+      k.wire[2 * i] = k.left[i];
+      k.wire[2 * i + 1] = k.right[i];
+    }
+
+    memcpy(&k.segments[BENCH_KERNEL_WIRE_OFFSET],
+           (k.bits == 16) ? (const void *)k.interleaved : (const void *)k.wire,
+           BENCH_KERNEL_FRAMES * 2 * ((k.bits == 16) ? 2 : 4));
+
+    bench_kernel("pack", &k, bench_kernel_pack);
+    memcpy(k.packed, k.out, sizeof(k.packed));
+    bench_kernel("unpack", &k, bench_kernel_unpack);
+    bench_kernel("unpack_segments", &k, bench_kernel_unpack_segments);
+    if (k.bits == 16) {
+      bench_kernel("unpack_bytewise", &k, bench_kernel_unpack_bytewise);
+      bench_kernel("pack_interleaved", &k, bench_kernel_pack_interleaved);
+    }
+
+    resampler_init(&k.resampler, pcm_pack_container_bits(k.bits));
+    resampler_set_ppb(&k.resampler, 300000);
+    bench_kernel("resample", &k, bench_kernel_resample);
+  }
+}
+
+int main(int argc, char **argv) {
+  bool framerOnly = false;
+  bool garbage = false;
+  bool kernels = false;
+  uint32_t repeat = 1;
+  uint32_t segment = BENCH_SEGMENT_DEFAULT;
+  int failed = 0;
+  int i;
+
+  for (i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-r") == 0) && (i + 1 < argc)) {
+      repeat = strtoul(argv[++i], NULL, 0);
+    } else if ((strcmp(argv[i], "-s") == 0) && (i + 1 < argc)) {
+      segment = strtoul(argv[++i], NULL, 0);
+    } else if (strcmp(argv[i], "-f") == 0) {
+      framerOnly = true;
+    } else if (strcmp(argv[i], "-g") == 0) {
+      garbage = true;
+    } else if (strcmp(argv[i], "-k") == 0) {
+      kernels = true;
+    } else {
+      break;
+    }
+  }
+
+  if (((i >= argc) && !kernels) || (repeat == 0) || (segment == 0)) {
+    fprintf(stderr,
+            "usage: %s [-f] [-g] [-k] [-r repeat] [-s segment] "
+            "recording...\n",
+            argv[0]);
+
+    return 2;
+  }
+
+  if (kernels) {
+    bench_kernels();
+  }
+
+  for (uint32_t k = 0; k < BENCH_GARBAGE_SIZE; k++) {
+    benchGarbage[k] = (char)(k * 37 % 255);
+  }
+
+  for (; i < argc; i++) {
+    bench_t best, clean;
+    int64_t peakHeap = 0;
+    uint32_t len;
+    char *data = bench_load(argv[i], &len);
+
+    if (data == NULL) {
+      failed = 1;
+
+      continue;
+    }
+
+    if (framerOnly) {
+      if (bench_framer(argv[i], data, len, repeat, segment) != 0) {
+        failed = 1;
+      }
+
+      __real_free(data);
+
+      continue;
+    }
+
+    // audio the garbage passes have to decode to, errors are expected there
+    if (garbage) {
+      memset(&clean, 0, sizeof(clean));
+      clean.name = argv[i];
+
+      if ((bench_run(&clean, data, len, segment) != 0) || (clean.errors > 0)) {
+        failed = 1;
+      }
+    }
+
+    // fastest pass counts, the others only add noise
+    for (uint32_t r = 0; r < repeat; r++) {
+      bench_t b;
+
+      memset(&b, 0, sizeof(b));
+      b.name = argv[i];
+      b.garbage = garbage;
+
+      if (bench_run(&b, data, len, segment) != 0) {
+        failed = 1;
+      } else if (garbage && ((b.frames != clean.frames) ||
+                             (b.checksum != clean.checksum))) {
+        fprintf(stderr, "%s: decoded differently after garbage chunks\n",
+                argv[i]);
+
+        failed = 1;
+      } else if (!garbage && (b.errors > 0)) {
+        failed = 1;
+      }
+
+      if ((r == 0) || (b.decode_ns < best.decode_ns)) {
+        best = b;
+      }
+
+      if (heap.peak > peakHeap) {
+        peakHeap = heap.peak;
+      }
+    }
+
+    bench_report(&best, peakHeap);
+
+    __real_free(data);
+  }
+
+  return failed;
+}
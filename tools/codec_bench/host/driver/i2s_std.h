@@ -0,0 +1,24 @@
+#ifndef __CODEC_BENCH_I2S_STD_H__
+#define __CODEC_BENCH_I2S_STD_H__
+
+// host stand-in, just the types used by player.h
+
+typedef enum {
+  I2S_NUM_0 = 0,
+} i2s_port_t;
+
+typedef enum {
+  I2S_DATA_BIT_WIDTH_16BIT = 16,
+  I2S_DATA_BIT_WIDTH_24BIT = 24,
+  I2S_DATA_BIT_WIDTH_32BIT = 32,
+} i2s_data_bit_width_t;
+
+typedef struct {
+  int mclk;
+  int bclk;
+  int ws;
+  int dout;
+  int din;
+} i2s_std_gpio_config_t;
+
+#endif  // __CODEC_BENCH_I2S_STD_H__
@@ -0,0 +1,37 @@
+#ifndef __CODEC_BENCH_ESP_HEAP_CAPS_H__
+#define __CODEC_BENCH_ESP_HEAP_CAPS_H__
+
+// host stand-in, every region is the C heap
+
+#include <stdint.h>
+#include <stdlib.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+#define MALLOC_CAP_EXEC (1 << 0)
+#define MALLOC_CAP_32BIT (1 << 1)
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+#define heap_caps_malloc(size, caps) malloc(size)
+#define heap_caps_calloc(n, size, caps) calloc(n, size)
+#define heap_caps_free(ptr) free(ptr)
+
+// free bytes of the C heap where glibc tells, 0 otherwise
+static inline size_t heap_caps_get_free_size(uint32_t caps) {
+#if defined(__GLIBC__) && \
+    ((__GLIBC__ > 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ >= 33)))
+  return mallinfo2().fordblks;
+#else
+  return 0;
+#endif
+}
+
+// blocks of any size are tried, malloc() tells if there is room
+static inline size_t heap_caps_get_largest_free_block(uint32_t caps) {
+  return SIZE_MAX;
+}
+
+#endif  // __CODEC_BENCH_ESP_HEAP_CAPS_H__
@@ -0,0 +1,15 @@
+#ifndef __CODEC_BENCH_ESP_LOG_H__
+#define __CODEC_BENCH_ESP_LOG_H__
+
+// host stand-in, only errors are printed
+
+#include <stdio.h>
+
+#define ESP_LOGE(tag, fmt, ...) \
+  fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...)
+#define ESP_LOGI(tag, fmt, ...)
+#define ESP_LOGD(tag, fmt, ...)
+#define ESP_LOGV(tag, fmt, ...)
+
+#endif  // __CODEC_BENCH_ESP_LOG_H__
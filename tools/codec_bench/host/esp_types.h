@@ -0,0 +1,8 @@
+#ifndef __CODEC_BENCH_ESP_TYPES_H__
+#define __CODEC_BENCH_ESP_TYPES_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#endif  // __CODEC_BENCH_ESP_TYPES_H__
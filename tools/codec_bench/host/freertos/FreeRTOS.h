@@ -0,0 +1,17 @@
+#ifndef __CODEC_BENCH_FREERTOS_H__
+#define __CODEC_BENCH_FREERTOS_H__
+
+// host stand-in, just the types used by player.h and the host tests' queues
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+
+#define pdFALSE 0
+#define pdTRUE 1
+#define pdFAIL pdFALSE
+#define pdPASS pdTRUE
+#define portMAX_DELAY ((TickType_t)0xFFFFFFFF)
+
+#endif  // __CODEC_BENCH_FREERTOS_H__
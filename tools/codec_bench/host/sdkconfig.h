@@ -0,0 +1,6 @@
+#ifndef __CODEC_BENCH_SDKCONFIG_H__
+#define __CODEC_BENCH_SDKCONFIG_H__
+
+// host build, no Kconfig options set
+
+#endif  // __CODEC_BENCH_SDKCONFIG_H__
@@ -0,0 +1,71 @@
+#!/usr/bin/env python3
+"""Record a snapcast stream for codec_bench.
+
+Connects to a snapserver like a client, says hello and stores everything the
+server sends, unchanged, for the given time. The codec is the one configured
+for the server's stream, e.g. codec=flac in snapserver.conf.
+
+usage: record.py [-p port] [-t seconds] host out.snap
+"""
+
+import argparse
+import json
+import socket
+import struct
+import time
+
+HELLO = 5
+
+
+def hello_message():
+    hello = json.dumps({
+        "MAC": "00:00:00:00:00:00",
+        "HostName": "codec-bench",
+        "Version": "0.0.3",
+        "ClientName": "codec_bench",
+        "OS": "linux",
+        "Arch": "host",
+        "Instance": 1,
+        "ID": "codec-bench",
+        "SnapStreamProtocolVersion": 2,
+    }).encode()
+    payload = struct.pack("<I", len(hello)) + hello
+    now = time.time()
+    sec, usec = int(now), int((now % 1) * 1000000)
+    base = struct.pack("<HHHiiiiI", HELLO, 0, 0, sec, usec, 0, 0,
+                       len(payload))
+
+    return base + payload
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("host")
+    parser.add_argument("out")
+    parser.add_argument("-p", "--port", type=int, default=1704)
+    parser.add_argument("-t", "--time", type=float, default=30,
+                        help="seconds to record")
+    args = parser.parse_args()
+
+    size = 0
+    with socket.create_connection((args.host, args.port)) as sock, \
+            open(args.out, "wb") as out:
+        sock.sendall(hello_message())
+        sock.settimeout(1)
+
+        end = time.monotonic() + args.time
+        while time.monotonic() < end:
+            try:
+                data = sock.recv(65536)
+            except socket.timeout:
+                continue
+            if not data:
+                break
+            out.write(data)
+            size += len(data)
+
+    print("recorded %d bytes to %s" % (size, args.out))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,17 @@
+#ifndef __HOST_TESTS_ESP_TIMER_H__
+#define __HOST_TESTS_ESP_TIMER_H__
+
+// host stand-in, the monotonic clock in µs
+
+#include <stdint.h>
+#include <time.h>
+
+static inline int64_t esp_timer_get_time(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (int64_t)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+#endif  // __HOST_TESTS_ESP_TIMER_H__
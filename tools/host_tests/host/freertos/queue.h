@@ -0,0 +1,66 @@
+#ifndef __HOST_TESTS_QUEUE_H__
+#define __HOST_TESTS_QUEUE_H__
+
+// host stand-in, the tests run in one thread so a queue never blocks
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct host_queue_s {
+  char *items;
+  uint32_t length;
+  uint32_t itemSize;
+  uint32_t head;
+  uint32_t count;
+} *QueueHandle_t;
+
+static inline QueueHandle_t xQueueCreate(uint32_t length, uint32_t itemSize) {
+  QueueHandle_t q = (QueueHandle_t)calloc(1, sizeof(*q));
+
+  if (q != NULL) {
+    q->items = (char *)malloc(length * itemSize);
+    q->length = length;
+    q->itemSize = itemSize;
+  }
+
+  return q;
+}
+
+static inline void vQueueDelete(QueueHandle_t q) {
+  free(q->items);
+  free(q);
+}
+
+static inline BaseType_t xQueueSend(QueueHandle_t q, const void *item,
+                                    TickType_t ticks) {
+  if (q->count == q->length) {
+    return pdFALSE;
+  }
+
+  memcpy(&q->items[((q->head + q->count) % q->length) * q->itemSize], item,
+         q->itemSize);
+  q->count++;
+
+  return pdTRUE;
+}
+
+static inline BaseType_t xQueueReceive(QueueHandle_t q, void *item,
+                                       TickType_t ticks) {
+  if (q->count == 0) {
+    return pdFALSE;
+  }
+
+  memcpy(item, &q->items[q->head * q->itemSize], q->itemSize);
+  q->head = (q->head + 1) % q->length;
+  q->count--;
+
+  return pdTRUE;
+}
+
+static inline uint32_t uxQueueMessagesWaiting(QueueHandle_t q) {
+  return q->count;
+}
+
+#endif  // __HOST_TESTS_QUEUE_H__
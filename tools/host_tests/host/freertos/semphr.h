@@ -0,0 +1,25 @@
+#ifndef __HOST_TESTS_SEMPHR_H__
+#define __HOST_TESTS_SEMPHR_H__
+
+// host stand-in, the tests run in one thread so a mutex is always free
+
+#include "freertos/FreeRTOS.h"
+
+typedef int *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+  static int mutex;
+
+  return &mutex;
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t m,
+                                        TickType_t ticks) {
+  return pdTRUE;
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t m) { return pdTRUE; }
+
+static inline void vSemaphoreDelete(SemaphoreHandle_t m) {}
+
+#endif  // __HOST_TESTS_SEMPHR_H__
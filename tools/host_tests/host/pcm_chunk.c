@@ -0,0 +1,67 @@
+/**
+ * Stand-in for the PCM chunk allocation of player.c, which needs the target
+ * to build: chunks come from the pool, from the C heap if it is empty.
+ */
+
+#include <stdlib.h>
+
+#include "pcm_pool.h"
+#include "player.h"
+
+/**
+ *
+ */
+int8_t free_pcm_chunk(pcm_chunk_message_t *pcmChunk) {
+  if (pcmChunk == NULL) {
+    return -1;
+  }
+
+  if (pcm_pool_free(pcmChunk) == true) {
+    return 0;
+  }
+
+  if (pcmChunk->fragment != NULL) {
+    free(pcmChunk->fragment->payload);
+    free(pcmChunk->fragment);
+  }
+
+  free(pcmChunk);
+
+  return 0;
+}
+
+/**
+ *
+ */
+int32_t allocate_pcm_chunk_memory(pcm_chunk_message_t **pcmChunk,
+                                  size_t bytes) {
+  *pcmChunk = pcm_pool_alloc(bytes);
+  if (*pcmChunk != NULL) {
+    return 0;
+  }
+
+  *pcmChunk = (pcm_chunk_message_t *)calloc(1, sizeof(pcm_chunk_message_t));
+  if (*pcmChunk == NULL) {
+    return -2;
+  }
+
+  (*pcmChunk)->fragment =
+      (pcm_chunk_fragment_t *)calloc(1, sizeof(pcm_chunk_fragment_t));
+  if ((*pcmChunk)->fragment == NULL) {
+    free_pcm_chunk(*pcmChunk);
+
+    return -2;
+  }
+
+  (*pcmChunk)->fragment->payload = (char *)malloc(bytes);
+  if ((*pcmChunk)->fragment->payload == NULL) {
+    free_pcm_chunk(*pcmChunk);
+
+    return -2;
+  }
+
+  (*pcmChunk)->totalSize = bytes;
+  (*pcmChunk)->fragment->size = bytes;
+
+  return 0;
+}
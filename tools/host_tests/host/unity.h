@@ -0,0 +1,92 @@
+#ifndef __HOST_TESTS_UNITY_H__
+#define __HOST_TESTS_UNITY_H__
+
+// host stand-in for IDF's Unity, the TEST_CASE registry and the asserts used
+// by the tests built here. A failed assert ends its test case.
+
+#include <stdint.h>
+#include <string.h>
+
+typedef void (*unity_test_fn_t)(void);
+
+void unity_register(const char *name, unity_test_fn_t fn);
+void unity_fail(const char *file, int line, const char *fmt, ...)
+    __attribute__((noreturn, format(printf, 3, 4)));
+
+#define UNITY_CAT2(a, b) a##b
+#define UNITY_CAT(a, b) UNITY_CAT2(a, b)
+
+#define TEST_CASE(name, tags)                                          \
+  static void UNITY_CAT(unity_test_, __LINE__)(void);                  \
+  __attribute__((constructor)) static void UNITY_CAT(unity_register_,  \
+                                                     __LINE__)(void) { \
+    unity_register(name, UNITY_CAT(unity_test_, __LINE__));            \
+  }                                                                    \
+  static void UNITY_CAT(unity_test_, __LINE__)(void)
+
+// actual op expected, both taken as type first like Unity does
+#define UNITY_CMP(type, op, e, a)                                        \
+  do {                                                                   \
+    type unityE = (type)(e);                                             \
+    type unityA = (type)(a);                                             \
+    if (!(unityA op unityE)) {                                           \
+      unity_fail(__FILE__, __LINE__, "%s " #op " %s, was %lld and %lld", \
+                 #a, #e, (long long)unityA, (long long)unityE);          \
+    }                                                                    \
+  } while (0)
+
+#define UNITY_WITHIN(type, d, e, a)                                       \
+  do {                                                                    \
+    long long unityD = (long long)(type)(a) - (long long)(type)(e);       \
+    if ((unityD < -(long long)(d)) || (unityD > (long long)(d))) {        \
+      unity_fail(__FILE__, __LINE__, "%s not within %lld of %lld, was %lld", \
+                 #a, (long long)(d), (long long)(type)(e),                \
+                 (long long)(type)(a));                                   \
+    }                                                                     \
+  } while (0)
+
+#define TEST_ASSERT(c)                                   \
+  do {                                                   \
+    if (!(c)) {                                          \
+      unity_fail(__FILE__, __LINE__, "%s is false", #c); \
+    }                                                    \
+  } while (0)
+#define TEST_ASSERT_TRUE(c) TEST_ASSERT(c)
+#define TEST_ASSERT_FALSE(c) TEST_ASSERT(!(c))
+#define TEST_ASSERT_NULL(p) TEST_ASSERT((p) == NULL)
+#define TEST_ASSERT_NOT_NULL(p) TEST_ASSERT((p) != NULL)
+#define TEST_ASSERT_EQUAL_PTR(e, a) TEST_ASSERT((const void *)(a) == (const void *)(e))
+#define TEST_ASSERT_EQUAL_STRING(e, a) TEST_ASSERT(strcmp((e), (a)) == 0)
+#define TEST_ASSERT_EQUAL_MEMORY(e, a, len) \
+  TEST_ASSERT(memcmp((e), (a), (len)) == 0)
+#define TEST_ASSERT_EQUAL_HEX32_ARRAY(e, a, n) \
+  TEST_ASSERT_EQUAL_MEMORY((e), (a), (n) * sizeof(uint32_t))
+
+#define TEST_ASSERT_EQUAL(e, a) UNITY_CMP(long long, ==, e, a)
+#define TEST_ASSERT_EQUAL_INT(e, a) UNITY_CMP(int, ==, e, a)
+#define TEST_ASSERT_EQUAL_INT8(e, a) UNITY_CMP(int8_t, ==, e, a)
+#define TEST_ASSERT_EQUAL_INT16(e, a) UNITY_CMP(int16_t, ==, e, a)
+#define TEST_ASSERT_EQUAL_INT32(e, a) UNITY_CMP(int32_t, ==, e, a)
+#define TEST_ASSERT_EQUAL_INT64(e, a) UNITY_CMP(int64_t, ==, e, a)
+#define TEST_ASSERT_EQUAL_UINT8(e, a) UNITY_CMP(uint8_t, ==, e, a)
+#define TEST_ASSERT_EQUAL_UINT16(e, a) UNITY_CMP(uint16_t, ==, e, a)
+#define TEST_ASSERT_EQUAL_UINT32(e, a) UNITY_CMP(uint32_t, ==, e, a)
+#define TEST_ASSERT_EQUAL_UINT64(e, a) UNITY_CMP(uint64_t, ==, e, a)
+#define TEST_ASSERT_EQUAL_HEX16(e, a) UNITY_CMP(uint16_t, ==, e, a)
+#define TEST_ASSERT_EQUAL_HEX32(e, a) UNITY_CMP(uint32_t, ==, e, a)
+
+#define TEST_ASSERT_LESS_THAN_INT32(t, a) UNITY_CMP(int32_t, <, t, a)
+#define TEST_ASSERT_LESS_THAN_INT64(t, a) UNITY_CMP(int64_t, <, t, a)
+#define TEST_ASSERT_LESS_THAN_UINT32(t, a) UNITY_CMP(uint32_t, <, t, a)
+#define TEST_ASSERT_LESS_OR_EQUAL_UINT32(t, a) UNITY_CMP(uint32_t, <=, t, a)
+#define TEST_ASSERT_GREATER_THAN_UINT8(t, a) UNITY_CMP(uint8_t, >, t, a)
+#define TEST_ASSERT_GREATER_THAN_INT32(t, a) UNITY_CMP(int32_t, >, t, a)
+#define TEST_ASSERT_GREATER_THAN_INT64(t, a) UNITY_CMP(int64_t, >, t, a)
+#define TEST_ASSERT_GREATER_THAN_UINT32(t, a) UNITY_CMP(uint32_t, >, t, a)
+#define TEST_ASSERT_GREATER_OR_EQUAL_UINT32(t, a) UNITY_CMP(uint32_t, >=, t, a)
+
+#define TEST_ASSERT_INT_WITHIN(d, e, a) UNITY_WITHIN(int, d, e, a)
+#define TEST_ASSERT_INT32_WITHIN(d, e, a) UNITY_WITHIN(int32_t, d, e, a)
+#define TEST_ASSERT_UINT32_WITHIN(d, e, a) UNITY_WITHIN(uint32_t, d, e, a)
+
+#endif  // __HOST_TESTS_UNITY_H__
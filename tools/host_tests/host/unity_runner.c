@@ -0,0 +1,78 @@
+/**
+ * Runs every registered TEST_CASE, or those whose name contains the first
+ * argument. The exit status is the count of failed cases.
+ */
+
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "unity.h"
+
+#define UNITY_MAX_TESTS 64
+
+typedef struct unity_test_s {
+  const char *name;
+  unity_test_fn_t fn;
+} unity_test_t;
+
+static unity_test_t tests[UNITY_MAX_TESTS];
+static int testCnt = 0;
+static jmp_buf failed;
+
+/**
+ *
+ */
+void unity_register(const char *name, unity_test_fn_t fn) {
+  if (testCnt == UNITY_MAX_TESTS) {
+    fprintf(stderr, "too many test cases, %s is left out\n", name);
+
+    return;
+  }
+
+  tests[testCnt].name = name;
+  tests[testCnt].fn = fn;
+  testCnt++;
+}
+
+/**
+ *
+ */
+void unity_fail(const char *file, int line, const char *fmt, ...) {
+  va_list args;
+
+  printf("%s:%d: ", file, line);
+  va_start(args, fmt);
+  vprintf(fmt, args);
+  va_end(args);
+  printf("\n");
+
+  longjmp(failed, 1);
+}
+
+int main(int argc, char **argv) {
+  int run = 0, failures = 0;
+
+  for (int i = 0; i < testCnt; i++) {
+    if ((argc > 1) && (strstr(tests[i].name, argv[1]) == NULL)) {
+      continue;
+    }
+
+    run++;
+
+    if (setjmp(failed) == 0) {
+      tests[i].fn();
+      printf("%s: PASS\n", tests[i].name);
+    } else {
+      printf("%s: FAIL\n", tests[i].name);
+      failures++;
+    }
+
+    fflush(stdout);
+  }
+
+  printf("%d Tests %d Failures\n", run, failures);
+
+  return failures;
+}
@@ -0,0 +1,523 @@
+/**
+ * Host simulation of the player's sync control loop. Chunks are stamped by
+ * a virtual server, arrive over a virtual network and are written to a
+ * virtual DMA queue which a DAC drains at its own crystal's rate. After each
+ * chunk the age is measured like player_task() does and handed to the same
+ * sync_control.c the client runs, whose rate correction is applied by
+ * resampling or through the APLL coefficients.
+ *
+ * Prints a JSON summary: time to lock, RMS and maximum error once locked,
+ * soft and hard resyncs and time spent muted. -t writes a CSV trace per
+ * chunk.
+ *
+ * usage: sync_sim [options], see README.md
+ */
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apll_steer.h"
+#include "resampler.h"
+#include "slew.h"
+#include "sync_control.h"
+
+// as in player.c
+#define SIM_RATE_TAU_MS 10000
+#define SIM_RESAMPLE_MAX_PPB 500000
+#define SIM_APLL_MAX_PPB 200000
+#define SIM_RESAMPLE_DMA_FRAMES (22 * 100)
+#define SIM_CHNK_CTRL_CNT 2
+// APLL coefficients of 48 kHz, o_div 6
+#define SIM_APLL_SDM0 149
+#define SIM_APLL_SDM1 212
+#define SIM_APLL_SDM2 5
+// initial sync starts with the first frame due this late, as in player.c
+#define SIM_SYNC_LEAD_S 0.005
+// error within the lock band for this long counts as locked
+#define SIM_LOCK_HOLD_S 5.0
+#define SIM_MAX_EVENTS 32
+
+typedef enum sim_event_type_e {
+  SIM_STALL = 0,  // no chunk arrives for a while, then all at once
+  SIM_DROP,       // chunks never arrive
+  SIM_STEP,       // server time estimate jumps
+  SIM_PPM,        // DAC crystal drifts to a new offset
+} sim_event_type_t;
+
+typedef struct sim_event_s {
+  sim_event_type_t type;
+  double at_s;
+  double value;
+} sim_event_t;
+
+typedef struct sim_config_s {
+  double duration_s;
+  bool apll;
+  uint32_t sr;
+  uint32_t chunkFrames;
+  double buf_s;
+  double dacPpm;          // DAC crystal offset, positive runs fast
+  double skewErrPpm;      // error of the clock model's skew estimate
+  bool skewUnknown;       // no skew estimate, the loop starts at 0
+  double dacJitter_us;    // rms phase noise of the DAC
+  double latency_us;      // task wakes up to this late after a write
+  double offsetNoise_us;  // rms error of the server time estimate
+  double netDelay_s;
+  double netJitter_s;
+  double lockBand_us;
+  sim_event_t events[SIM_MAX_EVENTS];
+  uint32_t eventCnt;
+  FILE *trace;
+} sim_config_t;
+
+typedef struct sim_stats_s {
+  double lock_s;  // < 0 if never locked
+  double sumSq_us;
+  double maxAbs_us;
+  uint32_t lockedCnt;
+  double muted_s;
+} sim_stats_t;
+
+// the network, chunk n is stamped n * duration and arrives in order
+typedef struct sim_net_s {
+  uint64_t next;      // next chunk to receive
+  double lastArrival;
+} sim_net_t;
+
+/**
+ * Normal distributed with rms sigma.
+ */
+static double sim_gauss(double sigma) {
+  double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+  double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+
+  return sigma * sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+/**
+ * Uniform in [0, max).
+ */
+static double sim_uniform(double max) {
+  return max * rand() / (RAND_MAX + 1.0);
+}
+
+/**
+ * Sum of the values of events of a type which happened by t, or the last
+ * value for SIM_PPM.
+ */
+static double sim_event_value(const sim_config_t *cfg, sim_event_type_t type,
+                              double t, double initial) {
+  double v = initial;
+
+  for (uint32_t i = 0; i < cfg->eventCnt; i++) {
+    const sim_event_t *e = &cfg->events[i];
+
+    if ((e->type == type) && (e->at_s <= t)) {
+      v = (type == SIM_PPM) ? e->value : v + e->value;
+    }
+  }
+
+  return v;
+}
+
+/**
+ * Next chunk off the network, skipping dropped ones.
+ *
+ * @param[out] ts Server time stamp of its first frame.
+ * @return Arrival time.
+ */
+static double sim_net_receive(const sim_config_t *cfg, sim_net_t *net,
+                              double *ts) {
+  double chunk_s = (double)cfg->chunkFrames / cfg->sr;
+
+  while (1) {
+    uint64_t n = net->next++;
+    double stamp = n * chunk_s;
+    double arrival = stamp + cfg->netDelay_s + sim_uniform(cfg->netJitter_s);
+    bool dropped = false;
+
+    for (uint32_t i = 0; i < cfg->eventCnt; i++) {
+      const sim_event_t *e = &cfg->events[i];
+
+      if ((e->type == SIM_STALL) && (arrival >= e->at_s) &&
+          (arrival < e->at_s + e->value / 1000)) {
+        arrival = e->at_s + e->value / 1000;
+      } else if ((e->type == SIM_DROP) && (stamp >= e->at_s) &&
+                 (stamp < e->at_s + e->value * chunk_s)) {
+        dropped = true;
+      }
+    }
+
+    if (dropped) {
+      continue;
+    }
+
+    // TCP delivers in order
+    if (arrival < net->lastArrival) {
+      arrival = net->lastArrival;
+    }
+    net->lastArrival = arrival;
+    *ts = stamp;
+
+    return arrival;
+  }
+}
+
+/**
+ *
+ */
+static void sim_trace(const sim_config_t *cfg, double t, double age_us,
+                      double err_us, const sync_control_t *sc, int32_t ppb,
+                      const char *what) {
+  if (cfg->trace == NULL) {
+    return;
+  }
+
+  fprintf(cfg->trace, "%.6f,%.1f,%.1f,%lld,%lld,%ld,%s\n", t, age_us, err_us,
+          (long long)sc->shortMedian_us, (long long)sc->miniMedian_us,
+          (long)ppb, what);
+}
+
+/**
+ * Track the true error for lock time and statistics.
+ */
+static void sim_account(const sim_config_t *cfg, sim_stats_t *stats,
+                        double *inBandSince, double t, double err_us) {
+  if (fabs(err_us) > cfg->lockBand_us) {
+    *inBandSince = -1;
+  } else if (*inBandSince < 0) {
+    *inBandSince = t;
+  }
+
+  if ((stats->lock_s < 0) && (*inBandSince >= 0) &&
+      (t - *inBandSince >= SIM_LOCK_HOLD_S)) {
+    stats->lock_s = *inBandSince;
+  }
+
+  if (stats->lock_s >= 0) {
+    stats->sumSq_us += err_us * err_us;
+    if (fabs(err_us) > stats->maxAbs_us) {
+      stats->maxAbs_us = fabs(err_us);
+    }
+    stats->lockedCnt++;
+  }
+}
+
+/**
+ * Play for the configured duration.
+ */
+static void sim_run(const sim_config_t *cfg, sync_control_t *sc, slew_t *sl,
+                    sim_stats_t *stats) {
+  const double chunk_s = (double)cfg->chunkFrames / cfg->sr;
+  // frames between the one written next and the one the DAC plays
+  const double capacity =
+      cfg->apll ? (double)SIM_CHNK_CTRL_CNT * cfg->chunkFrames
+                : SIM_RESAMPLE_DMA_FRAMES + RESAMPLER_DELAY_FRAMES;
+  sim_net_t net = {0, 0};
+  apll_steer_t apll;
+  double t = 0, inBandSince = -1;
+  double arrival, ts;  // next chunk off the network
+  bool playing = false;
+  // DAC position: q frames played at time tq, rate frames per second
+  double tq = 0, q = 0, rate = cfg->sr;
+  double written = 0;
+  uint32_t chunkSkip = 0;  // frames of the next chunk skipped on sync
+  int32_t ppb = 0;
+  // slews only need to know the count of frames
+  uint32_t *silence = calloc(2 * cfg->chunkFrames, sizeof(uint32_t));
+
+  memset(stats, 0, sizeof(sim_stats_t));
+  stats->lock_s = -1;
+
+  arrival = sim_net_receive(cfg, &net, &ts);
+
+  while (t < cfg->duration_s) {
+    double dacPpm = sim_event_value(cfg, SIM_PPM, t, cfg->dacPpm);
+    double end, done, chunkEnd, jitter_us, wake_us, err_us, age_us;
+    uint32_t used, n;
+    sync_control_action_t action;
+    bool starved;
+
+    if (playing == false) {
+      double muteStart = t;
+      double skewPpm, step_s;
+
+      double late_s;
+
+      // initial sync: wait for a chunk which isn't over yet by the server
+      // time estimate and start with its first frame due late enough
+      while (1) {
+        if (arrival > t) {
+          t = arrival;
+        }
+
+        step_s = sim_event_value(cfg, SIM_STEP, t, 0) * 1e-6;
+        late_s = t + step_s + SIM_SYNC_LEAD_S - ts - cfg->buf_s;
+        if (late_s < chunk_s) {
+          break;
+        }
+
+        arrival = sim_net_receive(cfg, &net, &ts);
+      }
+
+      chunkSkip = (late_s > 0) ? (uint32_t)ceil(late_s * cfg->sr) : 0;
+      if (chunkSkip >= cfg->chunkFrames) {
+        chunkSkip = cfg->chunkFrames - 1;
+      }
+
+      // the timer alarm starts I2S a little late
+      tq = ts + (double)chunkSkip / cfg->sr + cfg->buf_s - step_s +
+           sim_uniform(cfg->latency_us) * 1e-6;
+      q = 0;
+      written = 0;
+      stats->muted_s += tq - muteStart;
+
+      skewPpm = cfg->skewUnknown ? 0 : dacPpm + cfg->skewErrPpm;
+      sync_control_reset(sc, (int32_t)lrint(-skewPpm * 1000));
+      apll_steer_init(&apll, SIM_APLL_SDM0, SIM_APLL_SDM1, SIM_APLL_SDM2);
+      slew_reset(sl);
+      ppb = 0;
+      rate = cfg->sr * (1 + dacPpm * 1e-6);
+      playing = true;
+      sim_trace(cfg, t, 0, 0, sc, ppb, "sync");
+    }
+
+    // a pending slew replaces the first frames of the chunk
+    n = slew_process(sl, silence, cfg->chunkFrames - chunkSkip, &used);
+
+    // the write returns once the DAC made room for the chunk, not before
+    // it arrived
+    end = written + cfg->chunkFrames - chunkSkip + (double)n - used;
+    chunkSkip = 0;
+    done = tq + (end - capacity - q) / rate;
+    if (done < t) {
+      done = t;
+    }
+    if (done < arrival) {
+      done = arrival;
+    }
+
+    if (done > tq) {
+      q += (done - tq) * rate;
+      tq = done;
+    }
+    if (q > written) {
+      // DMA ran dry, the DAC waited
+      q = written;
+    }
+
+    t = done;
+    written = end;
+    chunkEnd = ts + chunk_s;
+
+    arrival = sim_net_receive(cfg, &net, &ts);
+
+    if (end <= capacity) {
+      // preloading, the write didn't block so nothing is measured
+      continue;
+    }
+
+    // the frame written next hits the DAC once the ones in front played, the
+    // age assumes DMA is full and drains at the nominal rate, measured when
+    // the task wakes up
+    jitter_us = sim_gauss(cfg->dacJitter_us);
+    wake_us = sim_uniform(cfg->latency_us);
+    err_us = (t + (written - q) / rate - chunkEnd - cfg->buf_s) * 1e6 +
+             jitter_us;
+    age_us = (t + capacity / cfg->sr - chunkEnd - cfg->buf_s) * 1e6 +
+             wake_us + jitter_us + sim_event_value(cfg, SIM_STEP, t, 0) +
+             sim_gauss(cfg->offsetNoise_us);
+    starved = (arrival > t + wake_us * 1e-6);
+
+    sim_account(cfg, stats, &inBandSince, t, err_us);
+
+    action = sync_control_update(sc, (int64_t)lrint(age_us),
+                                 (int64_t)lrint(chunk_s * 1e6), starved);
+    if (action == SYNC_CONTROL_RESYNC_HARD) {
+      sim_trace(cfg, t, age_us, err_us, sc, ppb,
+                starved ? "starved" : "resync");
+
+      // mute, what is in DMA is lost
+      t += wake_us * 1e-6;
+      playing = false;
+      inBandSince = -1;
+
+      continue;
+    }
+
+    if (action == SYNC_CONTROL_RESYNC_SOFT) {
+      slew_start(sl, (int32_t)lrint(sc->slew_us * 1e-6 * cfg->sr));
+    }
+
+    if (cfg->apll) {
+      apll_steer_update(&apll, sc->ppb);
+      ppb = apll_steer_ppb(&apll);
+    } else {
+      ppb = sc->ppb;
+    }
+
+    // frames played per second of server time
+    rate = cfg->sr * (1 + dacPpm * 1e-6) * (1 + ppb * 1e-9);
+
+    sim_trace(cfg, t, age_us, err_us, sc, ppb,
+              (action == SYNC_CONTROL_RESYNC_SOFT) ? "soft" : "play");
+  }
+
+  free(silence);
+}
+
+/**
+ *
+ */
+static int sim_parse_event(sim_config_t *cfg, const char *arg) {
+  static const char *names[] = {"stall", "drop", "step", "ppm"};
+  char name[8];
+  double at, value;
+
+  if ((cfg->eventCnt >= SIM_MAX_EVENTS) ||
+      (sscanf(arg, "%7[a-z]:%lf:%lf", name, &at, &value) != 3)) {
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+    if (strcmp(name, names[i]) == 0) {
+      cfg->events[cfg->eventCnt].type = (sim_event_type_t)i;
+      cfg->events[cfg->eventCnt].at_s = at;
+      cfg->events[cfg->eventCnt].value = value;
+      cfg->eventCnt++;
+
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+int main(int argc, char **argv) {
+  static sync_control_t sc;
+  static slew_t sl;
+  sim_config_t cfg;
+  sim_stats_t stats;
+  sync_control_stats_t scStats;
+  unsigned seed = 1;
+  int i;
+
+  memset(&cfg, 0, sizeof(cfg));
+  cfg.duration_s = 60;
+  cfg.sr = 48000;
+  cfg.chunkFrames = 1152;
+  cfg.buf_s = 1.0;
+  cfg.dacPpm = 20;
+  cfg.dacJitter_us = 1;
+  cfg.latency_us = 50;
+  cfg.offsetNoise_us = 20;
+  cfg.netDelay_s = 0.005;
+  cfg.netJitter_s = 0.010;
+  cfg.lockBand_us = 100;
+
+  for (i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+    if ((strcmp(arg, "-u") == 0)) {
+      cfg.skewUnknown = true;
+
+      continue;
+    }
+
+    if (val == NULL) {
+      break;
+    }
+    i++;
+
+    if (strcmp(arg, "-d") == 0) {
+      cfg.duration_s = atof(val);
+    } else if (strcmp(arg, "-m") == 0) {
+      cfg.apll = (strcmp(val, "apll") == 0);
+      if (!cfg.apll && (strcmp(val, "resample") != 0)) {
+        break;
+      }
+    } else if (strcmp(arg, "-r") == 0) {
+      cfg.sr = strtoul(val, NULL, 0);
+    } else if (strcmp(arg, "-f") == 0) {
+      cfg.chunkFrames = strtoul(val, NULL, 0);
+    } else if (strcmp(arg, "-b") == 0) {
+      cfg.buf_s = atof(val) / 1000;
+    } else if (strcmp(arg, "-p") == 0) {
+      cfg.dacPpm = atof(val);
+    } else if (strcmp(arg, "-k") == 0) {
+      cfg.skewErrPpm = atof(val);
+    } else if (strcmp(arg, "-j") == 0) {
+      cfg.dacJitter_us = atof(val);
+    } else if (strcmp(arg, "-l") == 0) {
+      cfg.latency_us = atof(val);
+    } else if (strcmp(arg, "-o") == 0) {
+      cfg.offsetNoise_us = atof(val);
+    } else if (strcmp(arg, "-n") == 0) {
+      cfg.netDelay_s = atof(val) / 1000;
+    } else if (strcmp(arg, "-N") == 0) {
+      cfg.netJitter_s = atof(val) / 1000;
+    } else if (strcmp(arg, "-L") == 0) {
+      cfg.lockBand_us = atof(val);
+    } else if (strcmp(arg, "-s") == 0) {
+      seed = strtoul(val, NULL, 0);
+    } else if (strcmp(arg, "-t") == 0) {
+      cfg.trace = fopen(val, "w");
+      if (cfg.trace == NULL) {
+        perror(val);
+
+        return 1;
+      }
+    } else if ((strcmp(arg, "-e") != 0) || (sim_parse_event(&cfg, val) < 0)) {
+      break;
+    }
+  }
+
+  if ((i < argc) || (cfg.sr == 0) || (cfg.chunkFrames == 0)) {
+    fprintf(stderr,
+            "usage: %s [-d s] [-m resample|apll] [-r sr] [-f frames] "
+            "[-b ms] [-p ppm] [-k ppm] [-u] [-j us] [-l us] [-o us] [-n ms] "
+            "[-N ms] [-L us] [-s seed] [-t trace.csv] "
+            "[-e stall|drop|step|ppm:at_s:value]...\n",
+            argv[0]);
+
+    return 2;
+  }
+
+  srand(seed);
+
+  sync_control_init(&sc, SIM_RATE_TAU_MS,
+                    cfg.apll ? SIM_APLL_MAX_PPB : SIM_RESAMPLE_MAX_PPB,
+                    SYNC_CONTROL_SOFT_RESYNC_US, SYNC_CONTROL_HARD_RESYNC_US);
+  slew_init(&sl, 32);
+
+  if (cfg.trace != NULL) {
+    fprintf(cfg.trace,
+            "t_s,age_us,err_us,short_median_us,mini_median_us,ppb,event\n");
+  }
+
+  sim_run(&cfg, &sc, &sl, &stats);
+  sync_control_get_stats(&sc, &scStats);
+
+  if (cfg.trace != NULL) {
+    fclose(cfg.trace);
+  }
+
+  printf(
+      "{\"mode\":\"%s\",\"duration_s\":%.1f,\"dac_ppm\":%.2f,"
+      "\"lock_s\":%.3f,\"rms_us\":%.2f,\"max_us\":%.1f,"
+      "\"soft_resyncs\":%u,\"skipped\":%u,\"inserted\":%u,"
+      "\"hard_resyncs\":%u,\"starved\":%u,\"muted_s\":%.3f,\"ppb\":%ld}\n",
+      cfg.apll ? "apll" : "resample", cfg.duration_s, cfg.dacPpm,
+      stats.lock_s,
+      (stats.lockedCnt > 0) ? sqrt(stats.sumSq_us / stats.lockedCnt) : 0,
+      stats.maxAbs_us, scStats.softResyncs, sl.skipped, sl.inserted,
+      scStats.hardResyncs, scStats.starved, stats.muted_s,
+      (long)sc.ppb);
+
+  return 0;
+}